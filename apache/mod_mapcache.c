@@ -268,6 +268,11 @@ static void read_post_body(mapcache_context_apache_request *ctx, mapcache_reques
   p->post_buf[p->post_len] = 0;
 }
 
+static void write_http_response_stream_func(mapcache_context *ctx, void *data, const unsigned char *buf, size_t len)
+{
+  ap_rwrite(buf, len, (request_rec*)data);
+}
+
 static int write_http_response(mapcache_context_apache_request *ctx, mapcache_http_response *response)
 {
   request_rec *r = ctx->request;
@@ -295,6 +300,17 @@ static int write_http_response(mapcache_context_apache_request *ctx, mapcache_ht
       }
     }
   }
+  if(response->stream) {
+    /* the body is sent as it is produced, with no content-length */
+    mapcache_context *mctx = (mapcache_context*)ctx;
+    r->status = response->code;
+    response->stream->run(mctx, response->stream, write_http_response_stream_func, r);
+    if(GC_HAS_ERROR(mctx)) {
+      ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, "failed to stream response: %s", mctx->get_error_message(mctx));
+      r->connection->keepalive = AP_CONN_CLOSE;
+    }
+    return OK;
+  }
   if(response->data && response->data->size) {
     ap_set_content_length(r,response->data->size);
     ap_rwrite((void*)response->data->buf, response->data->size, r);
@@ -377,6 +393,7 @@ static int mapcache_handler(request_rec *r, mapcache_alias_entry *alias_entry) {
         *end = '\0';
       }
     }
+    req_caps->accept_encoding = apr_table_get(r->headers_in,"Accept-Encoding");
     http_response = mapcache_core_get_capabilities(ctx,request->service,req_caps,
                                                    url,original->path_info,ctx->config);
   } else if( request->type == MAPCACHE_REQUEST_GET_TILE) {
@@ -679,6 +696,10 @@ static const char* mapcache_add_alias(cmd_parms *cmd, void *cfg, const char *ali
   if(mapcache_config_services_enabled(ctx, alias_entry->cfg) <= 0) {
     return "no mapcache <service>s configured/enabled, no point in continuing.";
   }
+  if(alias_entry->cfg->prefetcher) {
+    mapcache_prefetcher_set_log_context(alias_entry->cfg->prefetcher,
+                                        (mapcache_context*)create_apache_server_context(cmd->server,cmd->pool));
+  }
   if(quick && !strcmp(quick,"quick")) {
     APR_ARRAY_PUSH(sconfig->quickaliases,mapcache_alias_entry*) = alias_entry;
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, cmd->server, "loaded mapcache configuration file from %s on (quick) endpoint %s", alias_entry->configfile, alias_entry->endpoint);
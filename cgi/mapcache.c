@@ -37,6 +37,16 @@
 #include <apr_date.h>
 #ifdef USE_FASTCGI
 #include <fcgi_stdio.h>
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#define USE_FASTCGI_THREADS 1
+#endif
+#endif
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
 #endif
 
 typedef struct mapcache_context_fcgi mapcache_context_fcgi;
@@ -70,6 +80,9 @@ static char* err_msg(int code)
 
 struct mapcache_context_fcgi {
   mapcache_context ctx;
+#ifdef USE_FASTCGI_THREADS
+  FCGX_Request *request; /**< the request being handled, in threaded mode */
+#endif
 };
 
 static mapcache_context* fcgi_context_clone(mapcache_context *ctx)
@@ -78,6 +91,9 @@ static mapcache_context* fcgi_context_clone(mapcache_context *ctx)
                                   sizeof(mapcache_context_fcgi));
   mapcache_context *nctx = (mapcache_context*)newctx;
   mapcache_context_copy(ctx,nctx);
+#ifdef USE_FASTCGI_THREADS
+  newctx->request = ((mapcache_context_fcgi*)ctx)->request;
+#endif
   apr_pool_create(&nctx->pool,ctx->pool);
   return nctx;
 }
@@ -98,13 +114,13 @@ static void handle_signal(int signal)
   exit(signal);
 }
 
-static mapcache_context_fcgi* fcgi_context_create()
+static mapcache_context_fcgi* fcgi_context_create(apr_pool_t *pool)
 {
-  mapcache_context_fcgi *ctx = apr_pcalloc(global_pool, sizeof(mapcache_context_fcgi));
+  mapcache_context_fcgi *ctx = apr_pcalloc(pool, sizeof(mapcache_context_fcgi));
   if(!ctx) {
     return NULL;
   }
-  ctx->ctx.pool = global_pool;
+  ctx->ctx.pool = pool;
   mapcache_context_init((mapcache_context*)ctx);
   ctx->ctx.log = fcgi_context_log;
   ctx->ctx.clone = fcgi_context_clone;
@@ -112,26 +128,65 @@ static mapcache_context_fcgi* fcgi_context_create()
   return ctx;
 }
 
+/**
+ * \brief return a CGI variable of the request being handled
+ */
+static char* fcgi_getenv(mapcache_context_fcgi *ctx, const char *name)
+{
+#ifdef USE_FASTCGI_THREADS
+  if(ctx->request) {
+    return FCGX_GetParam(name, ctx->request->envp);
+  }
+#endif
+  return getenv(name);
+}
+
+static void fcgi_write(mapcache_context_fcgi *ctx, const char *buf, size_t len)
+{
+#ifdef USE_FASTCGI_THREADS
+  if(ctx->request) {
+    FCGX_PutStr(buf, (int)len, ctx->request->out);
+    return;
+  }
+#endif
+  fwrite(buf, len, 1, stdout);
+}
+
+static void fcgi_printf(mapcache_context_fcgi *ctx, const char *fmt, ...)
+{
+  char *str;
+  va_list args;
+  va_start(args,fmt);
+  str = apr_pvsprintf(ctx->ctx.pool,fmt,args);
+  va_end(args);
+  fcgi_write(ctx, str, strlen(str));
+}
+
+static void fcgi_write_response_stream_func(mapcache_context *ctx, void *data, const unsigned char *buf, size_t len)
+{
+  fcgi_write((mapcache_context_fcgi*)data, (const char*)buf, len);
+}
+
 static void fcgi_write_response(mapcache_context_fcgi *ctx, mapcache_http_response *response)
 {
   if(response->code != 200) {
-    printf("Status: %ld %s\r\n",response->code, err_msg(response->code));
+    fcgi_printf(ctx,"Status: %ld %s\r\n",response->code, err_msg(response->code));
   }
   if(response->headers && !apr_is_empty_table(response->headers)) {
     const apr_array_header_t *elts = apr_table_elts(response->headers);
     int i;
     for(i=0; i<elts->nelts; i++) {
       apr_table_entry_t entry = APR_ARRAY_IDX(elts,i,apr_table_entry_t);
-      printf("%s: %s\r\n", entry.key, entry.val);
+      fcgi_printf(ctx,"%s: %s\r\n", entry.key, entry.val);
     }
   }
   if(response->mtime) {
     char *datestr;
-    char *if_modified_since = getenv("HTTP_IF_MODIFIED_SINCE");
+    char *if_modified_since = fcgi_getenv(ctx,"HTTP_IF_MODIFIED_SINCE");
 
     datestr = apr_palloc(ctx->ctx.pool, APR_RFC822_DATE_LEN);
     apr_rfc822_date(datestr, response->mtime);
-    printf("Last-Modified: %s\r\n", datestr);
+    fcgi_printf(ctx,"Last-Modified: %s\r\n", datestr);
 
     if(if_modified_since) {
       apr_time_t ims_time;
@@ -142,19 +197,28 @@ static void fcgi_write_response(mapcache_context_fcgi *ctx, mapcache_http_respon
       ims_time = apr_date_parse_http(if_modified_since);
       ims = apr_time_sec(ims_time);
       if(ims >= mtime) {
-        printf("Status: 304 Not Modified\r\n");
+        fcgi_printf(ctx,"Status: 304 Not Modified\r\n");
 	/*
 	 * "The 304 response MUST NOT contain a message-body"
 	 * https://tools.ietf.org/html/rfc2616#section-10.3.5
 	 */
-	printf("\r\n");
+	fcgi_printf(ctx,"\r\n");
 	return;
       }
     }
   }
-  if(response->data) {
-    printf("Content-Length: %ld\r\n\r\n", response->data->size);
-    fwrite((char*)response->data->buf, response->data->size,1,stdout);
+  if(response->stream) {
+    /* the body is sent as it is produced, with no content-length */
+    mapcache_context *mctx = (mapcache_context*)ctx;
+    fcgi_printf(ctx,"\r\n");
+    response->stream->run(mctx, response->stream, fcgi_write_response_stream_func, ctx);
+    if(GC_HAS_ERROR(mctx)) {
+      mctx->log(mctx, MAPCACHE_ERROR, "failed to stream response: %s", mctx->get_error_message(mctx));
+      mctx->clear_errors(mctx);
+    }
+  } else if(response->data) {
+    fcgi_printf(ctx,"Content-Length: %ld\r\n\r\n", response->data->size);
+    fcgi_write(ctx, (char*)response->data->buf, response->data->size);
   }
 }
 
@@ -162,6 +226,20 @@ static void fcgi_write_response(mapcache_context_fcgi *ctx, mapcache_http_respon
 apr_time_t mtime;
 char *conffile;
 
+/**
+ * \brief have the prefetch threads of a configuration log like the requests
+ */
+static void fcgi_prefetcher_log_init(mapcache_cfg *cfg, apr_pool_t *pool)
+{
+  mapcache_context *log_ctx;
+  if(!cfg->prefetcher) {
+    return;
+  }
+  log_ctx = (mapcache_context*)fcgi_context_create(pool);
+  log_ctx->config = cfg;
+  mapcache_prefetcher_set_log_context(cfg->prefetcher, log_ctx);
+}
+
 static void load_config(mapcache_context *ctx, char *filename)
 {
   apr_file_t *f;
@@ -211,6 +289,7 @@ static void load_config(mapcache_context *ctx, char *filename)
   }
   config_pool = tmp_config_pool;
   mapcache_connection_pool_create(cfg, &ctx->connection_pool, config_pool);
+  fcgi_prefetcher_log_init(cfg, config_pool);
 
   return;
 
@@ -228,15 +307,392 @@ failed_load:
 
 }
 
-int main(int argc, const char **argv)
+/**
+ * \brief handle the current request, using ctx->config and the ctx->pool request pool
+ */
+static void fcgi_handle_request(mapcache_context_fcgi *fctx)
 {
-  mapcache_context_fcgi* globalctx;
-  mapcache_context* ctx;
+  mapcache_context *ctx = (mapcache_context*)fctx;
   apr_table_t *params;
   mapcache_request *request = NULL;
   char *pathInfo;
   mapcache_http_response *http_response;
 
+  pathInfo = fcgi_getenv(fctx,"PATH_INFO");
+
+
+  params = mapcache_http_parse_param_string(ctx, fcgi_getenv(fctx,"QUERY_STRING"));
+  mapcache_service_dispatch_request(ctx,&request,pathInfo,params,ctx->config);
+  if(GC_HAS_ERROR(ctx) || !request) {
+    fcgi_write_response(fctx, mapcache_core_respond_to_error(ctx));
+    return;
+  }
+
+  http_response = NULL;
+  if(request->type == MAPCACHE_REQUEST_GET_CAPABILITIES) {
+    mapcache_request_get_capabilities *req = (mapcache_request_get_capabilities*)request;
+    char *host = fcgi_getenv(fctx,"SERVER_NAME");
+    char *port = fcgi_getenv(fctx,"SERVER_PORT");
+    char *fullhost;
+    char *url;
+    if(fcgi_getenv(fctx,"HTTPS")) {
+      if(!port || !strcmp(port,"443")) {
+        fullhost = apr_psprintf(ctx->pool,"https://%s",host);
+      } else {
+        fullhost = apr_psprintf(ctx->pool,"https://%s:%s",host,port);
+      }
+    } else {
+      if(!port || !strcmp(port,"80")) {
+        fullhost = apr_psprintf(ctx->pool,"http://%s",host);
+      } else {
+        fullhost = apr_psprintf(ctx->pool,"http://%s:%s",host,port);
+      }
+    }
+    url = apr_psprintf(ctx->pool,"%s%s/",
+                       fullhost,
+                       fcgi_getenv(fctx,"SCRIPT_NAME")
+                      );
+    req->accept_encoding = fcgi_getenv(fctx,"HTTP_ACCEPT_ENCODING");
+    http_response = mapcache_core_get_capabilities(ctx,request->service,req,url,pathInfo,ctx->config);
+  } else if( request->type == MAPCACHE_REQUEST_GET_TILE) {
+    mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*)request;
+    http_response = mapcache_core_get_tile(ctx,req_tile);
+  } else if( request->type == MAPCACHE_REQUEST_PROXY ) {
+    mapcache_request_proxy *req_proxy = (mapcache_request_proxy*)request;
+    http_response = mapcache_core_proxy_request(ctx, req_proxy);
+  } else if( request->type == MAPCACHE_REQUEST_GET_MAP) {
+    mapcache_request_get_map *req_map = (mapcache_request_get_map*)request;
+    http_response = mapcache_core_get_map(ctx,req_map);
+  } else if( request->type == MAPCACHE_REQUEST_GET_FEATUREINFO) {
+    mapcache_request_get_feature_info *req_fi = (mapcache_request_get_feature_info*)request;
+    http_response = mapcache_core_get_featureinfo(ctx,req_fi);
+#ifdef DEBUG
+  } else {
+    ctx->set_error(ctx,500,"###BUG### unknown request type");
+#endif
+  }
+  if(GC_HAS_ERROR(ctx)) {
+    fcgi_write_response(fctx, mapcache_core_respond_to_error(ctx));
+    return;
+  }
+#ifdef DEBUG
+  if(!http_response) {
+    ctx->set_error(ctx,500,"###BUG### NULL response");
+    fcgi_write_response(fctx, mapcache_core_respond_to_error(ctx));
+    return;
+  }
+#endif
+  fcgi_write_response(fctx,http_response);
+}
+
+#ifdef USE_FASTCGI_THREADS
+/*
+ * Threaded FastCGI mode: MAPCACHE_FCGI_THREADS threads accept and handle
+ * requests concurrently, sharing a single parsed configuration and connection
+ * pool.
+ *
+ * The configuration is published as a reference counted version: a request
+ * takes a reference on the current version for its whole duration. When the
+ * configuration file changes, a new version is parsed by a watcher thread
+ * (woken up by inotify where available, otherwise by polling the file's
+ * modification time every second) and swapped in, the previous version being
+ * destroyed once its last request has completed. Requests never stat the
+ * configuration file themselves.
+ */
+
+typedef struct fcgi_config_version fcgi_config_version;
+
+struct fcgi_config_version {
+  apr_pool_t *pool;
+  mapcache_cfg *cfg;
+  mapcache_connection_pool *connection_pool;
+  apr_time_t mtime; /**< modification time of the file this version was loaded from */
+  int refcount; /**< number of requests using this version */
+  int retired; /**< this version has been replaced */
+};
+
+static apr_thread_mutex_t *config_mutex = NULL;
+static apr_thread_mutex_t *accept_mutex = NULL;
+static fcgi_config_version *current_config = NULL;
+
+/**
+ * \brief parse the configuration file into a new version
+ * \returns NULL and sets the error on ctx on failure
+ */
+static fcgi_config_version* fcgi_config_load(mapcache_context *ctx)
+{
+  apr_pool_t *pool, *ctx_pool = ctx->pool;
+  apr_finfo_t finfo;
+  fcgi_config_version *version;
+
+  if(apr_stat(&finfo, conffile, APR_FINFO_MTIME, ctx->pool) != APR_SUCCESS) {
+    ctx->set_error(ctx,500,"failed to open config file %s",conffile);
+    return NULL;
+  }
+  apr_pool_create(&pool,global_pool);
+  version = apr_pcalloc(pool, sizeof(fcgi_config_version));
+  version->pool = pool;
+  version->mtime = finfo.mtime;
+  version->cfg = mapcache_configuration_create(pool);
+  ctx->config = version->cfg;
+  ctx->pool = pool;
+
+  mapcache_configuration_parse(ctx,conffile,version->cfg,1);
+  if(GC_HAS_ERROR(ctx)) goto failed_load;
+  mapcache_configuration_post_config(ctx, version->cfg);
+  if(GC_HAS_ERROR(ctx)) goto failed_load;
+  if(mapcache_config_services_enabled(ctx,version->cfg) <= 0) {
+    ctx->set_error(ctx,500,"no mapcache <service>s configured/enabled, no point in continuing.");
+    goto failed_load;
+  }
+  mapcache_connection_pool_create(version->cfg, &version->connection_pool, pool);
+  fcgi_prefetcher_log_init(version->cfg, pool);
+  ctx->config = NULL;
+  ctx->pool = ctx_pool;
+  return version;
+
+failed_load:
+  {
+    /* the error message is allocated from the pool we are about to destroy */
+    int code = ctx->get_error(ctx);
+    char *msg = apr_pstrdup(ctx_pool, ctx->get_error_message(ctx));
+    ctx->clear_errors(ctx);
+    ctx->exceptions = NULL;
+    ctx->config = NULL;
+    ctx->pool = ctx_pool;
+    ctx->set_error(ctx,code,"%s",msg);
+  }
+  apr_pool_destroy(pool);
+  return NULL;
+}
+
+static void fcgi_config_release(fcgi_config_version *version)
+{
+  int destroy;
+  apr_thread_mutex_lock(config_mutex);
+  destroy = (--version->refcount == 0 && version->retired);
+  apr_thread_mutex_unlock(config_mutex);
+  if(destroy) {
+    apr_pool_destroy(version->pool);
+  }
+}
+
+static fcgi_config_version* fcgi_config_acquire()
+{
+  fcgi_config_version *version;
+  apr_thread_mutex_lock(config_mutex);
+  version = current_config;
+  version->refcount++;
+  apr_thread_mutex_unlock(config_mutex);
+  return version;
+}
+
+/**
+ * \brief make version the configuration used by new requests
+ */
+static void fcgi_config_publish(fcgi_config_version *version)
+{
+  fcgi_config_version *old;
+  int destroy = 0;
+  apr_thread_mutex_lock(config_mutex);
+  old = current_config;
+  current_config = version;
+  if(old) {
+    old->retired = 1;
+    destroy = (old->refcount == 0);
+  }
+  apr_thread_mutex_unlock(config_mutex);
+  if(destroy) {
+    apr_pool_destroy(old->pool);
+  }
+}
+
+static void* APR_THREAD_FUNC fcgi_config_watcher(apr_thread_t *thread, void *data)
+{
+  mapcache_context *ctx = (mapcache_context*)data;
+  apr_pool_t *pool = ctx->pool;
+  apr_time_t loaded_mtime = current_config->mtime;
+#ifdef HAVE_INOTIFY
+  union {
+    struct inotify_event event;
+    char buf[4096];
+  } events;
+  char *dir = apr_pstrdup(pool, conffile);
+  char *base = strrchr(dir,'/');
+  int fd;
+
+  /* watch the directory, as editors usually replace the file rather than writing to it */
+  if(base) {
+    *base++ = '\0';
+    if(!*dir) dir = "/";
+  } else {
+    base = dir;
+    dir = ".";
+  }
+  fd = inotify_init();
+  if(fd >= 0 && inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+    close(fd);
+    fd = -1;
+  }
+  if(fd < 0) {
+    ctx->log(ctx,MAPCACHE_WARN,"failed to watch %s with inotify, polling it for changes instead",conffile);
+  }
+#endif
+
+  apr_pool_create(&ctx->pool,pool);
+  for(;;) {
+    fcgi_config_version *version;
+    apr_finfo_t finfo;
+
+    apr_pool_clear(ctx->pool);
+#ifdef HAVE_INOTIFY
+    if(fd >= 0) {
+      int changed = 0;
+      char *p;
+      ssize_t len = read(fd, events.buf, sizeof(events.buf));
+      if(len <= 0) {
+        if(len < 0 && errno == EINTR) continue;
+        ctx->log(ctx,MAPCACHE_WARN,"failed to read inotify events, polling %s for changes instead",conffile);
+        close(fd);
+        fd = -1;
+        continue;
+      }
+      for(p = events.buf; p < events.buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+        struct inotify_event *event = (struct inotify_event*)p;
+        if(event->len && !strcmp(event->name, base)) {
+          changed = 1;
+        }
+      }
+      if(!changed) continue;
+      /* give the writer some time to finish */
+      apr_sleep(100000);
+    } else
+#endif
+      apr_sleep(apr_time_from_sec(1));
+
+    if(apr_stat(&finfo, conffile, APR_FINFO_MTIME, ctx->pool) != APR_SUCCESS || finfo.mtime <= loaded_mtime) {
+      continue;
+    }
+    ctx->log(ctx,MAPCACHE_INFO,"config file has changed, reloading");
+    loaded_mtime = finfo.mtime;
+    version = fcgi_config_load(ctx);
+    if(!version) {
+      /* keep the running configuration, only log the error */
+      ctx->log(ctx,MAPCACHE_ERROR,"failed to reload config file %s: %s", conffile,ctx->get_error_message(ctx));
+      ctx->clear_errors(ctx);
+      ctx->exceptions = NULL;
+      continue;
+    }
+    loaded_mtime = version->mtime;
+    fcgi_config_publish(version);
+    if(!version->cfg->autoreload) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+static void* APR_THREAD_FUNC fcgi_worker_thread(apr_thread_t *thread, void *data)
+{
+  apr_pool_t *thread_pool;
+  mapcache_context_fcgi *fctx;
+  mapcache_context *ctx;
+  FCGX_Request request;
+
+  apr_pool_create(&thread_pool,global_pool);
+  fctx = fcgi_context_create(thread_pool);
+  ctx = (mapcache_context*)fctx;
+  FCGX_InitRequest(&request, 0, 0);
+
+  for(;;) {
+    fcgi_config_version *version;
+    int rc;
+
+    apr_thread_mutex_lock(accept_mutex);
+    rc = FCGX_Accept_r(&request);
+    apr_thread_mutex_unlock(accept_mutex);
+    if(rc < 0) {
+      break;
+    }
+
+    version = fcgi_config_acquire();
+    ctx->config = version->cfg;
+    ctx->connection_pool = version->connection_pool;
+    fctx->request = &request;
+    apr_pool_create(&ctx->pool,thread_pool);
+
+    fcgi_handle_request(fctx);
+
+    ctx->clear_errors(ctx);
+    ctx->exceptions = NULL;
+    apr_pool_destroy(ctx->pool);
+    ctx->pool = thread_pool;
+    fctx->request = NULL;
+    ctx->config = NULL;
+    ctx->connection_pool = NULL;
+    fcgi_config_release(version);
+    FCGX_Finish_r(&request);
+  }
+  return NULL;
+}
+
+static int fcgi_run_threaded(mapcache_context *ctx, int nthreads)
+{
+  apr_thread_t **threads;
+  fcgi_config_version *version;
+  apr_status_t rv;
+  int i, started = 0;
+
+  if(FCGX_Init() != 0) {
+    ctx->log(ctx,MAPCACHE_ERROR,"failed to initialize the FastCGI library");
+    return 1;
+  }
+  apr_thread_mutex_create(&config_mutex,APR_THREAD_MUTEX_DEFAULT,global_pool);
+  apr_thread_mutex_create(&accept_mutex,APR_THREAD_MUTEX_DEFAULT,global_pool);
+
+  version = fcgi_config_load(ctx);
+  if(!version) {
+    ctx->log(ctx,MAPCACHE_ERROR,"failed to load config file %s: %s", conffile,ctx->get_error_message(ctx));
+    return 1;
+  }
+  fcgi_config_publish(version);
+
+  if(version->cfg->autoreload) {
+    apr_thread_t *watcher;
+    apr_pool_t *watcher_pool;
+    apr_pool_create(&watcher_pool,global_pool);
+    if(apr_thread_create(&watcher, NULL, fcgi_config_watcher, fcgi_context_create(watcher_pool), global_pool) != APR_SUCCESS) {
+      ctx->log(ctx,MAPCACHE_ERROR,"failed to start the config file watcher thread, config changes will be ignored");
+    }
+  }
+
+  threads = apr_pcalloc(global_pool, nthreads * sizeof(apr_thread_t*));
+  for(i=0; i<nthreads; i++) {
+    if(apr_thread_create(&threads[i], NULL, fcgi_worker_thread, NULL, global_pool) != APR_SUCCESS) {
+      ctx->log(ctx,MAPCACHE_ERROR,"failed to start FastCGI worker thread %d",i);
+      threads[i] = NULL;
+    } else {
+      started++;
+    }
+  }
+  ctx->log(ctx,MAPCACHE_INFO,"mapcache fcgi running %d worker threads",started);
+  for(i=0; i<nthreads; i++) {
+    if(threads[i]) {
+      apr_thread_join(&rv, threads[i]);
+    }
+  }
+  return started ? 0 : 1;
+}
+#endif
+
+int main(int argc, const char **argv)
+{
+  mapcache_context_fcgi* globalctx;
+  mapcache_context* ctx;
+#ifdef USE_FASTCGI_THREADS
+  char *nthreads;
+#endif
+
   (void) signal(SIGTERM,handle_signal);
 #ifndef _WIN32
   (void) signal(SIGUSR1,handle_signal);
@@ -247,9 +703,8 @@ int main(int argc, const char **argv)
     return 1;
   }
   config_pool = NULL;
-  globalctx = fcgi_context_create();
+  globalctx = fcgi_context_create(global_pool);
   ctx = (mapcache_context*)globalctx;
-
   conffile  = getenv("MAPCACHE_CONFIG_FILE");
 #ifdef DEBUG
   if(!conffile) {
@@ -273,6 +728,13 @@ int main(int argc, const char **argv)
   ctx->log(ctx,MAPCACHE_INFO,"mapcache fcgi conf file: %s",conffile);
 
 
+#ifdef USE_FASTCGI_THREADS
+  nthreads = getenv("MAPCACHE_FCGI_THREADS");
+  if(nthreads && atoi(nthreads) > 1) {
+    return fcgi_run_threaded(ctx, atoi(nthreads));
+  }
+#endif
+
 #ifdef USE_FASTCGI
   while (FCGI_Accept() >= 0) {
 #endif
@@ -286,71 +748,7 @@ int main(int argc, const char **argv)
       }
     }
     apr_pool_create(&(ctx->pool),config_pool);
-    request = NULL;
-    pathInfo = getenv("PATH_INFO");
-
-
-    params = mapcache_http_parse_param_string(ctx, getenv("QUERY_STRING"));
-    mapcache_service_dispatch_request(ctx,&request,pathInfo,params,ctx->config);
-    if(GC_HAS_ERROR(ctx) || !request) {
-      fcgi_write_response(globalctx, mapcache_core_respond_to_error(ctx));
-      goto cleanup;
-    }
-
-    http_response = NULL;
-    if(request->type == MAPCACHE_REQUEST_GET_CAPABILITIES) {
-      mapcache_request_get_capabilities *req = (mapcache_request_get_capabilities*)request;
-      char *host = getenv("SERVER_NAME");
-      char *port = getenv("SERVER_PORT");
-      char *fullhost;
-      char *url;
-      if(getenv("HTTPS")) {
-        if(!port || !strcmp(port,"443")) {
-          fullhost = apr_psprintf(ctx->pool,"https://%s",host);
-        } else {
-          fullhost = apr_psprintf(ctx->pool,"https://%s:%s",host,port);
-        }
-      } else {
-        if(!port || !strcmp(port,"80")) {
-          fullhost = apr_psprintf(ctx->pool,"http://%s",host);
-        } else {
-          fullhost = apr_psprintf(ctx->pool,"http://%s:%s",host,port);
-        }
-      }
-      url = apr_psprintf(ctx->pool,"%s%s/",
-                         fullhost,
-                         getenv("SCRIPT_NAME")
-                        );
-      http_response = mapcache_core_get_capabilities(ctx,request->service,req,url,pathInfo,ctx->config);
-    } else if( request->type == MAPCACHE_REQUEST_GET_TILE) {
-      mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*)request;
-      http_response = mapcache_core_get_tile(ctx,req_tile);
-    } else if( request->type == MAPCACHE_REQUEST_PROXY ) {
-      mapcache_request_proxy *req_proxy = (mapcache_request_proxy*)request;
-      http_response = mapcache_core_proxy_request(ctx, req_proxy);
-    } else if( request->type == MAPCACHE_REQUEST_GET_MAP) {
-      mapcache_request_get_map *req_map = (mapcache_request_get_map*)request;
-      http_response = mapcache_core_get_map(ctx,req_map);
-    } else if( request->type == MAPCACHE_REQUEST_GET_FEATUREINFO) {
-      mapcache_request_get_feature_info *req_fi = (mapcache_request_get_feature_info*)request;
-      http_response = mapcache_core_get_featureinfo(ctx,req_fi);
-#ifdef DEBUG
-    } else {
-      ctx->set_error(ctx,500,"###BUG### unknown request type");
-#endif
-    }
-    if(GC_HAS_ERROR(ctx)) {
-      fcgi_write_response(globalctx, mapcache_core_respond_to_error(ctx));
-      goto cleanup;
-    }
-#ifdef DEBUG
-    if(!http_response) {
-      ctx->set_error(ctx,500,"###BUG### NULL response");
-      fcgi_write_response(globalctx, mapcache_core_respond_to_error(ctx));
-      goto cleanup;
-    }
-#endif
-    fcgi_write_response(globalctx,http_response);
+    fcgi_handle_request(globalctx);
 cleanup:
 #ifdef USE_FASTCGI
     apr_pool_destroy(ctx->pool);
@@ -0,0 +1,20 @@
+FIND_PACKAGE(PkgConfig)
+PKG_CHECK_MODULES(PC_BROTLI libbrotlienc)
+
+FIND_PATH(BROTLI_INCLUDE_DIR
+    NAMES brotli/encode.h
+    HINTS ${PC_BROTLI_INCLUDEDIR}
+          ${PC_BROTLI_INCLUDE_DIRS}
+)
+
+FIND_LIBRARY(BROTLI_LIBRARY
+    NAMES brotlienc
+    HINTS ${PC_BROTLI_LIBDIR}
+          ${PC_BROTLI_LIBRARY_DIRS}
+)
+
+set(BROTLI_INCLUDE_DIRS ${BROTLI_INCLUDE_DIR})
+set(BROTLI_LIBRARIES ${BROTLI_LIBRARY})
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(BROTLI DEFAULT_MSG BROTLI_LIBRARY BROTLI_INCLUDE_DIR)
+mark_as_advanced(BROTLI_LIBRARY BROTLI_INCLUDE_DIR)
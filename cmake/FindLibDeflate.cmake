@@ -0,0 +1,20 @@
+FIND_PACKAGE(PkgConfig)
+PKG_CHECK_MODULES(PC_LIBDEFLATE libdeflate)
+
+FIND_PATH(LIBDEFLATE_INCLUDE_DIR
+    NAMES libdeflate.h
+    HINTS ${PC_LIBDEFLATE_INCLUDEDIR}
+          ${PC_LIBDEFLATE_INCLUDE_DIRS}
+)
+
+FIND_LIBRARY(LIBDEFLATE_LIBRARY
+    NAMES deflate libdeflate
+    HINTS ${PC_LIBDEFLATE_LIBDIR}
+          ${PC_LIBDEFLATE_LIBRARY_DIRS}
+)
+
+set(LIBDEFLATE_INCLUDE_DIRS ${LIBDEFLATE_INCLUDE_DIR})
+set(LIBDEFLATE_LIBRARIES ${LIBDEFLATE_LIBRARY})
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LIBDEFLATE DEFAULT_MSG LIBDEFLATE_LIBRARY LIBDEFLATE_INCLUDE_DIR)
+mark_as_advanced(LIBDEFLATE_LIBRARY LIBDEFLATE_INCLUDE_DIR)
@@ -0,0 +1,20 @@
+FIND_PACKAGE(PkgConfig)
+PKG_CHECK_MODULES(PC_WEBP libwebp)
+
+FIND_PATH(WEBP_INCLUDE_DIR
+    NAMES webp/encode.h webp/decode.h
+    HINTS ${PC_WEBP_INCLUDEDIR}
+          ${PC_WEBP_INCLUDE_DIRS}
+)
+
+FIND_LIBRARY(WEBP_LIBRARY
+    NAMES webp libwebp
+    HINTS ${PC_WEBP_LIBDIR}
+          ${PC_WEBP_LIBRARY_DIRS}
+)
+
+set(WEBP_INCLUDE_DIRS ${WEBP_INCLUDE_DIR})
+set(WEBP_LIBRARIES ${WEBP_LIBRARY})
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(WEBP DEFAULT_MSG WEBP_LIBRARY WEBP_INCLUDE_DIR)
+mark_as_advanced(WEBP_LIBRARY WEBP_INCLUDE_DIR)
@@ -78,9 +78,11 @@ typedef struct mapcache_image_format_mixed mapcache_image_format_mixed;
 typedef struct mapcache_image_format_png mapcache_image_format_png;
 typedef struct mapcache_image_format_png_q mapcache_image_format_png_q;
 typedef struct mapcache_image_format_jpeg mapcache_image_format_jpeg;
+typedef struct mapcache_image_format_webp mapcache_image_format_webp;
 typedef struct mapcache_image_format_raw mapcache_image_format_raw;
 typedef struct mapcache_cfg mapcache_cfg;
 typedef struct mapcache_tileset mapcache_tileset;
+typedef struct mapcache_existence_filter mapcache_existence_filter;
 typedef struct mapcache_cache mapcache_cache;
 typedef struct mapcache_source mapcache_source;
 typedef struct mapcache_buffer mapcache_buffer;
@@ -90,6 +92,8 @@ typedef struct mapcache_feature_info mapcache_feature_info;
 typedef struct mapcache_request_get_feature_info mapcache_request_get_feature_info;
 typedef struct mapcache_map mapcache_map;
 typedef struct mapcache_http_response mapcache_http_response;
+typedef struct mapcache_response_stream mapcache_response_stream;
+typedef struct mapcache_image_stream mapcache_image_stream;
 typedef struct mapcache_http mapcache_http;
 typedef struct mapcache_request mapcache_request;
 typedef struct mapcache_request_image mapcache_request_image;
@@ -102,6 +106,12 @@ typedef struct mapcache_request_get_map mapcache_request_get_map;
 typedef struct mapcache_service mapcache_service;
 typedef struct mapcache_server_cfg mapcache_server_cfg;
 typedef struct mapcache_image mapcache_image;
+typedef struct mapcache_decoded_tile_cache mapcache_decoded_tile_cache;
+typedef struct mapcache_image_workers mapcache_image_workers;
+typedef struct mapcache_prefetcher mapcache_prefetcher;
+typedef struct mapcache_uniform_tile_cache mapcache_uniform_tile_cache;
+typedef struct mapcache_capabilities_cache mapcache_capabilities_cache;
+typedef struct mapcache_render_limiter mapcache_render_limiter;
 typedef struct mapcache_grid mapcache_grid;
 typedef struct mapcache_grid_level mapcache_grid_level;
 typedef struct mapcache_grid_link mapcache_grid_link;
@@ -272,6 +282,32 @@ typedef enum {
   MAPCACHE_SOURCE_FALLBACK
 } mapcache_source_type;
 
+typedef enum {
+  MAPCACHE_OVERLOAD_ERROR, /**< report the error (a stale tile is still returned if there is one) */
+  MAPCACHE_OVERLOAD_UPSCALE /**< return an upscaled tile of a lower zoom level if one is cached */
+} mapcache_overload_fallback;
+
+/**
+ * \brief cross-process limit on the number of concurrent renders
+ */
+struct mapcache_render_limiter {
+  char *name;
+  char *filename; /**< file whose locked bytes count the renders and the waiting requests */
+  int max; /**< maximum number of concurrent renders */
+  int reserved; /**< number of render slots that seeding cannot use */
+  int queue; /**< maximum number of interactive requests waiting for a slot */
+  double timeout; /**< maximum time in seconds an interactive request waits for a slot */
+};
+
+mapcache_render_limiter* mapcache_render_limiter_create(mapcache_context *ctx, const char *name, const char *filename, int max);
+
+/**
+ * \brief wait for a render slot
+ * \returns MAPCACHE_FAILURE with a 503 error if the queue is full or the wait timed out
+ */
+int mapcache_render_limiter_enter(mapcache_context *ctx, mapcache_render_limiter *limiter, void **slot);
+void mapcache_render_limiter_leave(mapcache_context *ctx, void *slot);
+
 /**\interface mapcache_source
  * \brief a source of data that can return image data
  */
@@ -282,6 +318,8 @@ struct mapcache_source {
   apr_table_t *metadata;
   unsigned int retry_count;
   double retry_delay;
+  mapcache_render_limiter *limiter; /**< optional limit on the concurrent renders of this source */
+  mapcache_overload_fallback overload_fallback; /**< what to return when the limiter rejects a render */
 
   apr_array_header_t *info_formats;
   /**
@@ -327,6 +365,8 @@ typedef enum {
   ,MAPCACHE_CACHE_COMPOSITE
   ,MAPCACHE_CACHE_COUCHBASE
   ,MAPCACHE_CACHE_RIAK
+  ,MAPCACHE_CACHE_ARCHIVE
+  ,MAPCACHE_CACHE_DEDUP
 } mapcache_cache_type;
 
 /** \interface mapcache_cache
@@ -349,6 +389,13 @@ struct mapcache_cache {
    */
   int (*_tile_get)(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile * tile);
 
+  /**
+   * get the content of several tiles from the cache, the tiles that aren't
+   * in the cache are left with a NULL encoded_data. optional.
+   * \memberof mapcache_cache
+   */
+  void (*_tile_multi_get)(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tiles, int ntiles);
+
   /**
    * delete tile from cache
    *
@@ -370,6 +417,7 @@ struct mapcache_cache {
 };
 
 MS_DLL_EXPORT int mapcache_cache_tile_get(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile);
+void mapcache_cache_tile_multi_get(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tiles, int ntiles);
 void mapcache_cache_tile_delete(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile);
 MS_DLL_EXPORT int mapcache_cache_tile_exists(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile);
 MS_DLL_EXPORT void mapcache_cache_tile_set(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile);
@@ -463,8 +511,27 @@ struct mapcache_request_get_tile {
   int allow_redirect;
 };
 
+/**
+ * receives the bytes of a streamed response body as soon as they are produced
+ */
+typedef void (*mapcache_stream_write_func)(mapcache_context *ctx, void *data, const unsigned char *buf, size_t len);
+
+/**\interface mapcache_response_stream
+ * \brief a response body that is produced while being sent to the client
+ */
+struct mapcache_response_stream {
+  /**
+   * produce the whole body, passing it to write in successive chunks. called by the
+   * frontend once the headers have been sent, so errors can no longer be reported to
+   * the client
+   */
+  void (*run)(mapcache_context *ctx, mapcache_response_stream *stream,
+              mapcache_stream_write_func write, void *write_data);
+};
+
 struct mapcache_http_response {
   mapcache_buffer *data;
+  mapcache_response_stream *stream; /**< if set, the body is produced by stream instead of being in data */
   apr_table_t *headers;
   long code;
   apr_time_t mtime;
@@ -481,6 +548,7 @@ struct mapcache_map {
   mapcache_extent extent;
   apr_time_t mtime; /**< last modification time */
   int expires; /**< time in seconds after which the tile should be rechecked for validity */
+  int overloaded; /**< set when the source's own concurrency limit refused to render the map */
 };
 
 struct mapcache_feature_info {
@@ -515,6 +583,12 @@ struct mapcache_request_get_capabilities {
    * the mime type
    */
   char *mime_type;
+
+  /**
+   * the Accept-Encoding header of the request, if any, used to serve precompressed
+   * cached documents
+   */
+  const char *accept_encoding;
 };
 
 
@@ -666,7 +740,7 @@ MS_DLL_EXPORT int mapcache_config_services_enabled(mapcache_context *ctx, mapcac
 /** @{ */
 
 typedef enum {
-  GC_UNKNOWN, GC_PNG, GC_JPEG, GC_RAW
+  GC_UNKNOWN, GC_PNG, GC_JPEG, GC_RAW, GC_WEBP
 } mapcache_image_format_type;
 
 typedef enum {
@@ -709,10 +783,15 @@ struct mapcache_image {
 mapcache_image* mapcache_image_create(mapcache_context *ctx);
 mapcache_image* mapcache_image_create_with_data(mapcache_context *ctx, int width, int height);
 
+/**
+ * \brief resample src onto dst
+ * \param npixels if dst is a band of a larger image, the number of pixels of that image,
+ * which decides whether the rows are processed in parallel. 0 if dst is the whole image
+ */
 void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
-    double off_x, double off_y, double scale_x, double scale_y);
+    double off_x, double off_y, double scale_x, double scale_y, size_t npixels);
 void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
-    double off_x, double off_y, double scale_x, double scale_y, int reflect_edges);
+    double off_x, double off_y, double scale_x, double scale_y, int reflect_edges, size_t npixels);
 
 
 /**
@@ -728,6 +807,59 @@ void mapcache_image_copy_resampled(mapcache_context *ctx, mapcache_image *src, m
                                    int srcX, int srcY, int srcW, int srcH,
                                    int dstX, int dstY, int dstW, int dstH);
 
+/**
+ * \brief shrink src by an integer factor into dst, averaging each factor x factor block of pixels
+ * dst must be allocated and be (at most) src->w/factor x src->h/factor pixels
+ */
+void mapcache_image_box_reduce(mapcache_image *src, mapcache_image *dst, int factor);
+
+/**
+ * a pixel kernel processing rows [y0,y1) of its destination image
+ */
+typedef void (*mapcache_image_band_func)(void *data, int y0, int y1);
+
+/**
+ * \brief create a per-process pool of threads used to process large images
+ * \param nthreads the number of threads working on a single image, including the calling thread
+ * \param min_pixels images with less pixels are processed on the calling thread only
+ */
+mapcache_image_workers* mapcache_image_workers_create(apr_pool_t *pool, int nthreads, size_t min_pixels);
+
+/**
+ * \brief run func over all the rows of a width x height image
+ * \param npixels the number of pixels of the whole image when the rows are a band of a
+ * larger one, so that bands of a large image are processed in parallel too. 0 for width x height
+ *
+ * the rows are split into bands processed in parallel by the configured image workers,
+ * or processed on the calling thread if there are none or if the image is too small.
+ */
+void mapcache_image_workers_run(mapcache_context *ctx, int width, int height, size_t npixels,
+                                mapcache_image_band_func func, void *data);
+
+/**
+ * \brief create a per-process queue of metatiles rendered in the background
+ * \param nthreads the number of threads rendering the queued metatiles
+ * \param max_pending metatiles scheduled while the queue holds this many are dropped
+ */
+mapcache_prefetcher* mapcache_prefetcher_create(apr_pool_t *pool, int nthreads, int max_pending);
+
+/**
+ * \brief set the context the prefetch threads log through
+ *
+ * the context must outlive the prefetcher and is only used by it from then on: its pool is
+ * replaced by one the prefetcher clears after each message. without a log context, warnings
+ * are written to stderr.
+ */
+void mapcache_prefetcher_set_log_context(mapcache_prefetcher *prefetcher, mapcache_context *log_ctx);
+
+/**
+ * \brief schedule the rendering of the metatiles a client is likely to request after the given tile
+ *
+ * the neighboring metatiles and/or the children of the tile are queued, depending on the tileset's
+ * configuration. this never blocks, and never sets an error on the context.
+ */
+void mapcache_prefetcher_schedule(mapcache_context *ctx, mapcache_tile *tile);
+
 /**
  * \brief split the given metatile into tiles
  * \param mt the metatile to split
@@ -759,6 +891,10 @@ void mapcache_image_fill(mapcache_context *ctx, mapcache_image *image, const uns
 void mapcache_http_do_request(mapcache_context *ctx, mapcache_http *req, mapcache_buffer *data, apr_table_t *headers, long *http_code);
 char* mapcache_http_build_url(mapcache_context *ctx, char *base, apr_table_t *params);
 MS_DLL_EXPORT apr_table_t *mapcache_http_parse_param_string(mapcache_context *ctx, char *args);
+/**
+ * \brief decode the %xx escapes of an url in place
+ */
+MS_DLL_EXPORT int _mapcache_unescape_url(char *url);
 /** @} */
 
 /** \defgroup configuration Configuration*/
@@ -777,7 +913,8 @@ typedef enum {
 typedef enum {
   MAPCACHE_LOCKER_DISK,
   MAPCACHE_LOCKER_MEMCACHE,
-  MAPCACHE_LOCKER_FALLBACK
+  MAPCACHE_LOCKER_FALLBACK,
+  MAPCACHE_LOCKER_FLOCK
 } mapcache_lock_mode;
 
 typedef enum {
@@ -791,6 +928,12 @@ struct mapcache_locker{
   mapcache_lock_result (*aquire_lock)(mapcache_context *ctx, mapcache_locker *self, char *resource, void **lock);
   mapcache_lock_result (*ping_lock)(mapcache_context *ctx, mapcache_locker *self, void *lock);
   void (*release_lock)(mapcache_context *ctx, mapcache_locker *self, void *lock);
+  /**
+   * \brief optional, block until a lock held by someone else is released, instead of polling it
+   * \returns MAPCACHE_LOCK_AQUIRED if the lock now belongs to the caller, MAPCACHE_LOCK_NOENT
+   * if the previous holder is done with the resource
+   */
+  mapcache_lock_result (*wait_lock)(mapcache_context *ctx, mapcache_locker *self, void *lock);
 
   void (*parse_xml)(mapcache_context *ctx, mapcache_locker *self, ezxml_t node);
   mapcache_lock_mode type;
@@ -804,6 +947,8 @@ mapcache_locker* mapcache_locker_memcache_create(mapcache_context *ctx);
 
 mapcache_locker* mapcache_locker_fallback_create(mapcache_context *ctx);
 
+mapcache_locker* mapcache_locker_flock_create(mapcache_context *ctx);
+
 void mapcache_config_parse_locker(mapcache_context *ctx, ezxml_t node, mapcache_locker **locker);
 void mapcache_config_parse_locker_old(mapcache_context *ctx, ezxml_t doc, mapcache_cfg *config);
 
@@ -888,6 +1033,48 @@ struct mapcache_cfg {
   // - cp_ttl defines the maximum amount of time in microseconds an unused connection is valid
   int cp_hmax;
   int cp_ttl;
+
+  /**
+   * optional in-memory cache of decoded tiles, used when assembling tiles into maps
+   */
+  mapcache_decoded_tile_cache *decoded_tile_cache;
+
+  /**
+   * optional pool of threads used to resample and merge large images
+   */
+  mapcache_image_workers *image_workers;
+
+  /**
+   * optional background rendering of the tiles neighboring the requested ones
+   */
+  mapcache_prefetcher *prefetcher;
+
+  /**
+   * shared encodings of single color tiles
+   */
+  mapcache_uniform_tile_cache *uniform_tiles;
+
+  /**
+   * optional in-memory cache of the GetCapabilities documents
+   */
+  mapcache_capabilities_cache *capabilities_cache;
+
+  /**
+   * optional limit on the concurrent renders of all the sources
+   */
+  mapcache_render_limiter *render_limiter;
+
+  /**
+   * set by the seeder: renders are batch renders, i.e. they do not time out waiting for
+   * a render slot and cannot use the slots reserved for interactive requests
+   */
+  int batch_rendering;
+
+  /**
+   * encode assembled GetMap responses while they are being sent to the client, instead of
+   * buffering them
+   */
+  int getmap_streaming;
 };
 
 /**
@@ -967,6 +1154,16 @@ mapcache_cache* mapcache_cache_google_create(mapcache_context *ctx);
  */
 mapcache_cache* mapcache_cache_tiff_create(mapcache_context *ctx);
 
+/**
+ * \memberof mapcache_cache_archive
+ */
+mapcache_cache* mapcache_cache_archive_create(mapcache_context *ctx);
+
+/**
+ * \memberof mapcache_cache_dedup
+ */
+mapcache_cache* mapcache_cache_dedup_create(mapcache_context *ctx);
+
 mapcache_cache* mapcache_cache_composite_create(mapcache_context *ctx);
 mapcache_cache* mapcache_cache_fallback_create(mapcache_context *ctx);
 mapcache_cache* mapcache_cache_multitier_create(mapcache_context *ctx);
@@ -1010,6 +1207,26 @@ struct mapcache_tile {
    * compositing image data
    */
   int nodata;
+
+  /**
+   * set by the caches that stored the tile as a single color marker: the color
+   * of the tile, only valid as long as encoded_data is uniform_data
+   */
+  mapcache_buffer *uniform_data;
+  unsigned char uniform_color[4];
+
+  /**
+   * set by the caches that store uniform tiles as single color markers to the data
+   * of a tile that wasn't stored as one: the tile is known not to be uniform, as
+   * long as encoded_data is nonuniform_data
+   */
+  mapcache_buffer *nonuniform_data;
+
+  /**
+   * store the tile with its mtime instead of the current time, for the caches
+   * that keep a modification time (used when copying tiles between caches)
+   */
+  int keep_mtime;
 };
 
 /**
@@ -1130,6 +1347,42 @@ struct mapcache_ruleset {
   apr_array_header_t *rules;
 };
 
+/**
+ * \brief a bloom filter of the tiles stored in a tileset's cache
+ *
+ * used to answer requests for tiles that have never been stored without querying the cache
+ */
+struct mapcache_existence_filter {
+  char *filename;
+  apr_pool_t *pool;
+  apr_uint64_t nbits; /**< size of the filter */
+  apr_uint32_t nhashes; /**< number of bits set per tile */
+  int writable;
+  struct mapcache_existence_filter_header *header; /**< the mapped file, NULL if the filter is not available */
+  volatile apr_uint32_t *bits;
+};
+
+MS_DLL_EXPORT mapcache_existence_filter* mapcache_existence_filter_create(apr_pool_t *pool);
+
+/**
+ * \brief map the filter file
+ * \param create create an empty filter if the file does not exist. if false, a missing
+ *        file is not an error and leaves the filter disabled
+ */
+MS_DLL_EXPORT void mapcache_existence_filter_open(mapcache_context *ctx, mapcache_existence_filter *filter, int create);
+
+/**
+ * \returns MAPCACHE_FALSE if the tile is known not to exist in the cache, MAPCACHE_TRUE if
+ *          it may exist or if the filter is not available or not complete
+ */
+MS_DLL_EXPORT int mapcache_existence_filter_may_contain(mapcache_context *ctx, mapcache_existence_filter *filter, mapcache_tile *tile);
+MS_DLL_EXPORT void mapcache_existence_filter_add(mapcache_context *ctx, mapcache_existence_filter *filter, mapcache_tile *tile);
+
+/**
+ * \brief mark the filter as containing all the tiles of the cache, i.e. allow it to be used for lookups
+ */
+MS_DLL_EXPORT void mapcache_existence_filter_set_complete(mapcache_context *ctx, mapcache_existence_filter *filter);
+
 /**\class mapcache_tileset
  * \brief a set of tiles that can be requested by a client, created from a mapcache_source
  *        stored by a mapcache_cache in a mapcache_format
@@ -1176,9 +1429,40 @@ struct mapcache_tileset {
    */
   int auto_expire;
 
+  /**
+   * when a tile that is missing from the cache is being rendered by another request, return an
+   * upscaled copy of a cached tile at most #upscale_on_miss levels up instead of waiting for the
+   * render to complete. 0 (the default) disables this behavior
+   */
+  int upscale_on_miss;
+
+  /**
+   * the expiration (in seconds) sent to clients for upscaled tiles
+   * \sa upscale_on_miss
+   */
+  int upscale_expires;
+
+  /**
+   * prefetch the neighboring metatiles of the requested tiles
+   * \sa mapcache_prefetcher_schedule
+   */
+  int prefetch_neighbors;
+
+  /**
+   * prefetch the metatiles covering the children of the requested tiles
+   * \sa mapcache_prefetcher_schedule
+   */
+  int prefetch_children;
+
   int read_only;
   int subdimension_read_only;
 
+  /**
+   * optional filter of the tiles present in the cache, checked before querying the cache
+   * for read-only tilesets or tilesets with no source
+   */
+  mapcache_existence_filter *existence_filter;
+
   /**
    * the cache in which the tiles should be stored
    */
@@ -1240,6 +1524,24 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
     mapcache_tile **tiles,
     mapcache_resample_mode mode);
 
+/**
+ * receives successive bands of rows of an image being assembled, from top to bottom.
+ * the band image is only valid for the duration of the call
+ */
+typedef void (*mapcache_image_band_sink)(mapcache_context *ctx, mapcache_image *band, void *data);
+
+/**
+ * \brief assemble the tiles like mapcache_tileset_assemble_map_tiles(), without ever holding
+ * the full destination image in memory
+ */
+void mapcache_tileset_assemble_map_tiles_streamed(mapcache_context *ctx, mapcache_tileset *tileset,
+    mapcache_grid_link *grid_link,
+    mapcache_extent *bbox, int width, int height,
+    int ntiles,
+    mapcache_tile **tiles,
+    mapcache_resample_mode mode,
+    mapcache_image_band_sink sink, void *sink_data);
+
 /**
  * compute x,y,z value given a bbox.
  * will return MAPCACHE_FAILURE
@@ -1294,6 +1596,16 @@ MS_DLL_EXPORT mapcache_tile* mapcache_tileset_tile_create(apr_pool_t *pool, mapc
 
 mapcache_tile* mapcache_tileset_tile_clone(apr_pool_t *pool, mapcache_tile *src);
 
+/* number of zoom levels that are searched for a cached ancestor tile */
+#define MAPCACHE_ANCESTOR_MAX_LEVELS 4
+
+/**
+ * \brief fill the tile with the upscaled data of the closest cached lower zoom level, at
+ * most max_levels levels up
+ * \returns MAPCACHE_FALSE if none of these levels is cached for the tile's extent
+ */
+int mapcache_tileset_tile_get_from_ancestor(mapcache_context *ctx, mapcache_tile *tile, int max_levels);
+
 /**
  * \brief create and initialize a map for the given tileset and grid_link
  * @param tileset
@@ -1324,6 +1636,12 @@ void mapcache_tileset_add_watermark(mapcache_context *ctx, mapcache_tileset *til
 
 
 MS_DLL_EXPORT int mapcache_lock_or_wait_for_resource(mapcache_context *ctx, mapcache_locker *locker, char *resource, void **lock);
+/**
+ * \brief wait for a lock that could not be aquired to be released
+ * \returns MAPCACHE_TRUE if the lock was aquired by the caller afterwards, MAPCACHE_FALSE if the
+ * resource was created by the other lock holder
+ */
+MS_DLL_EXPORT int mapcache_wait_for_resource(mapcache_context *ctx, mapcache_locker *locker, void *lock);
 MS_DLL_EXPORT void mapcache_unlock_resource(mapcache_context *ctx, mapcache_locker *locker, void *lock);
 
 MS_DLL_EXPORT mapcache_metatile* mapcache_tileset_metatile_get(mapcache_context *ctx, mapcache_tile *tile);
@@ -1336,6 +1654,21 @@ MS_DLL_EXPORT char* mapcache_tileset_metatile_resource_key(mapcache_context *ctx
 
 
 MS_DLL_EXPORT mapcache_http_response* mapcache_core_get_capabilities(mapcache_context *ctx, mapcache_service *service, mapcache_request_get_capabilities *req_caps, char *url, char *path_info, mapcache_cfg *config);
+
+/**
+ * \brief create a per-process cache of capabilities documents, holding at most max_size bytes
+ */
+mapcache_capabilities_cache* mapcache_capabilities_cache_create(apr_pool_t *pool, size_t max_size);
+
+/**
+ * \brief return the (possibly cached) capabilities response of the service
+ *
+ * the document is encoded as accepted by req_caps->accept_encoding. returns NULL without
+ * setting an error if the document cannot be cached, in which case the caller should
+ * build the response itself.
+ */
+mapcache_http_response* mapcache_capabilities_cache_get_response(mapcache_context *ctx, mapcache_capabilities_cache *cache,
+    mapcache_service *service, mapcache_request_get_capabilities *req_caps, char *url, char *path_info, mapcache_cfg *config);
 MS_DLL_EXPORT mapcache_http_response* mapcache_core_get_tile(mapcache_context *ctx, mapcache_request_get_tile *req_tile);
 
 MS_DLL_EXPORT mapcache_http_response* mapcache_core_get_map(mapcache_context *ctx, mapcache_request_get_map *req_map);
@@ -1345,6 +1678,12 @@ MS_DLL_EXPORT mapcache_http_response* mapcache_core_get_featureinfo(mapcache_con
 MS_DLL_EXPORT mapcache_http_response* mapcache_core_proxy_request(mapcache_context *ctx, mapcache_request_proxy *req_proxy);
 MS_DLL_EXPORT mapcache_http_response* mapcache_core_respond_to_error(mapcache_context *ctx);
 
+/**
+ * \brief run the response's stream, if any, to fill response->data. used by the frontends
+ * that cannot send a body while it is being produced
+ */
+MS_DLL_EXPORT void mapcache_http_response_buffer_stream(mapcache_context *ctx, mapcache_http_response *response);
+
 
 /* in ruleset.c */
 
@@ -1474,6 +1813,10 @@ char* mapcache_util_get_tile_key(mapcache_context *ctx, mapcache_tile *tile, cha
                                  char* sanitized_chars, char *sanitize_to);
 void mapcache_make_parent_dirs(mapcache_context *ctx, char *filename);
 
+/* in hmac-sha.c */
+void sha256(const unsigned char *message, unsigned int len, unsigned char *digest);
+void sha_hex_encode(unsigned char *sha, unsigned int sha_size);
+
 /**\defgroup imageio Image IO */
 /** @{ */
 
@@ -1487,6 +1830,26 @@ typedef enum {
   MAPCACHE_COMPRESSION_DEFAULT /**< default compression*/
 } mapcache_compression_type;
 
+/**
+ * png row filtering to apply before compression
+ */
+typedef enum {
+  MAPCACHE_PNG_FILTER_NONE, /**< no filtering, fastest */
+  MAPCACHE_PNG_FILTER_SUB,
+  MAPCACHE_PNG_FILTER_UP,
+  MAPCACHE_PNG_FILTER_AVG,
+  MAPCACHE_PNG_FILTER_PAETH,
+  MAPCACHE_PNG_FILTER_ADAPTIVE /**< choose the best filter for each row */
+} mapcache_png_filter;
+
+/**
+ * deflate implementation used to compress png data
+ */
+typedef enum {
+  MAPCACHE_DEFLATE_ZLIB, /**< zlib, through libpng */
+  MAPCACHE_DEFLATE_LIBDEFLATE /**< libdeflate, for RGB(A) images only */
+} mapcache_deflate_backend;
+
 /**
  * photometric interpretation for jpeg bands
  */
@@ -1520,10 +1883,24 @@ struct mapcache_image_format {
 
   mapcache_buffer* (*create_empty_image)(mapcache_context *ctx, mapcache_image_format *format,
                                          size_t width, size_t height, unsigned int color);
+
+  mapcache_image_stream* (*stream)(mapcache_context *ctx, mapcache_image_format *format,
+                                   int width, int height, mapcache_stream_write_func write, void *write_data);
+  /**< optional pointer to a function that starts an incremental encoding of a width x height image.
+   * NULL for formats that need the whole image before encoding it (e.g. quantized png)
+   */
   apr_table_t *metadata;
   mapcache_image_format_type type;
 };
 
+/**\interface mapcache_image_stream
+ * \brief an incremental image encoder, fed with successive bands of rows from top to bottom
+ */
+struct mapcache_image_stream {
+  void (*write_rows)(mapcache_context *ctx, mapcache_image_stream *stream, mapcache_image *band);
+  void (*finish)(mapcache_context *ctx, mapcache_image_stream *stream);
+};
+
 /**\defgroup imageio_png PNG Image IO
  * \ingroup imageio */
 /** @{ */
@@ -1536,6 +1913,8 @@ struct mapcache_image_format {
 struct mapcache_image_format_png {
   mapcache_image_format format;
   mapcache_compression_type compression_level; /**< PNG compression level to apply */
+  mapcache_png_filter filter; /**< row filter, defaults to none */
+  mapcache_deflate_backend deflate; /**< deflate implementation, defaults to zlib */
 };
 
 struct mapcache_image_format_mixed {
@@ -1547,6 +1926,45 @@ struct mapcache_image_format_mixed {
 
 mapcache_buffer* mapcache_empty_png_decode(mapcache_context *ctx, int width, int height, const unsigned char *hex_color, int *is_empty);
 
+/**
+ * \brief create a per-process cache of encoded single color tiles, holding at most max_size bytes
+ */
+mapcache_uniform_tile_cache* mapcache_uniform_tile_cache_create(apr_pool_t *pool, size_t max_size);
+
+/**
+ * \brief encode a width x height tile filled with color in the given format
+ * \param color the 4 bytes of the (premultiplied) pixel
+ *
+ * the encoding is computed once per format, size and color, and is then shared by
+ * all the requests of the process
+ */
+mapcache_buffer* mapcache_uniform_tile_encode(mapcache_context *ctx, mapcache_image_format *format,
+    int width, int height, const unsigned char *color);
+
+/**
+ * \brief return the encoded data of a tile stored as a single color marker by a cache
+ * \param marker the '#' character followed by the 4 bytes of the tile's color
+ *
+ * opaque tiles of non png tilesets are encoded in the tileset's format, other tiles
+ * are returned as palette pngs. tile->nodata is set if the color is fully transparent.
+ */
+mapcache_buffer* mapcache_uniform_tile_decode(mapcache_context *ctx, mapcache_tile *tile, const unsigned char *marker);
+
+/**
+ * \brief return the pixels of a tile read from a single color marker, without decoding it
+ * \returns NULL if the tile's data doesn't come from a marker
+ *
+ * the returned image is read-only: all its rows share the same pixels (its stride is 0).
+ * it allows caches detecting blank tiles to store the tile without decoding it.
+ */
+mapcache_image* mapcache_uniform_tile_image(mapcache_context *ctx, mapcache_tile *tile);
+
+/**
+ * \brief whether the tile's data was read from a cache that would have stored it as a
+ * single color marker if it were uniform, so that detecting blank tiles can skip decoding it
+ */
+int mapcache_tile_is_nonuniform(mapcache_tile *tile);
+
 mapcache_image_format* mapcache_imageio_create_mixed_format(apr_pool_t *pool,
     char *name, mapcache_image_format *transparent, mapcache_image_format *opaque, unsigned int alpha_cutoff);
 
@@ -1639,6 +2057,57 @@ mapcache_image* _mapcache_imageio_jpeg_decode(mapcache_context *ctx, mapcache_bu
 void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
     mapcache_image *image);
 
+/**
+ * \brief decode at 1/scale_denom of the jpeg's size, using libjpeg's DCT scaling
+ */
+void _mapcache_imageio_jpeg_decode_to_image_scaled(mapcache_context *ctx, mapcache_buffer *buffer,
+    mapcache_image *image, int scale_denom);
+
+/** @} */
+
+/**\defgroup imageio_webp WebP Image IO
+ * \ingroup imageio */
+/** @{ */
+
+typedef enum {
+  MAPCACHE_WEBP_LOSSY, /**< lossy (VP8) compression, with lossless compression of the alpha plane */
+  MAPCACHE_WEBP_LOSSLESS, /**< lossless (VP8L) compression */
+  MAPCACHE_WEBP_MIXED /**< lossless if the image has transparency, lossy otherwise */
+} mapcache_webp_mode;
+
+/**\class mapcache_image_format_webp
+ * \brief WebP image format
+ * \extends mapcache_image_format
+ */
+struct mapcache_image_format_webp {
+  mapcache_image_format format;
+  int quality; /**< WebP quality, 0-100. for lossless encoding, the compression effort */
+  mapcache_webp_mode mode;
+};
+
+/**
+ * \brief create a WebP format
+ *
+ * the #MAPCACHE_WEBP_MIXED mode returns a mixed format whose members are a lossless and a lossy WebP format
+ */
+mapcache_image_format* mapcache_imageio_create_webp_format(apr_pool_t *pool, char *name, int quality,
+    mapcache_webp_mode mode);
+
+/**
+ * @param r
+ * @param buffer
+ * @return
+ */
+mapcache_image* _mapcache_imageio_webp_decode(mapcache_context *ctx, mapcache_buffer *buffer);
+
+/**
+ * @param r
+ * @param buffer
+ * @return
+ */
+void _mapcache_imageio_webp_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
+    mapcache_image *image);
+
 /** @} */
 
 /**
@@ -1667,6 +2136,31 @@ mapcache_image* mapcache_imageio_decode(mapcache_context *ctx, mapcache_buffer *
  */
 void mapcache_imageio_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer, mapcache_image *image);
 
+/**
+ * decodes given buffer to an allocated image, at 1/scale_denom of its size. scale_denom
+ * must be 1, 2, 4 or 8. JPEG images are decoded directly at the reduced size, other formats
+ * are decoded and then reduced
+ */
+void mapcache_imageio_decode_to_image_scaled(mapcache_context *ctx, mapcache_buffer *buffer, mapcache_image *image,
+    int scale_denom);
+
+/**
+ * \brief create a per-process cache of decoded tiles, holding at most max_size bytes of pixel data
+ */
+mapcache_decoded_tile_cache* mapcache_decoded_tile_cache_create(apr_pool_t *pool, size_t max_size);
+
+/**
+ * decodes the given tile's encoded data, going through the configured decoded tile cache
+ * \returns an image that is owned by the caller
+ */
+mapcache_image* mapcache_tile_decode(mapcache_context *ctx, mapcache_tile *tile);
+
+/**
+ * decodes the given tile's encoded data to an allocated image, going through the configured
+ * decoded tile cache
+ */
+void mapcache_tile_decode_to_image(mapcache_context *ctx, mapcache_tile *tile, mapcache_image *image);
+
 
 /** @} */
 
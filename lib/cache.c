@@ -61,6 +61,47 @@ int mapcache_cache_tile_get(mapcache_context *ctx, mapcache_cache *cache, mapcac
   return rv;
 }
 
+void mapcache_cache_tile_multi_get(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tiles, int ntiles) {
+  int i;
+#ifdef DEBUG
+  ctx->log(ctx,MAPCACHE_DEBUG,"calling tile_multi_get on cache (%s): (tileset=%s, grid=%s, first tile: z=%d, x=%d, y=%d",cache->name,tiles[0].tileset->name,tiles[0].grid_link->grid->name,
+      tiles[0].z,tiles[0].x, tiles[0].y);
+#endif
+  if(cache->_tile_multi_get) {
+    /* the tiles outside the visible limits are returned as blank tiles by mapcache_cache_tile_get */
+    for(i=0;i<ntiles;i++) {
+      mapcache_rule *rule = mapcache_ruleset_rule_get(tiles[i].grid_link->rules, tiles[i].z);
+      if (mapcache_ruleset_is_visible_tile(rule, &tiles[i]) == MAPCACHE_FALSE)
+        break;
+    }
+    if(i == ntiles) {
+      for(i=0;i<=cache->retry_count;i++) {
+        if(i) {
+          ctx->log(ctx,MAPCACHE_INFO,"cache (%s) multi-get retry %d of %d. previous try returned error: %s",cache->name,i,cache->retry_count,ctx->get_error_message(ctx));
+          ctx->clear_errors(ctx);
+          if(cache->retry_delay > 0) {
+            double wait = cache->retry_delay;
+            int j = 0;
+            for(j=1;j<i;j++) /* sleep twice as long as before previous retry */
+              wait *= 2;
+            apr_sleep((int)(wait*1000000));  /* apr_sleep expects microseconds */
+          }
+        }
+        cache->_tile_multi_get(ctx,cache,tiles,ntiles);
+        if(!GC_HAS_ERROR(ctx))
+          break;
+      }
+      return;
+    }
+  }
+  for( i=0;i<ntiles;i++ ) {
+    if(mapcache_cache_tile_get(ctx, cache, tiles+i) != MAPCACHE_SUCCESS) {
+      tiles[i].encoded_data = NULL;
+    }
+    GC_CHECK_ERROR(ctx);
+  }
+}
+
 void mapcache_cache_tile_delete(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tile) {
   int i;
 #ifdef DEBUG
@@ -141,6 +182,9 @@ void mapcache_cache_tile_set(mapcache_context *ctx, mapcache_cache *cache, mapca
     if(!GC_HAS_ERROR(ctx))
       break;
   }
+  if(!GC_HAS_ERROR(ctx) && tile->tileset->existence_filter) {
+    mapcache_existence_filter_add(ctx, tile->tileset->existence_filter, tile);
+  }
 }
 
 void mapcache_cache_tile_multi_set(mapcache_context *ctx, mapcache_cache *cache, mapcache_tile *tiles, int ntiles) {
@@ -168,6 +212,11 @@ void mapcache_cache_tile_multi_set(mapcache_context *ctx, mapcache_cache *cache,
       if(!GC_HAS_ERROR(ctx))
         break;
     }
+    if(!GC_HAS_ERROR(ctx) && tiles[0].tileset->existence_filter) {
+      for( i=0;i<ntiles;i++ ) {
+        mapcache_existence_filter_add(ctx, tiles[i].tileset->existence_filter, tiles+i);
+      }
+    }
   } else {
     for( i=0;i<ntiles;i++ ) {
       mapcache_cache_tile_set(ctx, cache, tiles+i);
@@ -0,0 +1,827 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching: single file archive cache backend.
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+ * The archive cache stores all the tiles of a tileset/grid(/dimension) in a
+ * single file. The layout of the file is:
+ *
+ *  - a fixed size header (MAPCACHE_ARCHIVE_HEADER_SIZE bytes)
+ *  - tile data
+ *  - a "sealed" directory: an array of entries sorted by tile id, where the
+ *    tile id is the zoom level followed by the position of the tile along a
+ *    hilbert curve. lookups in the directory are a binary search in a read-only
+ *    memory mapping of the file.
+ *  - an append-only log of entries that have been written since the directory
+ *    was last sealed. each log entry is directly followed by its tile data,
+ *    unless it references an already stored (i.e. identical) blob.
+ *
+ * Writers append to the log and commit by rewriting the header, incrementing
+ * its generation counter so that readers notice the commit even when the file's
+ * modification time and size don't change. Once the log
+ * grows too large, it is merged with the previous directory and a new directory
+ * is appended to the file (the previous one becomes unused space). All integers
+ * are stored little-endian.
+ */
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_file_info.h>
+#include <apr_mmap.h>
+#include <apr_md5.h>
+#include <apr_hash.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define MAPCACHE_ARCHIVE_MAGIC "MCARCHV1"
+#define MAPCACHE_ARCHIVE_VERSION 1
+#define MAPCACHE_ARCHIVE_HEADER_SIZE 64
+#define MAPCACHE_ARCHIVE_ENTRY_SIZE 24
+#define MAPCACHE_ARCHIVE_GENERATION_OFFSET 56 /* position of the generation counter in the header */
+
+typedef struct mapcache_cache_archive mapcache_cache_archive;
+
+struct mapcache_cache_archive {
+  mapcache_cache cache;
+  char *filename_template;
+  int seal_entries; /**< minimum number of log entries before the log is merged into the directory */
+  int dedup_entries; /**< maximum number of blobs remembered by a writer for deduplication */
+  mapcache_locker *locker;
+};
+
+typedef struct {
+  apr_uint64_t dir_offset;
+  apr_uint64_t dir_entries;
+  apr_uint64_t log_offset;
+  apr_uint64_t log_end;
+  apr_uint64_t log_entries;
+  apr_uint64_t generation; /**< incremented by every commit */
+} mapcache_archive_header;
+
+typedef struct {
+  apr_uint64_t tile_id;
+  apr_uint64_t offset;
+  apr_uint32_t length; /**< 0 for a deleted tile */
+  apr_uint32_t seq; /**< position in the log, only used when sealing */
+} mapcache_archive_entry;
+
+struct archive_conn_params {
+  mapcache_cache_archive *cache;
+  char *filename;
+};
+
+/* a read-only mapping of an archive file */
+struct archive_ro_conn {
+  apr_pool_t *pool;
+  apr_pool_t *map_pool;
+  const unsigned char *map;
+  apr_size_t map_size;
+  apr_time_t mtime;
+  apr_off_t size;
+  mapcache_archive_header header;
+  apr_hash_t *log; /* tile id -> mapcache_archive_entry* for the unsealed entries */
+};
+
+/* an archive file opened for writing */
+struct archive_rw_conn {
+  apr_pool_t *pool;
+  apr_file_t *f;
+  apr_finfo_t finfo;
+  apr_hash_t *blobs; /* md5 digest -> mapcache_archive_entry* of blobs already stored in the file */
+  int nblobs;
+};
+
+static void _archive_put_u32(unsigned char *p, apr_uint32_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+static void _archive_put_u64(unsigned char *p, apr_uint64_t v)
+{
+  _archive_put_u32(p, (apr_uint32_t)(v & 0xffffffff));
+  _archive_put_u32(p + 4, (apr_uint32_t)(v >> 32));
+}
+
+static apr_uint32_t _archive_get_u32(const unsigned char *p)
+{
+  return (apr_uint32_t)p[0] | ((apr_uint32_t)p[1] << 8) | ((apr_uint32_t)p[2] << 16) | ((apr_uint32_t)p[3] << 24);
+}
+
+static apr_uint64_t _archive_get_u64(const unsigned char *p)
+{
+  return (apr_uint64_t)_archive_get_u32(p) | ((apr_uint64_t)_archive_get_u32(p + 4) << 32);
+}
+
+static void _archive_encode_entry(unsigned char *p, mapcache_archive_entry *e)
+{
+  _archive_put_u64(p, e->tile_id);
+  _archive_put_u64(p + 8, e->offset);
+  _archive_put_u32(p + 16, e->length);
+  _archive_put_u32(p + 20, 0);
+}
+
+static void _archive_decode_entry(const unsigned char *p, mapcache_archive_entry *e)
+{
+  e->tile_id = _archive_get_u64(p);
+  e->offset = _archive_get_u64(p + 8);
+  e->length = _archive_get_u32(p + 16);
+  e->seq = 0;
+}
+
+static void _archive_encode_header(unsigned char *p, mapcache_archive_header *h)
+{
+  memset(p, 0, MAPCACHE_ARCHIVE_HEADER_SIZE);
+  memcpy(p, MAPCACHE_ARCHIVE_MAGIC, 8);
+  _archive_put_u32(p + 8, MAPCACHE_ARCHIVE_VERSION);
+  _archive_put_u64(p + 16, h->dir_offset);
+  _archive_put_u64(p + 24, h->dir_entries);
+  _archive_put_u64(p + 32, h->log_offset);
+  _archive_put_u64(p + 40, h->log_end);
+  _archive_put_u64(p + 48, h->log_entries);
+  _archive_put_u64(p + MAPCACHE_ARCHIVE_GENERATION_OFFSET, h->generation);
+}
+
+static int _archive_decode_header(const unsigned char *p, mapcache_archive_header *h)
+{
+  if(memcmp(p, MAPCACHE_ARCHIVE_MAGIC, 8) || _archive_get_u32(p + 8) != MAPCACHE_ARCHIVE_VERSION) {
+    return MAPCACHE_FAILURE;
+  }
+  h->dir_offset = _archive_get_u64(p + 16);
+  h->dir_entries = _archive_get_u64(p + 24);
+  h->log_offset = _archive_get_u64(p + 32);
+  h->log_end = _archive_get_u64(p + 40);
+  h->log_entries = _archive_get_u64(p + 48);
+  h->generation = _archive_get_u64(p + MAPCACHE_ARCHIVE_GENERATION_OFFSET);
+  return MAPCACHE_SUCCESS;
+}
+
+/**
+ * \brief compute the tile id of a tile: the zoom level in the upper 6 bits,
+ * followed by the distance of the tile along a hilbert curve, so that tiles
+ * that are close to each other have close ids
+ */
+static apr_uint64_t _archive_tile_id(mapcache_tile *tile)
+{
+  apr_uint32_t n = 1u << 29;
+  apr_uint32_t x = (apr_uint32_t)tile->x, y = (apr_uint32_t)tile->y;
+  apr_uint32_t s, rx, ry;
+  apr_uint64_t d = 0;
+  for(s = n/2; s > 0; s /= 2) {
+    rx = (x & s) > 0;
+    ry = (y & s) > 0;
+    d += (apr_uint64_t)s * s * ((3 * rx) ^ ry);
+    /* rotate the quadrant */
+    if(ry == 0) {
+      apr_uint32_t t;
+      if(rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return ((apr_uint64_t)tile->z << 58) | d;
+}
+
+static char* _archive_filename(mapcache_context *ctx, mapcache_cache_archive *cache, mapcache_tile *tile)
+{
+  return mapcache_util_get_tile_key(ctx, tile, cache->filename_template, "/.", "#");
+}
+
+static void _archive_scan_log(struct archive_ro_conn *conn, apr_uint64_t pos, apr_uint64_t end)
+{
+  while(pos + MAPCACHE_ARCHIVE_ENTRY_SIZE <= end && pos + MAPCACHE_ARCHIVE_ENTRY_SIZE <= conn->map_size) {
+    mapcache_archive_entry *e = apr_palloc(conn->pool, sizeof(mapcache_archive_entry));
+    _archive_decode_entry(conn->map + pos, e);
+    pos += MAPCACHE_ARCHIVE_ENTRY_SIZE;
+    if(e->length && e->offset == pos) {
+      /* the tile data directly follows the entry */
+      pos += e->length;
+    }
+    apr_hash_set(conn->log, &e->tile_id, sizeof(apr_uint64_t), e);
+  }
+}
+
+/**
+ * \brief (re)create the memory mapping of the archive and parse its header
+ */
+static void _archive_map(mapcache_context *ctx, struct archive_ro_conn *conn, const char *filename)
+{
+  apr_file_t *f;
+  apr_finfo_t finfo;
+  apr_mmap_t *mm;
+  apr_status_t rv;
+
+  apr_pool_clear(conn->map_pool);
+  conn->map = NULL;
+  conn->map_size = 0;
+  if(apr_file_open(&f, filename, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, conn->map_pool) != APR_SUCCESS) {
+    /* most probably the file does not exist, the caller will treat this as a cache miss */
+    ctx->set_error(ctx, 404, "failed to open archive %s", filename);
+    return;
+  }
+  apr_file_info_get(&finfo, APR_FINFO_SIZE|APR_FINFO_MTIME, f);
+  if(finfo.size < MAPCACHE_ARCHIVE_HEADER_SIZE) {
+    ctx->set_error(ctx, 500, "archive %s is truncated", filename);
+    return;
+  }
+  rv = apr_mmap_create(&mm, f, 0, finfo.size, APR_MMAP_READ, conn->map_pool);
+  if(rv != APR_SUCCESS) {
+    char errmsg[120];
+    ctx->set_error(ctx, 500, "failed to mmap archive %s: %s", filename, apr_strerror(rv,errmsg,120));
+    return;
+  }
+  apr_file_close(f);
+  conn->map = mm->mm;
+  conn->map_size = finfo.size;
+  conn->mtime = finfo.mtime;
+  conn->size = finfo.size;
+  if(_archive_decode_header(conn->map, &conn->header) != MAPCACHE_SUCCESS) {
+    ctx->set_error(ctx, 500, "%s is not a mapcache archive", filename);
+    return;
+  }
+  if(conn->header.dir_offset + conn->header.dir_entries * MAPCACHE_ARCHIVE_ENTRY_SIZE > conn->map_size) {
+    ctx->set_error(ctx, 500, "archive %s has a corrupted directory", filename);
+    return;
+  }
+}
+
+static void mapcache_archive_ro_connection_destructor(void *conn_)
+{
+  struct archive_ro_conn *conn = (struct archive_ro_conn*)conn_;
+  apr_pool_destroy(conn->pool);
+  free(conn);
+}
+
+static void mapcache_archive_ro_connection_constructor(mapcache_context *ctx, void **conn_, void *params)
+{
+  struct archive_conn_params *p = (struct archive_conn_params*)params;
+  struct archive_ro_conn *conn = calloc(1, sizeof(struct archive_ro_conn));
+  apr_pool_create(&conn->pool, NULL);
+  apr_pool_create(&conn->map_pool, conn->pool);
+  conn->log = apr_hash_make(conn->pool);
+  _archive_map(ctx, conn, p->filename);
+  if(GC_HAS_ERROR(ctx)) {
+    mapcache_archive_ro_connection_destructor(conn);
+    return;
+  }
+  _archive_scan_log(conn, conn->header.log_offset, conn->header.log_end);
+  *conn_ = conn;
+}
+
+/**
+ * \brief return a read-only connection to the archive containing the given tile
+ *
+ * the connection is refreshed if the archive has been modified since it was mapped:
+ * entries appended to the log are indexed incrementally, whereas a new directory
+ * or a replaced file trigger a full reload.
+ * \returns NULL (and sets an error) if the archive does not exist or is not readable
+ */
+static mapcache_pooled_connection* _archive_get_ro_conn(mapcache_context *ctx, mapcache_cache_archive *cache, mapcache_tile *tile)
+{
+  struct archive_conn_params params;
+  mapcache_pooled_connection *pc;
+  struct archive_ro_conn *conn;
+  apr_finfo_t finfo;
+  mapcache_archive_header prev;
+  char *key;
+
+  params.cache = cache;
+  params.filename = _archive_filename(ctx, cache, tile);
+  key = apr_pstrcat(ctx->pool, "archive_ro_", params.filename, NULL);
+  pc = mapcache_connection_pool_get_connection(ctx, key, mapcache_archive_ro_connection_constructor,
+                                               mapcache_archive_ro_connection_destructor, &params);
+  if(GC_HAS_ERROR(ctx) || !pc) {
+    return NULL;
+  }
+  conn = pc->connection;
+  if(apr_stat(&finfo, params.filename, APR_FINFO_MTIME|APR_FINFO_SIZE, ctx->pool) != APR_SUCCESS) {
+    mapcache_connection_pool_invalidate_connection(ctx, pc);
+    ctx->set_error(ctx, 404, "archive %s has been removed", params.filename);
+    return NULL;
+  }
+  /* the mapping is shared, its header shows the last commit even if the file's
+   * modification time and size haven't changed */
+  if(finfo.mtime == conn->mtime && finfo.size == conn->size &&
+      _archive_get_u64(conn->map + MAPCACHE_ARCHIVE_GENERATION_OFFSET) == conn->header.generation) {
+    return pc;
+  }
+
+  prev = conn->header;
+  _archive_map(ctx, conn, params.filename);
+  if(!GC_HAS_ERROR(ctx) && prev.dir_offset == conn->header.dir_offset &&
+      prev.log_offset == conn->header.log_offset && prev.log_end <= conn->header.log_end) {
+    /* only new log entries have been appended */
+    _archive_scan_log(conn, prev.log_end, conn->header.log_end);
+    return pc;
+  }
+  mapcache_connection_pool_invalidate_connection(ctx, pc);
+  if(GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  pc = mapcache_connection_pool_get_connection(ctx, key, mapcache_archive_ro_connection_constructor,
+                                               mapcache_archive_ro_connection_destructor, &params);
+  if(GC_HAS_ERROR(ctx) || !pc) {
+    return NULL;
+  }
+  return pc;
+}
+
+/**
+ * \brief find the entry of the given tile
+ * \returns MAPCACHE_TRUE if the tile exists in the archive
+ */
+static int _archive_lookup(struct archive_ro_conn *conn, apr_uint64_t tile_id, mapcache_archive_entry *e)
+{
+  mapcache_archive_entry *le = apr_hash_get(conn->log, &tile_id, sizeof(apr_uint64_t));
+  if(le) {
+    *e = *le;
+  } else {
+    const unsigned char *dir = conn->map + conn->header.dir_offset;
+    apr_uint64_t lo = 0, hi = conn->header.dir_entries;
+    e->length = 0;
+    while(lo < hi) {
+      apr_uint64_t mid = lo + (hi - lo) / 2;
+      apr_uint64_t mid_id = _archive_get_u64(dir + mid * MAPCACHE_ARCHIVE_ENTRY_SIZE);
+      if(mid_id == tile_id) {
+        _archive_decode_entry(dir + mid * MAPCACHE_ARCHIVE_ENTRY_SIZE, e);
+        break;
+      } else if(mid_id < tile_id) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+  }
+  if(!e->length || e->offset + e->length > conn->map_size) {
+    return MAPCACHE_FALSE;
+  }
+  return MAPCACHE_TRUE;
+}
+
+static int _mapcache_cache_archive_has_tile(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_archive *cache = (mapcache_cache_archive*)pcache;
+  mapcache_archive_entry e;
+  int ret;
+  mapcache_pooled_connection *pc = _archive_get_ro_conn(ctx, cache, tile);
+  if(!pc) {
+    ctx->clear_errors(ctx);
+    return MAPCACHE_FALSE;
+  }
+  ret = _archive_lookup(pc->connection, _archive_tile_id(tile), &e);
+  mapcache_connection_pool_release_connection(ctx, pc);
+  return ret;
+}
+
+static int _mapcache_cache_archive_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_archive *cache = (mapcache_cache_archive*)pcache;
+  struct archive_ro_conn *conn;
+  mapcache_archive_entry e;
+  mapcache_pooled_connection *pc = _archive_get_ro_conn(ctx, cache, tile);
+  if(!pc) {
+    ctx->clear_errors(ctx);
+    return MAPCACHE_CACHE_MISS;
+  }
+  conn = pc->connection;
+  if(_archive_lookup(conn, _archive_tile_id(tile), &e) != MAPCACHE_TRUE) {
+    mapcache_connection_pool_release_connection(ctx, pc);
+    return MAPCACHE_CACHE_MISS;
+  }
+  /* copy the data out of the mapping, which may be remapped by a subsequent access */
+  tile->encoded_data = mapcache_buffer_create(e.length, ctx->pool);
+  mapcache_buffer_append(tile->encoded_data, e.length, (void*)(conn->map + e.offset));
+  /* archives don't store a per-tile timestamp */
+  tile->mtime = conn->mtime;
+  mapcache_connection_pool_release_connection(ctx, pc);
+  return MAPCACHE_SUCCESS;
+}
+
+static void mapcache_archive_rw_connection_destructor(void *conn_)
+{
+  struct archive_rw_conn *conn = (struct archive_rw_conn*)conn_;
+  apr_pool_destroy(conn->pool);
+  free(conn);
+}
+
+static void mapcache_archive_rw_connection_constructor(mapcache_context *ctx, void **conn_, void *params)
+{
+  struct archive_conn_params *p = (struct archive_conn_params*)params;
+  struct archive_rw_conn *conn;
+  apr_status_t rv;
+
+  mapcache_make_parent_dirs(ctx, p->filename);
+  GC_CHECK_ERROR(ctx);
+  conn = calloc(1, sizeof(struct archive_rw_conn));
+  apr_pool_create(&conn->pool, NULL);
+  rv = apr_file_open(&conn->f, p->filename, APR_FOPEN_READ|APR_FOPEN_WRITE|APR_FOPEN_CREATE|APR_FOPEN_BINARY|APR_FOPEN_BUFFERED,
+                     APR_OS_DEFAULT, conn->pool);
+  if(rv != APR_SUCCESS) {
+    char errmsg[120];
+    ctx->set_error(ctx, 500, "failed to open archive %s for writing: %s", p->filename, apr_strerror(rv,errmsg,120));
+    mapcache_archive_rw_connection_destructor(conn);
+    return;
+  }
+  apr_file_info_get(&conn->finfo, APR_FINFO_IDENT, conn->f);
+  conn->blobs = apr_hash_make(conn->pool);
+  *conn_ = conn;
+}
+
+static mapcache_pooled_connection* _archive_get_rw_conn(mapcache_context *ctx, mapcache_cache_archive *cache, char *filename)
+{
+  struct archive_conn_params params;
+  mapcache_pooled_connection *pc;
+  struct archive_rw_conn *conn;
+  apr_finfo_t finfo;
+  char *key = apr_pstrcat(ctx->pool, "archive_rw_", filename, NULL);
+
+  params.cache = cache;
+  params.filename = filename;
+  pc = mapcache_connection_pool_get_connection(ctx, key, mapcache_archive_rw_connection_constructor,
+                                               mapcache_archive_rw_connection_destructor, &params);
+  if(GC_HAS_ERROR(ctx) || !pc) {
+    return NULL;
+  }
+  conn = pc->connection;
+  if(apr_stat(&finfo, filename, APR_FINFO_IDENT, ctx->pool) != APR_SUCCESS ||
+      finfo.device != conn->finfo.device || finfo.inode != conn->finfo.inode) {
+    /* the archive has been removed or replaced since we opened it */
+    mapcache_connection_pool_invalidate_connection(ctx, pc);
+    pc = mapcache_connection_pool_get_connection(ctx, key, mapcache_archive_rw_connection_constructor,
+                                                 mapcache_archive_rw_connection_destructor, &params);
+    if(GC_HAS_ERROR(ctx) || !pc) {
+      return NULL;
+    }
+  }
+  return pc;
+}
+
+static void _archive_read_at(mapcache_context *ctx, apr_file_t *f, apr_uint64_t pos, void *buf, apr_size_t len)
+{
+  apr_off_t off = pos;
+  apr_size_t bytes;
+  if(apr_file_seek(f, APR_SET, &off) != APR_SUCCESS ||
+      apr_file_read_full(f, buf, len, &bytes) != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "archive: failed to read %d bytes at offset %ld", (int)len, (long)pos);
+  }
+}
+
+static void _archive_write_at(mapcache_context *ctx, apr_file_t *f, apr_uint64_t pos, const void *buf, apr_size_t len)
+{
+  apr_off_t off = pos;
+  apr_size_t bytes;
+  if(apr_file_seek(f, APR_SET, &off) != APR_SUCCESS ||
+      apr_file_write_full(f, buf, len, &bytes) != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "archive: failed to write %d bytes at offset %ld", (int)len, (long)pos);
+  }
+}
+
+static int _archive_entry_cmp(const void *pa, const void *pb)
+{
+  const mapcache_archive_entry *a = pa, *b = pb;
+  if(a->tile_id != b->tile_id) {
+    return (a->tile_id < b->tile_id) ? -1 : 1;
+  }
+  return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+/**
+ * \brief merge the log into the directory, and append the resulting directory to the archive
+ */
+static void _archive_seal(mapcache_context *ctx, apr_file_t *f, mapcache_archive_header *h)
+{
+  mapcache_archive_entry *dir = NULL, *log = NULL, *merged = NULL;
+  unsigned char *buf = NULL;
+  apr_uint64_t i, j, n, nlog = 0, pos;
+
+  dir = malloc((h->dir_entries + 1) * sizeof(mapcache_archive_entry));
+  log = malloc((h->log_entries + 1) * sizeof(mapcache_archive_entry));
+  merged = malloc((h->dir_entries + h->log_entries + 1) * sizeof(mapcache_archive_entry));
+  buf = malloc((h->dir_entries + h->log_entries + 1) * MAPCACHE_ARCHIVE_ENTRY_SIZE);
+  if(!dir || !log || !merged || !buf) {
+    ctx->set_error(ctx, 500, "archive: failed to allocate memory for directory");
+    goto cleanup;
+  }
+
+  if(h->dir_entries) {
+    _archive_read_at(ctx, f, h->dir_offset, buf, h->dir_entries * MAPCACHE_ARCHIVE_ENTRY_SIZE);
+    if(GC_HAS_ERROR(ctx)) goto cleanup;
+    for(i = 0; i < h->dir_entries; i++) {
+      _archive_decode_entry(buf + i * MAPCACHE_ARCHIVE_ENTRY_SIZE, &dir[i]);
+    }
+  }
+
+  pos = h->log_offset;
+  while(pos + MAPCACHE_ARCHIVE_ENTRY_SIZE <= h->log_end && nlog < h->log_entries) {
+    unsigned char raw[MAPCACHE_ARCHIVE_ENTRY_SIZE];
+    _archive_read_at(ctx, f, pos, raw, MAPCACHE_ARCHIVE_ENTRY_SIZE);
+    if(GC_HAS_ERROR(ctx)) goto cleanup;
+    _archive_decode_entry(raw, &log[nlog]);
+    log[nlog].seq = (apr_uint32_t)nlog;
+    pos += MAPCACHE_ARCHIVE_ENTRY_SIZE;
+    if(log[nlog].length && log[nlog].offset == pos) {
+      pos += log[nlog].length;
+    }
+    nlog++;
+  }
+  qsort(log, nlog, sizeof(mapcache_archive_entry), _archive_entry_cmp);
+
+  /* merge: the last log entry for a given tile wins over previous ones and over the directory */
+  i = j = n = 0;
+  while(i < h->dir_entries || j < nlog) {
+    mapcache_archive_entry *e;
+    if(j < nlog && (i == h->dir_entries || log[j].tile_id <= dir[i].tile_id)) {
+      while(j + 1 < nlog && log[j + 1].tile_id == log[j].tile_id) j++;
+      if(i < h->dir_entries && dir[i].tile_id == log[j].tile_id) i++;
+      e = &log[j++];
+    } else {
+      e = &dir[i++];
+    }
+    if(e->length) {
+      merged[n++] = *e;
+    }
+  }
+  for(i = 0; i < n; i++) {
+    _archive_encode_entry(buf + i * MAPCACHE_ARCHIVE_ENTRY_SIZE, &merged[i]);
+  }
+  _archive_write_at(ctx, f, h->log_end, buf, n * MAPCACHE_ARCHIVE_ENTRY_SIZE);
+  if(GC_HAS_ERROR(ctx)) goto cleanup;
+
+  h->dir_offset = h->log_end;
+  h->dir_entries = n;
+  h->log_offset = h->log_end = h->dir_offset + n * MAPCACHE_ARCHIVE_ENTRY_SIZE;
+  h->log_entries = 0;
+
+cleanup:
+  free(dir);
+  free(log);
+  free(merged);
+  free(buf);
+}
+
+/**
+ * \brief append entries to the log of the archive of the given tiles
+ *
+ * tiles with a NULL encoded_data are recorded as deleted
+ */
+static void _archive_append(mapcache_context *ctx, mapcache_cache_archive *cache, mapcache_tile *tiles, int ntiles)
+{
+  mapcache_locker *locker = cache->locker?cache->locker:ctx->config->locker;
+  char *filename = _archive_filename(ctx, cache, &tiles[0]);
+  mapcache_pooled_connection *pc;
+  struct archive_rw_conn *conn;
+  mapcache_archive_header h;
+  unsigned char raw[MAPCACHE_ARCHIVE_HEADER_SIZE];
+  mapcache_buffer *log;
+  apr_finfo_t finfo;
+  void *lock;
+  int i;
+
+  while(mapcache_lock_or_wait_for_resource(ctx, locker, filename, &lock) == MAPCACHE_FALSE);
+  GC_CHECK_ERROR(ctx);
+
+  pc = _archive_get_rw_conn(ctx, cache, filename);
+  if(!pc) {
+    mapcache_unlock_resource(ctx, locker, lock);
+    return;
+  }
+  conn = pc->connection;
+
+  apr_file_info_get(&finfo, APR_FINFO_SIZE, conn->f);
+  if(finfo.size < MAPCACHE_ARCHIVE_HEADER_SIZE) {
+    /* new archive */
+    memset(&h, 0, sizeof(h));
+    h.dir_offset = h.log_offset = h.log_end = MAPCACHE_ARCHIVE_HEADER_SIZE;
+  } else {
+    _archive_read_at(ctx, conn->f, 0, raw, MAPCACHE_ARCHIVE_HEADER_SIZE);
+    if(!GC_HAS_ERROR(ctx) && _archive_decode_header(raw, &h) != MAPCACHE_SUCCESS) {
+      ctx->set_error(ctx, 500, "%s is not a mapcache archive", filename);
+    }
+    if(GC_HAS_ERROR(ctx)) goto cleanup;
+  }
+
+  log = mapcache_buffer_create(ntiles * (MAPCACHE_ARCHIVE_ENTRY_SIZE + 1024), ctx->pool);
+  for(i = 0; i < ntiles; i++) {
+    mapcache_tile *tile = &tiles[i];
+    mapcache_archive_entry e;
+    unsigned char rawentry[MAPCACHE_ARCHIVE_ENTRY_SIZE];
+    mapcache_archive_entry *known = NULL;
+    unsigned char digest[APR_MD5_DIGESTSIZE];
+
+    e.tile_id = _archive_tile_id(tile);
+    e.offset = 0;
+    e.length = 0;
+    if(tile->encoded_data) {
+      e.length = (apr_uint32_t)tile->encoded_data->size;
+      apr_md5(digest, tile->encoded_data->buf, tile->encoded_data->size);
+      known = apr_hash_get(conn->blobs, digest, APR_MD5_DIGESTSIZE);
+      if(known && known->length == e.length) {
+        /* identical content already stored in the archive, only reference it */
+        e.offset = known->offset;
+      } else {
+        e.offset = h.log_end + log->size + MAPCACHE_ARCHIVE_ENTRY_SIZE;
+        if(conn->nblobs < cache->dedup_entries) {
+          unsigned char *key = apr_pmemdup(conn->pool, digest, APR_MD5_DIGESTSIZE);
+          known = apr_pmemdup(conn->pool, &e, sizeof(e));
+          apr_hash_set(conn->blobs, key, APR_MD5_DIGESTSIZE, known);
+          conn->nblobs++;
+        }
+        known = NULL;
+      }
+    }
+    _archive_encode_entry(rawentry, &e);
+    mapcache_buffer_append(log, MAPCACHE_ARCHIVE_ENTRY_SIZE, rawentry);
+    if(tile->encoded_data && !known) {
+      mapcache_buffer_append(log, tile->encoded_data->size, tile->encoded_data->buf);
+    }
+  }
+
+  _archive_write_at(ctx, conn->f, h.log_end, log->buf, log->size);
+  if(GC_HAS_ERROR(ctx)) goto cleanup;
+  h.log_end += log->size;
+  h.log_entries += ntiles;
+
+  if(h.log_entries >= MAPCACHE_MAX(cache->seal_entries, h.dir_entries / 4)) {
+    _archive_seal(ctx, conn->f, &h);
+    if(GC_HAS_ERROR(ctx)) goto cleanup;
+  }
+
+  /* committing the header makes the new entries visible to readers */
+  apr_file_flush(conn->f);
+  h.generation++;
+  _archive_encode_header(raw, &h);
+  _archive_write_at(ctx, conn->f, 0, raw, MAPCACHE_ARCHIVE_HEADER_SIZE);
+  if(!GC_HAS_ERROR(ctx)) {
+    apr_file_flush(conn->f);
+  }
+
+cleanup:
+  if(GC_HAS_ERROR(ctx)) {
+    /* forget the remembered blobs, as they may reference data that was never committed */
+    mapcache_connection_pool_invalidate_connection(ctx, pc);
+  } else {
+    mapcache_connection_pool_release_connection(ctx, pc);
+  }
+  mapcache_unlock_resource(ctx, locker, lock);
+}
+
+static void _mapcache_cache_archive_multi_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tiles, int ntiles)
+{
+  mapcache_cache_archive *cache = (mapcache_cache_archive*)pcache;
+  mapcache_tile *group;
+  char **filenames;
+  char *done;
+  int i, j, ngroup;
+  for(i = 0; i < ntiles; i++) {
+    if(!tiles[i].encoded_data) {
+      tiles[i].encoded_data = tiles[i].tileset->format->write(ctx, tiles[i].raw_image, tiles[i].tileset->format);
+      GC_CHECK_ERROR(ctx);
+    }
+  }
+  if(ntiles == 1) {
+    _archive_append(ctx, cache, tiles, 1);
+    return;
+  }
+
+  /* the filename template may split the tiles over multiple archives: append each archive's tiles at once */
+  filenames = apr_palloc(ctx->pool, ntiles * sizeof(char*));
+  done = apr_pcalloc(ctx->pool, ntiles);
+  group = apr_palloc(ctx->pool, ntiles * sizeof(mapcache_tile));
+  for(i = 0; i < ntiles; i++) {
+    filenames[i] = _archive_filename(ctx, cache, &tiles[i]);
+  }
+  for(i = 0; i < ntiles; i++) {
+    if(done[i]) continue;
+    ngroup = 0;
+    for(j = i; j < ntiles; j++) {
+      if(!done[j] && !strcmp(filenames[i], filenames[j])) {
+        group[ngroup++] = tiles[j];
+        done[j] = 1;
+      }
+    }
+    _archive_append(ctx, cache, group, ngroup);
+    GC_CHECK_ERROR(ctx);
+  }
+}
+
+static void _mapcache_cache_archive_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  _mapcache_cache_archive_multi_set(ctx, pcache, tile, 1);
+}
+
+static void _mapcache_cache_archive_delete(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_archive *cache = (mapcache_cache_archive*)pcache;
+  mapcache_tile deleted = *tile;
+  if(_mapcache_cache_archive_has_tile(ctx, pcache, tile) != MAPCACHE_TRUE) {
+    return;
+  }
+  deleted.encoded_data = NULL;
+  _archive_append(ctx, cache, &deleted, 1);
+}
+
+/**
+ * \private \memberof mapcache_cache_archive
+ */
+static void _mapcache_cache_archive_configuration_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_cache *pcache, mapcache_cfg *config)
+{
+  ezxml_t cur_node;
+  mapcache_cache_archive *cache = (mapcache_cache_archive*)pcache;
+
+  if ((cur_node = ezxml_child(node,"filename")) != NULL) {
+    cache->filename_template = apr_pstrdup(ctx->pool,cur_node->txt);
+  }
+  if ((cur_node = ezxml_child(node,"seal_entries")) != NULL) {
+    char *endptr;
+    cache->seal_entries = (int)strtol(cur_node->txt,&endptr,10);
+    if(*endptr != 0 || cache->seal_entries < 1) {
+      ctx->set_error(ctx,400,"invalid <seal_entries> \"%s\" for archive cache %s (positive integer expected)",
+                     cur_node->txt, pcache->name);
+      return;
+    }
+  }
+  if ((cur_node = ezxml_child(node,"dedup_entries")) != NULL) {
+    char *endptr;
+    cache->dedup_entries = (int)strtol(cur_node->txt,&endptr,10);
+    if(*endptr != 0 || cache->dedup_entries < 0) {
+      ctx->set_error(ctx,400,"invalid <dedup_entries> \"%s\" for archive cache %s (positive integer expected)",
+                     cur_node->txt, pcache->name);
+      return;
+    }
+  }
+  cur_node = ezxml_child(node,"locker");
+  if(cur_node) {
+    mapcache_config_parse_locker(ctx, cur_node, &cache->locker);
+  }
+}
+
+/**
+ * \private \memberof mapcache_cache_archive
+ */
+static void _mapcache_cache_archive_configuration_post_config(mapcache_context *ctx, mapcache_cache *pcache,
+    mapcache_cfg *cfg)
+{
+  mapcache_cache_archive *cache = (mapcache_cache_archive*)pcache;
+  if(!cache->filename_template || !strlen(cache->filename_template)) {
+    ctx->set_error(ctx, 400, "archive cache %s has no <filename>", pcache->name);
+    return;
+  }
+}
+
+/**
+ * \brief creates and initializes a mapcache_cache_archive
+ */
+mapcache_cache* mapcache_cache_archive_create(mapcache_context *ctx)
+{
+  mapcache_cache_archive *cache = apr_pcalloc(ctx->pool,sizeof(mapcache_cache_archive));
+  if(!cache) {
+    ctx->set_error(ctx, 500, "failed to allocate archive cache");
+    return NULL;
+  }
+  cache->cache.metadata = apr_table_make(ctx->pool,3);
+  cache->cache.type = MAPCACHE_CACHE_ARCHIVE;
+  cache->cache._tile_delete = _mapcache_cache_archive_delete;
+  cache->cache._tile_get = _mapcache_cache_archive_get;
+  cache->cache._tile_exists = _mapcache_cache_archive_has_tile;
+  cache->cache._tile_set = _mapcache_cache_archive_set;
+  cache->cache._tile_multi_set = _mapcache_cache_archive_multi_set;
+  cache->cache.configuration_post_config = _mapcache_cache_archive_configuration_post_config;
+  cache->cache.configuration_parse_xml = _mapcache_cache_archive_configuration_parse_xml;
+  cache->seal_entries = 65536;
+  cache->dedup_entries = 4096;
+  return (mapcache_cache*)cache;
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
@@ -222,13 +222,17 @@ static int _mapcache_cache_bdb_get(mapcache_context *ctx, mapcache_cache *pcache
 
   if(ret == 0) {
     if(((char*)(data.data))[0] == '#') {
-      tile->encoded_data = mapcache_empty_png_decode(ctx,tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy, (unsigned char*)data.data,&tile->nodata);
+      tile->encoded_data = mapcache_uniform_tile_decode(ctx,tile,(unsigned char*)data.data);
     } else {
       tile->encoded_data = mapcache_buffer_create(0,ctx->pool);
       tile->encoded_data->buf = data.data;
       tile->encoded_data->size = data.size-sizeof(apr_time_t);
       tile->encoded_data->avail = data.size;
       apr_pool_cleanup_register(ctx->pool, tile->encoded_data->buf,(void*)free, apr_pool_cleanup_null);
+      if(tile->grid_link->grid->tile_sx == 256 && tile->grid_link->grid->tile_sy == 256) {
+        /* it would have been stored as a marker if it were uniform */
+        tile->nonuniform_data = tile->encoded_data;
+      }
     }
     tile->mtime = *((apr_time_t*)(((char*)data.data)+data.size-sizeof(apr_time_t)));
     ret = MAPCACHE_SUCCESS;
@@ -252,19 +256,19 @@ static void _mapcache_cache_bdb_set(mapcache_context *ctx, mapcache_cache *pcach
   char *skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
   mapcache_pooled_connection *pc;
   struct bdb_env *benv;
-  now = apr_time_now();
+  now = (tile->keep_mtime && tile->mtime)?tile->mtime:apr_time_now();
   memset(&key, 0, sizeof(DBT));
   memset(&data, 0, sizeof(DBT));
 
   key.data = skey;
   key.size = strlen(skey)+1;
 
-  if(!tile->raw_image) {
+  if(!tile->raw_image && !mapcache_tile_is_nonuniform(tile)) {
     tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
     GC_CHECK_ERROR(ctx);
   }
 
-  if(tile->raw_image->h==256 && tile->raw_image->w==256 && mapcache_image_blank_color(tile->raw_image) != MAPCACHE_FALSE) {
+  if(tile->raw_image && tile->raw_image->h==256 && tile->raw_image->w==256 && mapcache_image_blank_color(tile->raw_image) != MAPCACHE_FALSE) {
     data.size = 5+sizeof(apr_time_t);
     data.data = apr_palloc(ctx->pool,data.size);
     (((char*)data.data)[0])='#';
@@ -305,7 +309,6 @@ static void _mapcache_cache_bdb_multiset(mapcache_context *ctx, mapcache_cache *
   mapcache_cache_bdb *cache = (mapcache_cache_bdb*)pcache;
   mapcache_pooled_connection *pc;
   struct bdb_env *benv;
-  now = apr_time_now();
   memset(&key, 0, sizeof(DBT));
   memset(&data, 0, sizeof(DBT));
 
@@ -319,15 +322,16 @@ static void _mapcache_cache_bdb_multiset(mapcache_context *ctx, mapcache_cache *
     memset(&key, 0, sizeof(DBT));
     memset(&data, 0, sizeof(DBT));
     tile = &tiles[i];
+    now = (tile->keep_mtime && tile->mtime)?tile->mtime:apr_time_now();
     skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
-    if(!tile->raw_image) {
+    if(!tile->raw_image && !mapcache_tile_is_nonuniform(tile)) {
       tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
       if(GC_HAS_ERROR(ctx)) {
         _bdb_release_conn(ctx,cache,&tiles[0],pc);
         return;
       }
     }
-    if(tile->raw_image->h==256 && tile->raw_image->w==256 && mapcache_image_blank_color(tile->raw_image) != MAPCACHE_FALSE) {
+    if(tile->raw_image && tile->raw_image->h==256 && tile->raw_image->w==256 && mapcache_image_blank_color(tile->raw_image) != MAPCACHE_FALSE) {
       data.size = 5+sizeof(apr_time_t);
       data.data = apr_palloc(ctx->pool,data.size);
       (((char*)data.data)[0])='#';
@@ -0,0 +1,460 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching: content addressed (deduplicating) cache
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+ * The dedup cache wraps another (index) cache: instead of the tile data, the
+ * index cache stores a small record containing the sha256 of the tile data.
+ * The data itself is stored once per distinct content in a blob directory,
+ * along with the number of index records that reference it. Storing a tile
+ * whose content is already known only updates the index and a reference count.
+ * The reference counts are updated once per distinct content of a batch of
+ * tiles (e.g. a metatile), as uniform tiles tend to share the same content.
+ *
+ * Tiles read from the index cache that are not dedup records (e.g. tiles that
+ * were stored before the index cache was wrapped) are returned as is.
+ */
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_file_info.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define MAPCACHE_DEDUP_MAGIC "MCDEDUP1"
+#define MAPCACHE_DEDUP_MAGIC_SIZE 8
+#define MAPCACHE_DEDUP_DIGEST_SIZE 32
+#define MAPCACHE_DEDUP_RECORD_SIZE (MAPCACHE_DEDUP_MAGIC_SIZE + MAPCACHE_DEDUP_DIGEST_SIZE)
+
+typedef struct mapcache_cache_dedup mapcache_cache_dedup;
+
+struct mapcache_cache_dedup {
+  mapcache_cache cache;
+  mapcache_cache *index; /**< the cache storing the tile to content hash records */
+  char *blob_dir; /**< the directory storing the content */
+  mapcache_locker *locker;
+};
+
+/**
+ * \brief extract the digest from an index record
+ * \returns MAPCACHE_FALSE if the buffer is not a dedup record
+ */
+static int _dedup_record_digest(mapcache_buffer *record, unsigned char *digest)
+{
+  if(!record || record->size != MAPCACHE_DEDUP_RECORD_SIZE ||
+      memcmp(record->buf, MAPCACHE_DEDUP_MAGIC, MAPCACHE_DEDUP_MAGIC_SIZE)) {
+    return MAPCACHE_FALSE;
+  }
+  memcpy(digest, (unsigned char*)record->buf + MAPCACHE_DEDUP_MAGIC_SIZE, MAPCACHE_DEDUP_DIGEST_SIZE);
+  return MAPCACHE_TRUE;
+}
+
+static mapcache_buffer* _dedup_record_create(mapcache_context *ctx, unsigned char *digest)
+{
+  mapcache_buffer *record = mapcache_buffer_create(MAPCACHE_DEDUP_RECORD_SIZE, ctx->pool);
+  mapcache_buffer_append(record, MAPCACHE_DEDUP_MAGIC_SIZE, MAPCACHE_DEDUP_MAGIC);
+  mapcache_buffer_append(record, MAPCACHE_DEDUP_DIGEST_SIZE, digest);
+  return record;
+}
+
+static char* _dedup_hex(mapcache_context *ctx, unsigned char *digest)
+{
+  unsigned char *hex = apr_pcalloc(ctx->pool, MAPCACHE_DEDUP_DIGEST_SIZE * 2 + 1);
+  memcpy(hex, digest, MAPCACHE_DEDUP_DIGEST_SIZE);
+  sha_hex_encode(hex, MAPCACHE_DEDUP_DIGEST_SIZE);
+  return (char*)hex;
+}
+
+/**
+ * \brief the location of a blob: blob_dir/ab/cd/abcd....
+ */
+static char* _dedup_blob_filename(mapcache_context *ctx, mapcache_cache_dedup *cache, char *hex)
+{
+  return apr_psprintf(ctx->pool, "%s/%.2s/%.2s/%s", cache->blob_dir, hex, hex + 2, hex);
+}
+
+static int _dedup_read_refcount(mapcache_context *ctx, char *refname)
+{
+  apr_file_t *f;
+  char buf[32];
+  apr_size_t bytes = sizeof(buf) - 1;
+  if(apr_file_open(&f, refname, APR_FOPEN_READ, APR_OS_DEFAULT, ctx->pool) != APR_SUCCESS) {
+    return 0;
+  }
+  if(apr_file_read(f, buf, &bytes) != APR_SUCCESS) {
+    bytes = 0;
+  }
+  apr_file_close(f);
+  buf[bytes] = 0;
+  return atoi(buf);
+}
+
+static void _dedup_write_file(mapcache_context *ctx, char *filename, const void *data, apr_size_t size)
+{
+  apr_file_t *f;
+  apr_status_t ret;
+  apr_size_t bytes;
+  char errmsg[120];
+  /* write to a temporary file first so that readers never see a partial file */
+  char *tmpname = apr_psprintf(ctx->pool, "%s.XXXXXX", filename);
+
+  ret = apr_file_mktemp(&f, tmpname, APR_FOPEN_CREATE|APR_FOPEN_WRITE|APR_FOPEN_EXCL|APR_FOPEN_BINARY, ctx->pool);
+  if(ret != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "failed to create file %s: %s", tmpname, apr_strerror(ret,errmsg,120));
+    return;
+  }
+  ret = apr_file_write_full(f, data, size, &bytes);
+  apr_file_close(f);
+  if(ret != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "failed to write data to file %s: %s", tmpname, apr_strerror(ret,errmsg,120));
+    apr_file_remove(tmpname, ctx->pool);
+    return;
+  }
+  ret = apr_file_rename(tmpname, filename, ctx->pool);
+  if(ret != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "failed to rename %s to %s: %s", tmpname, filename, apr_strerror(ret,errmsg,120));
+    apr_file_remove(tmpname, ctx->pool);
+  }
+}
+
+/**
+ * \brief add nrefs references to the given content, storing it if it is not known yet
+ *
+ * fails if a different content is already stored under the same digest: it is
+ * referenced by other tiles and must not be overwritten.
+ */
+static void _dedup_blob_ref(mapcache_context *ctx, mapcache_cache_dedup *cache, unsigned char *digest, mapcache_buffer *data, int nrefs)
+{
+  mapcache_locker *locker = cache->locker?cache->locker:ctx->config->locker;
+  char *hex = _dedup_hex(ctx, digest);
+  char *blobname = _dedup_blob_filename(ctx, cache, hex);
+  char *refname = apr_pstrcat(ctx->pool, blobname, ".refs", NULL);
+  char *refs;
+  apr_finfo_t finfo;
+  void *lock;
+  int count;
+
+  while(mapcache_lock_or_wait_for_resource(ctx, locker, apr_pstrcat(ctx->pool, "dedup_", hex, NULL), &lock) == MAPCACHE_FALSE);
+  GC_CHECK_ERROR(ctx);
+
+  if(apr_stat(&finfo, blobname, APR_FINFO_SIZE, ctx->pool) == APR_SUCCESS) {
+    if(finfo.size != data->size) {
+      ctx->set_error(ctx, 500, "dedup cache %s: content file %s (%d bytes) does not match a %d bytes tile with the same digest",
+                     cache->cache.name, blobname, (int)finfo.size, (int)data->size);
+    }
+  } else {
+    /* a missing blob whose references are still counted is restored as well */
+    mapcache_make_parent_dirs(ctx, blobname);
+    if(!GC_HAS_ERROR(ctx)) {
+      _dedup_write_file(ctx, blobname, data->buf, data->size);
+    }
+  }
+  if(!GC_HAS_ERROR(ctx)) {
+    count = _dedup_read_refcount(ctx, refname);
+    refs = apr_psprintf(ctx->pool, "%d", count + nrefs);
+    _dedup_write_file(ctx, refname, refs, strlen(refs));
+  }
+  mapcache_unlock_resource(ctx, locker, lock);
+}
+
+/**
+ * \brief remove nrefs references to the given content, deleting it if it is not referenced anymore
+ */
+static void _dedup_blob_unref(mapcache_context *ctx, mapcache_cache_dedup *cache, unsigned char *digest, int nrefs)
+{
+  mapcache_locker *locker = cache->locker?cache->locker:ctx->config->locker;
+  char *hex = _dedup_hex(ctx, digest);
+  char *blobname = _dedup_blob_filename(ctx, cache, hex);
+  char *refname = apr_pstrcat(ctx->pool, blobname, ".refs", NULL);
+  char *refs;
+  void *lock;
+  int count;
+
+  while(mapcache_lock_or_wait_for_resource(ctx, locker, apr_pstrcat(ctx->pool, "dedup_", hex, NULL), &lock) == MAPCACHE_FALSE);
+  GC_CHECK_ERROR(ctx);
+
+  count = _dedup_read_refcount(ctx, refname);
+  if(count <= nrefs) {
+    apr_file_remove(blobname, ctx->pool);
+    apr_file_remove(refname, ctx->pool);
+  } else {
+    refs = apr_psprintf(ctx->pool, "%d", count - nrefs);
+    _dedup_write_file(ctx, refname, refs, strlen(refs));
+  }
+  mapcache_unlock_resource(ctx, locker, lock);
+}
+
+/**
+ * \brief group the selected digests of a batch, so that each distinct content is
+ * locked and has its reference count rewritten once per batch
+ * \returns the number of selected digests equal to the i-th one, or 0 if the i-th
+ * digest isn't selected or if it was already counted with a previous one
+ */
+static int _dedup_group_size(unsigned char *digests, int *selected, int ntiles, int i)
+{
+  int k, n = 1;
+  if(!selected[i]) {
+    return 0;
+  }
+  for(k = 0; k < ntiles; k++) {
+    if(k == i || !selected[k] ||
+        memcmp(digests + k * MAPCACHE_DEDUP_DIGEST_SIZE, digests + i * MAPCACHE_DEDUP_DIGEST_SIZE, MAPCACHE_DEDUP_DIGEST_SIZE)) {
+      continue;
+    }
+    if(k < i) {
+      return 0;
+    }
+    n++;
+  }
+  return n;
+}
+
+/**
+ * \brief fetch the digest currently referenced by the index for the given tile
+ * \returns MAPCACHE_FALSE if the tile isn't indexed or isn't a dedup record
+ */
+static int _dedup_index_digest(mapcache_context *ctx, mapcache_cache_dedup *cache, mapcache_tile *tile, unsigned char *digest)
+{
+  mapcache_tile indexed = *tile;
+  int ret;
+  indexed.encoded_data = NULL;
+  indexed.raw_image = NULL;
+  ret = mapcache_cache_tile_get(ctx, cache->index, &indexed);
+  if(GC_HAS_ERROR(ctx)) {
+    return MAPCACHE_FALSE;
+  }
+  if(ret != MAPCACHE_SUCCESS) {
+    return MAPCACHE_FALSE;
+  }
+  return _dedup_record_digest(indexed.encoded_data, digest);
+}
+
+static int _mapcache_cache_dedup_tile_exists(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_dedup *cache = (mapcache_cache_dedup*)pcache;
+  return mapcache_cache_tile_exists(ctx, cache->index, tile);
+}
+
+/**
+ * \brief get content of given tile
+ *
+ * resolves the index record of the tile and fills mapcache_tile::encoded_data with the referenced content
+ * \private \memberof mapcache_cache_dedup
+ * \sa mapcache_cache::tile_get()
+ */
+static int _mapcache_cache_dedup_tile_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_dedup *cache = (mapcache_cache_dedup*)pcache;
+  unsigned char digest[MAPCACHE_DEDUP_DIGEST_SIZE];
+  char *blobname;
+  apr_file_t *f;
+  apr_finfo_t finfo;
+  apr_size_t bytes;
+  apr_status_t rv;
+  int ret;
+
+  ret = mapcache_cache_tile_get(ctx, cache->index, tile);
+  if(ret != MAPCACHE_SUCCESS || GC_HAS_ERROR(ctx)) {
+    return ret;
+  }
+  if(_dedup_record_digest(tile->encoded_data, digest) != MAPCACHE_TRUE) {
+    /* not stored through this cache, return the tile data unchanged */
+    return MAPCACHE_SUCCESS;
+  }
+  tile->encoded_data = NULL;
+  blobname = _dedup_blob_filename(ctx, cache, _dedup_hex(ctx, digest));
+  if(apr_file_open(&f, blobname, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, ctx->pool) != APR_SUCCESS) {
+    ctx->log(ctx, MAPCACHE_WARN, "dedup cache %s: tile (%s,z=%d,y=%d,x=%d) references missing content %s",
+             pcache->name, tile->tileset->name, tile->z, tile->y, tile->x, blobname);
+    return MAPCACHE_CACHE_MISS;
+  }
+  apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+  tile->encoded_data = mapcache_buffer_create(finfo.size, ctx->pool);
+  rv = apr_file_read_full(f, tile->encoded_data->buf, finfo.size, &bytes);
+  apr_file_close(f);
+  if(rv != APR_SUCCESS) {
+    char errmsg[120];
+    ctx->set_error(ctx, 500, "failed to read content file %s: %s", blobname, apr_strerror(rv,errmsg,120));
+    return MAPCACHE_FAILURE;
+  }
+  tile->encoded_data->size = bytes;
+  return MAPCACHE_SUCCESS;
+}
+
+static void _mapcache_cache_dedup_tile_delete(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_dedup *cache = (mapcache_cache_dedup*)pcache;
+  unsigned char digest[MAPCACHE_DEDUP_DIGEST_SIZE];
+  int indexed = _dedup_index_digest(ctx, cache, tile, digest);
+  GC_CHECK_ERROR(ctx);
+  mapcache_cache_tile_delete(ctx, cache->index, tile);
+  GC_CHECK_ERROR(ctx);
+  if(indexed == MAPCACHE_TRUE) {
+    _dedup_blob_unref(ctx, cache, digest, 1);
+  }
+}
+
+static void _mapcache_cache_dedup_tile_multi_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tiles, int ntiles)
+{
+  mapcache_cache_dedup *cache = (mapcache_cache_dedup*)pcache;
+  mapcache_tile *records = apr_palloc(ctx->pool, ntiles * sizeof(mapcache_tile));
+  unsigned char *digests = apr_palloc(ctx->pool, ntiles * MAPCACHE_DEDUP_DIGEST_SIZE);
+  unsigned char *previous = apr_palloc(ctx->pool, ntiles * MAPCACHE_DEDUP_DIGEST_SIZE);
+  int *stores = apr_pcalloc(ctx->pool, ntiles * sizeof(int)); /* the tile references a new content */
+  int *replaces = apr_pcalloc(ctx->pool, ntiles * sizeof(int)); /* the tile referenced another content */
+  int *nrefs = apr_pcalloc(ctx->pool, ntiles * sizeof(int)); /* the references taken, per group */
+  int i, nrecords = 0;
+
+  for(i = 0; i < ntiles; i++) {
+    mapcache_tile *tile = &tiles[i];
+    unsigned char *digest = digests + i * MAPCACHE_DEDUP_DIGEST_SIZE;
+    if(!tile->encoded_data) {
+      tile->encoded_data = tile->tileset->format->write(ctx, tile->raw_image, tile->tileset->format);
+      GC_CHECK_ERROR(ctx);
+    }
+    sha256(tile->encoded_data->buf, (unsigned int)tile->encoded_data->size, digest);
+
+    replaces[i] = (_dedup_index_digest(ctx, cache, tile, previous + i * MAPCACHE_DEDUP_DIGEST_SIZE) == MAPCACHE_TRUE);
+    GC_CHECK_ERROR(ctx);
+    if(replaces[i] && !memcmp(previous + i * MAPCACHE_DEDUP_DIGEST_SIZE, digest, MAPCACHE_DEDUP_DIGEST_SIZE)) {
+      /* the tile already references the same content, nothing to do */
+      replaces[i] = 0;
+      continue;
+    }
+    stores[i] = 1;
+    records[nrecords] = *tile;
+    records[nrecords].raw_image = NULL;
+    records[nrecords].encoded_data = _dedup_record_create(ctx, digest);
+    nrecords++;
+  }
+
+  for(i = 0; i < ntiles; i++) {
+    int n = _dedup_group_size(digests, stores, ntiles, i);
+    if(n) {
+      _dedup_blob_ref(ctx, cache, digests + i * MAPCACHE_DEDUP_DIGEST_SIZE, tiles[i].encoded_data, n);
+      if(GC_HAS_ERROR(ctx)) break;
+      nrefs[i] = n;
+    }
+  }
+  if(!GC_HAS_ERROR(ctx) && nrecords) {
+    mapcache_cache_tile_multi_set(ctx, cache->index, records, nrecords);
+  }
+  if(GC_HAS_ERROR(ctx)) {
+    /* the index wasn't updated, release the references we just took */
+    char *msg = ctx->get_error_message(ctx);
+    int code = ctx->get_error(ctx);
+    ctx->clear_errors(ctx);
+    for(i = 0; i < ntiles; i++) {
+      if(nrefs[i]) {
+        _dedup_blob_unref(ctx, cache, digests + i * MAPCACHE_DEDUP_DIGEST_SIZE, nrefs[i]);
+        ctx->clear_errors(ctx);
+      }
+    }
+    ctx->set_error(ctx, code, "%s", msg);
+    return;
+  }
+
+  for(i = 0; i < ntiles; i++) {
+    int n = _dedup_group_size(previous, replaces, ntiles, i);
+    if(n) {
+      _dedup_blob_unref(ctx, cache, previous + i * MAPCACHE_DEDUP_DIGEST_SIZE, n);
+      GC_CHECK_ERROR(ctx);
+    }
+  }
+}
+
+static void _mapcache_cache_dedup_tile_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  _mapcache_cache_dedup_tile_multi_set(ctx, pcache, tile, 1);
+}
+
+/**
+ * \private \memberof mapcache_cache_dedup
+ */
+static void _mapcache_cache_dedup_configuration_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_cache *pcache, mapcache_cfg *config)
+{
+  ezxml_t cur_node;
+  mapcache_cache_dedup *cache = (mapcache_cache_dedup*)pcache;
+  if ((cur_node = ezxml_child(node,"cache")) != NULL) {
+    cache->index = mapcache_configuration_get_cache(config, cur_node->txt);
+    if(!cache->index) {
+      ctx->set_error(ctx, 400, "dedup cache \"%s\" references cache \"%s\","
+                     " but it is not configured (hint:referenced caches must be declared before this dedup cache in the xml file)", pcache->name, cur_node->txt);
+      return;
+    }
+  }
+  if ((cur_node = ezxml_child(node,"blobs")) != NULL) {
+    cache->blob_dir = apr_pstrdup(ctx->pool, cur_node->txt);
+  }
+  cur_node = ezxml_child(node,"locker");
+  if(cur_node) {
+    mapcache_config_parse_locker(ctx, cur_node, &cache->locker);
+  }
+}
+
+/**
+ * \private \memberof mapcache_cache_dedup
+ */
+static void _mapcache_cache_dedup_configuration_post_config(mapcache_context *ctx, mapcache_cache *pcache,
+    mapcache_cfg *cfg)
+{
+  mapcache_cache_dedup *cache = (mapcache_cache_dedup*)pcache;
+  if(!cache->index) {
+    ctx->set_error(ctx, 400, "dedup cache \"%s\" does not reference an index <cache>", pcache->name);
+    return;
+  }
+  if(!cache->blob_dir || !strlen(cache->blob_dir)) {
+    ctx->set_error(ctx, 400, "dedup cache \"%s\" has no <blobs> directory", pcache->name);
+    return;
+  }
+}
+
+/**
+ * \brief creates and initializes a mapcache_cache_dedup
+ */
+mapcache_cache* mapcache_cache_dedup_create(mapcache_context *ctx)
+{
+  mapcache_cache_dedup *cache = apr_pcalloc(ctx->pool,sizeof(mapcache_cache_dedup));
+  if(!cache) {
+    ctx->set_error(ctx, 500, "failed to allocate dedup cache");
+    return NULL;
+  }
+  cache->cache.metadata = apr_table_make(ctx->pool,3);
+  cache->cache.type = MAPCACHE_CACHE_DEDUP;
+  cache->cache._tile_delete = _mapcache_cache_dedup_tile_delete;
+  cache->cache._tile_get = _mapcache_cache_dedup_tile_get;
+  cache->cache._tile_exists = _mapcache_cache_dedup_tile_exists;
+  cache->cache._tile_set = _mapcache_cache_dedup_tile_set;
+  cache->cache._tile_multi_set = _mapcache_cache_dedup_tile_multi_set;
+  cache->cache.configuration_post_config = _mapcache_cache_dedup_configuration_post_config;
+  cache->cache.configuration_parse_xml = _mapcache_cache_dedup_configuration_parse_xml;
+  return (mapcache_cache*)cache;
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
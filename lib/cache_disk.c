@@ -507,7 +507,7 @@ static void _mapcache_cache_disk_set(mapcache_context *ctx, mapcache_cache *pcac
 
   cache->tile_key(ctx, cache, tile, &filename);
   GC_CHECK_ERROR(ctx);
-  if ( cache->detect_blank ) {
+  if ( cache->detect_blank && !mapcache_tile_is_nonuniform(tile) ) {
     if(!tile->raw_image) {
       tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
       GC_CHECK_ERROR(ctx);
@@ -533,7 +533,7 @@ static void _mapcache_cache_disk_set(mapcache_context *ctx, mapcache_cache *pcac
   }
 
 #ifdef HAVE_SYMLINK
-  if(cache->symlink_blank) {
+  if(cache->symlink_blank && !mapcache_tile_is_nonuniform(tile)) {
     if(tile->tileset->format->type != GC_RAW && !tile->raw_image) {
       tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
       GC_CHECK_ERROR(ctx);
@@ -667,8 +667,15 @@ static void _mapcache_cache_disk_set(mapcache_context *ctx, mapcache_cache *pcac
   if(bytes != tile->encoded_data->size) {
     ctx->set_error(ctx, 500, "failed to write image data to %s, wrote %d of %d bytes", filename, (int)bytes, (int)tile->encoded_data->size);
     apr_file_remove(filename, ctx->pool);
+    return;
   }
 
+  if(tile->keep_mtime && tile->mtime) {
+    ret = apr_file_mtime_set(filename, tile->mtime, ctx->pool);
+    if(ret != APR_SUCCESS) {
+      ctx->log(ctx, MAPCACHE_WARN, "failed to set modification time of %s: %s", filename, apr_strerror(ret,errmsg,120));
+    }
+  }
 }
 
 /**
@@ -209,9 +209,12 @@ static int _mapcache_cache_memcache_get(mapcache_context *ctx, mapcache_cache *p
   encoded_data->avail = encoded_data->size;
   encoded_data->size -= sizeof(apr_time_t);
   if(((char*)encoded_data->buf)[0] == '#' && encoded_data->size > 1) {
-    tile->encoded_data = mapcache_empty_png_decode(ctx,tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy ,encoded_data->buf,&tile->nodata);
+    tile->encoded_data = mapcache_uniform_tile_decode(ctx,tile,encoded_data->buf);
   } else {
     tile->encoded_data = encoded_data;
+    if(cache->detect_blank) {
+      tile->nonuniform_data = encoded_data;
+    }
   }
   rv = MAPCACHE_SUCCESS;
   
@@ -250,7 +253,7 @@ static void _mapcache_cache_memcache_set(mapcache_context *ctx, mapcache_cache *
   if(tile->tileset->auto_expire)
     expires = tile->tileset->auto_expire;
 
-  if(cache->detect_blank) {
+  if(cache->detect_blank && !mapcache_tile_is_nonuniform(tile)) {
     if(!tile->raw_image) {
       tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
       GC_CHECK_ERROR(ctx);
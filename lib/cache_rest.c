@@ -58,14 +58,12 @@ typedef enum {
   MAPCACHE_REST_PROVIDER_GOOGLE
 } mapcache_rest_provider;
 
-void sha256(const unsigned char *message, unsigned int len, unsigned char *digest);
 void hmac_sha256(const unsigned char *message, unsigned int message_len,
           const unsigned char *key, unsigned int key_size,
           unsigned char *mac, unsigned mac_size);
 void hmac_sha1(const char *message, unsigned int message_len,
           const unsigned char *key, unsigned int key_size,
           void *mac);
-void sha_hex_encode(unsigned char *sha, unsigned int sha_size);
 char *base64_encode(apr_pool_t *pool, const unsigned char *data, size_t input_length);
 
 typedef struct mapcache_rest_operation mapcache_rest_operation;
@@ -1186,6 +1184,8 @@ static void _mapcache_cache_rest_set(mapcache_context *ctx, mapcache_cache *pcac
       apr_table_set(headers, "Content-Type", "image/jpeg");
     } else if (imgfmt == GC_PNG) {
       apr_table_set(headers, "Content-Type", "image/png");
+    } else if (imgfmt == GC_WEBP) {
+      apr_table_set(headers, "Content-Type", "image/webp");
     }
   }
 
@@ -361,11 +361,16 @@ static void _bind_sqlite_params(mapcache_context *ctx, void *vstmt, mapcache_cac
   paramidx = sqlite3_bind_parameter_index(stmt, ":tileset");
   if (paramidx) sqlite3_bind_text(stmt, paramidx, tile->tileset->name, -1, SQLITE_STATIC);
 
+  /* modification time, in seconds since the epoch */
+  paramidx = sqlite3_bind_parameter_index(stmt, ":mtime");
+  if (paramidx) sqlite3_bind_int64(stmt, paramidx,
+                                     apr_time_sec((tile->keep_mtime && tile->mtime)?tile->mtime:apr_time_now()));
+
   /* tile blob data */
   paramidx = sqlite3_bind_parameter_index(stmt, ":data");
   if (paramidx) {
     int written = 0;
-    if(cache->detect_blank) {
+    if(cache->detect_blank && !mapcache_tile_is_nonuniform(tile)) {
       if(!tile->raw_image) {
         tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
         GC_CHECK_ERROR(ctx);
@@ -430,7 +435,13 @@ static void _bind_mbtiles_params(mapcache_context *ctx, void *vstmt, mapcache_ca
   paramidx = sqlite3_bind_parameter_index(stmt, ":data");
   if (paramidx) {
     if (!tile->encoded_data) {
-      tile->encoded_data = tile->tileset->format->write(ctx, tile->raw_image, tile->tileset->format);
+      if(tile->raw_image->is_blank == MC_EMPTY_YES) {
+        /* blank tiles are stored once per color, reuse the shared encoding of the color */
+        tile->encoded_data = mapcache_uniform_tile_encode(ctx, tile->tileset->format,
+                             tile->raw_image->w, tile->raw_image->h, tile->raw_image->data);
+      } else {
+        tile->encoded_data = tile->tileset->format->write(ctx, tile->raw_image, tile->tileset->format);
+      }
       GC_CHECK_ERROR(ctx);
     }
     if (tile->encoded_data && tile->encoded_data->size) {
@@ -597,11 +608,11 @@ static void _single_mbtile_set(mapcache_context *ctx, mapcache_cache_sqlite *cac
 {
   sqlite3_stmt *stmt1,*stmt2;
   int ret;
-  if(!tile->raw_image) {
+  if(!tile->raw_image && !mapcache_tile_is_nonuniform(tile)) {
     tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
     GC_CHECK_ERROR(ctx);
   }
-  if(mapcache_image_blank_color(tile->raw_image) != MAPCACHE_FALSE) {
+  if(tile->raw_image && mapcache_image_blank_color(tile->raw_image) != MAPCACHE_FALSE) {
     stmt1 = conn->prepared_statements[MBTILES_SET_EMPTY_TILE_STMT1_IDX];
     stmt2 = conn->prepared_statements[MBTILES_SET_EMPTY_TILE_STMT2_IDX];
     if(!stmt1) {
@@ -658,25 +669,10 @@ static void _single_mbtile_set(mapcache_context *ctx, mapcache_cache_sqlite *cac
   sqlite3_reset(stmt2);
 }
 
-static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+static int _single_sqlitetile_get(mapcache_context *ctx, mapcache_cache_sqlite *cache, mapcache_tile *tile, struct sqlite_conn *conn)
 {
-  mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*) pcache;
-  struct sqlite_conn *conn;
   sqlite3_stmt *stmt;
   int ret;
-  mapcache_pooled_connection *pc = mapcache_sqlite_get_conn(ctx,cache,tile,1);
-  if (GC_HAS_ERROR(ctx)) {
-    if(tile->tileset->read_only || !tile->tileset->source) {
-      mapcache_sqlite_release_conn(ctx, pc);
-      return MAPCACHE_FAILURE;
-    } else {
-      /* not an error in this case, as the db file may not have been created yet */
-      ctx->clear_errors(ctx);
-      mapcache_sqlite_release_conn(ctx, pc);
-      return MAPCACHE_CACHE_MISS;
-    }
-  }
-  conn = SQLITE_CONN(pc);
   stmt = conn->prepared_statements[GET_TILE_STMT_IDX];
   if(!stmt) {
     sqlite3_prepare(conn->handle, cache->get_stmt.sql, -1, &conn->prepared_statements[GET_TILE_STMT_IDX], NULL);
@@ -688,34 +684,96 @@ static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_cache *pca
     if (ret != SQLITE_DONE && ret != SQLITE_ROW && ret != SQLITE_BUSY && ret != SQLITE_LOCKED) {
       ctx->set_error(ctx, 500, "sqlite backend failed on get: %s", sqlite3_errmsg(conn->handle));
       sqlite3_reset(stmt);
-      mapcache_sqlite_release_conn(ctx, pc);
       return MAPCACHE_FAILURE;
     }
   } while (ret == SQLITE_BUSY || ret == SQLITE_LOCKED);
   if (ret == SQLITE_DONE) {
     sqlite3_reset(stmt);
-    mapcache_sqlite_release_conn(ctx, pc);
     return MAPCACHE_CACHE_MISS;
   } else {
     const void *blob = sqlite3_column_blob(stmt, 0);
     int size = sqlite3_column_bytes(stmt, 0);
     if(size>0 && ((char*)blob)[0] == '#') {
-      tile->encoded_data = mapcache_empty_png_decode(ctx,tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy ,blob,&tile->nodata);
+      tile->encoded_data = mapcache_uniform_tile_decode(ctx,tile,blob);
     } else {
       tile->encoded_data = mapcache_buffer_create(size, ctx->pool);
       memcpy(tile->encoded_data->buf, blob, size);
       tile->encoded_data->size = size;
+      /* mbtiles stores its blank tiles fully encoded, unlike sqlite's markers */
+      if(cache->detect_blank && cache->bind_stmt == _bind_sqlite_params) {
+        tile->nonuniform_data = tile->encoded_data;
+      }
     }
     if (sqlite3_column_count(stmt) > 1) {
       time_t mtime = sqlite3_column_int64(stmt, 1);
       apr_time_ansi_put(&(tile->mtime), mtime);
     }
     sqlite3_reset(stmt);
-    mapcache_sqlite_release_conn(ctx, pc);
     return MAPCACHE_SUCCESS;
   }
 }
 
+static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*) pcache;
+  int ret;
+  mapcache_pooled_connection *pc = mapcache_sqlite_get_conn(ctx,cache,tile,1);
+  if (GC_HAS_ERROR(ctx)) {
+    if(tile->tileset->read_only || !tile->tileset->source) {
+      mapcache_sqlite_release_conn(ctx, pc);
+      return MAPCACHE_FAILURE;
+    } else {
+      /* not an error in this case, as the db file may not have been created yet */
+      ctx->clear_errors(ctx);
+      mapcache_sqlite_release_conn(ctx, pc);
+      return MAPCACHE_CACHE_MISS;
+    }
+  }
+  ret = _single_sqlitetile_get(ctx, cache, tile, SQLITE_CONN(pc));
+  mapcache_sqlite_release_conn(ctx, pc);
+  return ret;
+}
+
+static void _mapcache_cache_sqlite_multi_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tiles, int ntiles)
+{
+  mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*) pcache;
+  mapcache_pooled_connection *pc = NULL;
+  char *pc_dbfile = NULL;
+  int i;
+
+  for(i = 0; i < ntiles; i++) {
+    mapcache_tile *tile = &tiles[i];
+    char *dbfile;
+    tile->encoded_data = NULL;
+    /* consecutive tiles usually live in the same db file, reuse its connection */
+    _mapcache_cache_sqlite_filename_for_tile(ctx, cache, tile, &dbfile);
+    if(!pc || strcmp(dbfile, pc_dbfile)) {
+      if(pc) {
+        mapcache_sqlite_release_conn(ctx, pc);
+      }
+      pc_dbfile = dbfile;
+      pc = mapcache_sqlite_get_conn(ctx, cache, tile, 1);
+      if(GC_HAS_ERROR(ctx)) {
+        mapcache_sqlite_release_conn(ctx, pc);
+        pc = NULL;
+        if(tile->tileset->read_only || !tile->tileset->source) {
+          return;
+        }
+        /* the db file may not have been created yet */
+        ctx->clear_errors(ctx);
+        continue;
+      }
+    }
+    if(_single_sqlitetile_get(ctx, cache, tile, SQLITE_CONN(pc)) != MAPCACHE_SUCCESS) {
+      tile->encoded_data = NULL;
+    }
+    if(GC_HAS_ERROR(ctx)) break;
+  }
+  if(pc) {
+    mapcache_sqlite_release_conn(ctx, pc);
+  }
+}
+
 static void _single_sqlitetile_set(mapcache_context *ctx, mapcache_cache_sqlite *cache, mapcache_tile *tile, struct sqlite_conn *conn)
 {
   sqlite3_stmt *stmt = conn->prepared_statements[SQLITE_SET_TILE_STMT_IDX];
@@ -821,6 +879,10 @@ static void _mapcache_cache_mbtiles_multi_set(mapcache_context *ctx, mapcache_ca
   /* decode/encode image data before going into the sqlite write lock */
   for (i = 0; i < ntiles; i++) {
     mapcache_tile *tile = &tiles[i];
+    if(mapcache_tile_is_nonuniform(tile)) {
+      /* stored as is, without a blank test */
+      continue;
+    }
     if(!tile->raw_image) {
       tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
       GC_CHECK_ERROR(ctx);
@@ -1057,6 +1119,7 @@ mapcache_cache* mapcache_cache_sqlite_create(mapcache_context *ctx)
   cache->cache.type = MAPCACHE_CACHE_SQLITE;
   cache->cache._tile_delete = _mapcache_cache_sqlite_delete;
   cache->cache._tile_get = _mapcache_cache_sqlite_get;
+  cache->cache._tile_multi_get = _mapcache_cache_sqlite_multi_get;
   cache->cache._tile_exists = _mapcache_cache_sqlite_has_tile;
   cache->cache._tile_set = _mapcache_cache_sqlite_set;
   cache->cache._tile_multi_set = _mapcache_cache_sqlite_multi_set;
@@ -1069,7 +1132,7 @@ mapcache_cache* mapcache_cache_sqlite_create(mapcache_context *ctx)
   cache->get_stmt.sql = apr_pstrdup(ctx->pool,
                                     "select data,strftime(\"%s\",ctime) from tiles where tileset=:tileset and grid=:grid and x=:x and y=:y and z=:z and dim=:dim");
   cache->set_stmt.sql = apr_pstrdup(ctx->pool,
-                                    "insert or replace into tiles(tileset,grid,x,y,z,data,dim,ctime) values (:tileset,:grid,:x,:y,:z,:data,:dim,datetime('now'))");
+                                    "insert or replace into tiles(tileset,grid,x,y,z,data,dim,ctime) values (:tileset,:grid,:x,:y,:z,:data,:dim,datetime(:mtime,'unixepoch'))");
   cache->delete_stmt.sql = apr_pstrdup(ctx->pool,
                                        "delete from tiles where x=:x and y=:y and z=:z and dim=:dim and tileset=:tileset and grid=:grid");
   cache->n_prepared_statements = 4;
@@ -95,6 +95,31 @@ struct mapcache_cache_tiff {
   } storage;
 };
 
+struct tiff_conn_params {
+  mapcache_cache_tiff *cache;
+  mapcache_tile *tile;
+  char *filename;
+};
+
+/*
+ * an opened tiff file, along with the tile index of its full resolution
+ * directory. this lets us serve tiles with a single seek+read on an already
+ * opened file descriptor instead of reparsing the tiff directory each time
+ */
+struct tiff_conn {
+  apr_pool_t *pool;
+  apr_file_t *f;
+  apr_time_t mtime; /* modification time of the file when it was indexed */
+  apr_off_t size; /* size of the file when it was indexed */
+  ttile_t ntiles;
+  toff_t *offsets;
+  toff_t *sizes;
+  unsigned char *jpegtable;
+  uint32 jpegtable_size;
+};
+
+#define TIFF_CONN(pooled_connection) ((struct tiff_conn*)((pooled_connection)->connection))
+
 #ifdef USE_GDAL
 
 static tsize_t
@@ -507,6 +532,187 @@ static void check_tiff_format(mapcache_context *ctx, mapcache_cache_tiff *cache,
 }
 #endif
 
+/**
+ * \brief return the index of the given tile inside the list of tiles of its tiff file
+ * \private \memberof mapcache_cache_tiff
+ */
+static int _mapcache_cache_tiff_tile_offset(mapcache_cache_tiff *cache, mapcache_tile *tile)
+{
+  int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
+  /*
+   * compute the width and height of the full tiff file. This
+   * is not simply the tile size times the number of tiles per
+   * file for lower zoom levels
+   */
+  mapcache_grid_level *level = tile->grid_link->grid->levels[tile->z];
+  int ntilesx = MAPCACHE_MIN(cache->count_x, level->maxx);
+  int ntilesy = MAPCACHE_MIN(cache->count_y, level->maxy);
+
+  /* x offset of the tile along a row */
+  tiff_offx = tile->x % ntilesx;
+
+  /*
+   * y offset of the requested row. we inverse it as the rows are ordered
+   * from top to bottom, whereas the tile y is bottom to top
+   */
+  tiff_offy = ntilesy - (tile->y % ntilesy) -1;
+  return tiff_offy * ntilesx + tiff_offx;
+}
+
+static void mapcache_cache_tiff_connection_destructor(void *conn_)
+{
+  struct tiff_conn *conn = (struct tiff_conn*)conn_;
+  free(conn->offsets);
+  free(conn->sizes);
+  free(conn->jpegtable);
+  apr_pool_destroy(conn->pool);
+  free(conn);
+}
+
+static void mapcache_cache_tiff_connection_constructor(mapcache_context *ctx, void **conn_, void *params)
+{
+  struct tiff_conn_params *tp = (struct tiff_conn_params*)params;
+  struct tiff_conn *conn;
+  apr_finfo_t finfo;
+  TIFF *hTIFF;
+  int found = 0;
+
+  conn = calloc(1, sizeof(struct tiff_conn));
+  apr_pool_create(&conn->pool,NULL);
+  if(apr_file_open(&conn->f, tp->filename, APR_FOPEN_READ|APR_FOPEN_BINARY,
+                   APR_OS_DEFAULT, conn->pool) != APR_SUCCESS) {
+    /* most probably the file does not exist, the caller will treat this as a cache miss */
+    ctx->set_error(ctx,404,"failed to open tiff file \"%s\"",tp->filename);
+    mapcache_cache_tiff_connection_destructor(conn);
+    return;
+  }
+  if(apr_file_info_get(&finfo, APR_FINFO_MTIME|APR_FINFO_SIZE, conn->f) != APR_SUCCESS) {
+    ctx->set_error(ctx,500,"failed to stat tiff file \"%s\"",tp->filename);
+    mapcache_cache_tiff_connection_destructor(conn);
+    return;
+  }
+  conn->mtime = finfo.mtime;
+  conn->size = finfo.size;
+
+  hTIFF = mapcache_cache_tiff_open(ctx,tp->cache,tp->filename,"r");
+  if(!hTIFF) {
+    ctx->set_error(ctx,500,"failed to open tiff file \"%s\"",tp->filename);
+    mapcache_cache_tiff_connection_destructor(conn);
+    return;
+  }
+
+  do {
+    uint32 nSubType = 0;
+    toff_t *offsets=NULL, *sizes=NULL;
+    uint32 jpegtable_size = 0;
+    unsigned char* jpegtable_ptr = NULL;
+
+    if( !TIFFGetField(hTIFF, TIFFTAG_SUBFILETYPE, &nSubType) )
+      nSubType = 0;
+
+    /* skip overviews and masks */
+    if( (nSubType & FILETYPE_REDUCEDIMAGE) ||
+        (nSubType & FILETYPE_MASK) )
+      continue;
+
+#ifdef DEBUG
+    check_tiff_format(ctx,tp->cache,tp->tile,hTIFF,tp->filename);
+    if(GC_HAS_ERROR(ctx)) {
+      break;
+    }
+#endif
+
+    /* get the offset of the jpeg data from the start of the file for each tile */
+    if(1 != TIFFGetField( hTIFF, TIFFTAG_TILEOFFSETS, &offsets )) {
+      ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile offsets",
+                     tp->filename);
+      break;
+    }
+
+    /* get the size of the jpeg data for each tile */
+    if(1 != TIFFGetField( hTIFF, TIFFTAG_TILEBYTECOUNTS, &sizes )) {
+      ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile sizes",
+                     tp->filename);
+      break;
+    }
+
+    conn->ntiles = TIFFNumberOfTiles(hTIFF);
+    conn->offsets = malloc(conn->ntiles * sizeof(toff_t));
+    conn->sizes = malloc(conn->ntiles * sizeof(toff_t));
+    memcpy(conn->offsets, offsets, conn->ntiles * sizeof(toff_t));
+    memcpy(conn->sizes, sizes, conn->ntiles * sizeof(toff_t));
+
+    /*
+     * read the jpeg header (common to all tiles). a missing table is only
+     * reported when a tile is actually read, as before
+     */
+    if( TIFFGetField( hTIFF, TIFFTAG_JPEGTABLES, &jpegtable_size, &jpegtable_ptr ) == 1 &&
+        jpegtable_ptr && jpegtable_size >= 2 ) {
+      conn->jpegtable = malloc(jpegtable_size);
+      memcpy(conn->jpegtable, jpegtable_ptr, jpegtable_size);
+      conn->jpegtable_size = jpegtable_size;
+    }
+    found = 1;
+    break;
+  } while( TIFFReadDirectory( hTIFF ) );
+
+  MyTIFFClose(hTIFF);
+
+  if(!found) {
+    if(!GC_HAS_ERROR(ctx)) {
+      /* the tiff only contains overviews ? */
+      ctx->set_error(ctx,500,"TIFF file \"%s\" has no full resolution directory",tp->filename);
+    }
+    mapcache_cache_tiff_connection_destructor(conn);
+    return;
+  }
+  *conn_ = conn;
+}
+
+/**
+ * \brief return a pooled connection holding the tile index of the given tiff file
+ *
+ * the cached index is validated against the modification time and size of the
+ * file, and rebuilt if the file has been modified since it was indexed.
+ * \returns NULL (and sets an error) if the file does not exist or could not be indexed
+ * \private \memberof mapcache_cache_tiff
+ */
+static mapcache_pooled_connection* _mapcache_cache_tiff_get_conn(mapcache_context *ctx,
+    mapcache_cache_tiff *cache, mapcache_tile *tile, char *filename)
+{
+  struct tiff_conn_params params;
+  mapcache_pooled_connection *pc;
+  struct tiff_conn *conn;
+  apr_finfo_t finfo;
+  char *key = apr_pstrcat(ctx->pool,"tiff_",filename,NULL);
+
+  params.cache = cache;
+  params.tile = tile;
+  params.filename = filename;
+
+  pc = mapcache_connection_pool_get_connection(ctx,key,mapcache_cache_tiff_connection_constructor,
+                                               mapcache_cache_tiff_connection_destructor,&params);
+  if(GC_HAS_ERROR(ctx) || !pc) {
+    return NULL;
+  }
+  conn = TIFF_CONN(pc);
+  if(apr_stat(&finfo,filename,APR_FINFO_MTIME|APR_FINFO_SIZE,ctx->pool) != APR_SUCCESS) {
+    mapcache_connection_pool_invalidate_connection(ctx,pc);
+    ctx->set_error(ctx,404,"tiff file \"%s\" has been removed",filename);
+    return NULL;
+  }
+  if(finfo.mtime != conn->mtime || finfo.size != conn->size) {
+    /* file has been modified since we indexed it */
+    mapcache_connection_pool_invalidate_connection(ctx,pc);
+    pc = mapcache_connection_pool_get_connection(ctx,key,mapcache_cache_tiff_connection_constructor,
+                                                 mapcache_cache_tiff_connection_destructor,&params);
+    if(GC_HAS_ERROR(ctx) || !pc) {
+      return NULL;
+    }
+  }
+  return pc;
+}
+
 static int _mapcache_cache_tiff_has_tile(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
 {
   char *filename;
@@ -517,6 +723,24 @@ static int _mapcache_cache_tiff_has_tile(mapcache_context *ctx, mapcache_cache *
     return MAPCACHE_FALSE;
   }
 
+  if(cache->storage.type == MAPCACHE_TIFF_STORAGE_FILE) {
+    mapcache_pooled_connection *pc;
+    struct tiff_conn *conn;
+    int tiff_off, ret = MAPCACHE_FALSE;
+    pc = _mapcache_cache_tiff_get_conn(ctx,cache,tile,filename);
+    if(!pc) {
+      ctx->clear_errors(ctx);
+      return MAPCACHE_FALSE;
+    }
+    conn = TIFF_CONN(pc);
+    tiff_off = _mapcache_cache_tiff_tile_offset(cache,tile);
+    if( tiff_off < conn->ntiles && conn->offsets[tiff_off] > 0 && conn->sizes[tiff_off] > 0 ) {
+      ret = MAPCACHE_TRUE;
+    }
+    mapcache_connection_pool_release_connection(ctx,pc);
+    return ret;
+  }
+
 #ifdef USE_GDAL
   CPLPushErrorHandlerEx(mapcache_cache_tiff_gdal_error_handler, ctx);
 #endif
@@ -608,31 +832,17 @@ static void _mapcache_cache_tiff_delete(mapcache_context *ctx, mapcache_cache *p
 }
 
 
+#ifdef USE_GDAL
 /**
- * \brief get file content of given tile
- *
- * fills the mapcache_tile::data of the given tile with content stored in the file
+ * \brief get content of given tile from a network (/vsi) based tiff file
  * \private \memberof mapcache_cache_tiff
- * \sa mapcache_cache::tile_get()
  */
-static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+static int _mapcache_cache_tiff_vsi_get(mapcache_context *ctx, mapcache_cache_tiff *cache, mapcache_tile *tile, char *filename)
 {
-  char *filename;
   TIFF *hTIFF = NULL;
   int rv;
-  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
-  _mapcache_cache_tiff_tile_key(ctx, cache, tile, &filename);
-  if(GC_HAS_ERROR(ctx)) {
-    return MAPCACHE_FALSE;
-  }
-#ifdef DEBUG
-  ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => filename %s)",
-           tile->x,tile->y,tile->z,filename);
-#endif
 
-#ifdef USE_GDAL
   CPLPushErrorHandlerEx(mapcache_cache_tiff_gdal_error_handler, ctx);
-#endif
 
   hTIFF = mapcache_cache_tiff_open(ctx,cache,filename,"r");
 
@@ -649,12 +859,7 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
   if(hTIFF) {
     do {
       uint32 nSubType = 0;
-      int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
       int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
-
-      mapcache_grid_level *level;
-      int ntilesx;
-      int ntilesy;
       toff_t  *offsets=NULL, *sizes=NULL;
 
       if( !TIFFGetField(hTIFF, TIFFTAG_SUBFILETYPE, &nSubType) )
@@ -669,30 +874,11 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
       check_tiff_format(ctx,cache,tile,hTIFF,filename);
       if(GC_HAS_ERROR(ctx)) {
         MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
         CPLPopErrorHandler();
-#endif
         return MAPCACHE_FAILURE;
       }
 #endif
-      /*
-       * compute the width and height of the full tiff file. This
-       * is not simply the tile size times the number of tiles per
-       * file for lower zoom levels
-       */
-      level = tile->grid_link->grid->levels[tile->z];
-      ntilesx = MAPCACHE_MIN(cache->count_x, level->maxx);
-      ntilesy = MAPCACHE_MIN(cache->count_y, level->maxy);
-
-      /* x offset of the tile along a row */
-      tiff_offx = tile->x % ntilesx;
-
-      /*
-       * y offset of the requested row. we inverse it as the rows are ordered
-       * from top to bottom, whereas the tile y is bottom to top
-       */
-      tiff_offy = ntilesy - (tile->y % ntilesy) -1;
-      tiff_off = tiff_offy * ntilesx + tiff_offx;
+      tiff_off = _mapcache_cache_tiff_tile_offset(cache,tile);
 
       /* get the offset of the jpeg data from the start of the file for each tile */
       rv = TIFFGetField( hTIFF, TIFFTAG_TILEOFFSETS, &offsets );
@@ -700,9 +886,7 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
         ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile offsets",
                        filename);
         MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
         CPLPopErrorHandler();
-#endif
         return MAPCACHE_FAILURE;
       }
 
@@ -712,9 +896,7 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
         ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile sizes",
                        filename);
         MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
         CPLPopErrorHandler();
-#endif
         return MAPCACHE_FAILURE;
       }
 
@@ -724,9 +906,12 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
        * if not, the tiff file is sparse and is missing the requested tile
        */
       if( offsets[tiff_off] > 0 && sizes[tiff_off] >= 2 ) {
-        apr_file_t *f;
-        apr_finfo_t finfo;
-        apr_status_t ret;
+        char *bufptr;
+        apr_off_t off;
+        apr_size_t bytes_to_read;
+        size_t bytes_read;
+        VSIStatBufL sStat;
+        VSILFILE* fp;
 
         /* read the jpeg header (common to all tiles) */
         uint32 jpegtable_size = 0;
@@ -737,9 +922,7 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
           ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" jpeg table",
                          filename);
           MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
           CPLPopErrorHandler();
-#endif
           return MAPCACHE_FAILURE;
         }
 
@@ -747,169 +930,82 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
          * open the tiff file directly to access the jpeg image data with the given
          * offset
          */
-#ifdef USE_GDAL
-        if( cache->storage.type != MAPCACHE_TIFF_STORAGE_FILE )
+        fp = mapcache_cache_tiff_vsi_open(cache, filename, "r");
+        if( fp == NULL )
         {
-          char *bufptr;
-          apr_off_t off;
-          apr_size_t bytes_to_read;
-          size_t bytes_read;
-          VSIStatBufL sStat;
-          VSILFILE* fp;
-
-          fp = mapcache_cache_tiff_vsi_open(cache, filename, "r");
-          if( fp == NULL )
-          {
-            /*
-             * shouldn't usually happen. we managed to open the file before,
-             * nothing much to do except bail out.
-             */
-            ctx->set_error(ctx,500,
-                           "VSIFOpenL() failed on already open tiff "
-                           "file \"%s\", giving up .... ",
-                           filename);
-            MyTIFFClose(hTIFF);
-            CPLPopErrorHandler();
-            return MAPCACHE_FAILURE;
-          }
-
-          if( mapcache_cache_tiff_vsi_stat(cache, filename, &sStat) == 0 )  {
-            /*
-             * extract the file modification time. this isn't guaranteed to be the
-             * modification time of the actual tile, but it's the best we can do
-             */
-            tile->mtime = sStat.st_mtime;
-          }
-
-#ifdef DEBUG
-          ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => mtime = %d)",
-                   tile->x,tile->y,tile->z,tile->mtime);
-#endif
-
-
-          /* create a memory buffer to contain the jpeg data */
-          tile->encoded_data = mapcache_buffer_create(
-              (jpegtable_size+sizes[tiff_off]-4),ctx->pool);
-
           /*
-           * copy the jpeg header to the beginning of the memory buffer,
-           * omitting the last 2 bytes
+           * shouldn't usually happen. we managed to open the file before,
+           * nothing much to do except bail out.
            */
-          memcpy(tile->encoded_data->buf,jpegtable_ptr,(jpegtable_size-2));
-
-          /* advance the data pointer to after the header data */
-          bufptr = ((char *)tile->encoded_data->buf) + (jpegtable_size-2);
-
-
-          /* go to the specified offset in the tiff file, plus 2 bytes */
-          off = offsets[tiff_off]+2;
-          VSIFSeekL(fp, (vsi_l_offset)off, SEEK_SET);
+          ctx->set_error(ctx,500,
+                         "VSIFOpenL() failed on already open tiff "
+                         "file \"%s\", giving up .... ",
+                         filename);
+          MyTIFFClose(hTIFF);
+          CPLPopErrorHandler();
+          return MAPCACHE_FAILURE;
+        }
 
+        if( mapcache_cache_tiff_vsi_stat(cache, filename, &sStat) == 0 )  {
           /*
-           * copy the jpeg body at the end of the memory buffer, accounting
-           * for the two bytes we omitted in the previous step
+           * extract the file modification time. this isn't guaranteed to be the
+           * modification time of the actual tile, but it's the best we can do
            */
-          bytes_to_read = sizes[tiff_off]-2;
-          bytes_read = VSIFReadL(bufptr, 1, bytes_to_read, fp);
-
-          /* check we have correctly read the requested number of bytes */
-          if(bytes_to_read != bytes_read) {
-            ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
-                        (read %d of %d bytes)",
-                        filename,(int)bytes_read,(int)sizes[tiff_off]-2);
-            VSIFCloseL(fp);
-            MyTIFFClose(hTIFF);
-            CPLPopErrorHandler();
-            return MAPCACHE_FAILURE;
-          }
-
-          tile->encoded_data->size = (jpegtable_size+sizes[tiff_off]-4);
-
-          VSIFCloseL(fp);
-          CPLPopErrorHandler();
-          return MAPCACHE_SUCCESS;
+          tile->mtime = sStat.st_mtime;
         }
-        else
+
+#ifdef DEBUG
+        ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => mtime = %d)",
+                 tile->x,tile->y,tile->z,tile->mtime);
 #endif
-        if((ret=apr_file_open(&f, filename,
-                              APR_FOPEN_READ|APR_FOPEN_BUFFERED|APR_FOPEN_BINARY,APR_OS_DEFAULT,
-                              ctx->pool)) == APR_SUCCESS) {
-          char *bufptr;
-          apr_off_t off;
-          apr_size_t bytes;
-          ret = apr_file_info_get(&finfo, APR_FINFO_MTIME, f);
-          if(ret == APR_SUCCESS) {
-            /*
-             * extract the file modification time. this isn't guaranteed to be the
-             * modification time of the actual tile, but it's the best we can do
-             */
-            tile->mtime = finfo.mtime;
-          }
-
-          /* create a memory buffer to contain the jpeg data */
-          tile->encoded_data = mapcache_buffer_create((jpegtable_size+sizes[tiff_off]-4),ctx->pool);
 
-          /*
-           * copy the jpeg header to the beginning of the memory buffer,
-           * omitting the last 2 bytes
-           */
-          memcpy(tile->encoded_data->buf,jpegtable_ptr,(jpegtable_size-2));
 
-          /* advance the data pointer to after the header data */
-          bufptr = ((char *)tile->encoded_data->buf) + (jpegtable_size-2);
+        /* create a memory buffer to contain the jpeg data */
+        tile->encoded_data = mapcache_buffer_create(
+            (jpegtable_size+sizes[tiff_off]-4),ctx->pool);
 
+        /*
+         * copy the jpeg header to the beginning of the memory buffer,
+         * omitting the last 2 bytes
+         */
+        memcpy(tile->encoded_data->buf,jpegtable_ptr,(jpegtable_size-2));
 
-          /* go to the specified offset in the tiff file, plus 2 bytes */
-          off = offsets[tiff_off]+2;
-          apr_file_seek(f,APR_SET,&off);
+        /* advance the data pointer to after the header data */
+        bufptr = ((char *)tile->encoded_data->buf) + (jpegtable_size-2);
 
-          /*
-           * copy the jpeg body at the end of the memory buffer, accounting
-           * for the two bytes we omitted in the previous step
-           */
-          bytes = sizes[tiff_off]-2;
-          apr_file_read(f,bufptr,&bytes);
-
-          /* check we have correctly read the requested number of bytes */
-          if(bytes !=  sizes[tiff_off]-2) {
-            ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
-                        (read %d of %d bytes)", filename,bytes,sizes[tiff_off]-2);
-            apr_file_close(f);
-            MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
-            CPLPopErrorHandler();
-#endif
-            return MAPCACHE_FAILURE;
-          }
 
-          tile->encoded_data->size = (jpegtable_size+sizes[tiff_off]-4);
+        /* go to the specified offset in the tiff file, plus 2 bytes */
+        off = offsets[tiff_off]+2;
+        VSIFSeekL(fp, (vsi_l_offset)off, SEEK_SET);
 
-          /* finalize and cleanup */
-          apr_file_close(f);
-          MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
-          CPLPopErrorHandler();
-#endif
-          return MAPCACHE_SUCCESS;
-        } else {
-          /* shouldn't usually happen. we managed to open the file with TIFFOpen,
-           * but apr_file_open failed to do so.
-           * nothing much to do except bail out.
-           */
-          ctx->set_error(ctx,500,"apr_file_open failed on already open tiff file \"%s\", giving up .... ",
-                         filename);
+        /*
+         * copy the jpeg body at the end of the memory buffer, accounting
+         * for the two bytes we omitted in the previous step
+         */
+        bytes_to_read = sizes[tiff_off]-2;
+        bytes_read = VSIFReadL(bufptr, 1, bytes_to_read, fp);
+
+        /* check we have correctly read the requested number of bytes */
+        if(bytes_to_read != bytes_read) {
+          ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
+                      (read %d of %d bytes)",
+                      filename,(int)bytes_read,(int)sizes[tiff_off]-2);
+          VSIFCloseL(fp);
           MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
           CPLPopErrorHandler();
-#endif
           return MAPCACHE_FAILURE;
         }
+
+        tile->encoded_data->size = (jpegtable_size+sizes[tiff_off]-4);
+
+        VSIFCloseL(fp);
+        MyTIFFClose(hTIFF);
+        CPLPopErrorHandler();
+        return MAPCACHE_SUCCESS;
       } else {
         /* sparse tiff file without the requested tile */
         MyTIFFClose(hTIFF);
-#ifdef USE_GDAL
         CPLPopErrorHandler();
-#endif
         return MAPCACHE_CACHE_MISS;
       }
     } /* loop through the tiff directories if there are multiple ones */
@@ -922,105 +1018,151 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcach
      */
     MyTIFFClose(hTIFF);
   }
-#ifdef USE_GDAL
   CPLPopErrorHandler();
-#endif
   /* failed to open tiff file */
   return MAPCACHE_CACHE_MISS;
 }
+#endif /* USE_GDAL */
 
 /**
- * \brief write tile data to tiff
+ * \brief get file content of given tile
  *
- * writes the content of mapcache_tile::data to tiff.
- * \returns MAPCACHE_FAILURE if there is no data to write, or if the tile isn't locked
- * \returns MAPCACHE_SUCCESS if the tile has been successfully written to tiff
+ * fills the mapcache_tile::data of the given tile with content stored in the file
  * \private \memberof mapcache_cache_tiff
- * \sa mapcache_cache::tile_set()
+ * \sa mapcache_cache::tile_get()
  */
-static void _mapcache_cache_tiff_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
 {
-#ifdef USE_TIFF_WRITE
   char *filename;
-  TIFF *hTIFF = NULL;
-  int rv;
-  void *lock;
-  int create;
-  mapcache_cache_tiff *cache;
-  mapcache_image_format_jpeg *format;
-  int tilew;
-  int tileh;
-  unsigned char *rgb;
-  int r,c;
-  apr_finfo_t finfo;
-  mapcache_grid_level *level;
-  int ntilesx;
-  int ntilesy;
-  int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
+  mapcache_pooled_connection *pc;
+  struct tiff_conn *conn;
   int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
-
-  cache = (mapcache_cache_tiff*)pcache;
-  if( cache->storage.type != MAPCACHE_TIFF_STORAGE_FILE )
-  {
-    ctx->set_error(ctx,500,"tiff cache %s is read-only\n",pcache->name);
-    return;
-  }
+  char *bufptr;
+  apr_off_t off;
+  apr_size_t bytes;
+  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
   _mapcache_cache_tiff_tile_key(ctx, cache, tile, &filename);
-  format = (mapcache_image_format_jpeg*) cache->format;
   if(GC_HAS_ERROR(ctx)) {
-    return;
+    return MAPCACHE_FALSE;
   }
 #ifdef DEBUG
-  ctx->log(ctx,MAPCACHE_DEBUG,"tile write (%d,%d,%d) => filename %s)",
+  ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => filename %s)",
            tile->x,tile->y,tile->z,filename);
 #endif
 
-  /*
-   * create the directory where the tiff file will be stored
-   */
-  mapcache_make_parent_dirs(ctx,filename);
-  GC_CHECK_ERROR(ctx);
+#ifdef USE_GDAL
+  if( cache->storage.type != MAPCACHE_TIFF_STORAGE_FILE ) {
+    return _mapcache_cache_tiff_vsi_get(ctx,cache,tile,filename);
+  }
+#endif
 
-  tilew = tile->grid_link->grid->tile_sx;
-  tileh = tile->grid_link->grid->tile_sy;
+  pc = _mapcache_cache_tiff_get_conn(ctx,cache,tile,filename);
+  if(!pc) {
+    /*
+     * we currrently have no way of knowing if the opening failed because the tif
+     * file does not exist (which is not an error condition, as it only signals
+     * that the requested tile does not exist in the cache), or if an other error
+     * that should be signaled occurred (access denied, not a tiff file, etc...)
+     *
+     * we ignore this case here and hope that further parts of the code will be
+     * able to detect what's happening more precisely
+     */
+    ctx->clear_errors(ctx);
+    return MAPCACHE_CACHE_MISS;
+  }
+  conn = TIFF_CONN(pc);
+  tiff_off = _mapcache_cache_tiff_tile_offset(cache,tile);
 
-  if(!tile->raw_image) {
-    tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
-    GC_CHECK_ERROR(ctx);
+  /*
+   * the tile data exists for the given tiff_off if both offsets and size
+   * are not zero for that index.
+   * if not, the tiff file is sparse and is missing the requested tile
+   */
+  if( tiff_off >= conn->ntiles || conn->offsets[tiff_off] == 0 || conn->sizes[tiff_off] < 2 ) {
+    mapcache_connection_pool_release_connection(ctx,pc);
+    return MAPCACHE_CACHE_MISS;
   }
 
-  /* remap xrgb to rgb */
-  rgb = (unsigned char*)malloc(tilew*tileh*3);
-  for(r=0; r<tile->raw_image->h; r++) {
-    unsigned char *imptr = tile->raw_image->data + r * tile->raw_image->stride;
-    unsigned char *rgbptr = rgb + r * tilew * 3;
-    for(c=0; c<tile->raw_image->w; c++) {
-      rgbptr[0] = imptr[2];
-      rgbptr[1] = imptr[1];
-      rgbptr[2] = imptr[0];
-      rgbptr += 3;
-      imptr += 4;
-    }
+  if( !conn->jpegtable ) {
+    /* there is no common jpeg header in the tiff tags */
+    ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" jpeg table",
+                   filename);
+    mapcache_connection_pool_release_connection(ctx,pc);
+    return MAPCACHE_FAILURE;
   }
 
   /*
-   * aquire a lock on the tiff file.
+   * extract the file modification time. this isn't guaranteed to be the
+   * modification time of the actual tile, but it's the best we can do
+   */
+  tile->mtime = conn->mtime;
+
+  /* create a memory buffer to contain the jpeg data */
+  tile->encoded_data = mapcache_buffer_create((conn->jpegtable_size+conn->sizes[tiff_off]-4),ctx->pool);
+
+  /*
+   * copy the jpeg header to the beginning of the memory buffer,
+   * omitting the last 2 bytes
    */
+  memcpy(tile->encoded_data->buf,conn->jpegtable,(conn->jpegtable_size-2));
 
-  while(mapcache_lock_or_wait_for_resource(ctx,(cache->locker?cache->locker:ctx->config->locker),filename, &lock) == MAPCACHE_FALSE);
+  /* advance the data pointer to after the header data */
+  bufptr = ((char *)tile->encoded_data->buf) + (conn->jpegtable_size-2);
+
+  /* go to the specified offset in the tiff file, plus 2 bytes */
+  off = conn->offsets[tiff_off]+2;
+  apr_file_seek(conn->f,APR_SET,&off);
+
+  /*
+   * copy the jpeg body at the end of the memory buffer, accounting
+   * for the two bytes we omitted in the previous step
+   */
+  bytes = conn->sizes[tiff_off]-2;
+  if(apr_file_read_full(conn->f,bufptr,bytes,&bytes) != APR_SUCCESS || bytes != conn->sizes[tiff_off]-2) {
+    ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
+                (read %d of %d bytes)", filename,(int)bytes,(int)conn->sizes[tiff_off]-2);
+    /* don't keep a file descriptor we failed to read from */
+    mapcache_connection_pool_invalidate_connection(ctx,pc);
+    return MAPCACHE_FAILURE;
+  }
+
+  tile->encoded_data->size = (conn->jpegtable_size+conn->sizes[tiff_off]-4);
+
+  mapcache_connection_pool_release_connection(ctx,pc);
+  return MAPCACHE_SUCCESS;
+}
+
+#ifdef USE_TIFF_WRITE
+/**
+ * \brief open (or create and initialize) the tiff file containing the given tile for writing
+ * \param create set to 1 if the file did not exist and has been created
+ * \private \memberof mapcache_cache_tiff
+ */
+static TIFF* _mapcache_cache_tiff_open_for_write(mapcache_context *ctx, mapcache_cache_tiff *cache,
+    mapcache_tile *tile, char *filename, int *create)
+{
+  TIFF *hTIFF;
+  apr_finfo_t finfo;
+  int rv;
+  mapcache_grid_level *level;
+  int ntilesx;
+  int ntilesy;
+  int tilew = tile->grid_link->grid->tile_sx;
+  int tileh = tile->grid_link->grid->tile_sy;
+  mapcache_image_format_jpeg *format = cache->format;
 
   /* check if the tiff file exists already */
   rv = apr_stat(&finfo,filename,0,ctx->pool);
   if(!APR_STATUS_IS_ENOENT(rv)) {
     hTIFF = mapcache_cache_tiff_open(ctx,cache,filename,"r+");
-    create = 0;
+    *create = 0;
   } else {
     hTIFF = mapcache_cache_tiff_open(ctx,cache,filename,"w+");
-    create = 1;
+    *create = 1;
   }
   if(!hTIFF) {
     ctx->set_error(ctx,500,"failed to open/create tiff file %s\n",filename);
-    goto close_tiff;
+    return NULL;
   }
 
 
@@ -1032,7 +1174,7 @@ static void _mapcache_cache_tiff_set(mapcache_context *ctx, mapcache_cache *pcac
   level = tile->grid_link->grid->levels[tile->z];
   ntilesx = MAPCACHE_MIN(cache->count_x, level->maxx);
   ntilesy = MAPCACHE_MIN(cache->count_y, level->maxy);
-  if(create) {
+  if(*create) {
 #ifdef USE_GEOTIFF
     double  adfPixelScale[3], adfTiePoints[6];
     mapcache_extent bbox;
@@ -1118,46 +1260,157 @@ static void _mapcache_cache_tiff_set(mapcache_context *ctx, mapcache_cache *pcac
     TIFFSetField( hTIFF, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_YCBCR);
   }
   TIFFSetField( hTIFF, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB );
+  return hTIFF;
+}
 
-  /* x offset of the tile along a row */
-  tiff_offx = tile->x % ntilesx;
+/**
+ * \brief encode a single tile into an already opened tiff file
+ * \param rgb scratch buffer of tile_sx*tile_sy*3 bytes
+ * \private \memberof mapcache_cache_tiff
+ */
+static void _mapcache_cache_tiff_write_tile(mapcache_context *ctx, mapcache_cache_tiff *cache,
+    TIFF *hTIFF, mapcache_tile *tile, char *filename, unsigned char *rgb)
+{
+  int r,c;
+  int tilew = tile->grid_link->grid->tile_sx;
+  int tileh = tile->grid_link->grid->tile_sy;
 
-  /*
-   * y offset of the requested row. we inverse it as the rows are ordered
-   * from top to bottom, whereas the tile y is bottom to top
-   */
-  tiff_offy = ntilesy - (tile->y % ntilesy) -1;
-  tiff_off = tiff_offy * ntilesx + tiff_offx;
+  if(!tile->raw_image) {
+    tile->raw_image = mapcache_imageio_decode(ctx, tile->encoded_data);
+    GC_CHECK_ERROR(ctx);
+  }
 
+  /* remap xrgb to rgb */
+  for(r=0; r<tile->raw_image->h; r++) {
+    unsigned char *imptr = tile->raw_image->data + r * tile->raw_image->stride;
+    unsigned char *rgbptr = rgb + r * tilew * 3;
+    for(c=0; c<tile->raw_image->w; c++) {
+      rgbptr[0] = imptr[2];
+      rgbptr[1] = imptr[1];
+      rgbptr[2] = imptr[0];
+      rgbptr += 3;
+      imptr += 4;
+    }
+  }
 
-  rv = TIFFWriteEncodedTile(hTIFF, tiff_off, rgb, tilew*tileh*3);
-  free(rgb);
-  if(!rv) {
+  if(!TIFFWriteEncodedTile(hTIFF, _mapcache_cache_tiff_tile_offset(cache,tile), rgb, tilew*tileh*3)) {
     ctx->set_error(ctx,500,"failed TIFFWriteEncodedTile to %s",filename);
-    goto close_tiff;
+    return;
   }
-  rv = TIFFWriteCheck( hTIFF, 1, "cache_set()");
-  if(!rv) {
+  if(!TIFFWriteCheck( hTIFF, 1, "cache_set()")) {
     ctx->set_error(ctx,500,"failed TIFFWriteCheck %s",filename);
-    goto close_tiff;
+    return;
   }
+}
+#endif
 
-  if(create) {
-    rv = TIFFWriteDirectory(hTIFF);
-    if(!rv) {
-      ctx->set_error(ctx,500,"failed TIFFWriteDirectory to %s",filename);
-      goto close_tiff;
-    }
+/**
+ * \brief write a list of tiles to tiff
+ *
+ * the tiles are grouped by the tiff file they belong to, so that each file is
+ * locked, opened and has its directory written only once whatever the number
+ * of tiles (i.e. usually the whole metatile) it receives.
+ * \private \memberof mapcache_cache_tiff
+ * \sa mapcache_cache::tile_multi_set()
+ */
+static void _mapcache_cache_tiff_multi_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tiles, int ntiles)
+{
+#ifdef USE_TIFF_WRITE
+  mapcache_cache_tiff *cache = (mapcache_cache_tiff*)pcache;
+  mapcache_locker *locker = cache->locker?cache->locker:ctx->config->locker;
+  char **filenames;
+  unsigned char *rgb;
+  int i,j;
+
+  if( cache->storage.type != MAPCACHE_TIFF_STORAGE_FILE )
+  {
+    ctx->set_error(ctx,500,"tiff cache %s is read-only\n",pcache->name);
+    return;
   }
 
-close_tiff:
-  if(hTIFF)
-    MyTIFFClose(hTIFF);
-  mapcache_unlock_resource(ctx,cache->locker?cache->locker:ctx->config->locker, lock);
+  filenames = apr_pcalloc(ctx->pool, ntiles * sizeof(char*));
+  for(i=0; i<ntiles; i++) {
+    _mapcache_cache_tiff_tile_key(ctx, cache, &tiles[i], &filenames[i]);
+    GC_CHECK_ERROR(ctx);
+#ifdef DEBUG
+    ctx->log(ctx,MAPCACHE_DEBUG,"tile write (%d,%d,%d) => filename %s)",
+             tiles[i].x,tiles[i].y,tiles[i].z,filenames[i]);
+#endif
+  }
+
+  /* a single conversion buffer is reused for all the tiles, they all come from the same grid */
+  rgb = (unsigned char*)malloc(tiles[0].grid_link->grid->tile_sx*tiles[0].grid_link->grid->tile_sy*3);
+
+  for(i=0; i<ntiles; i++) {
+    char *filename = filenames[i];
+    TIFF *hTIFF;
+    void *lock;
+    int create;
+
+    if(!filename) {
+      /* already written along with a previous tile of the same file */
+      continue;
+    }
+
+    /*
+     * create the directory where the tiff file will be stored
+     */
+    mapcache_make_parent_dirs(ctx,filename);
+    if(GC_HAS_ERROR(ctx)) {
+      break;
+    }
+
+    /*
+     * aquire a lock on the tiff file.
+     */
+    while(mapcache_lock_or_wait_for_resource(ctx,locker,filename, &lock) == MAPCACHE_FALSE);
+    if(GC_HAS_ERROR(ctx)) {
+      break;
+    }
+
+    hTIFF = _mapcache_cache_tiff_open_for_write(ctx, cache, &tiles[i], filename, &create);
+    if(hTIFF) {
+      for(j=i; j<ntiles; j++) {
+        if(!filenames[j] || strcmp(filenames[j],filename)) {
+          continue;
+        }
+        _mapcache_cache_tiff_write_tile(ctx, cache, hTIFF, &tiles[j], filename, rgb);
+        if(GC_HAS_ERROR(ctx)) {
+          break;
+        }
+        filenames[j] = NULL;
+      }
+
+      if(create && !GC_HAS_ERROR(ctx)) {
+        if(!TIFFWriteDirectory(hTIFF)) {
+          ctx->set_error(ctx,500,"failed TIFFWriteDirectory to %s",filename);
+        }
+      }
+      MyTIFFClose(hTIFF);
+    }
+    mapcache_unlock_resource(ctx,locker, lock);
+    if(GC_HAS_ERROR(ctx)) {
+      break;
+    }
+  }
+  free(rgb);
 #else
   ctx->set_error(ctx,500,"tiff write support disabled by default");
 #endif
+}
 
+/**
+ * \brief write tile data to tiff
+ *
+ * writes the content of mapcache_tile::data to tiff.
+ * \returns MAPCACHE_FAILURE if there is no data to write, or if the tile isn't locked
+ * \returns MAPCACHE_SUCCESS if the tile has been successfully written to tiff
+ * \private \memberof mapcache_cache_tiff
+ * \sa mapcache_cache::tile_set()
+ */
+static void _mapcache_cache_tiff_set(mapcache_context *ctx, mapcache_cache *pcache, mapcache_tile *tile)
+{
+  _mapcache_cache_tiff_multi_set(ctx, pcache, tile, 1);
 }
 
 /**
@@ -1395,6 +1648,7 @@ mapcache_cache* mapcache_cache_tiff_create(mapcache_context *ctx)
   cache->cache._tile_get = _mapcache_cache_tiff_get;
   cache->cache._tile_exists = _mapcache_cache_tiff_has_tile;
   cache->cache._tile_set = _mapcache_cache_tiff_set;
+  cache->cache._tile_multi_set = _mapcache_cache_tiff_multi_set;
   cache->cache.configuration_post_config = _mapcache_cache_tiff_configuration_post_config;
   cache->cache.configuration_parse_xml = _mapcache_cache_tiff_configuration_parse_xml;
   cache->count_x = 10;
@@ -153,7 +153,7 @@ static void _mapcache_cache_tc_set(mapcache_context *ctx, mapcache_tile *tile)
   struct tc_conn conn;
   mapcache_cache_tc *cache = (mapcache_cache_tc*)tile->tileset->cache;
   char *skey = mapcache_util_get_tile_key(ctx,tile,cache->key_template,NULL,NULL);
-  apr_time_t now = apr_time_now();
+  apr_time_t now = (tile->keep_mtime && tile->mtime)?tile->mtime:apr_time_now();
   conn = _tc_get_conn(ctx,tile,0);
   GC_CHECK_ERROR(ctx);
 
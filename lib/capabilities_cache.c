@@ -0,0 +1,460 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching: cache of GetCapabilities documents
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+ * A per-process cache of the capabilities documents produced by the services,
+ * so that the document isn't rebuilt and serialized on every GetCapabilities
+ * request. The cache belongs to the configuration, so it is dropped when the
+ * configuration is reloaded.
+ *
+ * Documents are keyed on the service, the url prefix and the path info. The
+ * values of the dynamic dimensions (i.e. those backed by a database) are listed
+ * in the WMS and WMTS capabilities: for these services a fingerprint of the
+ * current values is computed on each request, and the cached document is
+ * regenerated when it changes.
+ *
+ * The gzip (and brotli) encodings of a document are computed the first time a
+ * client accepting them requests it, and are then kept along with the document.
+ */
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <apr_hash.h>
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+typedef enum {
+  MAPCACHE_CAPS_IDENTITY = 0,
+  MAPCACHE_CAPS_GZIP,
+  MAPCACHE_CAPS_BROTLI,
+  MAPCACHE_CAPS_ENCODINGS
+} mapcache_capabilities_encoding;
+
+static const char *_caps_encoding_names[MAPCACHE_CAPS_ENCODINGS] = {NULL, "gzip", "br"};
+
+typedef struct mapcache_capabilities_entry mapcache_capabilities_entry;
+
+struct mapcache_capabilities_entry {
+  char *key;
+  apr_uint64_t fingerprint; /**< fingerprint of the dynamic dimension values */
+  char *mime_type;
+  apr_time_t mtime; /**< time the document was generated */
+  apr_time_t atime; /**< last time the document was served */
+  unsigned char *body[MAPCACHE_CAPS_ENCODINGS]; /**< the document, as produced by the service and encoded */
+  size_t size[MAPCACHE_CAPS_ENCODINGS];
+};
+
+struct mapcache_capabilities_cache {
+  apr_hash_t *entries;
+  size_t size;
+  size_t max_size;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+static void _capabilities_entry_free(mapcache_capabilities_entry *entry)
+{
+  int i;
+  for(i = 0; i < MAPCACHE_CAPS_ENCODINGS; i++) {
+    free(entry->body[i]);
+  }
+  free(entry->mime_type);
+  free(entry->key);
+  free(entry);
+}
+
+static size_t _capabilities_entry_size(mapcache_capabilities_entry *entry)
+{
+  size_t size = 0;
+  int i;
+  for(i = 0; i < MAPCACHE_CAPS_ENCODINGS; i++) {
+    size += entry->size[i];
+  }
+  return size;
+}
+
+static void _capabilities_entry_remove(mapcache_capabilities_cache *cache, mapcache_capabilities_entry *entry)
+{
+  apr_hash_set(cache->entries, entry->key, APR_HASH_KEY_STRING, NULL);
+  cache->size -= _capabilities_entry_size(entry);
+  _capabilities_entry_free(entry);
+}
+
+static apr_status_t _capabilities_cache_cleanup(void *data)
+{
+  mapcache_capabilities_cache *cache = (mapcache_capabilities_cache*)data;
+  apr_hash_index_t *hi;
+  while((hi = apr_hash_first(NULL, cache->entries)) != NULL) {
+    void *entry;
+    apr_hash_this(hi, NULL, NULL, &entry);
+    _capabilities_entry_remove(cache, (mapcache_capabilities_entry*)entry);
+  }
+  return APR_SUCCESS;
+}
+
+mapcache_capabilities_cache* mapcache_capabilities_cache_create(apr_pool_t *pool, size_t max_size)
+{
+  mapcache_capabilities_cache *cache = apr_pcalloc(pool, sizeof(mapcache_capabilities_cache));
+  cache->entries = apr_hash_make(pool);
+  cache->max_size = max_size;
+#if APR_HAS_THREADS
+  apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+#endif
+  apr_pool_cleanup_register(pool, cache, _capabilities_cache_cleanup, apr_pool_cleanup_null);
+  return cache;
+}
+
+static void _capabilities_cache_lock(mapcache_capabilities_cache *cache)
+{
+#if APR_HAS_THREADS
+  if(cache->mutex) apr_thread_mutex_lock(cache->mutex);
+#endif
+}
+
+static void _capabilities_cache_unlock(mapcache_capabilities_cache *cache)
+{
+#if APR_HAS_THREADS
+  if(cache->mutex) apr_thread_mutex_unlock(cache->mutex);
+#endif
+}
+
+/**
+ * \brief check whether a content coding is accepted (with a non zero quality) by an Accept-Encoding header
+ */
+static int _capabilities_accepts_encoding(const char *header, const char *coding)
+{
+  size_t len = strlen(coding);
+  const char *p = header;
+  while(p && *p) {
+    const char *end;
+    while(*p == ' ' || *p == '\t' || *p == ',') p++;
+    end = p;
+    while(*end && *end != ',' && *end != ';' && *end != ' ' && *end != '\t') end++;
+    if((size_t)(end - p) == len && !strncasecmp(p, coding, len)) {
+      /* look for a q=0 parameter */
+      const char *q = end;
+      while(*q && *q != ',') {
+        if((*q == 'q' || *q == 'Q') && q[1] == '=') {
+          return (strtod(q + 2, NULL) > 0) ? MAPCACHE_TRUE : MAPCACHE_FALSE;
+        }
+        q++;
+      }
+      return MAPCACHE_TRUE;
+    }
+    p = strchr(end, ',');
+  }
+  return MAPCACHE_FALSE;
+}
+
+static mapcache_capabilities_encoding _capabilities_choose_encoding(const char *accept_encoding)
+{
+  if(!accept_encoding) {
+    return MAPCACHE_CAPS_IDENTITY;
+  }
+#ifdef USE_BROTLI
+  if(_capabilities_accepts_encoding(accept_encoding, "br")) {
+    return MAPCACHE_CAPS_BROTLI;
+  }
+#endif
+  if(_capabilities_accepts_encoding(accept_encoding, "gzip")) {
+    return MAPCACHE_CAPS_GZIP;
+  }
+  return MAPCACHE_CAPS_IDENTITY;
+}
+
+/**
+ * \brief compute a fingerprint of the dimension values that are listed in the capabilities
+ * of the service and that may change without the configuration being reloaded
+ * \returns MAPCACHE_FAILURE if the values could not be queried
+ */
+static int _capabilities_fingerprint(mapcache_context *ctx, mapcache_service *service, mapcache_cfg *config,
+                                     apr_uint64_t *fingerprint)
+{
+  apr_uint64_t h = 14695981039346656037ULL; /* FNV-1a */
+  apr_hash_index_t *hi;
+  int i, j;
+
+#define FNV_STR(s) { const char *_c = (s); while(*_c) { h ^= (unsigned char)*_c++; h *= 1099511628211ULL; } h ^= '#'; h *= 1099511628211ULL; }
+  *fingerprint = h;
+  if(service->type != MAPCACHE_SERVICE_WMS && service->type != MAPCACHE_SERVICE_WMTS) {
+    return MAPCACHE_SUCCESS;
+  }
+  for(hi = apr_hash_first(ctx->pool, config->tilesets); hi; hi = apr_hash_next(hi)) {
+    mapcache_tileset *tileset;
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    tileset = (mapcache_tileset*)val;
+    if(!tileset->dimensions) continue;
+    for(i = 0; i < tileset->dimensions->nelts; i++) {
+      mapcache_dimension *dimension = APR_ARRAY_IDX(tileset->dimensions, i, mapcache_dimension*);
+      apr_array_header_t *values;
+      if(dimension->type == MAPCACHE_DIMENSION_VALUES || dimension->type == MAPCACHE_DIMENSION_REGEX) {
+        /* these can only change with the configuration */
+        continue;
+      }
+      values = dimension->get_all_ogc_formatted_entries(ctx, dimension, tileset, NULL, NULL);
+      if(GC_HAS_ERROR(ctx) || !values) {
+        return MAPCACHE_FAILURE;
+      }
+      FNV_STR(tileset->name);
+      FNV_STR(dimension->name);
+      for(j = 0; j < values->nelts; j++) {
+        FNV_STR(APR_ARRAY_IDX(values, j, char*));
+      }
+    }
+  }
+#undef FNV_STR
+  *fingerprint = h;
+  return MAPCACHE_SUCCESS;
+}
+
+static unsigned char* _capabilities_gzip(const unsigned char *data, size_t size, size_t *out_size)
+{
+  z_stream zs;
+  unsigned char *out;
+  uLong bound;
+  memset(&zs, 0, sizeof(zs));
+  /* 15+16 window bits: zlib writes a gzip header and trailer */
+  if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return NULL;
+  }
+  bound = deflateBound(&zs, (uLong)size);
+  out = malloc(bound);
+  if(!out) {
+    deflateEnd(&zs);
+    return NULL;
+  }
+  zs.next_in = (Bytef*)data;
+  zs.avail_in = (uInt)size;
+  zs.next_out = out;
+  zs.avail_out = (uInt)bound;
+  if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&zs);
+    free(out);
+    return NULL;
+  }
+  *out_size = zs.total_out;
+  deflateEnd(&zs);
+  return out;
+}
+
+#ifdef USE_BROTLI
+static unsigned char* _capabilities_brotli(const unsigned char *data, size_t size, size_t *out_size)
+{
+  size_t bound = BrotliEncoderMaxCompressedSize(size);
+  unsigned char *out;
+  if(!bound) {
+    return NULL;
+  }
+  out = malloc(bound);
+  if(!out) {
+    return NULL;
+  }
+  *out_size = bound;
+  /* quality 9 compresses markedly better than gzip at a comparable speed, 11 is too slow
+   * for documents that may be regenerated whenever the dimension values change */
+  if(!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size, data, out_size, out)) {
+    free(out);
+    return NULL;
+  }
+  return out;
+}
+#endif
+
+static mapcache_capabilities_entry* _capabilities_lookup(mapcache_capabilities_cache *cache, const char *key,
+    apr_uint64_t fingerprint)
+{
+  mapcache_capabilities_entry *entry = apr_hash_get(cache->entries, key, APR_HASH_KEY_STRING);
+  if(entry && entry->fingerprint != fingerprint) {
+    /* the dimension values have changed */
+    _capabilities_entry_remove(cache, entry);
+    entry = NULL;
+  }
+  return entry;
+}
+
+/**
+ * \brief make room for cost bytes by removing the least recently served documents
+ */
+static int _capabilities_cache_reserve(mapcache_capabilities_cache *cache, size_t cost)
+{
+  if(cost > cache->max_size / 2) {
+    return MAPCACHE_FALSE;
+  }
+  while(cache->size + cost > cache->max_size) {
+    apr_hash_index_t *hi;
+    mapcache_capabilities_entry *oldest = NULL;
+    for(hi = apr_hash_first(NULL, cache->entries); hi; hi = apr_hash_next(hi)) {
+      void *val;
+      apr_hash_this(hi, NULL, NULL, &val);
+      if(!oldest || ((mapcache_capabilities_entry*)val)->atime < oldest->atime) {
+        oldest = (mapcache_capabilities_entry*)val;
+      }
+    }
+    if(!oldest) break;
+    _capabilities_entry_remove(cache, oldest);
+  }
+  return MAPCACHE_TRUE;
+}
+
+static mapcache_http_response* _capabilities_response(mapcache_context *ctx, const unsigned char *body, size_t size,
+    const char *mime_type, mapcache_capabilities_encoding encoding, apr_time_t mtime)
+{
+  mapcache_http_response *response = mapcache_http_response_create(ctx->pool);
+  response->data = mapcache_buffer_create(size, ctx->pool);
+  mapcache_buffer_append(response->data, size, (void*)body);
+  response->mtime = mtime;
+  apr_table_set(response->headers, "Content-Type", mime_type);
+  apr_table_set(response->headers, "Vary", "Accept-Encoding");
+  if(encoding != MAPCACHE_CAPS_IDENTITY) {
+    apr_table_set(response->headers, "Content-Encoding", _caps_encoding_names[encoding]);
+  }
+  return response;
+}
+
+mapcache_http_response* mapcache_capabilities_cache_get_response(mapcache_context *ctx, mapcache_capabilities_cache *cache,
+    mapcache_service *service, mapcache_request_get_capabilities *req_caps, char *url, char *path_info, mapcache_cfg *config)
+{
+  mapcache_capabilities_encoding encoding = _capabilities_choose_encoding(req_caps->accept_encoding);
+  mapcache_capabilities_entry *entry;
+  mapcache_http_response *response = NULL;
+  apr_uint64_t fingerprint;
+  unsigned char *identity = NULL, *encoded = NULL;
+  size_t identity_size = 0, encoded_size = 0;
+  char *key, *mime_type = NULL;
+  apr_time_t mtime = 0;
+
+  if(_capabilities_fingerprint(ctx, service, config, &fingerprint) != MAPCACHE_SUCCESS) {
+    /* let the service report the failure */
+    ctx->clear_errors(ctx);
+    return NULL;
+  }
+  key = apr_psprintf(ctx->pool, "%s|%s|%s", service->name, url ? url : "", path_info ? path_info : "");
+
+  _capabilities_cache_lock(cache);
+  entry = _capabilities_lookup(cache, key, fingerprint);
+  if(entry) {
+    entry->atime = apr_time_now();
+    if(entry->body[encoding]) {
+      response = _capabilities_response(ctx, entry->body[encoding], entry->size[encoding], entry->mime_type,
+                                        encoding, entry->mtime);
+    } else {
+      /* encode a private copy, without holding the lock */
+      identity_size = entry->size[MAPCACHE_CAPS_IDENTITY];
+      identity = apr_pmemdup(ctx->pool, entry->body[MAPCACHE_CAPS_IDENTITY], identity_size);
+      mime_type = apr_pstrdup(ctx->pool, entry->mime_type);
+      mtime = entry->mtime;
+    }
+  }
+  _capabilities_cache_unlock(cache);
+  if(response) {
+    return response;
+  }
+
+  if(!identity) {
+    service->create_capabilities_response(ctx, req_caps, url, path_info, config);
+    if(GC_HAS_ERROR(ctx)) {
+      return NULL;
+    }
+    identity = (unsigned char*)req_caps->capabilities;
+    identity_size = strlen(req_caps->capabilities);
+    mime_type = req_caps->mime_type;
+    mtime = apr_time_now();
+  }
+
+  if(encoding == MAPCACHE_CAPS_GZIP) {
+    encoded = _capabilities_gzip(identity, identity_size, &encoded_size);
+#ifdef USE_BROTLI
+  } else if(encoding == MAPCACHE_CAPS_BROTLI) {
+    encoded = _capabilities_brotli(identity, identity_size, &encoded_size);
+#endif
+  }
+  if(encoding != MAPCACHE_CAPS_IDENTITY && !encoded) {
+    ctx->log(ctx, MAPCACHE_WARN, "failed to %s encode capabilities document, sending it uncompressed",
+             _caps_encoding_names[encoding]);
+    encoding = MAPCACHE_CAPS_IDENTITY;
+  }
+  if(encoding == MAPCACHE_CAPS_IDENTITY) {
+    response = _capabilities_response(ctx, identity, identity_size, mime_type, encoding, mtime);
+  } else {
+    response = _capabilities_response(ctx, encoded, encoded_size, mime_type, encoding, mtime);
+  }
+
+  _capabilities_cache_lock(cache);
+  entry = _capabilities_lookup(cache, key, fingerprint);
+  if(!entry) {
+    /* a new document, or the one we encoded was replaced in the meantime */
+    entry = calloc(1, sizeof(mapcache_capabilities_entry));
+    if(entry && _capabilities_cache_reserve(cache, identity_size + encoded_size)) {
+      entry->key = strdup(key);
+      entry->mime_type = strdup(mime_type);
+      entry->body[MAPCACHE_CAPS_IDENTITY] = malloc(identity_size + 1);
+      if(entry->key && entry->mime_type && entry->body[MAPCACHE_CAPS_IDENTITY]) {
+        memcpy(entry->body[MAPCACHE_CAPS_IDENTITY], identity, identity_size);
+        entry->size[MAPCACHE_CAPS_IDENTITY] = identity_size;
+        entry->fingerprint = fingerprint;
+        entry->mtime = mtime;
+        apr_hash_set(cache->entries, entry->key, APR_HASH_KEY_STRING, entry);
+        cache->size += identity_size;
+      } else {
+        _capabilities_entry_free(entry);
+        entry = NULL;
+      }
+    } else {
+      free(entry);
+      entry = NULL;
+    }
+  }
+  if(entry) {
+    entry->atime = apr_time_now();
+    if(encoded && !entry->body[encoding] && _capabilities_cache_reserve(cache, encoded_size)) {
+      /* the reservation may have evicted our own entry */
+      entry = _capabilities_lookup(cache, key, fingerprint);
+      if(entry) {
+        entry->body[encoding] = encoded;
+        entry->size[encoding] = encoded_size;
+        cache->size += encoded_size;
+        encoded = NULL;
+      }
+    }
+  }
+  _capabilities_cache_unlock(cache);
+  free(encoded);
+  return response;
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
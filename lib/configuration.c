@@ -144,6 +144,8 @@ mapcache_cfg* mapcache_configuration_create(apr_pool_t *pool)
                     mapcache_configuration_get_image_format(cfg,"JPEG"), 255),
           "mixed");
   cfg->default_image_format = mapcache_configuration_get_image_format(cfg,"mixed");
+  cfg->uniform_tiles = mapcache_uniform_tile_cache_create(pool, 4 * 1024 * 1024);
+  cfg->capabilities_cache = mapcache_capabilities_cache_create(pool, 16 * 1024 * 1024);
   cfg->reporting = MAPCACHE_REPORT_MSG;
 
   grid = mapcache_grid_create(pool);
@@ -482,6 +482,55 @@ void parseGrid(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
   mapcache_configuration_add_grid(config,grid,name);
 }
 
+/**
+ * \brief parse a <concurrency> or <render_concurrency> element
+ */
+static mapcache_render_limiter* parseRenderLimiter(mapcache_context *ctx, ezxml_t node, const char *name, const char *key)
+{
+  mapcache_render_limiter *limiter;
+  const char *attr, *dir = "/tmp";
+  char *endptr, *safekey, *c;
+  int max = (int)strtol(node->txt,&endptr,10);
+  if(*endptr != 0 || max <= 0) {
+    ctx->set_error(ctx, 400, "%s: failed to parse concurrency \"%s\" (expecting a positive number of renders)", name, node->txt);
+    return NULL;
+  }
+  if((attr = ezxml_attr(node,"directory")) != NULL) {
+    dir = attr;
+  }
+  safekey = apr_pstrdup(ctx->pool, key);
+  for(c = safekey; *c; c++) {
+    if(*c == ' ' || *c == '/' || *c == '~' || *c == '.') *c = '#';
+  }
+  limiter = mapcache_render_limiter_create(ctx, name, apr_psprintf(ctx->pool,"%s/_gc_render_%s.lck",dir,safekey), max);
+  if(!limiter) {
+    return NULL;
+  }
+  if((attr = ezxml_attr(node,"queue")) != NULL) {
+    limiter->queue = (int)strtol(attr,&endptr,10);
+    if(*endptr != 0 || limiter->queue < 0) {
+      ctx->set_error(ctx, 400, "%s: failed to parse concurrency queue \"%s\" (expecting a positive integer)", name, attr);
+      return NULL;
+    }
+  }
+  if((attr = ezxml_attr(node,"timeout")) != NULL) {
+    limiter->timeout = strtod(attr,&endptr);
+    if(*endptr != 0 || limiter->timeout <= 0) {
+      ctx->set_error(ctx, 400, "%s: failed to parse concurrency timeout \"%s\" (expecting a positive number of seconds)", name, attr);
+      return NULL;
+    }
+  }
+  if((attr = ezxml_attr(node,"reserved")) != NULL) {
+    limiter->reserved = (int)strtol(attr,&endptr,10);
+    if(*endptr != 0 || limiter->reserved < 0 || limiter->reserved >= max) {
+      ctx->set_error(ctx, 400, "%s: failed to parse concurrency reserved \"%s\" (expecting a positive integer smaller than %d)",
+                     name, attr, max);
+      return NULL;
+    }
+  }
+  return limiter;
+}
+
 void parseSource(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
 {
   ezxml_t cur_node;
@@ -545,6 +594,23 @@ void parseSource(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
     }
   }
 
+  if ((cur_node = ezxml_child(node,"concurrency")) != NULL) {
+    const char *fallback;
+    source->limiter = parseRenderLimiter(ctx, cur_node, apr_psprintf(ctx->pool,"source (%s)",source->name), source->name);
+    GC_CHECK_ERROR(ctx);
+    if((fallback = ezxml_attr(cur_node,"fallback")) != NULL) {
+      if(!strcmp(fallback,"error")) {
+        source->overload_fallback = MAPCACHE_OVERLOAD_ERROR;
+      } else if(!strcmp(fallback,"upscale")) {
+        source->overload_fallback = MAPCACHE_OVERLOAD_UPSCALE;
+      } else {
+        ctx->set_error(ctx,400,"source (%s): unknown concurrency fallback \"%s\" (allowed are error and upscale)",
+                       source->name, fallback);
+        return;
+      }
+    }
+  }
+
   source->configuration_parse_xml(ctx,node,source, config);
   GC_CHECK_ERROR(ctx);
   source->configuration_check(ctx,config,source);
@@ -571,6 +637,8 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
   if(!strcmp(type,"PNG")) {
     int colors = -1;
     mapcache_compression_type compression = MAPCACHE_COMPRESSION_DEFAULT;
+    mapcache_png_filter filter = MAPCACHE_PNG_FILTER_NONE;
+    mapcache_deflate_backend deflate = MAPCACHE_DEFLATE_ZLIB;
     if ((cur_node = ezxml_child(node,"compression")) != NULL) {
       if(!strcmp(cur_node->txt, "fast")) {
         compression = MAPCACHE_COMPRESSION_FAST;
@@ -595,6 +663,42 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
       }
     }
 
+    if ((cur_node = ezxml_child(node,"filter")) != NULL) {
+      if(!strcmp(cur_node->txt, "none")) {
+        filter = MAPCACHE_PNG_FILTER_NONE;
+      } else if(!strcmp(cur_node->txt, "sub")) {
+        filter = MAPCACHE_PNG_FILTER_SUB;
+      } else if(!strcmp(cur_node->txt, "up")) {
+        filter = MAPCACHE_PNG_FILTER_UP;
+      } else if(!strcmp(cur_node->txt, "avg")) {
+        filter = MAPCACHE_PNG_FILTER_AVG;
+      } else if(!strcmp(cur_node->txt, "paeth")) {
+        filter = MAPCACHE_PNG_FILTER_PAETH;
+      } else if(!strcmp(cur_node->txt, "adaptive")) {
+        filter = MAPCACHE_PNG_FILTER_ADAPTIVE;
+      } else {
+        ctx->set_error(ctx, 400, "unknown filter %s for format \"%s\" "
+                       "(expecting none, sub, up, avg, paeth or adaptive)", cur_node->txt, name);
+        return;
+      }
+    }
+    if ((cur_node = ezxml_child(node,"deflate")) != NULL) {
+      if(!strcmp(cur_node->txt, "zlib")) {
+        deflate = MAPCACHE_DEFLATE_ZLIB;
+      } else if(!strcmp(cur_node->txt, "libdeflate")) {
+#ifdef USE_LIBDEFLATE
+        deflate = MAPCACHE_DEFLATE_LIBDEFLATE;
+#else
+        ctx->set_error(ctx, 400, "format \"%s\": LIBDEFLATE support not compiled in this version", name);
+        return;
+#endif
+      } else {
+        ctx->set_error(ctx, 400, "unknown deflate implementation %s for format \"%s\" "
+                       "(expecting zlib or libdeflate)", cur_node->txt, name);
+        return;
+      }
+    }
+
     if(colors == -1) {
       format = mapcache_imageio_create_png_format(ctx->pool,
                name,compression);
@@ -602,6 +706,8 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
       format = mapcache_imageio_create_png_q_format(ctx->pool,
                name,compression, colors);
     }
+    ((mapcache_image_format_png*)format)->filter = filter;
+    ((mapcache_image_format_png*)format)->deflate = deflate;
   } else if(!strcmp(type,"JPEG")) {
     int quality = 95;
     int optimize = TRUE;
@@ -643,6 +749,40 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
     }
     format = mapcache_imageio_create_jpeg_format(ctx->pool,
              name,quality,photometric,optimize);
+  } else if(!strcmp(type,"WEBP")) {
+#ifdef USE_WEBP
+    int quality = 75;
+    mapcache_webp_mode mode = MAPCACHE_WEBP_LOSSY;
+    if ((cur_node = ezxml_child(node,"quality")) != NULL) {
+      char *endptr;
+      quality = (int)strtol(cur_node->txt,&endptr,10);
+      if(*endptr != 0 || quality < 0 || quality > 100) {
+        ctx->set_error(ctx, 400, "failed to parse quality \"%s\" for format \"%s\""
+                       "(expecting an  integer between 0 and 100 "
+                       "eg <quality>75</quality>",
+                       cur_node->txt,name);
+        return;
+      }
+    }
+    if ((cur_node = ezxml_child(node,"mode")) != NULL) {
+      if(cur_node->txt && !strcasecmp(cur_node->txt,"lossy"))
+        mode = MAPCACHE_WEBP_LOSSY;
+      else if(cur_node->txt && !strcasecmp(cur_node->txt,"lossless"))
+        mode = MAPCACHE_WEBP_LOSSLESS;
+      else if(cur_node->txt && !strcasecmp(cur_node->txt,"mixed"))
+        mode = MAPCACHE_WEBP_MIXED;
+      else {
+        ctx->set_error(ctx,400,"failed to parse webp format %s mode %s. expecting lossy, lossless or mixed",
+                       name,cur_node->txt);
+        return;
+      }
+    }
+    format = mapcache_imageio_create_webp_format(ctx->pool,
+             name,quality,mode);
+#else
+    ctx->set_error(ctx,400,"WEBP support not compiled in this version");
+    return;
+#endif
   } else if(!strcasecmp(type,"MIXED")) {
     mapcache_image_format *transparent=NULL, *opaque=NULL;
     unsigned int alpha_cutoff=255;
@@ -737,6 +877,10 @@ void parseCache(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
     cache = mapcache_cache_memcache_create(ctx);
   } else if(!strcmp(type,"tiff")) {
     cache = mapcache_cache_tiff_create(ctx);
+  } else if(!strcmp(type,"archive")) {
+    cache = mapcache_cache_archive_create(ctx);
+  } else if(!strcmp(type,"dedup")) {
+    cache = mapcache_cache_dedup_create(ctx);
   } else if(!strcmp(type,"couchbase")) {
     cache = mapcache_cache_couchbase_create(ctx);
   } else if(!strcmp(type,"riak")) {
@@ -806,6 +950,29 @@ void parseTileset(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
       tileset->read_only = 1;
   }
 
+  if ((cur_node = ezxml_child(node,"existence_filter")) != NULL) {
+    char *entries;
+    if(!cur_node->txt || !*cur_node->txt) {
+      ctx->set_error(ctx, 400, "tileset \"%s\": <existence_filter> must contain the path to the filter file", name);
+      return;
+    }
+    tileset->existence_filter = mapcache_existence_filter_create(ctx->pool);
+    tileset->existence_filter->filename = apr_pstrdup(ctx->pool, cur_node->txt);
+    if((entries = (char*)ezxml_attr(cur_node,"entries")) != NULL) {
+      char *endptr;
+      apr_int64_t nentries = apr_strtoi64(entries,&endptr,10);
+      if(*endptr != 0 || nentries <= 0) {
+        ctx->set_error(ctx, 400, "failed to parse existence_filter entries \"%s\" for tileset \"%s\" (expecting a positive integer)",
+                       entries, name);
+        return;
+      }
+      /* ~10 bits per entry gives a 1% false positive rate with 7 hashes */
+      tileset->existence_filter->nbits = ((apr_uint64_t)nentries * 10 + 31) / 32 * 32;
+    }
+    mapcache_existence_filter_open(ctx, tileset->existence_filter, 0);
+    GC_CHECK_ERROR(ctx);
+  }
+
   if ((cur_node = ezxml_child(node,"metadata")) != NULL) {
     parseMetadata(ctx, cur_node, tileset->metadata);
     GC_CHECK_ERROR(ctx);
@@ -1149,6 +1316,48 @@ void parseTileset(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config)
     }
   }
 
+  if ((cur_node = ezxml_child(node,"prefetch")) != NULL) {
+    const char *attr;
+    tileset->prefetch_neighbors = tileset->prefetch_children = 1;
+    if((attr = ezxml_attr(cur_node,"neighbors")) != NULL) {
+      if(!strcasecmp(attr,"false")) {
+        tileset->prefetch_neighbors = 0;
+      } else if(strcasecmp(attr,"true")) {
+        ctx->set_error(ctx, 400, "failed to parse prefetch neighbors attribute \"%s\" for tileset \"%s\". Expecting true or false", attr, name);
+        return;
+      }
+    }
+    if((attr = ezxml_attr(cur_node,"children")) != NULL) {
+      if(!strcasecmp(attr,"false")) {
+        tileset->prefetch_children = 0;
+      } else if(strcasecmp(attr,"true")) {
+        ctx->set_error(ctx, 400, "failed to parse prefetch children attribute \"%s\" for tileset \"%s\". Expecting true or false", attr, name);
+        return;
+      }
+    }
+  }
+
+  if ((cur_node = ezxml_child(node,"upscale_on_miss")) != NULL) {
+    char *endptr;
+    const char *attr;
+    tileset->upscale_on_miss = (int)strtol(cur_node->txt,&endptr,10);
+    if(*endptr != 0 || tileset->upscale_on_miss < 0) {
+      ctx->set_error(ctx, 400, "failed to parse upscale_on_miss %s."
+                     "(expecting a positive integer, "
+                     "eg <upscale_on_miss>3</upscale_on_miss>",
+                     cur_node->txt);
+      return;
+    }
+    if((attr = ezxml_attr(cur_node,"expires")) != NULL) {
+      tileset->upscale_expires = (int)strtol(attr,&endptr,10);
+      if(*endptr != 0 || tileset->upscale_expires < 1) {
+        ctx->set_error(ctx, 400, "failed to parse upscale_on_miss expires attribute %s."
+                       "(expecting a positive integer)", attr);
+        return;
+      }
+    }
+  }
+
   if ((cur_node = ezxml_child(node,"metabuffer")) != NULL) {
     char *endptr;
     tileset->metabuffer = (int)strtol(cur_node->txt,&endptr,10);
@@ -1412,6 +1621,15 @@ void mapcache_configuration_parse_xml(mapcache_context *ctx, const char *filenam
     }
   }
 
+  if((node = ezxml_child(doc,"getmap_streaming")) != NULL) {
+    if(!strcasecmp(node->txt,"true")) {
+      config->getmap_streaming = 1;
+    } else if(strcasecmp(node->txt,"false")) {
+      ctx->set_error(ctx, 400, "failed to parse getmap_streaming \"%s\". Expecting true or false",node->txt);
+      return;
+    }
+  }
+
   if((node = ezxml_child(doc,"log_level")) != NULL) {
     if(!strcasecmp(node->txt,"debug")) {
       config->loglevel = MAPCACHE_DEBUG;
@@ -1468,6 +1686,96 @@ void mapcache_configuration_parse_xml(mapcache_context *ctx, const char *filenam
     }
   }
 
+  if((node = ezxml_child(doc,"decoded_tile_cache")) != NULL) {
+    char *endptr;
+    int size_mb = (int)strtol(node->txt,&endptr,10);
+    if (*endptr != 0 || size_mb < 0) {
+      ctx->set_error(ctx, 400, "failed to parse decoded_tile_cache %s "
+          "(expecting a positive number of megabytes)", node->txt);
+      return;
+    }
+    if(size_mb > 0) {
+      config->decoded_tile_cache = mapcache_decoded_tile_cache_create(ctx->pool, (size_t)size_mb * 1024 * 1024);
+    }
+  }
+
+  if((node = ezxml_child(doc,"capabilities_cache")) != NULL) {
+    char *endptr;
+    int size_mb = (int)strtol(node->txt,&endptr,10);
+    if (*endptr != 0 || size_mb < 0) {
+      ctx->set_error(ctx, 400, "failed to parse capabilities_cache %s "
+          "(expecting a positive number of megabytes)", node->txt);
+      return;
+    }
+    if(size_mb > 0) {
+      config->capabilities_cache = mapcache_capabilities_cache_create(ctx->pool, (size_t)size_mb * 1024 * 1024);
+    } else {
+      config->capabilities_cache = NULL;
+    }
+  }
+
+  if((node = ezxml_child(doc,"render_concurrency")) != NULL) {
+    config->render_limiter = parseRenderLimiter(ctx, node, "render_concurrency", "global");
+    GC_CHECK_ERROR(ctx);
+  }
+
+  if((node = ezxml_child(doc,"image_threads")) != NULL) {
+    char *endptr;
+    const char *attr;
+    long min_pixels = 4000000;
+    int nthreads = (int)strtol(node->txt,&endptr,10);
+    if (*endptr != 0 || nthreads < 0) {
+      ctx->set_error(ctx, 400, "failed to parse image_threads %s "
+          "(expecting a positive number of threads)", node->txt);
+      return;
+    }
+    if((attr = ezxml_attr(node,"min_pixels")) != NULL) {
+      min_pixels = strtol(attr,&endptr,10);
+      if (*endptr != 0 || min_pixels < 0) {
+        ctx->set_error(ctx, 400, "failed to parse image_threads min_pixels %s "
+            "(expecting a positive number of pixels)", attr);
+        return;
+      }
+    }
+    if(nthreads > 1) {
+      config->image_workers = mapcache_image_workers_create(ctx->pool, nthreads, (size_t)min_pixels);
+    }
+  }
+
+  if((node = ezxml_child(doc,"prefetch_threads")) != NULL) {
+    char *endptr;
+    const char *attr;
+    int max_pending = 256;
+    int nthreads = (int)strtol(node->txt,&endptr,10);
+    if (*endptr != 0 || nthreads < 0) {
+      ctx->set_error(ctx, 400, "failed to parse prefetch_threads %s "
+          "(expecting a positive number of threads)", node->txt);
+      return;
+    }
+    if((attr = ezxml_attr(node,"max_pending")) != NULL) {
+      max_pending = (int)strtol(attr,&endptr,10);
+      if (*endptr != 0 || max_pending < 1) {
+        ctx->set_error(ctx, 400, "failed to parse prefetch_threads max_pending %s "
+            "(expecting a positive number of metatiles)", attr);
+        return;
+      }
+    }
+    if(nthreads > 0) {
+      config->prefetcher = mapcache_prefetcher_create(ctx->pool, nthreads, max_pending);
+    }
+  } else {
+    /* tilesets configured for prefetching get a single prefetch thread by default */
+    apr_hash_index_t *ti;
+    for(ti = apr_hash_first(ctx->pool,config->tilesets); ti; ti = apr_hash_next(ti)) {
+      mapcache_tileset *tileset;
+      apr_hash_this(ti,NULL,NULL,(void**)&tileset);
+      if(tileset->prefetch_neighbors || tileset->prefetch_children) {
+        config->prefetcher = mapcache_prefetcher_create(ctx->pool, 1, 256);
+        break;
+      }
+    }
+  }
+
 cleanup:
   ezxml_free(doc);
   return;
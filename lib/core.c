@@ -196,6 +196,7 @@ mapcache_http_response *mapcache_core_get_tile(mapcache_context *ctx, mapcache_r
   mapcache_http_response *response;
   char *timestr;
   mapcache_image *base;
+  mapcache_tile *basetile = NULL;
   mapcache_image_format *format;
   mapcache_image_format_type t;
   int i,is_empty=1; /* response image is initially empty */;
@@ -218,6 +219,14 @@ mapcache_http_response *mapcache_core_get_tile(mapcache_context *ctx, mapcache_r
   if(GC_HAS_ERROR(ctx))
     return NULL;
 
+  if(ctx->config->prefetcher) {
+    for(i=0; i<req_tile->ntiles; i++) {
+      if(req_tile->tiles[i]->tileset->prefetch_neighbors || req_tile->tiles[i]->tileset->prefetch_children) {
+        mapcache_prefetcher_schedule(ctx,req_tile->tiles[i]);
+      }
+    }
+  }
+
   if(req_tile->tiles[0]->redirect) {
     response->code = 302;
     apr_table_set(response->headers,"Location",req_tile->tiles[0]->redirect);
@@ -251,6 +260,7 @@ mapcache_http_response *mapcache_core_get_tile(mapcache_context *ctx, mapcache_r
      */
     if(is_empty && tile->encoded_data) {
       response->data = tile->encoded_data;
+      basetile = tile;
       /* just in case we also have the raw image data available, keep a ref to it
        if we need to merge another tile ontop of it*/
       if(tile->raw_image) {
@@ -269,14 +279,14 @@ mapcache_http_response *mapcache_core_get_tile(mapcache_context *ctx, mapcache_r
       /* we have an existing tile, so we know we need to merge the current one into it */
       if(!base) {
         /* the existing tile has not been decoded yet, but we need the access to the raw pixels*/
-        base = mapcache_imageio_decode(ctx, response->data);
+        base = mapcache_tile_decode(ctx, basetile);
         if(!base) return NULL;
       }
       response->data = NULL; /* the encoded data is now obsolete, as we will be merging the current tile */
 
       /* we need to access the current tile's pixel data */
       if(!tile->raw_image) {
-        tile->raw_image = mapcache_imageio_decode(ctx,tile->encoded_data);
+        tile->raw_image = mapcache_tile_decode(ctx,tile);
         if(!tile->raw_image) return NULL;
       }
       mapcache_image_merge(ctx, base, tile->raw_image);
@@ -338,6 +348,8 @@ mapcache_http_response *mapcache_core_get_tile(mapcache_context *ctx, mapcache_r
       apr_table_set(response->headers,"Content-Type","image/png");
     else if(t == GC_JPEG)
       apr_table_set(response->headers,"Content-Type","image/jpeg");
+    else if(t == GC_WEBP)
+      apr_table_set(response->headers,"Content-Type","image/webp");
   }
 
   /* compute expiry headers */
@@ -354,24 +366,31 @@ mapcache_http_response *mapcache_core_get_tile(mapcache_context *ctx, mapcache_r
   return response;
 }
 
-mapcache_map* mapcache_assemble_maps(mapcache_context *ctx, mapcache_map **maps, int nmaps, mapcache_resample_mode mode)
+/*
+ * fetch the tiles needed to assemble each of the maps, and compute the maps' modification
+ * times and expiration delays. maps for which no tile contains data are flagged as nodata
+ */
+static void _mapcache_fetch_maps_tiles(mapcache_context *ctx, mapcache_map **maps, int nmaps,
+    mapcache_tile ****pmaptiles, int **pnmaptiles, mapcache_grid_link ***pgrid_links)
 {
   mapcache_tile ***maptiles;
   int *nmaptiles;
   mapcache_tile **tiles;
   mapcache_grid_link **effectively_used_grid_links;
-  mapcache_map *basemap = NULL;
   int ntiles = 0;
   int i;
   maptiles = apr_pcalloc(ctx->pool,nmaps*sizeof(mapcache_tile**));
   nmaptiles = apr_pcalloc(ctx->pool,nmaps*sizeof(int));
   effectively_used_grid_links = apr_pcalloc(ctx->pool,nmaps*sizeof(mapcache_grid_link*));
+  *pmaptiles = maptiles;
+  *pnmaptiles = nmaptiles;
+  *pgrid_links = effectively_used_grid_links;
   for(i=0; i<nmaps; i++) {
     mapcache_tileset_get_map_tiles(ctx,maps[i]->tileset,maps[i]->grid_link,
                                    &maps[i]->extent, maps[i]->width, maps[i]->height,
                                    &(nmaptiles[i]), &(maptiles[i]), &(effectively_used_grid_links[i]),
                                    maps[i]->dimensions);
-    if(GC_HAS_ERROR(ctx)) return NULL;
+    if(GC_HAS_ERROR(ctx)) return;
     ntiles += nmaptiles[i];
   }
   tiles = apr_pcalloc(ctx->pool,ntiles * sizeof(mapcache_tile*));
@@ -385,7 +404,7 @@ mapcache_map* mapcache_assemble_maps(mapcache_context *ctx, mapcache_map **maps,
     }
   }
   mapcache_prefetch_tiles(ctx,tiles,ntiles);
-  if(GC_HAS_ERROR(ctx)) return NULL;
+  if(GC_HAS_ERROR(ctx)) return;
   for(i=0; i<nmaps; i++) {
     int j,hasdata = 0;
     for(j=0; j<nmaptiles[i]; j++) {
@@ -407,7 +426,23 @@ mapcache_map* mapcache_assemble_maps(mapcache_context *ctx, mapcache_map **maps,
         maps[i]->expires = tile->expires;
       }
     }
-    if(hasdata) {
+    if(!hasdata) {
+      maps[i]->nodata = 1;
+    }
+  }
+}
+
+mapcache_map* mapcache_assemble_maps(mapcache_context *ctx, mapcache_map **maps, int nmaps, mapcache_resample_mode mode)
+{
+  mapcache_tile ***maptiles;
+  int *nmaptiles;
+  mapcache_grid_link **effectively_used_grid_links;
+  mapcache_map *basemap = NULL;
+  int i;
+  _mapcache_fetch_maps_tiles(ctx, maps, nmaps, &maptiles, &nmaptiles, &effectively_used_grid_links);
+  if(GC_HAS_ERROR(ctx)) return NULL;
+  for(i=0; i<nmaps; i++) {
+    if(!maps[i]->nodata) {
       maps[i]->raw_image = mapcache_tileset_assemble_map_tiles(ctx,maps[i]->tileset,effectively_used_grid_links[i],
                            &maps[i]->extent, maps[i]->width, maps[i]->height,
                            nmaptiles[i], maptiles[i],
@@ -422,8 +457,6 @@ mapcache_map* mapcache_assemble_maps(mapcache_context *ctx, mapcache_map **maps,
         apr_pool_cleanup_run(ctx->pool, maps[i]->raw_image->data, (void*)free) ;
         maps[i]->raw_image = NULL;
       }
-    } else {
-      maps[i]->nodata = 1;
     }
   }
   if(!basemap) {
@@ -434,6 +467,84 @@ mapcache_map* mapcache_assemble_maps(mapcache_context *ctx, mapcache_map **maps,
   return basemap;
 }
 
+typedef struct {
+  mapcache_response_stream stream;
+  mapcache_map *map;
+  mapcache_grid_link *grid_link;
+  int ntiles;
+  mapcache_tile **tiles;
+  mapcache_resample_mode mode;
+  mapcache_image_format *format;
+  mapcache_image_stream *encoder;
+} _mapcache_getmap_stream;
+
+static void _mapcache_getmap_stream_band(mapcache_context *ctx, mapcache_image *band, void *data)
+{
+  _mapcache_getmap_stream *gs = (_mapcache_getmap_stream*)data;
+  gs->encoder->write_rows(ctx, gs->encoder, band);
+}
+
+static void _mapcache_getmap_stream_run(mapcache_context *ctx, mapcache_response_stream *stream,
+                                        mapcache_stream_write_func write, void *write_data)
+{
+  _mapcache_getmap_stream *gs = (_mapcache_getmap_stream*)stream;
+  gs->encoder = gs->format->stream(ctx, gs->format, gs->map->width, gs->map->height, write, write_data);
+  if(GC_HAS_ERROR(ctx)) return;
+  mapcache_tileset_assemble_map_tiles_streamed(ctx, gs->map->tileset, gs->grid_link,
+      &gs->map->extent, gs->map->width, gs->map->height,
+      gs->ntiles, gs->tiles, gs->mode,
+      _mapcache_getmap_stream_band, gs);
+  if(GC_HAS_ERROR(ctx)) return;
+  gs->encoder->finish(ctx, gs->encoder);
+}
+
+/*
+ * fetch the tiles of a single map, and prepare a response whose body will be assembled
+ * and encoded band by band while it is being sent
+ */
+static mapcache_map* _mapcache_core_get_map_streamed(mapcache_context *ctx, mapcache_request_get_map *req_map,
+    mapcache_http_response *response)
+{
+  mapcache_tile ***maptiles;
+  int *nmaptiles;
+  mapcache_grid_link **grid_links;
+  mapcache_map *map = req_map->maps[0];
+  _mapcache_getmap_stream *gs;
+
+  _mapcache_fetch_maps_tiles(ctx, req_map->maps, 1, &maptiles, &nmaptiles, &grid_links);
+  if(GC_HAS_ERROR(ctx)) return NULL;
+  if(map->nodata) {
+    ctx->set_error(ctx,404,
+                  "no tiles containing image data could be retrieved to create map (not in cache, and/or no source configured)");
+    return NULL;
+  }
+  gs = apr_pcalloc(ctx->pool, sizeof(_mapcache_getmap_stream));
+  gs->stream.run = _mapcache_getmap_stream_run;
+  gs->map = map;
+  gs->grid_link = grid_links[0];
+  gs->ntiles = nmaptiles[0];
+  gs->tiles = maptiles[0];
+  gs->mode = req_map->resample_mode;
+  gs->format = req_map->image_request.format;
+  response->stream = &gs->stream;
+  return map;
+}
+
+static void _mapcache_buffer_stream_write(mapcache_context *ctx, void *data, const unsigned char *buf, size_t len)
+{
+  mapcache_buffer_append((mapcache_buffer*)data, len, (void*)buf);
+}
+
+void mapcache_http_response_buffer_stream(mapcache_context *ctx, mapcache_http_response *response)
+{
+  if(!response->stream) {
+    return;
+  }
+  response->data = mapcache_buffer_create(5000, ctx->pool);
+  response->stream->run(ctx, response->stream, _mapcache_buffer_stream_write, response->data);
+  response->stream = NULL;
+}
+
 mapcache_http_response *mapcache_core_get_map(mapcache_context *ctx, mapcache_request_get_map *req_map)
 {
   mapcache_image_format *format = NULL;
@@ -457,7 +568,12 @@ mapcache_http_response *mapcache_core_get_map(mapcache_context *ctx, mapcache_re
   response = mapcache_http_response_create(ctx->pool);
 
   if(req_map->getmap_strategy == MAPCACHE_GETMAP_ASSEMBLE) {
-    basemap = mapcache_assemble_maps(ctx, req_map->maps, req_map->nmaps, req_map->resample_mode);
+    if(ctx->config->getmap_streaming && req_map->nmaps == 1 && req_map->image_request.format->stream) {
+      basemap = _mapcache_core_get_map_streamed(ctx, req_map, response);
+      format = req_map->image_request.format;
+    } else {
+      basemap = mapcache_assemble_maps(ctx, req_map->maps, req_map->nmaps, req_map->resample_mode);
+    }
     if(GC_HAS_ERROR(ctx)) return NULL;
   } else if(!ctx->config->non_blocking && req_map->getmap_strategy == MAPCACHE_GETMAP_FORWARD) {
     int i;
@@ -495,7 +611,9 @@ mapcache_http_response *mapcache_core_get_map(mapcache_context *ctx, mapcache_re
     return NULL;
   }
 
-  if(basemap->raw_image) {
+  if(response->stream) {
+    /* the body will be produced by the frontend through the response stream */
+  } else if(basemap->raw_image) {
     format = req_map->image_request.format; /* always defined, defaults to JPEG */
     response->data = format->write(ctx,basemap->raw_image,format);
     if(GC_HAS_ERROR(ctx)) {
@@ -515,12 +633,14 @@ mapcache_http_response *mapcache_core_get_map(mapcache_context *ctx, mapcache_re
   /* compute the content-type */
   if(format && format->mime_type) {
     apr_table_set(response->headers,"Content-Type",format->mime_type);
-  } else {
+  } else if(response->data) {
     mapcache_image_format_type t = mapcache_imageio_header_sniff(ctx,response->data);
     if(t == GC_PNG)
       apr_table_set(response->headers,"Content-Type","image/png");
     else if(t == GC_JPEG)
       apr_table_set(response->headers,"Content-Type","image/jpeg");
+    else if(t == GC_WEBP)
+      apr_table_set(response->headers,"Content-Type","image/webp");
   }
 
   /* compute expiry headers */
@@ -606,6 +726,12 @@ mapcache_http_response* mapcache_core_get_capabilities(mapcache_context *ctx, ma
     mapcache_request_get_capabilities *req_caps, char *url, char *path_info, mapcache_cfg *config)
 {
   mapcache_http_response *response;
+  if(config->capabilities_cache) {
+    response = mapcache_capabilities_cache_get_response(ctx,config->capabilities_cache,service,req_caps,url,path_info,config);
+    if(response || GC_HAS_ERROR(ctx)) {
+      return response;
+    }
+  }
   service->create_capabilities_response(ctx,req_caps,url,path_info,config);
   if(GC_HAS_ERROR(ctx)) {
     return NULL;
@@ -0,0 +1,248 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching: per tileset tile existence (bloom) filter
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+ * The existence filter is a bloom filter stored in a file that is shared
+ * (memory mapped) between all the processes using the tileset. It is filled by
+ * the tiles that are stored in the tileset's cache, and allows answering
+ * requests for tiles that were never stored without querying the cache.
+ *
+ * As a bloom filter never returns false negatives for the tiles that were added
+ * to it, the filter is only trusted once it has been marked as complete, i.e.
+ * once every tile present in the cache has been added (this is done by the
+ * seeder). Deleted tiles are not removed from the filter, they will only cost a
+ * cache lookup as before.
+ *
+ * The file is a 32 byte header followed by the filter bits, in native byte order.
+ */
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_mmap.h>
+#include <apr_atomic.h>
+#include <string.h>
+
+#define MAPCACHE_FILTER_MAGIC "MCBLOOM1"
+#define MAPCACHE_FILTER_HEADER_SIZE 32
+
+typedef struct mapcache_existence_filter_header {
+  char magic[8];
+  apr_uint64_t nbits;
+  apr_uint32_t nhashes;
+  apr_uint32_t complete;
+  char reserved[8];
+} mapcache_existence_filter_header;
+
+mapcache_existence_filter* mapcache_existence_filter_create(apr_pool_t *pool)
+{
+  mapcache_existence_filter *filter = apr_pcalloc(pool, sizeof(mapcache_existence_filter));
+  filter->pool = pool;
+  filter->nbits = 8 * 1024 * 1024 * 8; /* 8MB, i.e. ~7 million tiles at a 1% false positive rate */
+  filter->nhashes = 7;
+  return filter;
+}
+
+/**
+ * \brief create an empty filter file
+ */
+static void _mapcache_existence_filter_init_file(mapcache_context *ctx, mapcache_existence_filter *filter, apr_file_t *f)
+{
+  mapcache_existence_filter_header header;
+  apr_size_t bytes;
+  apr_off_t size = MAPCACHE_FILTER_HEADER_SIZE + (apr_off_t)(filter->nbits / 8);
+  apr_status_t rv;
+  char errmsg[120];
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAPCACHE_FILTER_MAGIC, 8);
+  header.nbits = filter->nbits;
+  header.nhashes = filter->nhashes;
+  rv = apr_file_write_full(f, &header, sizeof(header), &bytes);
+  if(rv == APR_SUCCESS) {
+    /* the filter bits are created as a sparse, zero filled, region */
+    rv = apr_file_trunc(f, size);
+  }
+  if(rv != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "failed to initialize existence filter %s: %s", filter->filename, apr_strerror(rv,errmsg,120));
+  }
+}
+
+void mapcache_existence_filter_open(mapcache_context *ctx, mapcache_existence_filter *filter, int create)
+{
+  apr_file_t *f;
+  apr_finfo_t finfo;
+  apr_mmap_t *mm;
+  apr_status_t rv;
+  mapcache_existence_filter_header *header;
+  char errmsg[120];
+
+  if(filter->header) {
+    return;
+  }
+  filter->writable = 1;
+  rv = apr_file_open(&f, filter->filename, APR_FOPEN_READ|APR_FOPEN_WRITE|APR_FOPEN_BINARY|(create?APR_FOPEN_CREATE:0),
+                     APR_OS_DEFAULT, filter->pool);
+  if(rv != APR_SUCCESS && !create) {
+    filter->writable = 0;
+    rv = apr_file_open(&f, filter->filename, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, filter->pool);
+  }
+  if(rv != APR_SUCCESS) {
+    if(create) {
+      ctx->set_error(ctx, 500, "failed to create existence filter %s: %s", filter->filename, apr_strerror(rv,errmsg,120));
+    } else {
+      /* the filter hasn't been built yet, requests will go to the cache as usual */
+      ctx->log(ctx, MAPCACHE_INFO, "existence filter %s is not available: %s", filter->filename, apr_strerror(rv,errmsg,120));
+    }
+    return;
+  }
+
+  apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+  if(finfo.size == 0 && create) {
+    _mapcache_existence_filter_init_file(ctx, filter, f);
+    if(GC_HAS_ERROR(ctx)) {
+      apr_file_close(f);
+      return;
+    }
+    apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+  }
+  if(finfo.size < MAPCACHE_FILTER_HEADER_SIZE) {
+    ctx->set_error(ctx, 500, "existence filter %s is truncated", filter->filename);
+    apr_file_close(f);
+    return;
+  }
+
+  rv = apr_mmap_create(&mm, f, 0, finfo.size, APR_MMAP_READ|(filter->writable?APR_MMAP_WRITE:0), filter->pool);
+  apr_file_close(f);
+  if(rv != APR_SUCCESS) {
+    ctx->set_error(ctx, 500, "failed to mmap existence filter %s: %s", filter->filename, apr_strerror(rv,errmsg,120));
+    return;
+  }
+  header = (mapcache_existence_filter_header*)mm->mm;
+  if(memcmp(header->magic, MAPCACHE_FILTER_MAGIC, 8) || header->nbits == 0 || header->nhashes == 0 ||
+      MAPCACHE_FILTER_HEADER_SIZE + header->nbits / 8 > (apr_uint64_t)finfo.size) {
+    ctx->set_error(ctx, 500, "%s is not a valid existence filter", filter->filename);
+    return;
+  }
+  if(header->nbits != filter->nbits || header->nhashes != filter->nhashes) {
+    ctx->log(ctx, MAPCACHE_INFO, "existence filter %s was created with a different size, using the size stored in the file",
+             filter->filename);
+  }
+  filter->nbits = header->nbits;
+  filter->nhashes = header->nhashes;
+  filter->bits = (volatile apr_uint32_t*)((char*)mm->mm + MAPCACHE_FILTER_HEADER_SIZE);
+  filter->header = header;
+}
+
+/**
+ * \brief compute the two base hashes of a tile, from which the nhashes bit positions are derived
+ */
+static void _mapcache_existence_filter_hash(mapcache_tile *tile, apr_uint64_t *h1, apr_uint64_t *h2)
+{
+  char buf[64];
+  apr_uint64_t h = 14695981039346656037ULL; /* FNV-1a */
+  const char *grid = tile->grid_link->grid->name;
+  int i, len;
+
+#define FNV_STR(s) while(*(s)) { h ^= (unsigned char)*(s)++; h *= 1099511628211ULL; }
+  FNV_STR(grid);
+  len = apr_snprintf(buf, sizeof(buf), "/%d/%d/%d", tile->z, tile->x, tile->y);
+  for(i = 0; i < len; i++) {
+    h ^= (unsigned char)buf[i];
+    h *= 1099511628211ULL;
+  }
+  if(tile->dimensions) {
+    for(i = 0; i < tile->dimensions->nelts; i++) {
+      mapcache_requested_dimension *rdim = APR_ARRAY_IDX(tile->dimensions,i,mapcache_requested_dimension*);
+      const char *value = rdim->cached_value?rdim->cached_value:rdim->requested_value;
+      h ^= '#';
+      h *= 1099511628211ULL;
+      if(value) {
+        FNV_STR(value);
+      }
+    }
+  }
+#undef FNV_STR
+  *h1 = h;
+  /* second hash: a finalizer mix of the first one, forced to be odd */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  *h2 = h | 1;
+}
+
+int mapcache_existence_filter_may_contain(mapcache_context *ctx, mapcache_existence_filter *filter, mapcache_tile *tile)
+{
+  apr_uint64_t h1, h2, bit;
+  apr_uint32_t i;
+  if(!filter->header || !filter->header->complete) {
+    return MAPCACHE_TRUE;
+  }
+  _mapcache_existence_filter_hash(tile, &h1, &h2);
+  for(i = 0; i < filter->nhashes; i++) {
+    bit = (h1 + i * h2) % filter->nbits;
+    if(!(apr_atomic_read32(&filter->bits[bit >> 5]) & (1u << (bit & 31)))) {
+      return MAPCACHE_FALSE;
+    }
+  }
+  return MAPCACHE_TRUE;
+}
+
+void mapcache_existence_filter_add(mapcache_context *ctx, mapcache_existence_filter *filter, mapcache_tile *tile)
+{
+  apr_uint64_t h1, h2, bit;
+  apr_uint32_t i, old, mask;
+  volatile apr_uint32_t *word;
+  if(!filter->header || !filter->writable) {
+    return;
+  }
+  _mapcache_existence_filter_hash(tile, &h1, &h2);
+  for(i = 0; i < filter->nhashes; i++) {
+    bit = (h1 + i * h2) % filter->nbits;
+    word = &filter->bits[bit >> 5];
+    mask = 1u << (bit & 31);
+    /* the mapping is shared with other threads and processes */
+    do {
+      old = apr_atomic_read32(word);
+    } while(!(old & mask) && apr_atomic_cas32(word, old | mask, old) != old);
+  }
+}
+
+void mapcache_existence_filter_set_complete(mapcache_context *ctx, mapcache_existence_filter *filter)
+{
+  if(!filter->header || !filter->writable) {
+    ctx->set_error(ctx, 500, "existence filter %s is not writable", filter->filename);
+    return;
+  }
+  filter->header->complete = 1;
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
@@ -82,25 +82,28 @@ int mapcache_image_has_alpha(mapcache_image *img, unsigned int cutoff)
   }
 }
 
-void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_image *overlay)
+typedef struct {
+  mapcache_image *base;
+  mapcache_image *overlay;
+  int starti, startj;
+} _image_merge_args;
+
+/* merge the overlay onto rows [y0,y1) of the base image */
+static void _mapcache_image_merge_rows(void *data, int y0, int y1)
 {
-  int starti,startj;
+  _image_merge_args *args = (_image_merge_args*)data;
+  mapcache_image *base = args->base;
+  mapcache_image *overlay = args->overlay;
+  int starti = args->starti, startj = args->startj;
 #ifdef USE_PIXMAN
   pixman_image_t *si;
   pixman_image_t *bi;
   pixman_transform_t transform;
 #else
-  int i,j;
+  int i,j,i0,i1;
   unsigned char *browptr, *orowptr, *bptr, *optr;
 #endif
 
-  if(base->w < overlay->w || base->h < overlay->h) {
-    ctx->set_error(ctx, 500, "attempting to merge an larger image onto another");
-    return;
-  }
-  
-  starti = (base->h - overlay->h)/2;
-  startj = (base->w - overlay->w)/2;
 #ifdef USE_PIXMAN
   si = pixman_image_create_bits(PIXMAN_a8r8g8b8,overlay->w,overlay->h,
                        (uint32_t*)overlay->data,overlay->stride);
@@ -114,15 +117,17 @@ void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_
     pixman_image_set_transform (si, &transform);
   }
   pixman_image_composite (PIXMAN_OP_OVER, si, NULL, bi,
-                          0, 0, 0, 0, 0, 0, base->w,base->h);
+                          0, y0, 0, 0, 0, y0, base->w,y1-y0);
   pixman_image_unref(si);
   pixman_image_unref(bi);
 #else
+  /* overlay rows that land in [y0,y1) */
+  i0 = MAPCACHE_MAX(0, y0 - starti);
+  i1 = MAPCACHE_MIN(overlay->h, y1 - starti);
 
-
-  browptr = base->data + starti * base->stride + startj*4;
-  orowptr = overlay->data;
-  for(i=0; i<overlay->h; i++) {
+  browptr = base->data + (starti + i0) * base->stride + startj*4;
+  orowptr = overlay->data + i0 * overlay->stride;
+  for(i=i0; i<i1; i++) {
     bptr = browptr;
     optr = orowptr;
     for(j=0; j<overlay->w; j++) {
@@ -157,6 +162,22 @@ void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_
 #endif
 }
 
+void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_image *overlay)
+{
+  _image_merge_args args;
+
+  if(base->w < overlay->w || base->h < overlay->h) {
+    ctx->set_error(ctx, 500, "attempting to merge an larger image onto another");
+    return;
+  }
+
+  args.base = base;
+  args.overlay = overlay;
+  args.starti = (base->h - overlay->h)/2;
+  args.startj = (base->w - overlay->w)/2;
+  mapcache_image_workers_run(ctx, base->w, base->h, 0, _mapcache_image_merge_rows, &args);
+}
+
 #ifndef USE_PIXMAN
 #ifndef _WIN32
 static inline void bilinear_pixel(mapcache_image *img, double x, double y, unsigned char *dst)
@@ -201,9 +222,19 @@ static __inline void bilinear_pixel(mapcache_image *img, double x, double y, uns
 }
 #endif
 
-void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
-    double off_x, double off_y, double scale_x, double scale_y)
+typedef struct {
+  mapcache_image *src;
+  mapcache_image *dst;
+  double off_x, off_y, scale_x, scale_y;
+  int reflect_edges;
+} _image_resample_args;
+
+/* resample the source onto rows [y0,y1) of the destination image */
+static void _mapcache_image_copy_resampled_nearest_rows(void *data, int y0, int y1)
 {
+  _image_resample_args *args = (_image_resample_args*)data;
+  mapcache_image *src = args->src, *dst = args->dst;
+  double off_x = args->off_x, off_y = args->off_y, scale_x = args->scale_x, scale_y = args->scale_y;
 #ifdef USE_PIXMAN
   pixman_image_t *si = pixman_image_create_bits(PIXMAN_a8r8g8b8,src->w,src->h,
                        (uint32_t*)src->data,src->stride);
@@ -215,13 +246,13 @@ void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image
   pixman_image_set_transform (si, &transform);
   pixman_image_set_filter(si,PIXMAN_FILTER_NEAREST, NULL, 0);
   pixman_image_composite (PIXMAN_OP_SRC, si, NULL, bi,
-                          0, 0, 0, 0, 0, 0, dst->w,dst->h);
+                          0, y0, 0, 0, 0, y0, dst->w,y1-y0);
   pixman_image_unref(si);
   pixman_image_unref(bi);
 #else
   int dstx,dsty;
-  unsigned char *dstrowptr = dst->data;
-  for(dsty=0; dsty<dst->h; dsty++) {
+  unsigned char *dstrowptr = dst->data + y0*dst->stride;
+  for(dsty=y0; dsty<y1; dsty++) {
     int *dstptr = (int*)dstrowptr;
     int srcy = (int)(((dsty-off_y)/scale_y)+0.5);
     if(srcy >= 0 && srcy < src->h) {
@@ -238,9 +269,12 @@ void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image
 #endif
 }
 
-void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
-    double off_x, double off_y, double scale_x, double scale_y, int reflect_edges)
+/* resample the source onto rows [y0,y1) of the destination image */
+static void _mapcache_image_copy_resampled_bilinear_rows(void *data, int y0, int y1)
 {
+  _image_resample_args *args = (_image_resample_args*)data;
+  mapcache_image *src = args->src, *dst = args->dst;
+  double off_x = args->off_x, off_y = args->off_y, scale_x = args->scale_x, scale_y = args->scale_y;
 #ifdef USE_PIXMAN
   pixman_image_t *si = pixman_image_create_bits(PIXMAN_a8r8g8b8,src->w,src->h,
                        (uint32_t*)src->data,src->stride);
@@ -250,18 +284,18 @@ void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_imag
   pixman_transform_init_translate(&transform,pixman_double_to_fixed(-off_x),pixman_double_to_fixed(-off_y));
   pixman_transform_scale(&transform,NULL,pixman_double_to_fixed(1.0/scale_x),pixman_double_to_fixed(1.0/scale_y));
   pixman_image_set_transform (si, &transform);
-  if(reflect_edges) {
+  if(args->reflect_edges) {
     pixman_image_set_repeat (si, PIXMAN_REPEAT_REFLECT);
   }
   pixman_image_set_filter(si,PIXMAN_FILTER_BILINEAR, NULL, 0);
   pixman_image_composite (PIXMAN_OP_OVER, si, NULL, bi,
-                          0, 0, 0, 0, 0, 0, dst->w,dst->h);
+                          0, y0, 0, 0, 0, y0, dst->w,y1-y0);
   pixman_image_unref(si);
   pixman_image_unref(bi);
 #else
   int dstx,dsty;
-  unsigned char *dstrowptr = dst->data;
-  for(dsty=0; dsty<dst->h; dsty++) {
+  unsigned char *dstrowptr = dst->data + y0*dst->stride;
+  for(dsty=y0; dsty<y1; dsty++) {
     unsigned char *dstptr = dstrowptr;
     double srcy = (dsty-off_y)/scale_y;
     if(srcy >= 0 && srcy < src->h) {
@@ -278,6 +312,62 @@ void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_imag
 #endif
 }
 
+void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
+    double off_x, double off_y, double scale_x, double scale_y, size_t npixels)
+{
+  _image_resample_args args;
+  args.src = src;
+  args.dst = dst;
+  args.off_x = off_x;
+  args.off_y = off_y;
+  args.scale_x = scale_x;
+  args.scale_y = scale_y;
+  args.reflect_edges = 0;
+  mapcache_image_workers_run(ctx, dst->w, dst->h, npixels, _mapcache_image_copy_resampled_nearest_rows, &args);
+}
+
+void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
+    double off_x, double off_y, double scale_x, double scale_y, int reflect_edges, size_t npixels)
+{
+  _image_resample_args args;
+  args.src = src;
+  args.dst = dst;
+  args.off_x = off_x;
+  args.off_y = off_y;
+  args.scale_x = scale_x;
+  args.scale_y = scale_y;
+  args.reflect_edges = reflect_edges;
+  mapcache_image_workers_run(ctx, dst->w, dst->h, npixels, _mapcache_image_copy_resampled_bilinear_rows, &args);
+}
+
+void mapcache_image_box_reduce(mapcache_image *src, mapcache_image *dst, int factor)
+{
+  int x, y, i, j, c;
+  int n = factor * factor;
+  for(y=0; y<dst->h; y++) {
+    unsigned char *dstptr = dst->data + y*dst->stride;
+    for(x=0; x<dst->w; x++) {
+      unsigned int sum[4] = {0,0,0,0};
+      for(j=0; j<factor; j++) {
+        unsigned char *srcptr = src->data + (y*factor+j)*src->stride + x*factor*4;
+        for(i=0; i<factor; i++) {
+          for(c=0; c<4; c++) {
+            sum[c] += srcptr[c];
+          }
+          srcptr += 4;
+        }
+      }
+      /* pixels are premultiplied, so averaging the channels independently is correct */
+      for(c=0; c<4; c++) {
+        dstptr[c] = (sum[c] + n/2) / n;
+      }
+      dstptr += 4;
+    }
+  }
+  dst->has_alpha = src->has_alpha;
+  dst->is_blank = src->is_blank;
+}
+
 void mapcache_image_metatile_split(mapcache_context *ctx, mapcache_metatile *mt)
 {
 
@@ -0,0 +1,285 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching: in-memory cache of decoded tiles
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+ * A per-process, size bounded, least recently used cache of decoded tiles,
+ * shared by all the threads of the process. It avoids decoding the same
+ * tiles over and over again when assembling maps for panning clients.
+ *
+ * Entries are keyed on the tile's identity (tileset, grid, z/x/y and
+ * dimensions) and are only reused if the tile's modification time and a hash
+ * of its encoded data match, so updated tiles are never served stale. Callers
+ * always get a private copy of the pixels, which they may modify.
+ */
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <apr_hash.h>
+#include <string.h>
+#include <stdlib.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+typedef struct mapcache_decoded_tile mapcache_decoded_tile;
+
+struct mapcache_decoded_tile {
+  char *key;
+  apr_time_t mtime;
+  apr_size_t encoded_size;
+  apr_uint64_t digest; /**< hash of the encoded data */
+  size_t w, h;
+  mapcache_image_alpha_type has_alpha;
+  mapcache_image_blank_type is_blank;
+  unsigned char *data; /**< w*h*4 bytes of pixel data */
+  mapcache_decoded_tile *prev, *next;
+};
+
+struct mapcache_decoded_tile_cache {
+  apr_hash_t *entries;
+  mapcache_decoded_tile *head; /**< most recently used entry */
+  mapcache_decoded_tile *tail; /**< least recently used entry */
+  size_t size;
+  size_t max_size;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+static void _decoded_tile_free(mapcache_decoded_tile *entry)
+{
+  free(entry->key);
+  free(entry->data);
+  free(entry);
+}
+
+static void _decoded_tile_unlink(mapcache_decoded_tile_cache *cache, mapcache_decoded_tile *entry)
+{
+  if(entry->prev) entry->prev->next = entry->next;
+  else cache->head = entry->next;
+  if(entry->next) entry->next->prev = entry->prev;
+  else cache->tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+static void _decoded_tile_push_front(mapcache_decoded_tile_cache *cache, mapcache_decoded_tile *entry)
+{
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if(cache->head) cache->head->prev = entry;
+  cache->head = entry;
+  if(!cache->tail) cache->tail = entry;
+}
+
+static void _decoded_tile_remove(mapcache_decoded_tile_cache *cache, mapcache_decoded_tile *entry)
+{
+  _decoded_tile_unlink(cache, entry);
+  apr_hash_set(cache->entries, entry->key, APR_HASH_KEY_STRING, NULL);
+  cache->size -= entry->w * entry->h * 4;
+  _decoded_tile_free(entry);
+}
+
+static apr_status_t _decoded_tile_cache_cleanup(void *data)
+{
+  mapcache_decoded_tile_cache *cache = (mapcache_decoded_tile_cache*)data;
+  while(cache->head) {
+    _decoded_tile_remove(cache, cache->head);
+  }
+  return APR_SUCCESS;
+}
+
+mapcache_decoded_tile_cache* mapcache_decoded_tile_cache_create(apr_pool_t *pool, size_t max_size)
+{
+  mapcache_decoded_tile_cache *cache = apr_pcalloc(pool, sizeof(mapcache_decoded_tile_cache));
+  cache->entries = apr_hash_make(pool);
+  cache->max_size = max_size;
+#if APR_HAS_THREADS
+  apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+#endif
+  apr_pool_cleanup_register(pool, cache, _decoded_tile_cache_cleanup, apr_pool_cleanup_null);
+  return cache;
+}
+
+static void _decoded_tile_cache_lock(mapcache_decoded_tile_cache *cache)
+{
+#if APR_HAS_THREADS
+  if(cache->mutex) apr_thread_mutex_lock(cache->mutex);
+#endif
+}
+
+static void _decoded_tile_cache_unlock(mapcache_decoded_tile_cache *cache)
+{
+#if APR_HAS_THREADS
+  if(cache->mutex) apr_thread_mutex_unlock(cache->mutex);
+#endif
+}
+
+static char* _decoded_tile_key(mapcache_context *ctx, mapcache_tile *tile)
+{
+  return apr_psprintf(ctx->pool, "%s/%s/%d/%d/%d/%s", tile->tileset->name, tile->grid_link->grid->name,
+                      tile->z, tile->x, tile->y, mapcache_util_get_tile_dimkey(ctx, tile, NULL, NULL));
+}
+
+static apr_uint64_t _decoded_tile_digest(mapcache_buffer *buffer)
+{
+  apr_uint64_t h = 14695981039346656037ULL; /* FNV-1a */
+  const unsigned char *p = buffer->buf;
+  size_t i;
+  for(i = 0; i < buffer->size; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+ * \brief copy the cached pixels of the tile into dst, whose dimensions must be set
+ * \returns MAPCACHE_FALSE if the tile isn't cached (or was modified since it was cached)
+ */
+static int _decoded_tile_cache_get(mapcache_context *ctx, mapcache_decoded_tile_cache *cache, mapcache_tile *tile,
+                                   char *key, apr_uint64_t digest, mapcache_image *dst)
+{
+  mapcache_decoded_tile *entry;
+  size_t r;
+  int ret = MAPCACHE_FALSE;
+
+  _decoded_tile_cache_lock(cache);
+  entry = apr_hash_get(cache->entries, key, APR_HASH_KEY_STRING);
+  if(entry) {
+    if(entry->mtime != tile->mtime || entry->encoded_size != tile->encoded_data->size || entry->digest != digest ||
+        entry->w != dst->w || entry->h != dst->h) {
+      /* the tile has been updated */
+      _decoded_tile_remove(cache, entry);
+    } else {
+      for(r = 0; r < entry->h; r++) {
+        memcpy(dst->data + r * dst->stride, entry->data + r * entry->w * 4, entry->w * 4);
+      }
+      dst->has_alpha = entry->has_alpha;
+      dst->is_blank = entry->is_blank;
+      _decoded_tile_unlink(cache, entry);
+      _decoded_tile_push_front(cache, entry);
+      ret = MAPCACHE_TRUE;
+    }
+  }
+  _decoded_tile_cache_unlock(cache);
+  return ret;
+}
+
+static void _decoded_tile_cache_put(mapcache_context *ctx, mapcache_decoded_tile_cache *cache, mapcache_tile *tile,
+                                    char *key, apr_uint64_t digest, mapcache_image *src)
+{
+  mapcache_decoded_tile *entry;
+  size_t r, cost = src->w * src->h * 4;
+
+  if(cost > cache->max_size / 8) {
+    /* don't let a single image flush most of the cache */
+    return;
+  }
+  entry = calloc(1, sizeof(mapcache_decoded_tile));
+  if(!entry) return;
+  entry->key = strdup(key);
+  entry->data = malloc(cost);
+  if(!entry->key || !entry->data) {
+    _decoded_tile_free(entry);
+    return;
+  }
+  entry->mtime = tile->mtime;
+  entry->encoded_size = tile->encoded_data->size;
+  entry->digest = digest;
+  entry->w = src->w;
+  entry->h = src->h;
+  entry->has_alpha = src->has_alpha;
+  entry->is_blank = src->is_blank;
+  for(r = 0; r < src->h; r++) {
+    memcpy(entry->data + r * src->w * 4, src->data + r * src->stride, src->w * 4);
+  }
+
+  _decoded_tile_cache_lock(cache);
+  {
+    mapcache_decoded_tile *existing = apr_hash_get(cache->entries, key, APR_HASH_KEY_STRING);
+    if(existing) {
+      /* another thread decoded the same tile concurrently, or the tile was updated */
+      _decoded_tile_remove(cache, existing);
+    }
+  }
+  while(cache->tail && cache->size + cost > cache->max_size) {
+    _decoded_tile_remove(cache, cache->tail);
+  }
+  apr_hash_set(cache->entries, entry->key, APR_HASH_KEY_STRING, entry);
+  _decoded_tile_push_front(cache, entry);
+  cache->size += cost;
+  _decoded_tile_cache_unlock(cache);
+}
+
+void mapcache_tile_decode_to_image(mapcache_context *ctx, mapcache_tile *tile, mapcache_image *dst)
+{
+  mapcache_decoded_tile_cache *cache = ctx->config?ctx->config->decoded_tile_cache:NULL;
+  apr_uint64_t digest;
+  char *key;
+
+  if(!cache || !tile->encoded_data) {
+    mapcache_imageio_decode_to_image(ctx, tile->encoded_data, dst);
+    return;
+  }
+  key = _decoded_tile_key(ctx, tile);
+  digest = _decoded_tile_digest(tile->encoded_data);
+  if(_decoded_tile_cache_get(ctx, cache, tile, key, digest, dst) == MAPCACHE_TRUE) {
+    return;
+  }
+  mapcache_imageio_decode_to_image(ctx, tile->encoded_data, dst);
+  GC_CHECK_ERROR(ctx);
+  _decoded_tile_cache_put(ctx, cache, tile, key, digest, dst);
+}
+
+mapcache_image* mapcache_tile_decode(mapcache_context *ctx, mapcache_tile *tile)
+{
+  mapcache_decoded_tile_cache *cache = ctx->config?ctx->config->decoded_tile_cache:NULL;
+  mapcache_image *image;
+  apr_uint64_t digest;
+  char *key;
+
+  if(!cache) {
+    return mapcache_imageio_decode(ctx, tile->encoded_data);
+  }
+  key = _decoded_tile_key(ctx, tile);
+  digest = _decoded_tile_digest(tile->encoded_data);
+  image = mapcache_image_create_with_data(ctx, tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy);
+  if(_decoded_tile_cache_get(ctx, cache, tile, key, digest, image) == MAPCACHE_TRUE) {
+    return image;
+  }
+  apr_pool_cleanup_run(ctx->pool, image->data, (void*)free);
+  image = mapcache_imageio_decode(ctx, tile->encoded_data);
+  if(!image) {
+    return NULL;
+  }
+  _decoded_tile_cache_put(ctx, cache, tile, key, digest, image);
+  return image;
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
@@ -0,0 +1,207 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching: parallel processing of large images
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+ * A per-process pool of threads used to run the pixel kernels (resampling,
+ * merging) on large images. The destination image is split into horizontal
+ * bands that are processed concurrently, the calling thread processing the
+ * first one itself. Each destination pixel is computed by exactly the same
+ * code as in the single threaded case, so the output does not depend on the
+ * number of threads.
+ *
+ * The threads are only started on first use, i.e. after the apache module has
+ * forked its children.
+ */
+
+#include "mapcache.h"
+#if APR_HAS_THREADS
+#include "apu_version.h"
+#if (APU_MAJOR_VERSION <= 1 && APU_MINOR_VERSION <= 3)
+#define USE_THREADPOOL 0
+#else
+#define USE_THREADPOOL 1
+#endif
+#else
+#define USE_THREADPOOL 0
+#endif
+
+#if USE_THREADPOOL
+#include <apr_thread_pool.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#endif
+
+/* don't hand out bands smaller than this number of rows to the workers */
+#define MAPCACHE_IMAGE_MIN_BAND_ROWS 32
+
+struct mapcache_image_workers {
+  int nthreads;
+  size_t min_pixels;
+#if USE_THREADPOOL
+  apr_pool_t *pool;
+  apr_thread_mutex_t *mutex;
+  apr_thread_pool_t *thread_pool; /* created on first use */
+  int failed;
+#endif
+};
+
+#if USE_THREADPOOL
+typedef struct {
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t *cond;
+  int pending;
+} _image_band_batch;
+
+typedef struct {
+  mapcache_image_band_func func;
+  void *data;
+  int y0, y1;
+  _image_band_batch *batch;
+} _image_band_job;
+
+static void* APR_THREAD_FUNC _image_band_thread(apr_thread_t *thread, void *data)
+{
+  _image_band_job *job = (_image_band_job*)data;
+  job->func(job->data, job->y0, job->y1);
+  apr_thread_mutex_lock(job->batch->mutex);
+  if(--job->batch->pending == 0) {
+    apr_thread_cond_signal(job->batch->cond);
+  }
+  apr_thread_mutex_unlock(job->batch->mutex);
+  return NULL;
+}
+
+static apr_thread_pool_t* _image_workers_get_pool(mapcache_image_workers *workers)
+{
+  apr_thread_pool_t *tp;
+  apr_thread_mutex_lock(workers->mutex);
+  if(!workers->thread_pool && !workers->failed) {
+    /* the calling thread processes one of the bands, hence nthreads-1 workers */
+    if(apr_thread_pool_create(&workers->thread_pool, 0, workers->nthreads - 1, workers->pool) != APR_SUCCESS) {
+      workers->thread_pool = NULL;
+      workers->failed = 1;
+    }
+  }
+  tp = workers->thread_pool;
+  apr_thread_mutex_unlock(workers->mutex);
+  return tp;
+}
+
+static apr_status_t _image_workers_cleanup(void *data)
+{
+  mapcache_image_workers *workers = (mapcache_image_workers*)data;
+  if(workers->thread_pool) {
+    apr_thread_pool_destroy(workers->thread_pool);
+    workers->thread_pool = NULL;
+  }
+  return APR_SUCCESS;
+}
+#endif
+
+mapcache_image_workers* mapcache_image_workers_create(apr_pool_t *pool, int nthreads, size_t min_pixels)
+{
+  mapcache_image_workers *workers = apr_pcalloc(pool, sizeof(mapcache_image_workers));
+  workers->nthreads = nthreads;
+  workers->min_pixels = min_pixels;
+#if USE_THREADPOOL
+  apr_pool_create(&workers->pool, pool);
+  apr_thread_mutex_create(&workers->mutex, APR_THREAD_MUTEX_DEFAULT, workers->pool);
+  apr_pool_cleanup_register(workers->pool, workers, _image_workers_cleanup, apr_pool_cleanup_null);
+#endif
+  return workers;
+}
+
+void mapcache_image_workers_run(mapcache_context *ctx, int width, int height, size_t npixels,
+                                mapcache_image_band_func func, void *data)
+{
+#if USE_THREADPOOL
+  mapcache_image_workers *workers = (ctx && ctx->config)?ctx->config->image_workers:NULL;
+  apr_thread_pool_t *tp;
+  _image_band_batch batch;
+  _image_band_job *jobs;
+  int nbands, band_rows, i;
+
+  if(!npixels) {
+    npixels = (size_t)width * height;
+  }
+  if(!workers || workers->nthreads < 2 || npixels < workers->min_pixels ||
+      height < 2 * MAPCACHE_IMAGE_MIN_BAND_ROWS) {
+    func(data, 0, height);
+    return;
+  }
+  nbands = MAPCACHE_MIN(workers->nthreads, height / MAPCACHE_IMAGE_MIN_BAND_ROWS);
+  tp = _image_workers_get_pool(workers);
+  if(!tp || apr_thread_mutex_create(&batch.mutex, APR_THREAD_MUTEX_DEFAULT, ctx->pool) != APR_SUCCESS ||
+      apr_thread_cond_create(&batch.cond, ctx->pool) != APR_SUCCESS) {
+    func(data, 0, height);
+    return;
+  }
+  band_rows = (height + nbands - 1) / nbands;
+  jobs = apr_pcalloc(ctx->pool, nbands * sizeof(_image_band_job));
+  batch.pending = 0;
+  for(i = 0; i < nbands; i++) {
+    jobs[i].func = func;
+    jobs[i].data = data;
+    jobs[i].y0 = i * band_rows;
+    jobs[i].y1 = MAPCACHE_MIN(height, (i + 1) * band_rows);
+    jobs[i].batch = &batch;
+  }
+
+  apr_thread_mutex_lock(batch.mutex);
+  for(i = 1; i < nbands; i++) {
+    if(jobs[i].y0 >= jobs[i].y1) continue;
+    if(apr_thread_pool_push(tp, _image_band_thread, &jobs[i], APR_THREAD_TASK_PRIORITY_NORMAL, NULL) == APR_SUCCESS) {
+      batch.pending++;
+    } else {
+      /* process it ourselves */
+      jobs[i].batch = NULL;
+    }
+  }
+  apr_thread_mutex_unlock(batch.mutex);
+
+  func(data, jobs[0].y0, jobs[0].y1);
+  for(i = 1; i < nbands; i++) {
+    if(!jobs[i].batch && jobs[i].y0 < jobs[i].y1) {
+      func(data, jobs[i].y0, jobs[i].y1);
+    }
+  }
+
+  apr_thread_mutex_lock(batch.mutex);
+  while(batch.pending > 0) {
+    apr_thread_cond_wait(batch.cond, batch.mutex);
+  }
+  apr_thread_mutex_unlock(batch.mutex);
+  apr_thread_cond_destroy(batch.cond);
+  apr_thread_mutex_destroy(batch.mutex);
+#else
+  func(data, 0, height);
+#endif
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
@@ -30,6 +30,7 @@
 #include "mapcache.h"
 #include <png.h>
 #include <jpeglib.h>
+#include <string.h>
 
 /**\addtogroup imageio*/
 /** @{ */
@@ -37,7 +38,7 @@
 int mapcache_imageio_is_valid_format(mapcache_context *ctx, mapcache_buffer *buffer)
 {
   mapcache_image_format_type t = mapcache_imageio_header_sniff(ctx,buffer);
-  if(t==GC_PNG || t==GC_JPEG) {
+  if(t==GC_PNG || t==GC_JPEG || t==GC_WEBP) {
     return MAPCACHE_TRUE;
   } else {
     return MAPCACHE_FALSE;
@@ -53,6 +54,8 @@ mapcache_image_format_type mapcache_imageio_header_sniff(mapcache_context *ctx,
     return GC_PNG;
   } else if(buffer->size >= 2 && ((unsigned char*)buffer->buf)[0] == 0xFF && ((unsigned char*)buffer->buf)[1] == 0xD8) {
     return GC_JPEG;
+  } else if(buffer->size >= 16 && !memcmp(buffer->buf, "RIFF", 4) && !memcmp((char*)buffer->buf + 8, "WEBPVP8", 7)) {
+    return GC_WEBP;
   } else {
     return GC_UNKNOWN;
   }
@@ -88,6 +91,19 @@ mapcache_image_alpha_type mapcache_imageio_alpha_sniff(mapcache_context *ctx, ma
         alpha_type = MC_ALPHA_UNKNOWN;
       }
       break;
+    case GC_WEBP:
+      alpha_type = MC_ALPHA_UNKNOWN;
+      if (b[15] == ' ') {
+        // Simple lossy file, no alpha plane
+        alpha_type = MC_ALPHA_NO;
+      } else if (b[15] == 'L' && buffer->size >= 25 && b[20] == 0x2f) {
+        // Lossless bitstream: alpha_is_used bit follows the 14 bit width and height
+        alpha_type = (b[24] & 0x10) ? MC_ALPHA_YES : MC_ALPHA_NO;
+      } else if (b[15] == 'X' && buffer->size >= 21) {
+        // Extended file: alpha flag in the VP8X chunk
+        alpha_type = (b[20] & 0x10) ? MC_ALPHA_YES : MC_ALPHA_NO;
+      }
+      break;
     default:
       alpha_type = MC_ALPHA_UNKNOWN;
       break;
@@ -102,6 +118,8 @@ mapcache_image* mapcache_imageio_decode(mapcache_context *ctx, mapcache_buffer *
     return _mapcache_imageio_png_decode(ctx,buffer);
   } else if(type == GC_JPEG) {
     return _mapcache_imageio_jpeg_decode(ctx,buffer);
+  } else if(type == GC_WEBP) {
+    return _mapcache_imageio_webp_decode(ctx,buffer);
   } else {
     ctx->set_error(ctx, 500, "mapcache_imageio_decode: unrecognized image format");
     return NULL;
@@ -112,8 +130,9 @@ void mapcache_image_create_empty(mapcache_context *ctx, mapcache_cfg *cfg)
 {
   unsigned int color=0;
 
-  /* create a transparent image for PNG, and a white one for jpeg */
-  if(cfg->default_image_format->mime_type && !strstr(cfg->default_image_format->mime_type,"png")) {
+  /* create a transparent image for PNG and WebP, and a white one for jpeg */
+  if(cfg->default_image_format->mime_type && !strstr(cfg->default_image_format->mime_type,"png") &&
+      !strstr(cfg->default_image_format->mime_type,"webp")) {
     color = 0xffffffff;
   }
   cfg->empty_image = cfg->default_image_format->create_empty_image(ctx, cfg->default_image_format,
@@ -129,12 +148,38 @@ void mapcache_imageio_decode_to_image(mapcache_context *ctx, mapcache_buffer *bu
     _mapcache_imageio_png_decode_to_image(ctx,buffer,image);
   } else if(type == GC_JPEG) {
     _mapcache_imageio_jpeg_decode_to_image(ctx,buffer,image);
+  } else if(type == GC_WEBP) {
+    _mapcache_imageio_webp_decode_to_image(ctx,buffer,image);
   } else {
     ctx->set_error(ctx, 500, "mapcache_imageio_decode: unrecognized image format");
   }
   return;
 }
 
+void mapcache_imageio_decode_to_image_scaled(mapcache_context *ctx, mapcache_buffer *buffer,
+    mapcache_image *image, int scale_denom)
+{
+  mapcache_image_format_type type;
+  mapcache_image *full;
+  if(scale_denom <= 1) {
+    mapcache_imageio_decode_to_image(ctx,buffer,image);
+    return;
+  }
+  type = mapcache_imageio_header_sniff(ctx,buffer);
+  if(type == GC_JPEG) {
+    _mapcache_imageio_jpeg_decode_to_image_scaled(ctx,buffer,image,scale_denom);
+    return;
+  }
+  full = mapcache_imageio_decode(ctx,buffer);
+  GC_CHECK_ERROR(ctx);
+  if(full->w / scale_denom < image->w || full->h / scale_denom < image->h) {
+    ctx->set_error(ctx, 500, "mapcache_imageio_decode_to_image_scaled: image is smaller than expected");
+  } else {
+    mapcache_image_box_reduce(full,image,scale_denom);
+  }
+  apr_pool_cleanup_run(ctx->pool, full->data, (void*)free);
+}
+
 /** @} */
 
 /* vim: ts=2 sts=2 et sw=2
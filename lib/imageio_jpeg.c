@@ -176,8 +176,14 @@ mapcache_buffer* _mapcache_imageio_jpeg_encode(mapcache_context *ctx, mapcache_i
 
   cinfo.image_width = img->w;
   cinfo.image_height = img->h;
+#ifdef HAVE_JPEG_EXT_COLORSPACES
+  /* libjpeg-turbo reads our BGRA pixels directly, ignoring the alpha byte */
+  cinfo.input_components = 4;
+  cinfo.in_color_space = JCS_EXT_BGRX;
+#else
   cinfo.input_components = 3;
   cinfo.in_color_space = JCS_RGB;
+#endif
   jpeg_set_defaults(&cinfo);
   jpeg_set_quality(&cinfo, ((mapcache_image_format_jpeg*)format)->quality, TRUE);
   switch(((mapcache_image_format_jpeg*)format)->photometric) {
@@ -202,6 +208,14 @@ mapcache_buffer* _mapcache_imageio_jpeg_encode(mapcache_context *ctx, mapcache_i
   }
   jpeg_start_compress(&cinfo, TRUE);
 
+#ifdef HAVE_JPEG_EXT_COLORSPACES
+  for(row=0; row<img->h; row++) {
+    rowdata = (JSAMPLE*)&(img->data[row*img->stride]);
+    (void) jpeg_write_scanlines(&cinfo, &rowdata, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+#else
   rowdata = (JSAMPLE*)malloc(img->w*cinfo.input_components*sizeof(JSAMPLE));
   for(row=0; row<img->h; row++) {
     JSAMPLE *pixptr = rowdata;
@@ -226,11 +240,164 @@ mapcache_buffer* _mapcache_imageio_jpeg_encode(mapcache_context *ctx, mapcache_i
   jpeg_finish_compress(&cinfo);
   jpeg_destroy_compress(&cinfo);
   free(rowdata);
+#endif
   return buffer;
 }
 
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  unsigned char *data;
+  mapcache_context *ctx;
+  mapcache_stream_write_func write;
+  void *write_data;
+} _mapcache_jpeg_stream_destination_mgr;
+
+typedef struct {
+  mapcache_image_stream stream;
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  JSAMPLE *rowdata;
+  int started;
+} _mapcache_jpeg_stream;
+
+static void _mapcache_imageio_jpeg_stream_term_destination (j_compress_ptr cinfo)
+{
+  _mapcache_jpeg_stream_destination_mgr *dest = (_mapcache_jpeg_stream_destination_mgr*) cinfo->dest;
+  dest->write(dest->ctx, dest->write_data, dest->data, OUTPUT_BUF_SIZE-dest->pub.free_in_buffer);
+  dest->pub.next_output_byte = dest->data;
+  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+}
+
+static int _mapcache_imageio_jpeg_stream_empty_output_buffer (j_compress_ptr cinfo)
+{
+  _mapcache_jpeg_stream_destination_mgr *dest = (_mapcache_jpeg_stream_destination_mgr*) cinfo->dest;
+  dest->write(dest->ctx, dest->write_data, dest->data, OUTPUT_BUF_SIZE);
+  dest->pub.next_output_byte = dest->data;
+  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  return TRUE;
+}
+
+static apr_status_t _mapcache_imageio_jpeg_stream_cleanup(void *data)
+{
+  _mapcache_jpeg_stream *js = (_mapcache_jpeg_stream*)data;
+  if(js->started) {
+    jpeg_destroy_compress(&js->cinfo);
+    free(js->rowdata);
+    js->started = 0;
+  }
+  return APR_SUCCESS;
+}
+
+static void _mapcache_imageio_jpeg_stream_write_rows(mapcache_context *ctx, mapcache_image_stream *stream, mapcache_image *band)
+{
+  _mapcache_jpeg_stream *js = (_mapcache_jpeg_stream*)stream;
+  unsigned int row;
+  if(!js->started) return;
+  ((_mapcache_jpeg_stream_destination_mgr*)js->cinfo.dest)->ctx = ctx;
+#ifdef HAVE_JPEG_EXT_COLORSPACES
+  for(row=0; row<band->h; row++) {
+    JSAMPROW rowptr = (JSAMPROW)&(band->data[row*band->stride]);
+    (void) jpeg_write_scanlines(&js->cinfo, &rowptr, 1);
+  }
+#else
+  for(row=0; row<band->h; row++) {
+    JSAMPLE *pixptr = js->rowdata;
+    int col;
+    unsigned char *r,*g,*b;
+    r=&(band->data[2])+row*band->stride;
+    g=&(band->data[1])+row*band->stride;
+    b=&(band->data[0])+row*band->stride;
+    for(col=0; col<band->w; col++) {
+      *(pixptr++) = *r;
+      *(pixptr++) = *g;
+      *(pixptr++) = *b;
+      r+=4;
+      g+=4;
+      b+=4;
+    }
+    (void) jpeg_write_scanlines(&js->cinfo, &js->rowdata, 1);
+  }
+#endif
+}
+
+static void _mapcache_imageio_jpeg_stream_finish(mapcache_context *ctx, mapcache_image_stream *stream)
+{
+  _mapcache_jpeg_stream *js = (_mapcache_jpeg_stream*)stream;
+  if(!js->started) return;
+  ((_mapcache_jpeg_stream_destination_mgr*)js->cinfo.dest)->ctx = ctx;
+  jpeg_finish_compress(&js->cinfo);
+  _mapcache_imageio_jpeg_stream_cleanup(js);
+}
+
+/**
+ * \brief start an incremental JPEG encoding
+ *
+ * huffman table optimization requires the whole image to be buffered by libjpeg, so it
+ * is not applied to streamed images.
+ * \private \memberof mapcache_image_format_jpeg
+ * \sa mapcache_image_format::stream()
+ */
+static mapcache_image_stream* _mapcache_imageio_jpeg_stream(mapcache_context *ctx, mapcache_image_format *format,
+    int width, int height, mapcache_stream_write_func write, void *write_data)
+{
+  _mapcache_jpeg_stream *js = apr_pcalloc(ctx->pool, sizeof(_mapcache_jpeg_stream));
+  _mapcache_jpeg_stream_destination_mgr *dest;
+  js->stream.write_rows = _mapcache_imageio_jpeg_stream_write_rows;
+  js->stream.finish = _mapcache_imageio_jpeg_stream_finish;
+  js->cinfo.err = jpeg_std_error(&js->jerr);
+  jpeg_create_compress(&js->cinfo);
+
+  dest = (_mapcache_jpeg_stream_destination_mgr*)(*js->cinfo.mem->alloc_small) (
+           (j_common_ptr) &js->cinfo, JPOOL_PERMANENT,
+           sizeof (_mapcache_jpeg_stream_destination_mgr));
+  dest->pub.init_destination = _mapcache_imageio_jpeg_init_destination;
+  dest->pub.empty_output_buffer = _mapcache_imageio_jpeg_stream_empty_output_buffer;
+  dest->pub.term_destination = _mapcache_imageio_jpeg_stream_term_destination;
+  dest->ctx = ctx;
+  dest->write = write;
+  dest->write_data = write_data;
+  js->cinfo.dest = (struct jpeg_destination_mgr *)dest;
+
+  js->cinfo.image_width = width;
+  js->cinfo.image_height = height;
+#ifdef HAVE_JPEG_EXT_COLORSPACES
+  js->cinfo.input_components = 4;
+  js->cinfo.in_color_space = JCS_EXT_BGRX;
+#else
+  js->cinfo.input_components = 3;
+  js->cinfo.in_color_space = JCS_RGB;
+#endif
+  jpeg_set_defaults(&js->cinfo);
+  jpeg_set_quality(&js->cinfo, ((mapcache_image_format_jpeg*)format)->quality, TRUE);
+  switch(((mapcache_image_format_jpeg*)format)->photometric) {
+    case MAPCACHE_PHOTOMETRIC_RGB:
+      jpeg_set_colorspace(&js->cinfo, JCS_RGB);
+      break;
+    case MAPCACHE_PHOTOMETRIC_YCBCR:
+    default:
+      jpeg_set_colorspace(&js->cinfo, JCS_YCbCr);
+  }
+  js->cinfo.optimize_coding = FALSE;
+  if(((mapcache_image_format_jpeg*)format)->optimize == MAPCACHE_OPTIMIZE_ARITHMETIC) {
+    js->cinfo.arith_code = TRUE;
+  }
+#ifndef HAVE_JPEG_EXT_COLORSPACES
+  js->rowdata = (JSAMPLE*)malloc(width*js->cinfo.input_components*sizeof(JSAMPLE));
+#endif
+  js->started = 1;
+  apr_pool_cleanup_register(ctx->pool, js, _mapcache_imageio_jpeg_stream_cleanup, apr_pool_cleanup_null);
+  jpeg_start_compress(&js->cinfo, TRUE);
+  return (mapcache_image_stream*)js;
+}
+
 void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *r, mapcache_buffer *buffer,
     mapcache_image *img)
+{
+  _mapcache_imageio_jpeg_decode_to_image_scaled(r, buffer, img, 1);
+}
+
+void _mapcache_imageio_jpeg_decode_to_image_scaled(mapcache_context *r, mapcache_buffer *buffer,
+    mapcache_image *img, int scale_denom)
 {
   int s;
   struct jpeg_decompress_struct cinfo = {NULL};
@@ -245,7 +412,24 @@ void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *r, mapcache_buffer
 
   img->has_alpha = MC_ALPHA_NO;
   jpeg_read_header(&cinfo, TRUE);
+  if(scale_denom > 1) {
+    /* let libjpeg skip the high frequency DCT coefficients we'd otherwise throw away when downsampling */
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale_denom;
+  }
+#ifdef HAVE_JPEG_EXT_COLORSPACES
+  if(cinfo.jpeg_color_space == JCS_GRAYSCALE || cinfo.jpeg_color_space == JCS_YCbCr || cinfo.jpeg_color_space == JCS_RGB) {
+    /* have libjpeg-turbo write BGRA pixels (with an opaque alpha) straight into the destination rows */
+    cinfo.out_color_space = JCS_EXT_BGRA;
+  }
+#endif
   jpeg_start_decompress(&cinfo);
+  if(scale_denom > 1 && img->data && (cinfo.output_width > img->w || cinfo.output_height > img->h)) {
+    r->set_error(r, 500, "jpeg image is larger than expected (%dx%d at 1/%d)",
+                 cinfo.output_width, cinfo.output_height, scale_denom);
+    jpeg_destroy_decompress(&cinfo);
+    return;
+  }
   img->w = cinfo.output_width;
   img->h = cinfo.output_height;
   s = cinfo.output_components;
@@ -255,6 +439,18 @@ void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *r, mapcache_buffer
     img->stride = img->w * 4;
   }
 
+#ifdef HAVE_JPEG_EXT_COLORSPACES
+  if(cinfo.out_color_space == JCS_EXT_BGRA) {
+    while ((int)cinfo.output_scanline < img->h) {
+      JSAMPROW rowptr = (JSAMPROW)&img->data[cinfo.output_scanline * img->stride];
+      jpeg_read_scanlines(&cinfo, &rowptr, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return;
+  }
+#endif
+
   temp = malloc(img->w*s);
   apr_pool_cleanup_register(r->pool, temp, (void*)free, apr_pool_cleanup_null) ;
   while ((int)cinfo.output_scanline < img->h) {
@@ -339,6 +535,7 @@ mapcache_image_format* mapcache_imageio_create_jpeg_format(apr_pool_t *pool, cha
   format->format.metadata = apr_table_make(pool,3);
   format->format.create_empty_image = _mapcache_imageio_jpg_create_empty;
   format->format.write = _mapcache_imageio_jpeg_encode;
+  format->format.stream = _mapcache_imageio_jpeg_stream;
   format->quality = quality;
   format->optimize = optimize;
   format->photometric = photometric;
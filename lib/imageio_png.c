@@ -31,6 +31,11 @@
 #include "mapcache.h"
 #include <png.h>
 #include <apr_strings.h>
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
 
 #ifdef _WIN32
 typedef unsigned char     uint8_t;
@@ -284,11 +289,9 @@ mapcache_buffer* mapcache_empty_png_decode(mapcache_context *ctx, int width, int
     }
     encoded_data->size = sizeof(empty_png_512);
   } else {
-    /* here for compatibility reasons, although this should not be used in production as it is cpu-heavy */
-    mapcache_image *rgba = mapcache_image_create_with_data(ctx,width,height);
+    /* no template for this size: the palette png is encoded once per color and size, and then shared */
     mapcache_image_format *format = mapcache_configuration_get_image_format(ctx->config,"PNG8");
-    mapcache_image_fill(ctx,rgba,hex_color+1);
-    encoded_data = format->write(ctx,rgba,format);
+    encoded_data = mapcache_uniform_tile_encode(ctx,format,width,height,hex_color+1);
   }
   if(hex_color[4] == 0) {
     *is_empty = 1;
@@ -494,6 +497,215 @@ xrgb_to_rgbx (png_structp png, png_row_infop row_info, png_bytep data)
 
 
 
+/**
+ * \brief apply the compression level and row filter of the format to a libpng write struct
+ */
+static void _mapcache_imageio_png_set_compression(png_structp png_ptr, mapcache_image_format_png *format)
+{
+  static const int filters[] = {
+    PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH, PNG_ALL_FILTERS
+  };
+  if(format->compression_level == MAPCACHE_COMPRESSION_BEST)
+    png_set_compression_level (png_ptr, Z_BEST_COMPRESSION);
+  else if(format->compression_level == MAPCACHE_COMPRESSION_FAST)
+    png_set_compression_level (png_ptr, Z_BEST_SPEED);
+  else if(format->compression_level == MAPCACHE_COMPRESSION_DISABLE)
+    png_set_compression_level (png_ptr, Z_NO_COMPRESSION);
+  png_set_filter(png_ptr,0,filters[format->filter]);
+}
+
+#ifdef USE_LIBDEFLATE
+
+/*
+ * A minimal RGB(A) png writer compressing the IDAT stream with libdeflate, which is
+ * several times faster than zlib at a comparable (or better) compression ratio. libpng
+ * does not allow replacing its deflate implementation, hence the image is filtered and
+ * the chunks are written here.
+ */
+
+static void _png_put_uint32(unsigned char *p, apr_uint32_t v)
+{
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+/* write the crc of a chunk of len bytes starting at its type field */
+static void _png_put_crc(unsigned char *chunk_type, size_t len)
+{
+  _png_put_uint32(chunk_type + 4 + len, libdeflate_crc32(0, chunk_type, 4 + len));
+}
+
+static unsigned char _png_paeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if(pa <= pb && pa <= pc) return a;
+  if(pb <= pc) return b;
+  return c;
+}
+
+/* filter a row of len bytes with the given png filter type, prev is the previous unfiltered row */
+static void _png_filter_row(int type, const unsigned char *cur, const unsigned char *prev,
+                            unsigned char *out, size_t len, int bpp)
+{
+  size_t i;
+  switch(type) {
+    case 1: /* sub */
+      for(i = 0; i < bpp; i++) out[i] = cur[i];
+      for(; i < len; i++) out[i] = cur[i] - cur[i - bpp];
+      break;
+    case 2: /* up */
+      for(i = 0; i < len; i++) out[i] = cur[i] - prev[i];
+      break;
+    case 3: /* average */
+      for(i = 0; i < bpp; i++) out[i] = cur[i] - (prev[i] >> 1);
+      for(; i < len; i++) out[i] = cur[i] - ((cur[i - bpp] + prev[i]) >> 1);
+      break;
+    case 4: /* paeth */
+      for(i = 0; i < bpp; i++) out[i] = cur[i] - prev[i];
+      for(; i < len; i++) out[i] = cur[i] - _png_paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+      break;
+    default:
+      memcpy(out, cur, len);
+  }
+}
+
+/* sum of the absolute values of the filtered bytes taken as signed, the usual heuristic
+ * (also used by libpng) to choose a filter type */
+static size_t _png_filter_cost(const unsigned char *out, size_t len)
+{
+  size_t i, sum = 0;
+  for(i = 0; i < len; i++) sum += (out[i] < 128) ? out[i] : 256 - out[i];
+  return sum;
+}
+
+/* convert a row of premultiplied argb pixels to rgb or un-premultiplied rgba */
+static void _png_convert_row(const unsigned char *src, unsigned char *dst, size_t w, int bpp)
+{
+  size_t i;
+  unsigned int alpha;
+  for(i = 0; i < w; i++, src += 4, dst += bpp) {
+    alpha = src[3];
+    if(bpp == 3 || alpha == 255) {
+      dst[0] = src[2];
+      dst[1] = src[1];
+      dst[2] = src[0];
+    } else if(alpha == 0) {
+      dst[0] = dst[1] = dst[2] = 0;
+    } else {
+      dst[0] = (src[2] * 255 + alpha / 2) / alpha;
+      dst[1] = (src[1] * 255 + alpha / 2) / alpha;
+      dst[2] = (src[0] * 255 + alpha / 2) / alpha;
+    }
+    if(bpp == 4) dst[3] = alpha;
+  }
+}
+
+static mapcache_buffer* _mapcache_imageio_png_encode_libdeflate(mapcache_context *ctx, mapcache_image *img,
+    mapcache_image_format_png *format)
+{
+  static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  int bpp = mapcache_image_has_alpha(img,255) ? 4 : 3;
+  size_t rowbytes = img->w * bpp, filtered_size = img->h * (rowbytes + 1);
+  size_t bound, zsize, row;
+  unsigned char *rows, *cur, *prev, *filtered, *trial = NULL, *p;
+  struct libdeflate_compressor *compressor;
+  mapcache_buffer *buffer;
+  int level, type;
+
+  switch(format->compression_level) {
+    case MAPCACHE_COMPRESSION_FAST: level = 1; break;
+    case MAPCACHE_COMPRESSION_BEST: level = 12; break;
+    default: level = 6;
+  }
+  compressor = libdeflate_alloc_compressor(level);
+  rows = calloc(2, rowbytes);
+  filtered = malloc(filtered_size);
+  if(format->filter == MAPCACHE_PNG_FILTER_ADAPTIVE) {
+    trial = malloc(rowbytes);
+  }
+  if(!compressor || !rows || !filtered || (format->filter == MAPCACHE_PNG_FILTER_ADAPTIVE && !trial)) {
+    if(compressor) libdeflate_free_compressor(compressor);
+    free(rows);
+    free(filtered);
+    free(trial);
+    ctx->set_error(ctx, 500, "png encoding: failed to allocate libdeflate buffers");
+    return NULL;
+  }
+
+  /* filter the rows, prev starts as the zeroed row above the image */
+  prev = rows;
+  cur = rows + rowbytes;
+  for(row = 0; row < img->h; row++) {
+    unsigned char *out = filtered + row * (rowbytes + 1) + 1;
+    _png_convert_row(img->data + row * img->stride, cur, img->w, bpp);
+    if(format->filter == MAPCACHE_PNG_FILTER_ADAPTIVE) {
+      size_t cost, best_cost;
+      _png_filter_row(0, cur, prev, out, rowbytes, bpp);
+      best_cost = _png_filter_cost(out, rowbytes);
+      out[-1] = 0;
+      for(type = 1; type <= 4; type++) {
+        _png_filter_row(type, cur, prev, trial, rowbytes, bpp);
+        cost = _png_filter_cost(trial, rowbytes);
+        if(cost < best_cost) {
+          best_cost = cost;
+          memcpy(out, trial, rowbytes);
+          out[-1] = type;
+        }
+      }
+    } else {
+      /* mapcache_png_filter values match the png filter types up to paeth */
+      out[-1] = format->filter;
+      _png_filter_row(format->filter, cur, prev, out, rowbytes, bpp);
+    }
+    p = prev;
+    prev = cur;
+    cur = p;
+  }
+  free(rows);
+  free(trial);
+
+  bound = libdeflate_zlib_compress_bound(compressor, filtered_size);
+  buffer = mapcache_buffer_create(8 + 25 + 12 + bound + 12, ctx->pool);
+  p = buffer->buf;
+  memcpy(p, signature, 8);
+  p += 8;
+
+  _png_put_uint32(p, 13);
+  memcpy(p + 4, "IHDR", 4);
+  _png_put_uint32(p + 8, img->w);
+  _png_put_uint32(p + 12, img->h);
+  p[16] = 8; /* bit depth */
+  p[17] = (bpp == 4) ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB;
+  p[18] = p[19] = p[20] = 0; /* compression, filter and interlace methods */
+  _png_put_crc(p + 4, 13);
+  p += 25;
+
+  zsize = libdeflate_zlib_compress(compressor, filtered, filtered_size, p + 8, bound);
+  libdeflate_free_compressor(compressor);
+  free(filtered);
+  if(!zsize) {
+    ctx->set_error(ctx, 500, "png encoding: libdeflate compression failed");
+    return NULL;
+  }
+  _png_put_uint32(p, zsize);
+  memcpy(p + 4, "IDAT", 4);
+  _png_put_crc(p + 4, zsize);
+  p += 12 + zsize;
+
+  _png_put_uint32(p, 0);
+  memcpy(p + 4, "IEND", 4);
+  _png_put_crc(p + 4, 0);
+  p += 12;
+
+  buffer->size = p - (unsigned char*)buffer->buf;
+  return buffer;
+}
+
+#endif
+
 /**
  * \brief encode an image to RGB(A) PNG format
  * \private \memberof mapcache_image_format_png
@@ -506,20 +718,19 @@ mapcache_buffer* _mapcache_imageio_png_encode(mapcache_context *ctx, mapcache_im
   int color_type;
   size_t row;
   mapcache_buffer *buffer = NULL;
-  int compression = ((mapcache_image_format_png*)format)->compression_level;
-  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
+  png_structp png_ptr;
+#ifdef USE_LIBDEFLATE
+  if(((mapcache_image_format_png*)format)->deflate == MAPCACHE_DEFLATE_LIBDEFLATE &&
+      ((mapcache_image_format_png*)format)->compression_level != MAPCACHE_COMPRESSION_DISABLE) {
+    return _mapcache_imageio_png_encode_libdeflate(ctx,img,(mapcache_image_format_png*)format);
+  }
+#endif
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
   if (!png_ptr) {
     ctx->set_error(ctx, 500, "failed to allocate png_struct structure");
     return NULL;
   }
-  if(compression == MAPCACHE_COMPRESSION_BEST)
-    png_set_compression_level (png_ptr, Z_BEST_COMPRESSION);
-  else if(compression == MAPCACHE_COMPRESSION_FAST)
-    png_set_compression_level (png_ptr, Z_BEST_SPEED);
-  else if(compression == MAPCACHE_COMPRESSION_DISABLE)
-    png_set_compression_level (png_ptr, Z_NO_COMPRESSION);
-    
-  png_set_filter(png_ptr,0,PNG_FILTER_NONE);
+  _mapcache_imageio_png_set_compression(png_ptr,(mapcache_image_format_png*)format);
 
   info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
@@ -566,6 +777,107 @@ mapcache_buffer* _mapcache_imageio_png_encode(mapcache_context *ctx, mapcache_im
   return buffer;
 }
 
+typedef struct {
+  mapcache_image_stream stream;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  mapcache_context *ctx;
+  mapcache_stream_write_func write;
+  void *write_data;
+} _mapcache_png_stream;
+
+static void _mapcache_imageio_png_stream_write_func(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+  _mapcache_png_stream *ps = (_mapcache_png_stream*)png_get_io_ptr(png_ptr);
+  ps->write(ps->ctx, ps->write_data, data, length);
+}
+
+static apr_status_t _mapcache_imageio_png_stream_cleanup(void *data)
+{
+  _mapcache_png_stream *ps = (_mapcache_png_stream*)data;
+  if(ps->png_ptr) {
+    png_destroy_write_struct(&ps->png_ptr, &ps->info_ptr);
+    ps->png_ptr = NULL;
+  }
+  return APR_SUCCESS;
+}
+
+static void _mapcache_imageio_png_stream_write_rows(mapcache_context *ctx, mapcache_image_stream *stream, mapcache_image *band)
+{
+  _mapcache_png_stream *ps = (_mapcache_png_stream*)stream;
+  png_bytep rowptr = band->data;
+  size_t row;
+  if(!ps->png_ptr) return;
+  ps->ctx = ctx;
+  if (setjmp(png_jmpbuf(ps->png_ptr))) {
+    ctx->set_error(ctx, 500, "failed to encode png rows");
+    _mapcache_imageio_png_stream_cleanup(ps);
+    return;
+  }
+  for(row=0; row<band->h; row++) {
+    png_write_row(ps->png_ptr,rowptr);
+    rowptr += band->stride;
+  }
+}
+
+static void _mapcache_imageio_png_stream_finish(mapcache_context *ctx, mapcache_image_stream *stream)
+{
+  _mapcache_png_stream *ps = (_mapcache_png_stream*)stream;
+  if(!ps->png_ptr) return;
+  ps->ctx = ctx;
+  if (setjmp(png_jmpbuf(ps->png_ptr))) {
+    ctx->set_error(ctx, 500, "failed to finish png encoding");
+  } else {
+    png_write_end(ps->png_ptr, ps->info_ptr);
+  }
+  _mapcache_imageio_png_stream_cleanup(ps);
+}
+
+/**
+ * \brief start an incremental RGBA PNG encoding
+ *
+ * as the alpha channel of the rows to come is unknown, the image is always encoded with
+ * an alpha channel.
+ * \private \memberof mapcache_image_format_png
+ * \sa mapcache_image_format::stream()
+ */
+static mapcache_image_stream* _mapcache_imageio_png_stream(mapcache_context *ctx, mapcache_image_format *format,
+    int width, int height, mapcache_stream_write_func write, void *write_data)
+{
+  _mapcache_png_stream *ps = apr_pcalloc(ctx->pool, sizeof(_mapcache_png_stream));
+  ps->stream.write_rows = _mapcache_imageio_png_stream_write_rows;
+  ps->stream.finish = _mapcache_imageio_png_stream_finish;
+  ps->ctx = ctx;
+  ps->write = write;
+  ps->write_data = write_data;
+  ps->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
+  if (!ps->png_ptr) {
+    ctx->set_error(ctx, 500, "failed to allocate png_struct structure");
+    return NULL;
+  }
+  ps->info_ptr = png_create_info_struct(ps->png_ptr);
+  if (!ps->info_ptr) {
+    png_destroy_write_struct(&ps->png_ptr, (png_infopp)NULL);
+    ctx->set_error(ctx, 500, "failed to allocate png_info structure");
+    return NULL;
+  }
+  apr_pool_cleanup_register(ctx->pool, ps, _mapcache_imageio_png_stream_cleanup, apr_pool_cleanup_null);
+  if (setjmp(png_jmpbuf(ps->png_ptr))) {
+    ctx->set_error(ctx, 500, "failed to setjmp(png_jmpbuf(png_ptr))");
+    _mapcache_imageio_png_stream_cleanup(ps);
+    return NULL;
+  }
+  _mapcache_imageio_png_set_compression(ps->png_ptr,(mapcache_image_format_png*)format);
+
+  png_set_write_fn(ps->png_ptr, ps, _mapcache_imageio_png_stream_write_func, _mapcache_imageio_png_flush_func);
+  png_set_IHDR(ps->png_ptr, ps->info_ptr, width, height,
+               8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(ps->png_ptr, ps->info_ptr);
+  png_set_write_user_transform_fn (ps->png_ptr, argb_to_rgba);
+  return (mapcache_image_stream*)ps;
+}
+
 /** \cond DONOTDOCUMENT */
 
 /*
@@ -1392,7 +1704,6 @@ mapcache_buffer* _mapcache_imageio_png_q_encode( mapcache_context *ctx, mapcache
 {
   mapcache_buffer *buffer = mapcache_buffer_create(3000,ctx->pool);
   mapcache_image_format_png_q *f = (mapcache_image_format_png_q*)format;
-  int compression = f->format.compression_level;
   unsigned int numPaletteEntries = f->ncolors;
   unsigned char *pixels = (unsigned char*)apr_pcalloc(ctx->pool,image->w*image->h*sizeof(unsigned char));
   rgbaPixel palette[256];
@@ -1419,13 +1730,7 @@ mapcache_buffer* _mapcache_imageio_png_q_encode( mapcache_context *ctx, mapcache
   if (!png_ptr)
     return (NULL);
 
-  if(compression == MAPCACHE_COMPRESSION_BEST)
-    png_set_compression_level (png_ptr, Z_BEST_COMPRESSION);
-  else if(compression == MAPCACHE_COMPRESSION_FAST)
-    png_set_compression_level (png_ptr, Z_BEST_SPEED);
-  else if(compression == MAPCACHE_COMPRESSION_DISABLE)
-    png_set_compression_level (png_ptr, Z_NO_COMPRESSION);
-  png_set_filter(png_ptr,0,PNG_FILTER_NONE);
+  _mapcache_imageio_png_set_compression(png_ptr,&f->format);
   info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
     png_destroy_write_struct(&png_ptr,(png_infopp)NULL);
@@ -1514,6 +1819,7 @@ mapcache_image_format* mapcache_imageio_create_png_format(apr_pool_t *pool, char
   format->compression_level = compression;
   format->format.metadata = apr_table_make(pool,3);
   format->format.write = _mapcache_imageio_png_encode;
+  format->format.stream = _mapcache_imageio_png_stream;
   format->format.create_empty_image = _mapcache_imageio_png_create_empty;
   format->format.type = GC_PNG;
   return (mapcache_image_format*)format;
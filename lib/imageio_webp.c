@@ -0,0 +1,272 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching support file: WebP format
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <stdlib.h>
+
+/**\addtogroup imageio_webp */
+/** @{ */
+
+#ifdef USE_WEBP
+
+#include <webp/encode.h>
+#include <webp/decode.h>
+
+/**
+ * \brief copy the image into a newly allocated buffer of un-premultiplied bgra pixels,
+ * as expected by the WebP encoder
+ */
+static unsigned char* _mapcache_imageio_webp_unpremultiply(mapcache_image *img)
+{
+  unsigned char *out = malloc(img->w * img->h * 4), *dst;
+  unsigned char *src;
+  size_t i, j;
+  unsigned int alpha;
+  if(!out) {
+    return NULL;
+  }
+  dst = out;
+  for(i = 0; i < img->h; i++) {
+    src = img->data + i * img->stride;
+    for(j = 0; j < img->w; j++) {
+      alpha = src[3];
+      if(alpha == 255) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+      } else if(alpha == 0) {
+        dst[0] = dst[1] = dst[2] = 0;
+      } else {
+        dst[0] = (src[0] * 255 + alpha / 2) / alpha;
+        dst[1] = (src[1] * 255 + alpha / 2) / alpha;
+        dst[2] = (src[2] * 255 + alpha / 2) / alpha;
+      }
+      dst[3] = alpha;
+      src += 4;
+      dst += 4;
+    }
+  }
+  return out;
+}
+
+/**
+ * \brief encode an image to WebP format
+ * \private \memberof mapcache_image_format_webp
+ * \sa mapcache_image_format::write()
+ */
+static mapcache_buffer* _mapcache_imageio_webp_encode(mapcache_context *ctx, mapcache_image *img,
+    mapcache_image_format *format)
+{
+  mapcache_image_format_webp *f = (mapcache_image_format_webp*)format;
+  mapcache_buffer *buffer;
+  unsigned char *rgba = NULL;
+  WebPConfig config;
+  WebPPicture picture;
+  WebPMemoryWriter writer;
+  int ok;
+
+  if(!WebPConfigPreset(&config, WEBP_PRESET_DEFAULT, (float)f->quality) || !WebPPictureInit(&picture)) {
+    ctx->set_error(ctx, 500, "failed to initialize webp encoder (library version mismatch?)");
+    return NULL;
+  }
+  config.lossless = (f->mode == MAPCACHE_WEBP_LOSSLESS);
+  picture.use_argb = config.lossless;
+  picture.width = img->w;
+  picture.height = img->h;
+
+  if(mapcache_image_has_alpha(img, 255)) {
+    rgba = _mapcache_imageio_webp_unpremultiply(img);
+    if(!rgba) {
+      ctx->set_error(ctx, 500, "webp encoding: failed to allocate image buffer");
+      return NULL;
+    }
+    ok = WebPPictureImportBGRA(&picture, rgba, img->w * 4);
+    free(rgba);
+  } else {
+    /* opaque image, the (premultiplied) pixels can be passed as is */
+    ok = WebPPictureImportBGRX(&picture, img->data, img->stride);
+  }
+  if(!ok) {
+    WebPPictureFree(&picture);
+    ctx->set_error(ctx, 500, "webp encoding: failed to import image");
+    return NULL;
+  }
+
+  WebPMemoryWriterInit(&writer);
+  picture.writer = WebPMemoryWrite;
+  picture.custom_ptr = &writer;
+  ok = WebPEncode(&config, &picture);
+  WebPPictureFree(&picture);
+  if(!ok) {
+    WebPMemoryWriterClear(&writer);
+    ctx->set_error(ctx, 500, "webp encoding failed (error code %d)", picture.error_code);
+    return NULL;
+  }
+  buffer = mapcache_buffer_create(writer.size, ctx->pool);
+  mapcache_buffer_append(buffer, writer.size, writer.mem);
+  WebPMemoryWriterClear(&writer);
+  return buffer;
+}
+
+void _mapcache_imageio_webp_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
+    mapcache_image *img)
+{
+  WebPDecoderConfig config;
+  VP8StatusCode status;
+
+  if(!WebPInitDecoderConfig(&config)) {
+    ctx->set_error(ctx, 500, "failed to initialize webp decoder (library version mismatch?)");
+    return;
+  }
+  status = WebPGetFeatures(buffer->buf, buffer->size, &config.input);
+  if(status != VP8_STATUS_OK) {
+    ctx->set_error(ctx, 500, "failed to read webp header (error code %d)", status);
+    return;
+  }
+
+  img->w = config.input.width;
+  img->h = config.input.height;
+  if(!img->data) {
+    img->data = calloc(1, img->w * img->h * 4 * sizeof(unsigned char));
+    apr_pool_cleanup_register(ctx->pool, img->data, (void*)free, apr_pool_cleanup_null) ;
+    img->stride = img->w * 4;
+  }
+
+  /* let libwebp output premultiplied bgra straight into the image rows */
+  config.output.colorspace = MODE_bgrA;
+  config.output.is_external_memory = 1;
+  config.output.u.RGBA.rgba = img->data;
+  config.output.u.RGBA.stride = img->stride;
+  config.output.u.RGBA.size = img->stride * img->h;
+  status = WebPDecode(buffer->buf, buffer->size, &config);
+  WebPFreeDecBuffer(&config.output);
+  if(status != VP8_STATUS_OK) {
+    ctx->set_error(ctx, 500, "failed to decode webp image (error code %d)", status);
+    return;
+  }
+  /* an alpha plane may still be fully opaque, mapcache_image_has_alpha() will check */
+  img->has_alpha = config.input.has_alpha ? MC_ALPHA_UNKNOWN : MC_ALPHA_NO;
+}
+
+mapcache_image* _mapcache_imageio_webp_decode(mapcache_context *ctx, mapcache_buffer *buffer)
+{
+  mapcache_image *img = mapcache_image_create(ctx);
+  _mapcache_imageio_webp_decode_to_image(ctx, buffer, img);
+  if(GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  return img;
+}
+
+static mapcache_buffer* _mapcache_imageio_webp_create_empty(mapcache_context *ctx, mapcache_image_format *format,
+    size_t width, size_t height, unsigned int color)
+{
+  mapcache_image *empty;
+  mapcache_buffer *buf;
+  size_t i;
+  empty = mapcache_image_create(ctx);
+  if(GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  empty->data = malloc(width * height * 4 * sizeof(unsigned char));
+  for(i = 0; i < width * height; i++) {
+    ((unsigned int*)empty->data)[i] = color;
+  }
+  empty->w = width;
+  empty->h = height;
+  empty->stride = width * 4;
+
+  buf = format->write(ctx, empty, format);
+  free(empty->data);
+  return buf;
+}
+
+static mapcache_image_format* _mapcache_imageio_create_webp_format(apr_pool_t *pool, char *name, int quality,
+    mapcache_webp_mode mode)
+{
+  mapcache_image_format_webp *format = apr_pcalloc(pool, sizeof(mapcache_image_format_webp));
+  format->format.name = name;
+  format->format.extension = apr_pstrdup(pool, "webp");
+  format->format.mime_type = apr_pstrdup(pool, "image/webp");
+  format->format.metadata = apr_table_make(pool, 3);
+  format->format.create_empty_image = _mapcache_imageio_webp_create_empty;
+  format->format.write = _mapcache_imageio_webp_encode;
+  format->quality = quality;
+  format->mode = mode;
+  format->format.type = GC_WEBP;
+  return (mapcache_image_format*)format;
+}
+
+mapcache_image_format* mapcache_imageio_create_webp_format(apr_pool_t *pool, char *name, int quality,
+    mapcache_webp_mode mode)
+{
+  mapcache_image_format *format;
+  if(mode != MAPCACHE_WEBP_MIXED) {
+    return _mapcache_imageio_create_webp_format(pool, name, quality, mode);
+  }
+  /* lossless where there is transparency, lossy for opaque images */
+  format = mapcache_imageio_create_mixed_format(pool, name,
+           _mapcache_imageio_create_webp_format(pool, apr_pstrcat(pool, name, "_lossless", NULL), quality,
+               MAPCACHE_WEBP_LOSSLESS),
+           _mapcache_imageio_create_webp_format(pool, apr_pstrcat(pool, name, "_lossy", NULL), quality,
+               MAPCACHE_WEBP_LOSSY),
+           255);
+  /* both members produce webp, so the mime type is known in advance */
+  format->extension = apr_pstrdup(pool, "webp");
+  format->mime_type = apr_pstrdup(pool, "image/webp");
+  return format;
+}
+
+#else
+
+mapcache_image_format* mapcache_imageio_create_webp_format(apr_pool_t *pool, char *name, int quality,
+    mapcache_webp_mode mode)
+{
+  return NULL;
+}
+
+void _mapcache_imageio_webp_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
+    mapcache_image *img)
+{
+  ctx->set_error(ctx, 500, "WEBP support not compiled in this version");
+}
+
+mapcache_image* _mapcache_imageio_webp_decode(mapcache_context *ctx, mapcache_buffer *buffer)
+{
+  ctx->set_error(ctx, 500, "WEBP support not compiled in this version");
+  return NULL;
+}
+
+#endif
+
+/** @} */
+
+/* vim: ts=2 sts=2 et sw=2
+*/
@@ -27,12 +27,25 @@
  * DEALINGS IN THE SOFTWARE.
  *****************************************************************************/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for the F_OFD_* fcntl commands */
+#endif
 #include "mapcache.h"
 #include <apr_file_io.h>
 #include <apr_strings.h>
 #include <apr_time.h>
+#include <apr_hash.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#include <apr_portable.h>
+#endif
 #ifndef _WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+#if !defined(_WIN32) && defined(F_OFD_SETLK)
+#define USE_OFD_LOCKS 1
 #endif
 
 typedef struct {
@@ -69,6 +82,41 @@ char* lock_filename_for_resource(mapcache_context *ctx, mapcache_locker_disk *ld
                       ldisk->dir,saferes);
 }
 
+/**
+ * \brief wait for a lock to be released by checking on it every retry_interval seconds
+ */
+static mapcache_lock_result _mapcache_locker_poll_lock(mapcache_context *ctx, mapcache_locker *locker, void *lock)
+{
+  apr_time_t start_wait = apr_time_now();
+  mapcache_lock_result rv = MAPCACHE_LOCK_LOCKED;
+
+  while(rv != MAPCACHE_LOCK_NOENT) {
+    unsigned int waited = apr_time_as_msec(apr_time_now()-start_wait);
+    if(waited > locker->timeout*1000) {
+      mapcache_unlock_resource(ctx,locker,lock);
+      ctx->log(ctx,MAPCACHE_ERROR,"deleting a possibly stale lock after waiting on it for %g seconds",waited/1000.0);
+      return MAPCACHE_LOCK_NOENT;
+    }
+    apr_sleep(locker->retry_interval * 1000000);
+    rv = locker->ping_lock(ctx,locker, lock);
+  }
+  return MAPCACHE_LOCK_NOENT;
+}
+
+int mapcache_wait_for_resource(mapcache_context *ctx, mapcache_locker *locker, void *lock)
+{
+  mapcache_lock_result rv;
+  if(locker->wait_lock) {
+    rv = locker->wait_lock(ctx, locker, lock);
+    if(GC_HAS_ERROR(ctx)) {
+      return MAPCACHE_FAILURE;
+    }
+  } else {
+    rv = _mapcache_locker_poll_lock(ctx, locker, lock);
+  }
+  return (rv == MAPCACHE_LOCK_AQUIRED) ? MAPCACHE_TRUE : MAPCACHE_FALSE;
+}
+
 int mapcache_lock_or_wait_for_resource(mapcache_context *ctx, mapcache_locker *locker, char *resource, void **lock)
 {
   mapcache_lock_result rv = locker->aquire_lock(ctx, locker, resource, lock);
@@ -77,22 +125,7 @@ int mapcache_lock_or_wait_for_resource(mapcache_context *ctx, mapcache_locker *l
   }
   if(rv == MAPCACHE_LOCK_AQUIRED)
     return MAPCACHE_TRUE;
-  else {
-    apr_time_t start_wait = apr_time_now();
-    rv = MAPCACHE_LOCK_LOCKED;
-
-    while(rv != MAPCACHE_LOCK_NOENT) {
-      unsigned int waited = apr_time_as_msec(apr_time_now()-start_wait);
-      if(waited > locker->timeout*1000) {
-        mapcache_unlock_resource(ctx,locker,*lock);
-        ctx->log(ctx,MAPCACHE_ERROR,"deleting a possibly stale lock after waiting on it for %g seconds",waited/1000.0);
-        return MAPCACHE_FALSE;
-      }
-      apr_sleep(locker->retry_interval * 1000000);
-      rv = locker->ping_lock(ctx,locker, *lock);
-    }
-    return MAPCACHE_FALSE;
-  }
+  return mapcache_wait_for_resource(ctx, locker, *lock);
 }
 
 
@@ -177,11 +210,497 @@ mapcache_locker* mapcache_locker_disk_create(mapcache_context *ctx) {
   return l;
 }
 
+#ifdef USE_OFD_LOCKS
+
+/*
+ * The flock locker maps resources onto byte ranges ("stripes") of a small set
+ * of lock files, that are created once and never deleted, and locks them with
+ * open file description (OFD) fcntl locks. These locks are owned by the file
+ * descriptor, so they work between threads as well as between processes, and
+ * are released by the kernel when the holding process dies. They are also
+ * supported on NFS, for synchronizing multiple nodes.
+ *
+ * Waiters poll the stripe every retry_interval seconds until the locker's
+ * timeout. As unrelated resources may share a stripe, the holder of a stripe
+ * writes the hash of its resource into it: a waiter that obtains the stripe
+ * checks whether its previous holder was working on the same resource, and
+ * otherwise keeps the lock and renders the resource itself.
+ *
+ * Each process keeps a table of the stripes its threads hold, shared by all the
+ * flock lockers as they may use the same files. A lock taken by a
+ * thread while it holds the same stripe for another resource (e.g. a cache file
+ * lock nested in a metatile lock) is covered by the held stripe, as nobody else
+ * can take it in the meantime. A thread holding a stripe that times out waiting
+ * for another one fails instead of retrying, which breaks lock cycles between
+ * threads.
+ */
+
+#define MAPCACHE_FLOCK_STRIPE_SIZE 8
+
+typedef struct {
+  char *slot; /**< the lock file and stripe */
+  int fd; /**< the descriptor holding the lock on the stripe */
+  int count; /**< number of locks of the holding thread covered by the stripe */
+#if APR_HAS_THREADS
+  apr_os_thread_t thread;
+#endif
+} mapcache_flock_stripe;
+
+typedef struct {
+  mapcache_locker locker;
+  const char *dir;
+  int nfiles;
+  int nstripes; /**< number of stripes per file */
+} mapcache_locker_flock;
+
+/* the stripes held by the threads of this process, by slot */
+static apr_pool_t *_flock_held_pool = NULL;
+static apr_hash_t *_flock_held = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *_flock_held_mutex = NULL;
+#endif
+
+typedef struct {
+  int fd;
+  off_t offset; /**< start of the stripe in the file */
+  apr_uint64_t key; /**< hash of the resource */
+  /* only used by the locker */
+  char *slot; /**< lockname:stripe */
+  char *lockname;
+  mapcache_flock_stripe *stripe; /**< the held stripe, NULL if not holding it */
+} mapcache_lock_flock;
+
+static int _flock_fcntl(int fd, int cmd, short type, off_t offset, off_t len)
+{
+  struct flock fl;
+  int ret;
+  memset(&fl, 0, sizeof(fl)); /* l_pid must be 0 for OFD locks */
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = offset;
+  fl.l_len = len;
+  do {
+    ret = fcntl(fd, cmd, &fl);
+  } while(ret == -1 && errno == EINTR);
+  return ret;
+}
+
+static void _flock_close(mapcache_lock_flock *flock)
+{
+  if(flock->fd >= 0) {
+    /* closing the descriptor releases the lock */
+    close(flock->fd);
+    flock->fd = -1;
+  }
+}
+
+static apr_status_t _flock_cleanup(void *data)
+{
+  _flock_close((mapcache_lock_flock*)data);
+  return APR_SUCCESS;
+}
+
+static void _flock_table_lock()
+{
+#if APR_HAS_THREADS
+  if(_flock_held_mutex) apr_thread_mutex_lock(_flock_held_mutex);
+#endif
+}
+
+static void _flock_table_unlock()
+{
+#if APR_HAS_THREADS
+  if(_flock_held_mutex) apr_thread_mutex_unlock(_flock_held_mutex);
+#endif
+}
+
+static int _flock_held_by_current_thread(mapcache_flock_stripe *stripe)
+{
+#if APR_HAS_THREADS
+  return apr_os_thread_equal(stripe->thread, apr_os_thread_current());
+#else
+  return 1;
+#endif
+}
+
+/**
+ * \brief whether the current thread holds stripes other than the one of the given lock
+ */
+static int _flock_thread_holds_others(mapcache_context *ctx, mapcache_lock_flock *flock)
+{
+  apr_hash_index_t *hi;
+  int ret = 0;
+  _flock_table_lock();
+  for(hi = apr_hash_first(ctx->pool, _flock_held); hi && !ret; hi = apr_hash_next(hi)) {
+    void *val;
+    apr_hash_this(hi, NULL, NULL, &val);
+    ret = (val != flock->stripe && _flock_held_by_current_thread((mapcache_flock_stripe*)val));
+  }
+  _flock_table_unlock();
+  return ret;
+}
+
+/**
+ * \brief take the stripe of the lock without blocking
+ */
+static mapcache_lock_result _flock_try_stripe(mapcache_context *ctx, mapcache_lock_flock *flock)
+{
+  mapcache_flock_stripe *stripe;
+  mapcache_lock_result rv;
+
+  _flock_table_lock();
+  stripe = apr_hash_get(_flock_held, flock->slot, APR_HASH_KEY_STRING);
+  if(stripe) {
+    if(_flock_held_by_current_thread(stripe)) {
+      /* nobody else can take the stripe before we release it, it already protects this resource */
+      stripe->count++;
+      flock->stripe = stripe;
+      rv = MAPCACHE_LOCK_AQUIRED;
+    } else {
+      /* held by another thread of this process, don't block on it */
+      rv = MAPCACHE_LOCK_LOCKED;
+    }
+    _flock_table_unlock();
+    return rv;
+  }
+
+  if(flock->fd < 0) {
+    flock->fd = open(flock->lockname, O_RDWR | O_CREAT, 0666);
+    if(flock->fd < 0) {
+      _flock_table_unlock();
+      ctx->set_error(ctx, 500, "failed to open lockfile %s: %s", flock->lockname, strerror(errno));
+      return MAPCACHE_LOCK_NOENT;
+    }
+  }
+  if(_flock_fcntl(flock->fd, F_OFD_SETLK, F_WRLCK, flock->offset, MAPCACHE_FLOCK_STRIPE_SIZE) == 0) {
+    stripe = calloc(1, sizeof(mapcache_flock_stripe));
+    if(stripe && !(stripe->slot = strdup(flock->slot))) {
+      free(stripe);
+      stripe = NULL;
+    }
+    if(!stripe) {
+      _flock_close(flock);
+      _flock_table_unlock();
+      ctx->set_error(ctx, 500, "failed to allocate lock stripe");
+      return MAPCACHE_LOCK_NOENT;
+    }
+    stripe->fd = flock->fd;
+    stripe->count = 1;
+#if APR_HAS_THREADS
+    stripe->thread = apr_os_thread_current();
+#endif
+    flock->fd = -1;
+    flock->stripe = stripe;
+    apr_hash_set(_flock_held, stripe->slot, APR_HASH_KEY_STRING, stripe);
+    rv = MAPCACHE_LOCK_AQUIRED;
+  } else if(errno == EAGAIN || errno == EACCES) {
+    rv = MAPCACHE_LOCK_LOCKED;
+  } else {
+    ctx->set_error(ctx, 500, "failed to lock %s: %s", flock->lockname, strerror(errno));
+    _flock_close(flock);
+    rv = MAPCACHE_LOCK_NOENT;
+  }
+  _flock_table_unlock();
+  return rv;
+}
+
+static void _flock_release(mapcache_lock_flock *flock)
+{
+  mapcache_flock_stripe *stripe = flock->stripe;
+  if(stripe) {
+    _flock_table_lock();
+    if(--stripe->count == 0) {
+      apr_hash_set(_flock_held, stripe->slot, APR_HASH_KEY_STRING, NULL);
+      /* closing the descriptor releases the lock */
+      close(stripe->fd);
+      free(stripe->slot);
+      free(stripe);
+    }
+    _flock_table_unlock();
+    flock->stripe = NULL;
+  }
+  _flock_close(flock);
+}
+
+static apr_status_t _flock_release_cleanup(void *data)
+{
+  _flock_release((mapcache_lock_flock*)data);
+  return APR_SUCCESS;
+}
+
+static void _flock_set_holder(mapcache_lock_flock *flock)
+{
+  if(flock->stripe->count > 1) {
+    /* a nested lock, the stripe keeps the key of the outer resource */
+    return;
+  }
+  if(pwrite(flock->stripe->fd, &flock->key, sizeof(flock->key), flock->offset) != sizeof(flock->key)) {
+    /* only costs a possibly duplicate rendering to another waiter */
+  }
+}
+
+mapcache_lock_result mapcache_locker_flock_aquire_lock(mapcache_context *ctx, mapcache_locker *self, char *resource, void **lock) {
+  mapcache_locker_flock *lf = (mapcache_locker_flock*)self;
+  mapcache_lock_flock *flock;
+  mapcache_lock_result rv;
+  apr_uint64_t h = 14695981039346656037ULL; /* FNV-1a */
+  apr_uint64_t stripe;
+  const char *c;
+  int nfile;
+
+  assert(self->type == MAPCACHE_LOCKER_FLOCK);
+  for(c = resource; *c; c++) {
+    h ^= (unsigned char)*c;
+    h *= 1099511628211ULL;
+  }
+  if(!h) h = 1;
+  nfile = (int)(h % lf->nfiles);
+  stripe = (h / lf->nfiles) % lf->nstripes;
+
+  flock = apr_pcalloc(ctx->pool, sizeof(mapcache_lock_flock));
+  flock->fd = -1;
+  flock->key = h;
+  flock->offset = (off_t)stripe * MAPCACHE_FLOCK_STRIPE_SIZE;
+  flock->lockname = apr_psprintf(ctx->pool,"%s/"MAPCACHE_LOCKFILE_PREFIX"_stripes%d.lck", lf->dir, nfile);
+  flock->slot = apr_psprintf(ctx->pool, "%s:%d", flock->lockname, (int)stripe);
+  apr_pool_cleanup_register(ctx->pool, flock, _flock_release_cleanup, apr_pool_cleanup_null);
+  *lock = flock;
+
+  rv = _flock_try_stripe(ctx, flock);
+  if(rv == MAPCACHE_LOCK_AQUIRED) {
+    _flock_set_holder(flock);
+  }
+  return rv;
+}
+
+mapcache_lock_result mapcache_locker_flock_wait_lock(mapcache_context *ctx, mapcache_locker *self, void *lock) {
+  mapcache_lock_flock *flock = (mapcache_lock_flock*)lock;
+  apr_time_t start_wait = apr_time_now();
+  apr_uint64_t holder;
+  mapcache_lock_result rv;
+
+  for(;;) {
+    double waited = (apr_time_now() - start_wait) / 1000000.0;
+    if(waited > self->timeout) {
+      if(_flock_thread_holds_others(ctx, flock)) {
+        /* we may be waiting on a thread that waits on one of our stripes */
+        ctx->set_error(ctx, 500, "timed out after waiting %g seconds for lock stripe %s:%d while holding other stripes",
+                       waited, flock->lockname, (int)(flock->offset / MAPCACHE_FLOCK_STRIPE_SIZE));
+      } else {
+        ctx->log(ctx, MAPCACHE_ERROR, "gave up waiting on lock stripe %s:%d after %g seconds",
+                 flock->lockname, (int)(flock->offset / MAPCACHE_FLOCK_STRIPE_SIZE), waited);
+      }
+      _flock_release(flock);
+      return MAPCACHE_LOCK_NOENT;
+    }
+    apr_sleep((apr_interval_time_t)(self->retry_interval * 1000000));
+    rv = _flock_try_stripe(ctx, flock);
+    if(GC_HAS_ERROR(ctx)) {
+      return MAPCACHE_LOCK_NOENT;
+    }
+    if(rv == MAPCACHE_LOCK_AQUIRED) {
+      break;
+    }
+  }
+  if(flock->stripe->count == 1 &&
+      pread(flock->stripe->fd, &holder, sizeof(holder), flock->offset) == sizeof(holder) && holder == flock->key) {
+    /* the previous holder was working on our resource */
+    _flock_release(flock);
+    return MAPCACHE_LOCK_NOENT;
+  }
+  /* the stripe was held for another resource */
+  _flock_set_holder(flock);
+  return MAPCACHE_LOCK_AQUIRED;
+}
+
+mapcache_lock_result mapcache_locker_flock_ping_lock(mapcache_context *ctx, mapcache_locker *self, void *lock) {
+  mapcache_lock_flock *flock = (mapcache_lock_flock*)lock;
+  mapcache_lock_result rv = _flock_try_stripe(ctx, flock);
+  if(rv == MAPCACHE_LOCK_AQUIRED) {
+    /* the stripe is free */
+    _flock_release(flock);
+    return MAPCACHE_LOCK_NOENT;
+  }
+  return rv;
+}
+
+void mapcache_locker_flock_release_lock(mapcache_context *ctx, mapcache_locker *self, void *lock) {
+  _flock_release((mapcache_lock_flock*)lock);
+}
+
+void mapcache_locker_flock_parse_xml(mapcache_context *ctx, mapcache_locker *self, ezxml_t doc) {
+  mapcache_locker_flock *lf = (mapcache_locker_flock*)self;
+  ezxml_t node;
+  char *endptr;
+  if((node = ezxml_child(doc,"directory")) != NULL) {
+    lf->dir = apr_pstrdup(ctx->pool, node->txt);
+  } else {
+    lf->dir = apr_pstrdup(ctx->pool,"/tmp");
+  }
+  if((node = ezxml_child(doc,"files")) != NULL) {
+    lf->nfiles = (int)strtol(node->txt,&endptr,10);
+    if(*endptr != 0 || lf->nfiles <= 0) {
+      ctx->set_error(ctx, 400, "failed to parse flock locker files \"%s\". Expecting a positive integer",
+          node->txt);
+      return;
+    }
+  }
+  if((node = ezxml_child(doc,"stripes")) != NULL) {
+    lf->nstripes = (int)strtol(node->txt,&endptr,10);
+    if(*endptr != 0 || lf->nstripes <= 0) {
+      ctx->set_error(ctx, 400, "failed to parse flock locker stripes \"%s\". Expecting a positive integer",
+          node->txt);
+      return;
+    }
+  }
+}
+
+mapcache_locker* mapcache_locker_flock_create(mapcache_context *ctx) {
+  mapcache_locker_flock *lf = (mapcache_locker_flock*)apr_pcalloc(ctx->pool, sizeof(mapcache_locker_flock));
+  mapcache_locker *l = (mapcache_locker*)lf;
+  l->type = MAPCACHE_LOCKER_FLOCK;
+  l->aquire_lock = mapcache_locker_flock_aquire_lock;
+  l->parse_xml = mapcache_locker_flock_parse_xml;
+  l->release_lock = mapcache_locker_flock_release_lock;
+  l->ping_lock = mapcache_locker_flock_ping_lock;
+  l->wait_lock = mapcache_locker_flock_wait_lock;
+  lf->nfiles = 8;
+  lf->nstripes = 4096;
+  if(!_flock_held) {
+    /* created while loading the configuration, before any lock is taken */
+    apr_pool_create(&_flock_held_pool, NULL);
+    _flock_held = apr_hash_make(_flock_held_pool);
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&_flock_held_mutex, APR_THREAD_MUTEX_DEFAULT, _flock_held_pool);
+#endif
+  }
+  return l;
+}
+
+/*
+ * Render limiters are cross-process counting semaphores: each of the first
+ * max bytes of the limiter's file is a render slot, and the following queue
+ * bytes are places in the wait queue, all locked with OFD locks. Interactive
+ * requests that find no free slot take a place in the queue, or fail straight
+ * away if it is full, and check back on the slots until their timeout expires.
+ * Batch (seeding) renders neither use the queue nor time out, but can't use the
+ * last reserved slots.
+ */
+
+mapcache_render_limiter* mapcache_render_limiter_create(mapcache_context *ctx, const char *name, const char *filename, int max)
+{
+  mapcache_render_limiter *limiter = apr_pcalloc(ctx->pool, sizeof(mapcache_render_limiter));
+  limiter->name = apr_pstrdup(ctx->pool, name);
+  limiter->filename = apr_pstrdup(ctx->pool, filename);
+  limiter->max = max;
+  limiter->queue = max * 4;
+  limiter->timeout = 30;
+  return limiter;
+}
+
+int mapcache_render_limiter_enter(mapcache_context *ctx, mapcache_render_limiter *limiter, void **slot)
+{
+  int batch = ctx->config && ctx->config->batch_rendering;
+  int nslots = batch ? limiter->max - limiter->reserved : limiter->max;
+  apr_time_t deadline = apr_time_now() + (apr_time_t)(limiter->timeout * 1000000);
+  apr_interval_time_t wait = 5000;
+  mapcache_lock_flock *flock;
+  int i, start, queued = -1;
+
+  *slot = NULL;
+  if(nslots < 1) nslots = 1;
+  flock = apr_pcalloc(ctx->pool, sizeof(mapcache_lock_flock));
+  flock->fd = open(limiter->filename, O_RDWR | O_CREAT, 0666);
+  if(flock->fd < 0) {
+    ctx->set_error(ctx, 500, "failed to open render limiter file %s: %s", limiter->filename, strerror(errno));
+    return MAPCACHE_FAILURE;
+  }
+  apr_pool_cleanup_register(ctx->pool, flock, _flock_cleanup, apr_pool_cleanup_null);
+
+  /* spread the requests over the slots */
+  start = (int)(apr_time_now() % nslots);
+  for(;;) {
+    for(i = 0; i < nslots; i++) {
+      off_t offset = (start + i) % nslots;
+      if(_flock_fcntl(flock->fd, F_OFD_SETLK, F_WRLCK, offset, 1) == 0) {
+        if(queued >= 0) {
+          _flock_fcntl(flock->fd, F_OFD_SETLK, F_UNLCK, limiter->max + queued, 1);
+        }
+        flock->offset = offset;
+        *slot = flock;
+        return MAPCACHE_SUCCESS;
+      }
+      if(errno != EAGAIN && errno != EACCES) {
+        ctx->set_error(ctx, 500, "failed to lock render limiter file %s: %s", limiter->filename, strerror(errno));
+        _flock_close(flock);
+        return MAPCACHE_FAILURE;
+      }
+    }
+    if(!batch) {
+      if(queued < 0) {
+        for(i = 0; i < limiter->queue; i++) {
+          if(_flock_fcntl(flock->fd, F_OFD_SETLK, F_WRLCK, limiter->max + i, 1) == 0) {
+            queued = i;
+            break;
+          }
+        }
+        if(queued < 0) {
+          _flock_close(flock);
+          ctx->set_error(ctx, 503, "%s: too many pending renders, rejecting request", limiter->name);
+          return MAPCACHE_FAILURE;
+        }
+      }
+      if(apr_time_now() > deadline) {
+        _flock_close(flock);
+        ctx->set_error(ctx, 503, "%s: timed out after waiting %g seconds for a render slot", limiter->name, limiter->timeout);
+        return MAPCACHE_FAILURE;
+      }
+    }
+    apr_sleep(wait);
+    if(wait < 100000) wait *= 2;
+  }
+}
+
+void mapcache_render_limiter_leave(mapcache_context *ctx, void *slot)
+{
+  if(slot) {
+    _flock_close((mapcache_lock_flock*)slot);
+  }
+}
+
+#else
+
+mapcache_render_limiter* mapcache_render_limiter_create(mapcache_context *ctx, const char *name, const char *filename, int max)
+{
+  ctx->set_error(ctx, 400, "%s: render concurrency limits are not supported on this platform", name);
+  return NULL;
+}
+
+int mapcache_render_limiter_enter(mapcache_context *ctx, mapcache_render_limiter *limiter, void **slot)
+{
+  *slot = NULL;
+  return MAPCACHE_SUCCESS;
+}
+
+void mapcache_render_limiter_leave(mapcache_context *ctx, void *slot)
+{
+}
+
+#endif
+
 struct mapcache_locker_fallback_lock {
   mapcache_locker *locker; /*the locker that actually acquired the lock*/
   void *lock; /*the opaque lock returned by the locker*/
 };
 
+mapcache_lock_result mapcache_locker_fallback_wait_lock(mapcache_context *ctx, mapcache_locker *self, void *lock) {
+  struct mapcache_locker_fallback_lock *flock = lock;
+  if(flock->locker->wait_lock) {
+    return flock->locker->wait_lock(ctx,flock->locker,flock->lock);
+  }
+  return _mapcache_locker_poll_lock(ctx,flock->locker,flock->lock);
+}
+
 void mapcache_locker_fallback_release_lock(mapcache_context *ctx, mapcache_locker *self, void *lock) {
   struct mapcache_locker_fallback_lock *flock = lock;
   flock->locker->release_lock(ctx,flock->locker,flock->lock);
@@ -400,6 +919,7 @@ mapcache_locker* mapcache_locker_fallback_create(mapcache_context *ctx) {
   l->ping_lock = mapcache_locker_fallback_ping_lock;
   l->parse_xml = mapcache_locker_fallback_parse_xml;
   l->release_lock = mapcache_locker_fallback_release_lock;
+  l->wait_lock = mapcache_locker_fallback_wait_lock;
   return l;
 }
 
@@ -441,6 +961,13 @@ void mapcache_config_parse_locker(mapcache_context *ctx, ezxml_t node, mapcache_
     *locker = mapcache_locker_disk_create(ctx);
   } else if(!strcmp(ltype,"fallback")) {
     *locker = mapcache_locker_fallback_create(ctx);
+  } else if(!strcmp(ltype,"flock")) {
+#ifdef USE_OFD_LOCKS
+    *locker = mapcache_locker_flock_create(ctx);
+#else
+    ctx->set_error(ctx,400,"<locker>: type \"flock\" cannot be used as open file description locks are not supported on this platform");
+    return;
+#endif
   } else if(!strcmp(ltype,"memcache")) {
 #ifdef USE_MEMCACHE
     *locker = mapcache_locker_memcache_create(ctx);
@@ -449,7 +976,7 @@ void mapcache_config_parse_locker(mapcache_context *ctx, ezxml_t node, mapcache_
     return;
 #endif
   } else {
-    ctx->set_error(ctx,400,"<locker>: unknown type \"%s\" (allowed are disk and memcache)",ltype);
+    ctx->set_error(ctx,400,"<locker>: unknown type \"%s\" (allowed are disk, flock, memcache and fallback)",ltype);
     return;
   }
   (*locker)->parse_xml(ctx, *locker, node);
@@ -0,0 +1,373 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching: background prefetching of neighboring tiles
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+ * A per-process queue of metatiles that are likely to be requested next (the
+ * neighbors of a served tile's metatile in the direction of its edges, and
+ * the metatiles covering its children), processed by a few background
+ * threads. Metatiles that are missing from the cache are rendered through the
+ * usual locking path, so a client requesting them afterwards either finds them
+ * in the cache or waits on the prefetch render instead of starting another.
+ *
+ * Scheduling never blocks a request: the queue is bounded and metatiles that
+ * don't fit in it are dropped. Prefetch renders are batch renders, i.e. they
+ * cannot use the render slots reserved for interactive requests.
+ *
+ * The threads are only started on first use, i.e. after the apache module has
+ * forked its children. They are stopped when the configuration's pool is
+ * destroyed: the queued metatiles are dropped, but the renders in progress are
+ * waited for, as they use the configuration. With the threaded fastcgi server,
+ * the request releasing a reloaded configuration is therefore delayed by at
+ * most one render.
+ */
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <apr_hash.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#endif
+
+typedef struct _prefetch_job _prefetch_job;
+
+struct _prefetch_job {
+  apr_pool_t *pool;
+  char *key;
+  mapcache_tile *tile;
+  _prefetch_job *next;
+};
+
+struct mapcache_prefetcher {
+  int nthreads;
+  int max_pending;
+#if APR_HAS_THREADS
+  apr_pool_t *pool;
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t *cond;
+  apr_thread_t **threads; /* started on first use */
+  int started;
+  int stopping;
+  mapcache_cfg *config; /* copy of the configuration, with batch rendering set */
+  mapcache_connection_pool *connection_pool;
+  _prefetch_job *head, *tail;
+  int npending;
+  apr_hash_t *pending; /* keys of the queued metatiles */
+  mapcache_context *log_ctx; /* front end context the threads log through */
+  apr_thread_mutex_t *log_mutex;
+#endif
+};
+
+#if APR_HAS_THREADS
+
+static void _prefetch_log(mapcache_context *ctx, mapcache_log_level level, char *msg, ...)
+{
+  mapcache_prefetcher *prefetcher = ctx->config->prefetcher;
+  va_list args;
+  char *fullmsg;
+  va_start(args,msg);
+  fullmsg = apr_pvsprintf(ctx->pool,msg,args);
+  va_end(args);
+  if(!prefetcher->log_ctx) {
+    if(level >= MAPCACHE_WARN) {
+      fprintf(stderr, "mapcache prefetch: %s\n", fullmsg);
+    }
+    return;
+  }
+  /* the front end's log functions aren't meant to be called from several threads with the same context */
+  apr_thread_mutex_lock(prefetcher->log_mutex);
+  prefetcher->log_ctx->log(prefetcher->log_ctx, level, "prefetch: %s", fullmsg);
+  apr_pool_clear(prefetcher->log_ctx->pool);
+  apr_thread_mutex_unlock(prefetcher->log_mutex);
+}
+
+static mapcache_context* _prefetch_context_clone(mapcache_context *ctx)
+{
+  mapcache_context *nctx = (mapcache_context*)apr_pcalloc(ctx->pool, sizeof(mapcache_context));
+  mapcache_context_copy(ctx,nctx);
+  apr_pool_create(&nctx->pool,NULL);
+  apr_pool_cleanup_register(ctx->pool, nctx->pool,(void*)apr_pool_destroy, apr_pool_cleanup_null);
+  return nctx;
+}
+
+static void _prefetch_job_run(mapcache_prefetcher *prefetcher, _prefetch_job *job)
+{
+  mapcache_context ctx;
+  mapcache_tile *tile = job->tile;
+
+  memset(&ctx, 0, sizeof(ctx));
+  mapcache_context_init(&ctx);
+  ctx.pool = job->pool;
+  ctx.config = prefetcher->config;
+  ctx.connection_pool = prefetcher->connection_pool;
+  ctx.log = _prefetch_log;
+  ctx.clone = _prefetch_context_clone;
+
+  if(mapcache_cache_tile_exists(&ctx, tile->tileset->_cache, tile) == MAPCACHE_FALSE && !GC_HAS_ERROR(&ctx)) {
+    mapcache_tileset_tile_get(&ctx, tile);
+  }
+  if(GC_HAS_ERROR(&ctx)) {
+    ctx.log(&ctx, MAPCACHE_WARN, "failed to prefetch tile %d %d %d of tileset %s: %s",
+            tile->x, tile->y, tile->z, tile->tileset->name, ctx.get_error_message(&ctx));
+  }
+}
+
+static void* APR_THREAD_FUNC _prefetch_thread(apr_thread_t *thread, void *data)
+{
+  mapcache_prefetcher *prefetcher = (mapcache_prefetcher*)data;
+  _prefetch_job *job;
+
+  apr_thread_mutex_lock(prefetcher->mutex);
+  for(;;) {
+    while(!prefetcher->head && !prefetcher->stopping) {
+      apr_thread_cond_wait(prefetcher->cond, prefetcher->mutex);
+    }
+    if(prefetcher->stopping) {
+      break;
+    }
+    job = prefetcher->head;
+    prefetcher->head = job->next;
+    if(!prefetcher->head) prefetcher->tail = NULL;
+    prefetcher->npending--;
+    apr_hash_set(prefetcher->pending, job->key, APR_HASH_KEY_STRING, NULL);
+    apr_thread_mutex_unlock(prefetcher->mutex);
+
+    _prefetch_job_run(prefetcher, job);
+    apr_pool_destroy(job->pool);
+
+    apr_thread_mutex_lock(prefetcher->mutex);
+  }
+  apr_thread_mutex_unlock(prefetcher->mutex);
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+static apr_status_t _prefetcher_cleanup(void *data)
+{
+  mapcache_prefetcher *prefetcher = (mapcache_prefetcher*)data;
+  apr_status_t rv;
+  _prefetch_job *job;
+  int i;
+
+  /* drop the queue before waiting for the threads, which only finish the job they are running */
+  apr_thread_mutex_lock(prefetcher->mutex);
+  prefetcher->stopping = 1;
+  while(prefetcher->head) {
+    job = prefetcher->head;
+    prefetcher->head = job->next;
+    apr_pool_destroy(job->pool);
+  }
+  prefetcher->tail = NULL;
+  prefetcher->npending = 0;
+  apr_thread_cond_broadcast(prefetcher->cond);
+  apr_thread_mutex_unlock(prefetcher->mutex);
+  if(prefetcher->threads) {
+    for(i = 0; i < prefetcher->nthreads; i++) {
+      if(prefetcher->threads[i]) {
+        apr_thread_join(&rv, prefetcher->threads[i]);
+      }
+    }
+  }
+  return APR_SUCCESS;
+}
+
+/**
+ * \brief start the threads, called with the mutex held
+ */
+static int _prefetcher_start(mapcache_context *ctx, mapcache_prefetcher *prefetcher)
+{
+  apr_threadattr_t *thread_attrs;
+  int i, nstarted = 0;
+
+  prefetcher->started = 1;
+  prefetcher->config = apr_pmemdup(prefetcher->pool, ctx->config, sizeof(mapcache_cfg));
+  prefetcher->config->batch_rendering = 1;
+  prefetcher->connection_pool = ctx->connection_pool;
+  prefetcher->threads = apr_pcalloc(prefetcher->pool, prefetcher->nthreads * sizeof(apr_thread_t*));
+  apr_threadattr_create(&thread_attrs, prefetcher->pool);
+  for(i = 0; i < prefetcher->nthreads; i++) {
+    if(apr_thread_create(&prefetcher->threads[i], thread_attrs, _prefetch_thread, prefetcher, prefetcher->pool) != APR_SUCCESS) {
+      prefetcher->threads[i] = NULL;
+    } else {
+      nstarted++;
+    }
+  }
+  if(!nstarted) {
+    ctx->log(ctx, MAPCACHE_WARN, "failed to start prefetch threads, prefetching is disabled");
+  }
+  return nstarted;
+}
+
+/**
+ * \brief queue the metatile containing tile (x,y,z) if it is in the grid's limits
+ */
+static void _prefetcher_push(mapcache_context *ctx, mapcache_prefetcher *prefetcher, mapcache_tile *src, int x, int y, int z)
+{
+  mapcache_extent_i *limits;
+  _prefetch_job *job;
+  apr_pool_t *pool;
+  char *key;
+  int i;
+
+  if(z < src->grid_link->minz || z >= src->grid_link->maxz) return;
+  limits = &src->grid_link->grid_limits[z];
+  if(x < limits->minx || x >= limits->maxx || y < limits->miny || y >= limits->maxy) return;
+
+  key = apr_psprintf(ctx->pool, "%s/%s/%d/%d/%d/%s", src->tileset->name, src->grid_link->grid->name, z,
+                     x / src->tileset->metasize_x, y / src->tileset->metasize_y,
+                     mapcache_util_get_tile_dimkey(ctx, src, NULL, NULL));
+
+  apr_thread_mutex_lock(prefetcher->mutex);
+  if(prefetcher->stopping || prefetcher->npending >= prefetcher->max_pending ||
+      apr_hash_get(prefetcher->pending, key, APR_HASH_KEY_STRING)) {
+    apr_thread_mutex_unlock(prefetcher->mutex);
+    return;
+  }
+  if(!prefetcher->started && !_prefetcher_start(ctx, prefetcher)) {
+    prefetcher->stopping = 1;
+  }
+  if(prefetcher->stopping) {
+    apr_thread_mutex_unlock(prefetcher->mutex);
+    return;
+  }
+  apr_pool_create(&pool, NULL);
+  job = apr_pcalloc(pool, sizeof(_prefetch_job));
+  job->pool = pool;
+  job->key = apr_pstrdup(pool, key);
+  job->tile = mapcache_tileset_tile_clone(pool, src);
+  /* the cloned dimensions still point into the request pool, which is gone
+   * by the time a prefetch thread renders the job */
+  if(job->tile->dimensions) {
+    for(i = 0; i < job->tile->dimensions->nelts; i++) {
+      mapcache_requested_dimension *rdim = APR_ARRAY_IDX(job->tile->dimensions, i, mapcache_requested_dimension*);
+      if(rdim->requested_value) rdim->requested_value = apr_pstrdup(pool, rdim->requested_value);
+      if(rdim->cached_value) rdim->cached_value = apr_pstrdup(pool, rdim->cached_value);
+      rdim->cached_entries_for_value = NULL;
+    }
+  }
+  job->tile->x = x;
+  job->tile->y = y;
+  job->tile->z = z;
+  job->tile->allow_redirect = 0;
+  if(prefetcher->tail) prefetcher->tail->next = job;
+  else prefetcher->head = job;
+  prefetcher->tail = job;
+  prefetcher->npending++;
+  apr_hash_set(prefetcher->pending, job->key, APR_HASH_KEY_STRING, job);
+  apr_thread_cond_signal(prefetcher->cond);
+  apr_thread_mutex_unlock(prefetcher->mutex);
+}
+
+#endif
+
+mapcache_prefetcher* mapcache_prefetcher_create(apr_pool_t *pool, int nthreads, int max_pending)
+{
+  mapcache_prefetcher *prefetcher = apr_pcalloc(pool, sizeof(mapcache_prefetcher));
+  prefetcher->nthreads = nthreads;
+  prefetcher->max_pending = max_pending;
+#if APR_HAS_THREADS
+  apr_pool_create(&prefetcher->pool, pool);
+  apr_thread_mutex_create(&prefetcher->mutex, APR_THREAD_MUTEX_DEFAULT, prefetcher->pool);
+  apr_thread_cond_create(&prefetcher->cond, prefetcher->pool);
+  apr_thread_mutex_create(&prefetcher->log_mutex, APR_THREAD_MUTEX_DEFAULT, prefetcher->pool);
+  prefetcher->pending = apr_hash_make(prefetcher->pool);
+  /* the threads and the log context's pool are subpools, which are gone by the time the regular cleanups run */
+  apr_pool_pre_cleanup_register(prefetcher->pool, prefetcher, _prefetcher_cleanup);
+#endif
+  return prefetcher;
+}
+
+void mapcache_prefetcher_set_log_context(mapcache_prefetcher *prefetcher, mapcache_context *log_ctx)
+{
+#if APR_HAS_THREADS
+  apr_pool_create(&log_ctx->pool, prefetcher->pool);
+  prefetcher->log_ctx = log_ctx;
+#endif
+}
+
+void mapcache_prefetcher_schedule(mapcache_context *ctx, mapcache_tile *tile)
+{
+#if APR_HAS_THREADS
+  mapcache_prefetcher *prefetcher = ctx->config?ctx->config->prefetcher:NULL;
+  mapcache_tileset *tileset = tile->tileset;
+  mapcache_grid_link *grid_link = tile->grid_link;
+  int dx, dy;
+
+  if(!prefetcher || !tileset->source || tileset->read_only || ctx->config->non_blocking ||
+      (grid_link->outofzoom_strategy != MAPCACHE_OUTOFZOOM_NOTCONFIGURED && tile->z > grid_link->max_cached_zoom)) {
+    return;
+  }
+
+  if(tileset->prefetch_neighbors) {
+    /* the neighboring metatiles in the direction of the edges of the metatile the tile is on */
+    int mx = tile->x % tileset->metasize_x, my = tile->y % tileset->metasize_y;
+    for(dy = -1; dy <= 1; dy++) {
+      if((dy == -1 && my != 0) || (dy == 1 && my != tileset->metasize_y - 1)) continue;
+      for(dx = -1; dx <= 1; dx++) {
+        if(!dx && !dy) continue;
+        if((dx == -1 && mx != 0) || (dx == 1 && mx != tileset->metasize_x - 1)) continue;
+        _prefetcher_push(ctx, prefetcher, tile, tile->x + dx, tile->y + dy, tile->z);
+      }
+    }
+  }
+
+  if(tileset->prefetch_children && tile->z + 1 < grid_link->maxz &&
+      (grid_link->outofzoom_strategy == MAPCACHE_OUTOFZOOM_NOTCONFIGURED || tile->z + 1 <= grid_link->max_cached_zoom)) {
+    mapcache_extent bbox;
+    double shrink_x, shrink_y;
+    int x[2], y[2], cx, cy;
+    mapcache_grid_get_tile_extent(ctx, grid_link->grid, tile->x, tile->y, tile->z, &bbox);
+    /* don't pick up the children that are only touching the tile's edges */
+    shrink_x = (bbox.maxx - bbox.minx) / (grid_link->grid->tile_sx * 4);
+    shrink_y = (bbox.maxy - bbox.miny) / (grid_link->grid->tile_sy * 4);
+    mapcache_grid_get_xy(ctx, grid_link->grid, bbox.minx + shrink_x, bbox.miny + shrink_y, tile->z + 1, &x[0], &y[0]);
+    mapcache_grid_get_xy(ctx, grid_link->grid, bbox.maxx - shrink_x, bbox.maxy - shrink_y, tile->z + 1, &x[1], &y[1]);
+    if(GC_HAS_ERROR(ctx)) {
+      ctx->clear_errors(ctx);
+      return;
+    }
+    if(abs(x[1] - x[0]) > 3 || abs(y[1] - y[0]) > 3) {
+      /* not a grid where each level refines the previous one */
+      return;
+    }
+    for(cy = MAPCACHE_MIN(y[0],y[1]); cy <= MAPCACHE_MAX(y[0],y[1]); cy++) {
+      for(cx = MAPCACHE_MIN(x[0],x[1]); cx <= MAPCACHE_MAX(x[0],x[1]); cx++) {
+        _prefetcher_push(ctx, prefetcher, tile, cx, cy, tile->z + 1);
+      }
+    }
+  }
+#endif
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
@@ -41,6 +41,22 @@ void mapcache_source_init(mapcache_context *ctx, mapcache_source *source)
 
 void mapcache_source_render_map(mapcache_context *ctx, mapcache_source *source, mapcache_map *map) {
   int i;
+  void *source_slot = NULL, *global_slot = NULL;
+  mapcache_render_limiter *global_limiter = ctx->config ? ctx->config->render_limiter : NULL;
+
+  /* a fallback source doesn't render anything itself, its subsources take the global slot */
+  if(source->type == MAPCACHE_SOURCE_FALLBACK) {
+    global_limiter = NULL;
+  }
+  map->overloaded = MAPCACHE_FALSE;
+  if(source->limiter && mapcache_render_limiter_enter(ctx, source->limiter, &source_slot) != MAPCACHE_SUCCESS) {
+    map->overloaded = MAPCACHE_TRUE;
+    return;
+  }
+  if(global_limiter && mapcache_render_limiter_enter(ctx, global_limiter, &global_slot) != MAPCACHE_SUCCESS) {
+    mapcache_render_limiter_leave(ctx, source_slot);
+    return;
+  }
 #ifdef DEBUG
   ctx->log(ctx, MAPCACHE_DEBUG, "calling render_map on source (%s): tileset=%s, grid=%s, extent=(%f,%f,%f,%f)",
            source->name, map->tileset->name, map->grid_link->grid->name,
@@ -63,6 +79,8 @@ void mapcache_source_render_map(mapcache_context *ctx, mapcache_source *source,
     if(!GC_HAS_ERROR(ctx))
       break;
   }
+  mapcache_render_limiter_leave(ctx, global_slot);
+  mapcache_render_limiter_leave(ctx, source_slot);
 }
 
 void mapcache_source_query_info(mapcache_context *ctx, mapcache_source *source, mapcache_feature_info *fi) {
@@ -269,41 +269,108 @@ void mapcache_tileset_get_map_tiles(mapcache_context *ctx, mapcache_tileset *til
   *ntiles = i;
 }
 
-mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapcache_tileset *tileset,
-    mapcache_grid_link *grid_link,
+/*
+ * compute the offset in pixels of a tile inside the mosaic of tiles [mx..Mx]x[my..My]
+ * \returns MAPCACHE_TRUE if the tile is at the top left of the mosaic
+ */
+static int _mapcache_tileset_tile_mosaic_offset(mapcache_context *ctx, mapcache_grid *grid, mapcache_tile *tile,
+    int mx, int my, int Mx, int My, int *ox, int *oy)
+{
+  switch(grid->origin) {
+    case MAPCACHE_GRID_ORIGIN_BOTTOM_LEFT:
+      *ox = (tile->x - mx) * grid->tile_sx;
+      *oy = (My - tile->y) * grid->tile_sy;
+      return (tile->x == mx && tile->y == My);
+    case MAPCACHE_GRID_ORIGIN_TOP_LEFT:
+      *ox = (tile->x - mx) * grid->tile_sx;
+      *oy = (tile->y - my) * grid->tile_sy;
+      return (tile->x == mx && tile->y == my);
+    case MAPCACHE_GRID_ORIGIN_BOTTOM_RIGHT:
+      *ox = (Mx - tile->x) * grid->tile_sx;
+      *oy = (My - tile->y) * grid->tile_sy;
+      return (tile->x == Mx && tile->y == My);
+    case MAPCACHE_GRID_ORIGIN_TOP_RIGHT:
+      *ox = (Mx - tile->x) * grid->tile_sx;
+      *oy = (tile->y - my) * grid->tile_sy;
+      return (tile->x == Mx && tile->y == my);
+    default:
+      ctx->set_error(ctx,500,"BUG: invalid grid origin");
+      return MAPCACHE_FALSE;
+  }
+}
+
+/*
+ * decode (or copy) the pixels of a tile at the given position of an image, reduced by
+ * a factor of scale_denom
+ */
+static void _mapcache_tileset_tile_copy_pixels(mapcache_context *ctx, mapcache_tile *tile, mapcache_image *dst, int ox, int oy,
+    int scale_denom)
+{
+  mapcache_image fakeimg;
+  fakeimg.stride = dst->stride;
+  fakeimg.data = &(dst->data[oy*dst->stride+ox*4]);
+  fakeimg.w = tile->grid_link->grid->tile_sx / scale_denom;
+  fakeimg.h = tile->grid_link->grid->tile_sy / scale_denom;
+  fakeimg.has_alpha = MC_ALPHA_UNKNOWN;
+  fakeimg.is_blank = MC_EMPTY_UNKNOWN;
+  if(!tile->raw_image) {
+    if(scale_denom > 1) {
+      mapcache_imageio_decode_to_image_scaled(ctx,tile->encoded_data,&fakeimg,scale_denom);
+    } else {
+      mapcache_tile_decode_to_image(ctx,tile,&fakeimg);
+    }
+  } else if(scale_denom > 1) {
+    mapcache_image_box_reduce(tile->raw_image,&fakeimg,scale_denom);
+  } else {
+    int r;
+    unsigned char *srcptr = tile->raw_image->data;
+    unsigned char *dstptr = fakeimg.data;
+    for(r=0; r<tile->raw_image->h; r++) {
+      memcpy(dstptr,srcptr,tile->raw_image->stride);
+      srcptr += tile->raw_image->stride;
+      dstptr += fakeimg.stride;
+    }
+  }
+}
+
+static void _mapcache_tileset_resample(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
+    double dstminx, double dstminy, double hf, double vf, mapcache_resample_mode mode, size_t npixels)
+{
+  if(fabs(hf-1)<0.0001 && fabs(vf-1)<0.0001) {
+    //use nearest resampling if we are at the resolution of the tiles
+    mapcache_image_copy_resampled_nearest(ctx,src,dst,dstminx,dstminy,hf,vf,npixels);
+  } else {
+    switch(mode) {
+      case MAPCACHE_RESAMPLE_BILINEAR:
+        mapcache_image_copy_resampled_bilinear(ctx,src,dst,dstminx,dstminy,hf,vf,0,npixels);
+        break;
+      default:
+        mapcache_image_copy_resampled_nearest(ctx,src,dst,dstminx,dstminy,hf,vf,npixels);
+        break;
+    }
+  }
+}
+
+/*
+ * resample the tiles onto image if it is given, or else pass the destination rows to sink
+ * in successive bands as soon as they are computed
+ */
+static void _mapcache_tileset_assemble(mapcache_context *ctx, mapcache_grid_link *grid_link,
     mapcache_extent *bbox, int width, int height,
-    int ntiles,
-    mapcache_tile **tiles,
-    mapcache_resample_mode mode)
+    int ntiles, mapcache_tile **tiles, mapcache_resample_mode mode,
+    mapcache_image *image, mapcache_image_band_sink sink, void *sink_data)
 {
   double hresolution = mapcache_grid_get_horizontal_resolution(bbox, width);
   double vresolution = mapcache_grid_get_vertical_resolution(bbox, height);
   mapcache_extent tilebbox;
   mapcache_tile *toplefttile=NULL;
+  mapcache_grid *grid;
   int mx=INT_MAX,my=INT_MAX,Mx=INT_MIN,My=INT_MIN;
-  int i;
-  mapcache_image *image;
+  int i, srcw, srch, tile_sy, nbands, margin, ds;
+  int *tile_ox, *tile_oy;
   mapcache_image *srcimage;
+  mapcache_image *bandimage = NULL;
   double tileresolution, dstminx, dstminy, hf, vf;
-#ifdef DEBUG
-  /* we know at least one tile contains data */
-  for(i=0; i<ntiles; i++) {
-    if(!tiles[i]->nodata) {
-      break;
-    }
-  }
-  if(i==ntiles) {
-    ctx->set_error(ctx,500,"###BUG#### mapcache_tileset_assemble_map_tiles called with no tiles containing data");
-    return NULL;
-  }
-#endif
-
-  image = mapcache_image_create_with_data(ctx,width,height);
-  if(ntiles == 0) {
-    image->has_alpha = MC_ALPHA_YES;
-    image->is_blank = MC_EMPTY_YES;
-    return image;
-  }
 
   /* compute the number of tiles horizontally and vertically */
   for(i=0; i<ntiles; i++) {
@@ -313,71 +380,23 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
     if(tile->x > Mx) Mx = tile->x;
     if(tile->y > My) My = tile->y;
   }
-  /* create image that will contain the unscaled tiles data */
-  srcimage = mapcache_image_create_with_data(ctx,
-          (Mx-mx+1)*tiles[0]->grid_link->grid->tile_sx,
-          (My-my+1)*tiles[0]->grid_link->grid->tile_sy);
+  grid = tiles[0]->grid_link->grid;
+  nbands = My-my+1;
 
-  /* copy the tiles data into the src image */
+  /* compute the position of each tile in the (virtual) mosaic of all the tiles */
+  tile_ox = apr_palloc(ctx->pool, ntiles*sizeof(int));
+  tile_oy = apr_palloc(ctx->pool, ntiles*sizeof(int));
   for(i=0; i<ntiles; i++) {
-    int ox,oy; /* the offset from the start of the src image to the start of the tile */
-    mapcache_image fakeimg;
-    mapcache_tile *tile = tiles[i];
-    switch(grid_link->grid->origin) {
-      case MAPCACHE_GRID_ORIGIN_BOTTOM_LEFT:
-        if(tile->x == mx && tile->y == My) {
-          toplefttile = tile;
-        }
-        ox = (tile->x - mx) * tile->grid_link->grid->tile_sx;
-        oy = (My - tile->y) * tile->grid_link->grid->tile_sy;
-        break;
-      case MAPCACHE_GRID_ORIGIN_TOP_LEFT:
-        if(tile->x == mx && tile->y == my) {
-          toplefttile = tile;
-        }
-        ox = (tile->x - mx) * tile->grid_link->grid->tile_sx;
-        oy = (tile->y - my) * tile->grid_link->grid->tile_sy;
-        break;
-      case MAPCACHE_GRID_ORIGIN_BOTTOM_RIGHT:
-        if(tile->x == Mx && tile->y == My) {
-          toplefttile = tile;
-        }
-        ox = (Mx - tile->x) * tile->grid_link->grid->tile_sx;
-        oy = (My - tile->y) * tile->grid_link->grid->tile_sy;
-        break;
-      case MAPCACHE_GRID_ORIGIN_TOP_RIGHT:
-        if(tile->x == Mx && tile->y == my) {
-          toplefttile = tile;
-        }
-        ox = (Mx - tile->x) * tile->grid_link->grid->tile_sx;
-        oy = (tile->y - my) * tile->grid_link->grid->tile_sy;
-        break;
-      default:
-        ctx->set_error(ctx,500,"BUG: invalid grid origin");
-        return NULL;
+    if(_mapcache_tileset_tile_mosaic_offset(ctx, grid_link->grid, tiles[i], mx, my, Mx, My, &tile_ox[i], &tile_oy[i])) {
+      toplefttile = tiles[i];
     }
-    if(tile->nodata) continue;
-
-
-    fakeimg.stride = srcimage->stride;
-    fakeimg.data = &(srcimage->data[oy*srcimage->stride+ox*4]);
-    if(!tile->raw_image) {
-      mapcache_imageio_decode_to_image(ctx,tile->encoded_data,&fakeimg);
-    } else {
-      int r;
-      unsigned char *srcptr = tile->raw_image->data;
-      unsigned char *dstptr = fakeimg.data;
-      for(r=0; r<tile->raw_image->h; r++) {
-        memcpy(dstptr,srcptr,tile->raw_image->stride);
-        srcptr += tile->raw_image->stride;
-        dstptr += fakeimg.stride;
-      }
+    if(GC_HAS_ERROR(ctx)) {
+      return;
     }
   }
 
   assert(toplefttile);
 
-  /* copy/scale the srcimage onto the destination image */
   tileresolution = toplefttile->grid_link->grid->levels[toplefttile->z]->resolution;
   mapcache_grid_get_tile_extent(ctx,toplefttile->grid_link->grid,
                            toplefttile->x, toplefttile->y, toplefttile->z, &tilebbox);
@@ -387,24 +406,190 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
   dstminy = (bbox->maxy-tilebbox.maxy)/vresolution;
   hf = tileresolution/hresolution;
   vf = tileresolution/vresolution;
-  if(fabs(hf-1)<0.0001 && fabs(vf-1)<0.0001) {
-    //use nearest resampling if we are at the resolution of the tiles
-    mapcache_image_copy_resampled_nearest(ctx,srcimage,image,dstminx,dstminy,hf,vf);
+
+  /*
+   * when the tiles are shrunk by a factor of 2 or more, decode them directly at 1/2, 1/4 or 1/8 of
+   * their size. this is only worth it for jpeg tiles, for which libjpeg can skip most of the decoding
+   * work, the other tiles of the map are decoded and then reduced to match.
+   */
+  ds = 1;
+  for(i=0; i<ntiles; i++) {
+    if(!tiles[i]->nodata && !tiles[i]->raw_image &&
+        mapcache_imageio_header_sniff(ctx,tiles[i]->encoded_data) == GC_JPEG) {
+      while(ds < 8 && hf*ds*2 <= 1.0 && vf*ds*2 <= 1.0 &&
+            grid->tile_sx % (ds*2) == 0 && grid->tile_sy % (ds*2) == 0) {
+        ds *= 2;
+      }
+      break;
+    }
+  }
+  hf *= ds;
+  vf *= ds;
+  srcw = (Mx-mx+1)*grid->tile_sx/ds;
+  srch = (My-my+1)*grid->tile_sy/ds;
+  tile_sy = grid->tile_sy/ds;
+  for(i=0; i<ntiles; i++) {
+    tile_ox[i] /= ds;
+    tile_oy[i] /= ds;
+  }
+
+  /* number of source rows above and below a destination row that the resamplers may read */
+  margin = 1 + (int)ceil(1.0/vf);
+
+  if(nbands <= 2 || margin >= tile_sy) {
+    /* create image that will contain the unscaled tiles data */
+    srcimage = mapcache_image_create_with_data(ctx, srcw, srch);
+
+    /* copy the tiles data into the src image */
+    for(i=0; i<ntiles; i++) {
+      if(tiles[i]->nodata) continue;
+      _mapcache_tileset_tile_copy_pixels(ctx, tiles[i], srcimage, tile_ox[i], tile_oy[i], ds);
+    }
+
+    /* copy/scale the srcimage onto the destination image */
+    if(image) {
+      _mapcache_tileset_resample(ctx, srcimage, image, dstminx, dstminy, hf, vf, mode, 0);
+    } else {
+      bandimage = mapcache_image_create_with_data(ctx, width, height);
+      _mapcache_tileset_resample(ctx, srcimage, bandimage, dstminx, dstminy, hf, vf, mode, 0);
+      if(!GC_HAS_ERROR(ctx)) {
+        sink(ctx, bandimage, sink_data);
+      }
+    }
   } else {
-    switch(mode) {
-      case MAPCACHE_RESAMPLE_BILINEAR:
-        mapcache_image_copy_resampled_bilinear(ctx,srcimage,image,dstminx,dstminy,hf,vf,0);
-        break;
-      default:
-        mapcache_image_copy_resampled_nearest(ctx,srcimage,image,dstminx,dstminy,hf,vf);
-        break;
+    /*
+     * process the mosaic one row of tiles (band) at a time, so we never need to hold more than
+     * two rows of decoded tiles in memory. the scratch image contains:
+     *  - the last <margin> rows of the previous band
+     *  - the current band
+     *  - the next band, that provides the first <margin> rows below the current band
+     * each destination row is resampled when processing the band that contains the source
+     * row its center maps to, so every tile is decoded exactly once.
+     */
+    int band, band_bytes = srcw*4*tile_sy;
+    srcimage = mapcache_image_create_with_data(ctx, srcw, margin + 2*tile_sy);
+    if(!image) {
+      /* a band of destination rows never spans more than the height of a scaled tile, plus one */
+      bandimage = mapcache_image_create_with_data(ctx, width, MAPCACHE_MIN(height, (int)ceil(tile_sy*vf) + 2));
+    }
+
+    for(i=0; i<ntiles; i++) {
+      if(tiles[i]->nodata || tile_oy[i] != 0) continue;
+      _mapcache_tileset_tile_copy_pixels(ctx, tiles[i], srcimage, tile_ox[i], margin, ds);
+    }
+    for(band=0; band<nbands; band++) {
+      mapcache_image srcview, dstview;
+      int top = band*tile_sy; /* first mosaic row of the current band */
+      int above = MAPCACHE_MIN(margin, top);
+      int below = (band+1 < nbands)?margin:0;
+      int d0, d1;
+
+      if(band+1 < nbands) {
+        memset(srcimage->data + (margin+tile_sy)*srcimage->stride, 0, band_bytes);
+        for(i=0; i<ntiles; i++) {
+          if(tiles[i]->nodata || tile_oy[i] != top+tile_sy) continue;
+          _mapcache_tileset_tile_copy_pixels(ctx, tiles[i], srcimage, tile_ox[i], margin+tile_sy, ds);
+        }
+      }
+      if(GC_HAS_ERROR(ctx)) break;
+
+      /* destination rows whose center falls in this band */
+      d0 = (band == 0)?0:(int)ceil(dstminy + top*vf - 0.5);
+      d1 = (band == nbands-1)?height:(int)ceil(dstminy + (top+tile_sy)*vf - 0.5);
+      d0 = MAPCACHE_MAX(d0,0);
+      d1 = MAPCACHE_MIN(d1,height);
+      if(d1 > d0) {
+        srcview = *srcimage;
+        srcview.data = srcimage->data + (margin-above)*srcimage->stride;
+        srcview.h = above + tile_sy + below;
+        srcview.has_alpha = MC_ALPHA_UNKNOWN;
+        if(image) {
+          dstview = *image;
+          dstview.data = image->data + d0*image->stride;
+        } else {
+          if(d1 - d0 > bandimage->h) {
+            apr_pool_cleanup_run(ctx->pool, bandimage->data, (void*)free) ;
+            bandimage = mapcache_image_create_with_data(ctx, width, d1 - d0);
+          }
+          memset(bandimage->data, 0, (d1 - d0)*bandimage->stride);
+          dstview = *bandimage;
+        }
+        dstview.h = d1 - d0;
+        /* the bands are about a tile high, whether they are worth splitting between the
+         * image workers depends on the size of the whole map */
+        _mapcache_tileset_resample(ctx, &srcview, &dstview, dstminx,
+                                   dstminy - d0 + (top-above)*vf, hf, vf, mode, (size_t)width*height);
+        if(sink && !GC_HAS_ERROR(ctx)) {
+          sink(ctx, &dstview, sink_data);
+        }
+        if(GC_HAS_ERROR(ctx)) break;
+      }
+
+      /* slide the window down by one band */
+      memcpy(srcimage->data, srcimage->data + tile_sy*srcimage->stride, margin*srcimage->stride);
+      memcpy(srcimage->data + margin*srcimage->stride, srcimage->data + (margin+tile_sy)*srcimage->stride, band_bytes);
     }
   }
-  /* free the memory of the temporary source image */
+  /* free the memory of the temporary source and band images */
   apr_pool_cleanup_run(ctx->pool, srcimage->data, (void*)free) ;
+  if(bandimage) {
+    apr_pool_cleanup_run(ctx->pool, bandimage->data, (void*)free) ;
+  }
+}
+
+mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapcache_tileset *tileset,
+    mapcache_grid_link *grid_link,
+    mapcache_extent *bbox, int width, int height,
+    int ntiles,
+    mapcache_tile **tiles,
+    mapcache_resample_mode mode)
+{
+  mapcache_image *image;
+#ifdef DEBUG
+  int i;
+  /* we know at least one tile contains data */
+  for(i=0; i<ntiles; i++) {
+    if(!tiles[i]->nodata) {
+      break;
+    }
+  }
+  if(i==ntiles) {
+    ctx->set_error(ctx,500,"###BUG#### mapcache_tileset_assemble_map_tiles called with no tiles containing data");
+    return NULL;
+  }
+#endif
+
+  image = mapcache_image_create_with_data(ctx,width,height);
+  if(ntiles == 0) {
+    image->has_alpha = MC_ALPHA_YES;
+    image->is_blank = MC_EMPTY_YES;
+    return image;
+  }
+  _mapcache_tileset_assemble(ctx, grid_link, bbox, width, height, ntiles, tiles, mode, image, NULL, NULL);
+  if(GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
   return image;
 }
 
+void mapcache_tileset_assemble_map_tiles_streamed(mapcache_context *ctx, mapcache_tileset *tileset,
+    mapcache_grid_link *grid_link,
+    mapcache_extent *bbox, int width, int height,
+    int ntiles,
+    mapcache_tile **tiles,
+    mapcache_resample_mode mode,
+    mapcache_image_band_sink sink, void *sink_data)
+{
+  if(ntiles == 0) {
+    mapcache_image *empty = mapcache_image_create_with_data(ctx,width,height);
+    sink(ctx, empty, sink_data);
+    apr_pool_cleanup_run(ctx->pool, empty->data, (void*)free) ;
+    return;
+  }
+  _mapcache_tileset_assemble(ctx, grid_link, bbox, width, height, ntiles, tiles, mode, NULL, sink, sink_data);
+}
+
+
 /*
  * compute the metatile that should be rendered for the given tile
  */
@@ -526,6 +711,8 @@ mapcache_tileset* mapcache_tileset_create(mapcache_context *ctx)
   tileset->metabuffer = 0;
   tileset->expires = 300; /*set a reasonable default to 5 mins */
   tileset->auto_expire = 0;
+  tileset->upscale_on_miss = 0;
+  tileset->upscale_expires = 5;
   tileset->read_only = 0;
   tileset->metadata = apr_table_make(ctx->pool,3);
   tileset->dimensions = NULL;
@@ -546,6 +733,10 @@ mapcache_tileset* mapcache_tileset_clone(mapcache_context *ctx, mapcache_tileset
   dst->metabuffer = src->metabuffer;
   dst->expires = src->expires;
   dst->auto_expire = src->auto_expire;
+  dst->upscale_on_miss = src->upscale_on_miss;
+  dst->upscale_expires = src->upscale_expires;
+  dst->prefetch_neighbors = src->prefetch_neighbors;
+  dst->prefetch_children = src->prefetch_children;
   dst->metadata = src->metadata;
   dst->dimensions = src->dimensions;
   dst->format = src->format;
@@ -560,6 +751,7 @@ mapcache_tileset* mapcache_tileset_clone(mapcache_context *ctx, mapcache_tileset
   dst->store_dimension_assemblies = src->store_dimension_assemblies;
   dst->dimension_assembly_type = src->dimension_assembly_type;
   dst->subdimension_read_only = src->subdimension_read_only;
+  dst->existence_filter = src->existence_filter;
   return dst;
 }
 
@@ -668,13 +860,17 @@ mapcache_feature_info* mapcache_tileset_feature_info_create(apr_pool_t *pool, ma
   return fi;
 }
 
-void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_tile *tile) {
+/**
+ * \brief assemble a tile by upscaling the tiles of the lower zoom level z that cover it
+ * \param read_only only use the tiles of level z that are in the cache, without rendering them
+ * \returns MAPCACHE_FALSE if one of the tiles isn't cached, in read only mode
+ */
+static int _mapcache_tileset_assemble_from_level(mapcache_context *ctx, mapcache_tile *tile, int z, int read_only) {
   mapcache_extent tile_bbox;
   double shrink_x, shrink_y, scalefactor;
   int x[4],y[4];
   int i, n=1;
   mapcache_tile *childtile;
-  assert(tile->grid_link->outofzoom_strategy == MAPCACHE_OUTOFZOOM_REASSEMBLE);
 
   /* we have at most 4 tiles composing the requested tile */
   mapcache_grid_get_tile_extent(ctx,tile->grid_link->grid,tile->x,tile->y,tile->z, &tile_bbox);
@@ -691,17 +887,15 @@ void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_
   tile_bbox.minx += shrink_x;
   tile_bbox.miny += shrink_y;
 
-  /* compute the x,y of the lower level tiles we'll use for reassembling (we take them from the grid_link->max_cached_zoom,
-   * which is the closest level were we can consume tiles from the cache
-   */
+  /* compute the x,y of the lower level tiles we'll use for reassembling */
 
-  mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.minx, tile_bbox.miny, tile->grid_link->max_cached_zoom, &x[0], &y[0]);
-  mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.maxx, tile_bbox.maxy, tile->grid_link->max_cached_zoom, &x[1], &y[1]);
+  mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.minx, tile_bbox.miny, z, &x[0], &y[0]);
+  mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.maxx, tile_bbox.maxy, z, &x[1], &y[1]);
   if(x[0] != x[1] || y[0] != y[1]) {
     /* no use computing these if the first two were identical */
     n = 4;
-    mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.minx, tile_bbox.maxy, tile->grid_link->max_cached_zoom, &x[2], &y[2]);
-    mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.maxx, tile_bbox.miny, tile->grid_link->max_cached_zoom, &x[3], &y[3]);
+    mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.minx, tile_bbox.maxy, z, &x[2], &y[2]);
+    mapcache_grid_get_xy(ctx,tile->grid_link->grid,tile_bbox.maxx, tile_bbox.miny, z, &x[3], &y[3]);
   }
   tile_bbox.maxx += shrink_x;
   tile_bbox.maxy += shrink_y;
@@ -709,7 +903,7 @@ void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_
   tile_bbox.miny -= shrink_y;
 
   childtile = mapcache_tileset_tile_clone(ctx->pool,tile);
-  childtile->z = tile->grid_link->max_cached_zoom;
+  childtile->z = z;
   scalefactor = childtile->grid_link->grid->levels[childtile->z]->resolution/tile->grid_link->grid->levels[tile->z]->resolution;
   tile->nodata = 1;
   for(i=0;i<n;i++) {
@@ -717,8 +911,19 @@ void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_
     double dstminx,dstminy;
     childtile->x = x[i];
     childtile->y = y[i];
-    mapcache_tileset_tile_get(ctx,childtile);
-    GC_CHECK_ERROR(ctx);
+    if(read_only) {
+      if(mapcache_cache_tile_get(ctx, tile->tileset->_cache, childtile) != MAPCACHE_SUCCESS || GC_HAS_ERROR(ctx)) {
+        if(tile->raw_image) {
+          apr_pool_cleanup_run(ctx->pool,tile->raw_image->data,(void*)free);
+          tile->raw_image = NULL;
+        }
+        tile->nodata = 0;
+        return MAPCACHE_FALSE;
+      }
+    } else {
+      mapcache_tileset_tile_get(ctx,childtile);
+    }
+    if(GC_HAS_ERROR(ctx)) return MAPCACHE_FALSE;
     if(childtile->nodata) {
       /* silently skip empty tiles */
       childtile->nodata = 0; /* reset flag */
@@ -726,7 +931,7 @@ void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_
     }
     if(!childtile->raw_image) {
       childtile->raw_image = mapcache_imageio_decode(ctx, childtile->encoded_data);
-      GC_CHECK_ERROR(ctx);
+      if(GC_HAS_ERROR(ctx)) return MAPCACHE_FALSE;
     }
     if(tile->nodata) {
       /* we defer the creation of the actual image bytes, no use allocating before knowing
@@ -745,7 +950,7 @@ void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_
      * ctx->log(ctx, MAPCACHE_DEBUG, "factor: %g. start: %g,%g (im size: %g)",scalefactor,dstminx,dstminy,scalefactor*256);
      */
     if(scalefactor <= tile->grid_link->grid->tile_sx/2) /*FIXME: might fail for non-square tiles, also check tile_sy */
-      mapcache_image_copy_resampled_bilinear(ctx,childtile->raw_image,tile->raw_image,dstminx,dstminy,scalefactor,scalefactor,1);
+      mapcache_image_copy_resampled_bilinear(ctx,childtile->raw_image,tile->raw_image,dstminx,dstminy,scalefactor,scalefactor,1,0);
     else {
       /* no use going through bilinear resampling if the requested scalefactor maps less than 4 pixels onto the
       * resulting tile, plus pixman has some rounding bugs in this case, see
@@ -776,6 +981,26 @@ void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_
     childtile->raw_image = NULL;
     childtile->encoded_data = NULL;
   }
+  return MAPCACHE_TRUE;
+}
+
+void mapcache_tileset_assemble_out_of_zoom_tile(mapcache_context *ctx, mapcache_tile *tile) {
+  assert(tile->grid_link->outofzoom_strategy == MAPCACHE_OUTOFZOOM_REASSEMBLE);
+  /* take the tiles from grid_link->max_cached_zoom, the closest level were we can consume tiles from the cache */
+  _mapcache_tileset_assemble_from_level(ctx, tile, tile->grid_link->max_cached_zoom, 0);
+}
+
+int mapcache_tileset_tile_get_from_ancestor(mapcache_context *ctx, mapcache_tile *tile, int max_levels) {
+  int z;
+  for(z = tile->z - 1; z >= tile->grid_link->minz && z >= tile->z - max_levels; z--) {
+    if(_mapcache_tileset_assemble_from_level(ctx, tile, z, 1) == MAPCACHE_TRUE) {
+      return MAPCACHE_TRUE;
+    }
+    if(GC_HAS_ERROR(ctx)) {
+      return MAPCACHE_FALSE;
+    }
+  }
+  return MAPCACHE_FALSE;
 }
 
 void mapcache_tileset_outofzoom_get(mapcache_context *ctx, mapcache_tile *tile) {
@@ -992,7 +1217,7 @@ void mapcache_tileset_tile_set_get_with_subdimensions(mapcache_context *ctx, map
           assembled_buffer = NULL; /* the image data went stale as we're merging something */
         }
         if(!subtile->raw_image) {
-          subtile->raw_image = mapcache_imageio_decode(ctx,subtile->encoded_data);
+          subtile->raw_image = mapcache_tile_decode(ctx,subtile);
           if(GC_HAS_ERROR(ctx))
             goto cleanup;
         }
@@ -1116,6 +1341,14 @@ static void mapcache_tileset_tile_get_without_subdimensions(mapcache_context *ct
 {
   int ret;
   mapcache_metatile *mt=NULL;
+
+  if(read_only && tile->tileset->existence_filter &&
+      mapcache_existence_filter_may_contain(ctx, tile->tileset->existence_filter, tile) == MAPCACHE_FALSE) {
+    /* the tile was never stored, and we won't be creating it: don't bother querying the cache */
+    tile->nodata = 1;
+    return;
+  }
+
   ret = mapcache_cache_tile_get(ctx, tile->tileset->_cache, tile);
   GC_CHECK_ERROR(ctx);
 
@@ -1166,7 +1399,25 @@ static void mapcache_tileset_tile_get_without_subdimensions(mapcache_context *ct
 
       /* aquire a lock on the metatile */
       mt = mapcache_tileset_metatile_get(ctx, tile);
-      isLocked = mapcache_lock_or_wait_for_resource(ctx, ctx->config->locker, mapcache_tileset_metatile_resource_key(ctx,mt), &lock);
+      if(ret == MAPCACHE_CACHE_MISS && tile->tileset->upscale_on_miss) {
+        mapcache_lock_result rv = ctx->config->locker->aquire_lock(ctx, ctx->config->locker,
+                                  mapcache_tileset_metatile_resource_key(ctx,mt), &lock);
+        GC_CHECK_ERROR(ctx);
+        if(rv == MAPCACHE_LOCK_AQUIRED) {
+          isLocked = MAPCACHE_TRUE;
+        } else {
+          /* another request is rendering the tile: don't wait for it if we can return an upscaled
+           * lower zoom level tile, that clients will replace with the rendered one shortly */
+          if(mapcache_tileset_tile_get_from_ancestor(ctx, tile, tile->tileset->upscale_on_miss) == MAPCACHE_TRUE) {
+            tile->expires = tile->tileset->upscale_expires;
+            return;
+          }
+          GC_CHECK_ERROR(ctx);
+          isLocked = mapcache_wait_for_resource(ctx, ctx->config->locker, lock);
+        }
+      } else {
+        isLocked = mapcache_lock_or_wait_for_resource(ctx, ctx->config->locker, mapcache_tileset_metatile_resource_key(ctx,mt), &lock);
+      }
       GC_CHECK_ERROR(ctx);
       if(isLocked == MAPCACHE_TRUE) {
          /* no other thread is doing the rendering, do it ourselves */
@@ -1195,6 +1446,22 @@ static void mapcache_tileset_tile_get_without_subdimensions(mapcache_context *ct
        */
       ctx->clear_errors(ctx);
 
+    else if (ctx->get_error(ctx) == 503 && mt && mt->map.overloaded &&
+             tile->tileset->source->overload_fallback == MAPCACHE_OVERLOAD_UPSCALE) {
+      /* the source refused to render: return an upscaled lower zoom level tile instead, that
+       * clients should not keep. a refusal from the global render_concurrency limit is not
+       * the source's to answer and is returned as is */
+      void *error;
+      ctx->pop_errors(ctx,&error);
+      if(mapcache_tileset_tile_get_from_ancestor(ctx, tile, MAPCACHE_ANCESTOR_MAX_LEVELS) == MAPCACHE_TRUE) {
+        tile->expires = 1;
+        return;
+      }
+      ctx->clear_errors(ctx);
+      ctx->push_errors(ctx,error);
+      return;
+    }
+
     else {
       /* Else, check for errors and try to fetch the tile from the cache.
       */
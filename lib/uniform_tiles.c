@@ -0,0 +1,208 @@
+/******************************************************************************
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching: shared encodings of uniform tiles
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+
+/*
+ * A per-process cache of the encoded versions of tiles filled with a single
+ * color, keyed on the format, the tile size and the color. Blank tiles are
+ * frequent (sea, empty areas) and caches storing them as a color marker
+ * would otherwise have to encode a full image on every request for the tile
+ * sizes that don't have a hardcoded png template, or for non png formats.
+ *
+ * Entries are never evicted: once the cache is full, further encodings are
+ * simply not cached.
+ */
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <apr_hash.h>
+#include <string.h>
+#include <stdlib.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+typedef struct {
+  char *key;
+  size_t size;
+  unsigned char *data;
+} mapcache_uniform_tile;
+
+struct mapcache_uniform_tile_cache {
+  apr_hash_t *entries;
+  size_t size;
+  size_t max_size;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+static apr_status_t _uniform_tile_cache_cleanup(void *data)
+{
+  mapcache_uniform_tile_cache *cache = (mapcache_uniform_tile_cache*)data;
+  apr_hash_index_t *hi;
+  for(hi = apr_hash_first(NULL, cache->entries); hi; hi = apr_hash_next(hi)) {
+    mapcache_uniform_tile *entry;
+    apr_hash_this(hi, NULL, NULL, (void**)&entry);
+    free(entry->key);
+    free(entry->data);
+    free(entry);
+  }
+  return APR_SUCCESS;
+}
+
+mapcache_uniform_tile_cache* mapcache_uniform_tile_cache_create(apr_pool_t *pool, size_t max_size)
+{
+  mapcache_uniform_tile_cache *cache = apr_pcalloc(pool, sizeof(mapcache_uniform_tile_cache));
+  cache->entries = apr_hash_make(pool);
+  cache->max_size = max_size;
+#if APR_HAS_THREADS
+  apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+#endif
+  apr_pool_cleanup_register(pool, cache, _uniform_tile_cache_cleanup, apr_pool_cleanup_null);
+  return cache;
+}
+
+static void _uniform_tile_cache_lock(mapcache_uniform_tile_cache *cache)
+{
+#if APR_HAS_THREADS
+  if(cache->mutex) apr_thread_mutex_lock(cache->mutex);
+#endif
+}
+
+static void _uniform_tile_cache_unlock(mapcache_uniform_tile_cache *cache)
+{
+#if APR_HAS_THREADS
+  if(cache->mutex) apr_thread_mutex_unlock(cache->mutex);
+#endif
+}
+
+mapcache_buffer* mapcache_uniform_tile_encode(mapcache_context *ctx, mapcache_image_format *format,
+    int width, int height, const unsigned char *color)
+{
+  mapcache_uniform_tile_cache *cache = ctx->config?ctx->config->uniform_tiles:NULL;
+  mapcache_uniform_tile *entry;
+  mapcache_buffer *encoded;
+  mapcache_image *image;
+  char *key;
+
+  key = apr_psprintf(ctx->pool, "%s/%dx%d/%02x%02x%02x%02x", format->name, width, height,
+                     color[0], color[1], color[2], color[3]);
+  if(cache) {
+    _uniform_tile_cache_lock(cache);
+    entry = apr_hash_get(cache->entries, key, APR_HASH_KEY_STRING);
+    if(entry) {
+      /* callers get their own copy, which they may modify */
+      encoded = mapcache_buffer_create(entry->size, ctx->pool);
+      mapcache_buffer_append(encoded, entry->size, entry->data);
+      _uniform_tile_cache_unlock(cache);
+      return encoded;
+    }
+    _uniform_tile_cache_unlock(cache);
+  }
+
+  image = mapcache_image_create_with_data(ctx, width, height);
+  if(GC_HAS_ERROR(ctx)) {
+    return NULL;
+  }
+  mapcache_image_fill(ctx, image, color);
+  image->is_blank = MC_EMPTY_YES;
+  image->has_alpha = (color[3] == 255) ? MC_ALPHA_NO : MC_ALPHA_YES;
+  encoded = format->write(ctx, image, format);
+  apr_pool_cleanup_run(ctx->pool, image->data, (void*)free);
+  if(GC_HAS_ERROR(ctx) || !cache) {
+    return encoded;
+  }
+
+  _uniform_tile_cache_lock(cache);
+  if(!apr_hash_get(cache->entries, key, APR_HASH_KEY_STRING) && cache->size + encoded->size <= cache->max_size) {
+    entry = calloc(1, sizeof(mapcache_uniform_tile));
+    if(entry) {
+      entry->key = strdup(key);
+      entry->data = malloc(encoded->size);
+      if(entry->key && entry->data) {
+        memcpy(entry->data, encoded->buf, encoded->size);
+        entry->size = encoded->size;
+        apr_hash_set(cache->entries, entry->key, APR_HASH_KEY_STRING, entry);
+        cache->size += entry->size;
+      } else {
+        free(entry->key);
+        free(entry->data);
+        free(entry);
+      }
+    }
+  }
+  _uniform_tile_cache_unlock(cache);
+  return encoded;
+}
+
+mapcache_buffer* mapcache_uniform_tile_decode(mapcache_context *ctx, mapcache_tile *tile, const unsigned char *marker)
+{
+  mapcache_image_format *format = tile->tileset->format;
+  mapcache_buffer *encoded;
+  /* png tilesets, and colors with transparency that jpeg can't represent, use the palette png */
+  if(marker[4] == 255 && format && format->type != GC_PNG && format->type != GC_RAW) {
+    tile->nodata = 0;
+    encoded = mapcache_uniform_tile_encode(ctx, format, tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy,
+                                           marker + 1);
+  } else {
+    encoded = mapcache_empty_png_decode(ctx, tile->grid_link->grid->tile_sx, tile->grid_link->grid->tile_sy, marker,
+                                        &tile->nodata);
+  }
+  tile->uniform_data = encoded;
+  memcpy(tile->uniform_color, marker + 1, 4);
+  return encoded;
+}
+
+mapcache_image* mapcache_uniform_tile_image(mapcache_context *ctx, mapcache_tile *tile)
+{
+  mapcache_image *image;
+  size_t c;
+  if(!tile->uniform_data || tile->uniform_data != tile->encoded_data) {
+    return NULL;
+  }
+  image = mapcache_image_create(ctx);
+  image->w = tile->grid_link->grid->tile_sx;
+  image->h = tile->grid_link->grid->tile_sy;
+  image->stride = 0;
+  image->data = apr_palloc(ctx->pool, image->w * 4);
+  for(c = 0; c < image->w; c++) {
+    memcpy(image->data + c * 4, tile->uniform_color, 4);
+  }
+  image->is_blank = MC_EMPTY_YES;
+  image->has_alpha = (tile->uniform_color[3] == 255)?MC_ALPHA_NO:MC_ALPHA_YES;
+  return image;
+}
+
+int mapcache_tile_is_nonuniform(mapcache_tile *tile)
+{
+  return tile->nonuniform_data && tile->nonuniform_data == tile->encoded_data;
+}
+
+/* vim: ts=2 sts=2 et sw=2
+*/
@@ -237,6 +237,12 @@ ngx_http_mapcache_handler(ngx_http_request_t *r)
                             "/",
                             NULL
                            );
+#if (NGX_HTTP_GZIP)
+    if(r->headers_in.accept_encoding) {
+      req->accept_encoding = apr_pstrndup(ctx->pool, (char*)r->headers_in.accept_encoding->value.data,
+                                          r->headers_in.accept_encoding->value.len);
+    }
+#endif
     http_response = mapcache_core_get_capabilities(ctx,request->service,req,url,pathInfo,ctx->config);
   } else if( request->type == MAPCACHE_REQUEST_GET_TILE) {
     mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*)request;
@@ -244,6 +250,10 @@ ngx_http_mapcache_handler(ngx_http_request_t *r)
   } else if( request->type == MAPCACHE_REQUEST_GET_MAP) {
     mapcache_request_get_map *req_map = (mapcache_request_get_map*)request;
     http_response = mapcache_core_get_map(ctx,req_map);
+    if(http_response) {
+      /* the body is always buffered, so errors can still be reported */
+      mapcache_http_response_buffer_stream(ctx,http_response);
+    }
 #ifdef NGINX_RW
   } else if( request->type == MAPCACHE_REQUEST_PROXY ) {
     mapcache_request_proxy *req_proxy = (mapcache_request_proxy*)request;
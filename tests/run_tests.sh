@@ -47,3 +47,129 @@ gdalinfo -checksum /tmp/0.jpg | grep Checksum=20574 >/dev/null || (echo "Did not
 curl -s "http://localhost/mapcache/wmts/1.0.0/global/default/GoogleMapsCompatible/0/0/0.jpg" > /tmp/0_bis.jpg
 diff /tmp/0.jpg /tmp/0_bis.jpg
 
+# dedup cache: every index record holds one reference on its content, also
+# after reseeding, and deleting the tiles releases all the content
+sudo rm -rf /tmp/mc/dedup-index /tmp/mc/dedup-blobs
+mapcache_seed -c /tmp/mc/tests.xml -t global-dedup --force -z 0,3
+mapcache_seed -c /tmp/mc/tests.xml -t global-dedup --force -z 0,3
+nrecords=$(find /tmp/mc/dedup-index -type f | wc -l)
+nrefs=0
+for refs in $(find /tmp/mc/dedup-blobs -name '*.refs'); do
+  nrefs=$((nrefs + $(cat $refs)))
+done
+test "$nrecords" -eq 85 || (echo "Expected 85 dedup index records, got $nrecords"; /bin/false)
+test "$nrefs" -eq "$nrecords" || (echo "Dedup reference counts ($nrefs) do not match the index ($nrecords)"; /bin/false)
+mapcache_seed -c /tmp/mc/tests.xml -t global-dedup -m delete --force -z 0,3
+test -z "$(find /tmp/mc/dedup-blobs -type f)" || (echo "Dedup content left after deleting all the tiles"; find /tmp/mc/dedup-blobs -type f; /bin/false)
+sudo rm -rf /tmp/mc/dedup-index /tmp/mc/dedup-blobs
+
+# existence filter: built over metatiles that were already seeded, it must
+# contain all their tiles, not only the first one of each metatile
+sudo rm -rf /tmp/mc/filtered /tmp/mc/global-filtered.filter
+! mapcache_seed -c /tmp/mc/tests.xml -t global-filtered --existence-filter -z 0,1 2>/dev/null || (echo "--existence-filter accepted a run restricted to some zoom levels"; /bin/false)
+! mapcache_seed -c /tmp/mc/tests.xml -t global-filtered-grids -g WGS84 --existence-filter 2>/dev/null || (echo "--existence-filter accepted a tileset with several grids"; /bin/false)
+mapcache_seed -c /tmp/mc/tests.xml -t global-filtered
+mapcache_seed -c /tmp/mc/tests.xml -t global-filtered --existence-filter
+sudo service apache2 restart
+for z in 0 1 2 3; do
+  n=$((1 << z))
+  for x in $(seq 0 $((n - 1))); do
+    for y in $(seq 0 $((n - 1))); do
+      curl -s "http://localhost/mapcache-tests/wmts/1.0.0/global-filtered/default/GoogleMapsCompatible/$z/$y/$x.png" > /tmp/filtered.png
+      curl -s "http://localhost/mapcache-tests/wmts/1.0.0/global-unfiltered/default/GoogleMapsCompatible/$z/$y/$x.png" > /tmp/unfiltered.png
+      cmp -s /tmp/filtered.png /tmp/unfiltered.png || (echo "Existence filter lost tile $z/$x/$y"; /bin/false)
+    done
+  done
+done
+sudo rm -rf /tmp/mc/filtered /tmp/mc/global-filtered.filter
+
+# flock locker: with a single stripe, the content locks of the dedup cache
+# collide with the metatile lock held by the rendering thread. concurrent
+# requests must all succeed: a content lock waiting on the stripe held by its
+# own thread would time out and fail the request
+sudo rm -rf /tmp/mc/dedup-index /tmp/mc/dedup-blobs
+pids=""
+for x in 0 1 2 3 4 5 6 7; do
+  for y in 0 2 4 6; do
+    timeout 60 curl -s -o /tmp/flock_${x}_${y}.png -w "%{http_code}\n" \
+      "http://localhost/mapcache-tests/wmts/1.0.0/global-flock/default/GoogleMapsCompatible/3/$y/$x.png" > /tmp/flock_${x}_${y}.status &
+    pids="$pids $!"
+  done
+done
+for pid in $pids; do
+  wait $pid || (echo "Concurrent request with the flock locker did not complete"; /bin/false)
+done
+for x in 0 1 2 3 4 5 6 7; do
+  for y in 0 2 4 6; do
+    grep -q 200 /tmp/flock_${x}_${y}.status || (echo "Request for tile 3/$x/$y failed with the flock locker"; cat /tmp/flock_${x}_${y}.status; /bin/false)
+  done
+done
+sudo rm -rf /tmp/mc/dedup-index /tmp/mc/dedup-blobs
+
+# distributed seeding: a coordinator and several local workers sharing a
+# directory must seed every tile, and a rerun of the coordinator with another
+# zoom range must not resume the published chunks
+sudo rm -rf /tmp/mc/filtered /tmp/mc/dist
+mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -z 0,3 --coordinate /tmp/mc/dist --chunk-size 1 --lease-timeout 30 -q &
+coordinator=$!
+workers=""
+for w in 1 2 3; do
+  mapcache_seed -c /tmp/mc/tests.xml -t global-filtered --work /tmp/mc/dist -n 2 -q &
+  workers="$workers $!"
+done
+for pid in $workers; do
+  wait $pid || (echo "Distributed seeding worker failed"; /bin/false)
+done
+wait $coordinator || (echo "Distributed seeding coordinator failed"; /bin/false)
+ntiles=$(find /tmp/mc/filtered -type f | wc -l)
+test "$ntiles" -eq 85 || (echo "Expected 85 tiles from the distributed seed, got $ntiles"; /bin/false)
+test -z "$(ls /tmp/mc/dist/pending /tmp/mc/dist/leased)" || (echo "Chunks left over after the distributed seed"; ls /tmp/mc/dist/pending /tmp/mc/dist/leased; /bin/false)
+! mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -z 0,2 --coordinate /tmp/mc/dist --chunk-size 1 -q >/dev/null || (echo "Coordinator resumed a seed of other zoom levels"; /bin/false)
+sudo rm -rf /tmp/mc/filtered /tmp/mc/dist
+
+# checkpoint and resume: a seed resumed from a checkpoint at the start of zoom
+# level 2 must seed all the tiles from there on and none of the levels before,
+# and mark the checkpoint as finished
+sudo rm -rf /tmp/mc/filtered /tmp/mc/seed.checkpoint
+printf 'mapcache_seed checkpoint\ntileset global-filtered\ngrid GoogleMapsCompatible\nzooms 0 3\nmetasize 2 2\niteration scanline\nseeded 2 0\nfinished 0\nposition 2 0 0\n' > /tmp/mc/seed.checkpoint
+! mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -i scanline -z 0,3 --checkpoint /tmp/mc/seed.checkpoint --resume --existence-filter 2>/dev/null || (echo "--resume accepted with --existence-filter"; /bin/false)
+! mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -i scanline -z 0,2 --checkpoint /tmp/mc/seed.checkpoint --resume 2>/dev/null || (echo "--resume accepted a checkpoint of other zoom levels"; /bin/false)
+mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -i scanline -z 0,3 --checkpoint /tmp/mc/seed.checkpoint --resume -q
+test ! -e /tmp/mc/filtered/0 -a ! -e /tmp/mc/filtered/1 || (echo "Resumed seed processed the levels before the checkpoint"; /bin/false)
+ntiles=$(find /tmp/mc/filtered -type f | wc -l)
+test "$ntiles" -eq 80 || (echo "Expected 80 tiles from the resumed seed, got $ntiles"; /bin/false)
+grep -q "finished 1" /tmp/mc/seed.checkpoint || (echo "Checkpoint not marked as finished"; cat /tmp/mc/seed.checkpoint; /bin/false)
+mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -i scanline -z 0,3 --checkpoint /tmp/mc/seed.checkpoint --resume -q | grep -q "already completed" || (echo "Finished checkpoint was resumed again"; /bin/false)
+sudo rm -rf /tmp/mc/filtered /tmp/mc/seed.checkpoint
+
+# bulk transfer: the blocks are aligned on the whole grid, only the tiles
+# inside the requested extent must be copied (1+1+4+16 tiles of the south
+# west quarter of the world)
+sudo rm -rf /tmp/mc/filtered /tmp/mc/transferred
+mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -q
+mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -x global-transferred -m transfer --bulk-transfer -e -20037507,-20037507,-1,-1 -q
+ntiles=$(find /tmp/mc/transferred -type f | wc -l)
+test "$ntiles" -eq 22 || (echo "Expected 22 tiles from the bulk transfer, got $ntiles"; /bin/false)
+cmp -s /tmp/mc/filtered/3/3/3.png /tmp/mc/transferred/3/3/3.png || (echo "Bulk transfer did not copy tile 3/3/3"; /bin/false)
+test ! -e /tmp/mc/transferred/3/4/0.png || (echo "Bulk transfer copied a tile outside the extent"; /bin/false)
+sudo rm -rf /tmp/mc/filtered /tmp/mc/transferred
+
+# archive cache: tiles written by the seeder are served, including the ones
+# committed after the server mapped the archive
+sudo rm -rf /tmp/mc/filtered /tmp/mc/archive
+mapcache_seed -c /tmp/mc/tests.xml -t global-filtered -z 0,2 -q
+mapcache_seed -c /tmp/mc/tests.xml -t global-archive -z 0,1 -q
+for z in 0 1 2; do
+  if test $z -eq 2; then
+    mapcache_seed -c /tmp/mc/tests.xml -t global-archive -z 2,2 -q
+  fi
+  n=$((1 << z))
+  for x in $(seq 0 $((n - 1))); do
+    for y in $(seq 0 $((n - 1))); do
+      curl -s "http://localhost/mapcache-tests/wmts/1.0.0/global-archive/default/GoogleMapsCompatible/$z/$y/$x.png" > /tmp/archive.png
+      curl -s "http://localhost/mapcache-tests/wmts/1.0.0/global-unfiltered/default/GoogleMapsCompatible/$z/$y/$x.png" > /tmp/unfiltered.png
+      cmp -s /tmp/archive.png /tmp/unfiltered.png || (echo "Archive cache did not return tile $z/$x/$y"; /bin/false)
+    done
+  done
+done
+sudo rm -rf /tmp/mc/filtered /tmp/mc/archive
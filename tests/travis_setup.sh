@@ -52,7 +52,105 @@ echo '    <service type="wms" enabled="true"/>' >> $MAPCACHE_CONF
 echo '    <log_level>debug</log_level>' >> $MAPCACHE_CONF
 echo '</mapcache>' >> $MAPCACHE_CONF
 
+# tilesets of the seeder and locking tests, kept out of the capabilities checked by run_tests.sh
+TESTS_CONF=/tmp/mc/tests.xml
+echo '<?xml version="1.0" encoding="UTF-8"?>' >> $TESTS_CONF
+echo '<mapcache>' >> $TESTS_CONF
+echo '    <source name="global-tif" type="gdal">' >> $TESTS_CONF
+echo '        <data>/tmp/mc/world.tif</data>' >> $TESTS_CONF
+echo '    </source>' >> $TESTS_CONF
+echo '    <cache name="dedup-index" type="disk">' >> $TESTS_CONF
+echo '        <base>/tmp/mc/dedup-index</base>' >> $TESTS_CONF
+echo '    </cache>' >> $TESTS_CONF
+echo '    <cache name="dedup" type="dedup">' >> $TESTS_CONF
+echo '        <cache>dedup-index</cache>' >> $TESTS_CONF
+echo '        <blobs>/tmp/mc/dedup-blobs</blobs>' >> $TESTS_CONF
+echo '    </cache>' >> $TESTS_CONF
+echo '    <cache name="dedup-flock" type="dedup">' >> $TESTS_CONF
+echo '        <cache>dedup-index</cache>' >> $TESTS_CONF
+echo '        <blobs>/tmp/mc/dedup-blobs</blobs>' >> $TESTS_CONF
+echo '        <locker type="flock">' >> $TESTS_CONF
+echo '            <directory>/tmp/mc/locks</directory>' >> $TESTS_CONF
+echo '            <files>1</files>' >> $TESTS_CONF
+echo '            <stripes>1</stripes>' >> $TESTS_CONF
+echo '            <retry>0.01</retry>' >> $TESTS_CONF
+echo '            <timeout>20</timeout>' >> $TESTS_CONF
+echo '        </locker>' >> $TESTS_CONF
+echo '    </cache>' >> $TESTS_CONF
+echo '    <cache name="filtered" type="disk" layout="template">' >> $TESTS_CONF
+echo '        <template>/tmp/mc/filtered/{z}/{x}/{y}.png</template>' >> $TESTS_CONF
+echo '    </cache>' >> $TESTS_CONF
+echo '    <cache name="archive" type="archive">' >> $TESTS_CONF
+echo '        <filename>/tmp/mc/archive/{tileset}-{grid}.mcarchive</filename>' >> $TESTS_CONF
+echo '        <seal_entries>8</seal_entries>' >> $TESTS_CONF
+echo '    </cache>' >> $TESTS_CONF
+echo '    <cache name="transferred" type="disk" layout="template">' >> $TESTS_CONF
+echo '        <template>/tmp/mc/transferred/{z}/{x}/{y}.png</template>' >> $TESTS_CONF
+echo '    </cache>' >> $TESTS_CONF
+echo '    <tileset name="global-dedup">' >> $TESTS_CONF
+echo '        <cache>dedup</cache>' >> $TESTS_CONF
+echo '        <source>global-tif</source>' >> $TESTS_CONF
+echo '        <grid maxzoom="17">GoogleMapsCompatible</grid>' >> $TESTS_CONF
+echo '        <format>PNG</format>' >> $TESTS_CONF
+echo '        <metatile>2 2</metatile>' >> $TESTS_CONF
+echo '    </tileset>' >> $TESTS_CONF
+echo '    <tileset name="global-filtered">' >> $TESTS_CONF
+echo '        <cache>filtered</cache>' >> $TESTS_CONF
+echo '        <source>global-tif</source>' >> $TESTS_CONF
+echo '        <grid maxzoom="3">GoogleMapsCompatible</grid>' >> $TESTS_CONF
+echo '        <format>PNG</format>' >> $TESTS_CONF
+echo '        <metatile>2 2</metatile>' >> $TESTS_CONF
+echo '        <read-only>true</read-only>' >> $TESTS_CONF
+echo '        <existence_filter entries="1000">/tmp/mc/global-filtered.filter</existence_filter>' >> $TESTS_CONF
+echo '    </tileset>' >> $TESTS_CONF
+echo '    <tileset name="global-filtered-grids">' >> $TESTS_CONF
+echo '        <cache>filtered</cache>' >> $TESTS_CONF
+echo '        <source>global-tif</source>' >> $TESTS_CONF
+echo '        <grid maxzoom="3">GoogleMapsCompatible</grid>' >> $TESTS_CONF
+echo '        <grid maxzoom="3">WGS84</grid>' >> $TESTS_CONF
+echo '        <format>PNG</format>' >> $TESTS_CONF
+echo '        <existence_filter entries="1000">/tmp/mc/global-filtered-grids.filter</existence_filter>' >> $TESTS_CONF
+echo '    </tileset>' >> $TESTS_CONF
+echo '    <tileset name="global-unfiltered">' >> $TESTS_CONF
+echo '        <cache>filtered</cache>' >> $TESTS_CONF
+echo '        <grid maxzoom="3">GoogleMapsCompatible</grid>' >> $TESTS_CONF
+echo '        <format>PNG</format>' >> $TESTS_CONF
+echo '    </tileset>' >> $TESTS_CONF
+echo '    <tileset name="global-archive">' >> $TESTS_CONF
+echo '        <cache>archive</cache>' >> $TESTS_CONF
+echo '        <source>global-tif</source>' >> $TESTS_CONF
+echo '        <grid maxzoom="3">GoogleMapsCompatible</grid>' >> $TESTS_CONF
+echo '        <format>PNG</format>' >> $TESTS_CONF
+echo '        <metatile>2 2</metatile>' >> $TESTS_CONF
+echo '        <read-only>true</read-only>' >> $TESTS_CONF
+echo '    </tileset>' >> $TESTS_CONF
+echo '    <tileset name="global-transferred">' >> $TESTS_CONF
+echo '        <cache>transferred</cache>' >> $TESTS_CONF
+echo '        <grid maxzoom="3">GoogleMapsCompatible</grid>' >> $TESTS_CONF
+echo '        <format>PNG</format>' >> $TESTS_CONF
+echo '    </tileset>' >> $TESTS_CONF
+echo '    <tileset name="global-flock">' >> $TESTS_CONF
+echo '        <cache>dedup-flock</cache>' >> $TESTS_CONF
+echo '        <source>global-tif</source>' >> $TESTS_CONF
+echo '        <grid maxzoom="17">GoogleMapsCompatible</grid>' >> $TESTS_CONF
+echo '        <format>PNG</format>' >> $TESTS_CONF
+echo '        <metatile>2 2</metatile>' >> $TESTS_CONF
+echo '    </tileset>' >> $TESTS_CONF
+echo '    <locker type="flock">' >> $TESTS_CONF
+echo '        <directory>/tmp/mc/locks</directory>' >> $TESTS_CONF
+echo '        <files>1</files>' >> $TESTS_CONF
+echo '        <stripes>1</stripes>' >> $TESTS_CONF
+echo '        <retry>0.01</retry>' >> $TESTS_CONF
+echo '        <timeout>20</timeout>' >> $TESTS_CONF
+echo '    </locker>' >> $TESTS_CONF
+echo '    <service type="wmts" enabled="true"/>' >> $TESTS_CONF
+echo '    <service type="wms" enabled="true"/>' >> $TESTS_CONF
+echo '    <log_level>debug</log_level>' >> $TESTS_CONF
+echo '</mapcache>' >> $TESTS_CONF
+
 cp data/world.tif /tmp/mc
+mkdir -p /tmp/mc/locks
+sudo chmod a+rwx /tmp/mc/locks
 
 sudo su -c "echo 'LoadModule mapcache_module /usr/lib/apache2/modules/mod_mapcache.so' >> /etc/apache2/apache2.conf"
 sudo su -c "echo '<IfModule mapcache_module>' >> /etc/apache2/apache2.conf"
@@ -60,6 +158,7 @@ sudo su -c "echo '   <Directory /tmp/mc>' >> /etc/apache2/apache2.conf"
 sudo su -c "echo '      Require all granted' >> /etc/apache2/apache2.conf"
 sudo su -c "echo '   </Directory>' >> /etc/apache2/apache2.conf"
 sudo su -c "echo '   MapCacheAlias /mapcache \"/tmp/mc/mapcache.xml\"' >> /etc/apache2/apache2.conf"
+sudo su -c "echo '   MapCacheAlias /mapcache-tests \"/tmp/mc/tests.xml\"' >> /etc/apache2/apache2.conf"
 sudo su -c "echo '</IfModule>' >> /etc/apache2/apache2.conf"
 
 sudo service apache2 restart
@@ -44,6 +44,8 @@
 
 #include <apr_time.h>
 #include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_atomic.h>
 
 #ifdef USE_FORK
 int msqid;
@@ -65,6 +67,10 @@ apr_queue_t *log_queue;
 #include "geos_c.h"
 int nClippers = 0;
 const GEOSPreparedGeometry **clippers=NULL;
+GEOSSTRtree *clippers_index = NULL;
+struct clip_bitmap *clip_bitmaps = NULL; /* indexed by zoom level */
+int clip_bitmap_zoom = -1;
+#define MAPCACHE_SEED_CLIP_BITMAP_MAX ((size_t)1 << 30)
 #endif
 
 mapcache_tileset *tileset;
@@ -80,6 +86,9 @@ int nprocesses=0;
 int quiet = 0;
 int verbose = 0;
 int force = 0;
+int bulk_transfer = 0;
+mapcache_extent_i *bulk_transfer_limits = NULL; /* grid limits before their alignment on the blocks */
+int build_existence_filter = 0;
 int sig_int_received = 0;
 int error_detected = 0;
 double percent_failed_allowed = 1.0;
@@ -91,6 +100,76 @@ FILE *failed_log = NULL, *retry_log = NULL;
 
 apr_time_t age_limit = 0;
 struct mctimeval starttime;
+double time_limit = 0;
+apr_time_t time_limit_deadline = 0;
+
+struct heatmap_entry {
+  int x,y,z;
+  apr_int64_t count;
+};
+struct heatmap_entry *heatmap = NULL;
+int heatmap_count = 0;
+apr_int64_t heatmap_budget = 0;
+
+/*
+ * distributed seeding through a directory shared by all the hosts: the
+ * coordinator publishes the chunks of work as empty files in DIR/pending,
+ * named z-x0-y0-x1-y1 (tile coordinates of a metatile aligned rectangle of a
+ * single zoom level, x1 and y1 excluded). A worker leases a chunk by renaming it
+ * into DIR/leased, keeps the lease alive by rewriting it, and renames it into
+ * DIR/done, containing the number of failed metatiles, once all its metatiles
+ * have been processed. The coordinator moves the chunks whose lease has expired
+ * (i.e. whose worker died) back to DIR/pending, and creates DIR/finished once
+ * every chunk is done. Lease times are modification times set by the shared
+ * filesystem when a file is written, and the coordinator compares them to the
+ * one of DIR/clock, which it rewrites itself, so the clocks of the machines
+ * never need to agree.
+ */
+const char *dist_dir = NULL;
+int dist_coordinator = 0;
+int dist_chunk_size = 16; /* in metatiles */
+int dist_lease_timeout = 300; /* in seconds */
+volatile apr_uint32_t dist_failed = 0;
+
+/* description of the distributed seed, written by the coordinator in DIR/job */
+struct dist_job {
+  char tileset[256];
+  char grid[256];
+  int metasize_x, metasize_y;
+  int minzoom, maxzoom;
+  mapcache_extent_i limits; /* grid limits of the highest zoom level, restricted by the extent */
+  int chunk_size;
+  int nchunks;
+  int lease_timeout;
+};
+
+/*
+ * resumable seeding: the feeder periodically saves its position to the
+ * checkpoint file, once all the metatiles it queued before it have been
+ * processed. In drill-down mode the position is the path of metatiles from the
+ * top level one to the one being examined, in scanline mode it is the metatile
+ * being examined.
+ */
+struct seed_position {
+  int x,y,z;
+};
+const char *checkpoint_file = NULL;
+char *checkpoint_tmpfile = NULL;
+int checkpoint_interval = 60; /* in seconds */
+apr_time_t checkpoint_next = 0;
+int checkpoint_stopped = 0;
+struct seed_position *checkpoint_path = NULL; /* indexed by zoom level - minzoom */
+int checkpoint_depth = 0;
+int resume = 0;
+struct seed_position *resume_path = NULL;
+int resume_depth = 0;
+int resume_metatiles = 0; /* seeded by the previous runs */
+int resume_nodata = 0;
+
+/* the commands queued by the feeder that haven't been processed yet, when
+ * tracked by --work or --checkpoint */
+int track_inflight = 0;
+volatile apr_uint32_t n_inflight = 0;
 
 typedef enum {
   MAPCACHE_CMD_SEED,
@@ -105,7 +184,9 @@ typedef enum {
   MAPCACHE_ITERATION_UNSET,
   MAPCACHE_ITERATION_DEPTH_FIRST,
   MAPCACHE_ITERATION_LEVEL_FIRST,
-  MAPCACHE_ITERATION_LOG
+  MAPCACHE_ITERATION_LOG,
+  MAPCACHE_ITERATION_HEATMAP,
+  MAPCACHE_ITERATION_DISTRIBUTED
 } mapcache_iteration_mode;
 
 mapcache_iteration_mode iteration_mode = MAPCACHE_ITERATION_UNSET;
@@ -144,6 +225,9 @@ int push_queue(struct seed_cmd cmd)
   struct seed_cmd *pcmd;
   int retries=0;
   int ret;
+  if(track_inflight && cmd.command != MAPCACHE_CMD_STOP) {
+    apr_atomic_inc32(&n_inflight);
+  }
 #ifdef USE_FORK
   if(nprocesses > 1) {
     struct msg_cmd mcmd;
@@ -165,7 +249,10 @@ int push_queue(struct seed_cmd cmd)
   }
   if(ret == APR_EINTR) {
     printf("failed to push tile %d %d %d after 10 retries\n",cmd.z,cmd.y,cmd.x);
-    return APR_EGENERAL;
+    ret = APR_EGENERAL;
+  }
+  if(ret != APR_SUCCESS && track_inflight && cmd.command != MAPCACHE_CMD_STOP) {
+    apr_atomic_dec32(&n_inflight);
   }
   return ret;
 }
@@ -232,6 +319,20 @@ int trypop_queue(struct seed_cmd *cmd)
 
 #define SEEDER_OPT_THREAD_DELAY 256
 #define SEEDER_OPT_RATE_LIMIT 257
+#define SEEDER_OPT_EXISTENCE_FILTER 258
+#define SEEDER_OPT_PNG_BENCHMARK 259
+#define SEEDER_OPT_HEATMAP 260
+#define SEEDER_OPT_HEATMAP_BUDGET 261
+#define SEEDER_OPT_TIME_LIMIT 262
+#define SEEDER_OPT_OGR_BITMAP_ZOOM 263
+#define SEEDER_OPT_COORDINATE 264
+#define SEEDER_OPT_WORK 265
+#define SEEDER_OPT_CHUNK_SIZE 266
+#define SEEDER_OPT_LEASE_TIMEOUT 267
+#define SEEDER_OPT_CHECKPOINT 268
+#define SEEDER_OPT_CHECKPOINT_INTERVAL 269
+#define SEEDER_OPT_RESUME 270
+#define SEEDER_OPT_BULK_TRANSFER 271
 
 static const apr_getopt_option_t seed_options[] = {
   /* long-option, short-option, has-arg flag, description */
@@ -265,11 +366,25 @@ static const apr_getopt_option_t seed_options[] = {
   { "verbose", 'v', FALSE, "show debug log messages" },
 #ifdef USE_CLIPPERS
   { "ogr-where", 'w', TRUE, "filter to apply on layer features"},
+  { "ogr-bitmap-zoom", SEEDER_OPT_OGR_BITMAP_ZOOM, TRUE, "precompute which metatiles intersect the ogr features for the zoom levels up to the given one, instead of testing them while seeding"},
 #endif
   { "transfer", 'x', TRUE, "tileset to transfer" },
+  { "bulk-transfer", SEEDER_OPT_BULK_TRANSFER, FALSE, "in transfer mode, copy the tiles by blocks of metatile size (-M, default 16,16) without checking them one by one nor re-encoding them, keeping their modification time. tiles already in the destination cache are overwritten. tiff destinations, and blank detecting destinations fed from a cache that doesn't store blank tiles as markers (disk, mbtiles...), still decode them"},
   { "zoom", 'z', TRUE, "min and max zoomlevels to seed, separated by a comma. eg 0,6" },
   { "rate-limit", SEEDER_OPT_RATE_LIMIT, TRUE, "maximum number of tiles/second to seed"},
   { "thread-delay", SEEDER_OPT_THREAD_DELAY, TRUE, "delay in seconds between rendering thread creation (ramp up)"},
+  { "existence-filter", SEEDER_OPT_EXISTENCE_FILTER, FALSE, "create the tileset's existence filter if needed, and enable it once the run has completed (the run must cover all the tiles of the tileset)"},
+  { "heatmap", SEEDER_OPT_HEATMAP, TRUE, "seed the metatiles of the tiles listed in the given file, most requested first. the file is an access log of tile requests (for the services enabled in the configuration), or lines of z,x,y[,count] in mapcache's tile coordinates"},
+  { "heatmap-budget", SEEDER_OPT_HEATMAP_BUDGET, TRUE, "with --heatmap, stop once this number of tiles has been seeded (a metatile counts for all its tiles)"},
+  { "time-limit", SEEDER_OPT_TIME_LIMIT, TRUE, "stop queueing tiles after this number of seconds, the queued ones are still processed"},
+  { "coordinate", SEEDER_OPT_COORDINATE, TRUE, "split the seed into chunks of metatiles published in the given directory, shared with the --work seeders, and wait for them to be processed"},
+  { "work", SEEDER_OPT_WORK, TRUE, "seed the chunks published by a --coordinate seeder in the given shared directory, until all of them are done"},
+  { "chunk-size", SEEDER_OPT_CHUNK_SIZE, TRUE, "with --coordinate, width and height of the chunks in metatiles (default: 16). increase it when seeding high zoom levels to limit the number of chunk files"},
+  { "lease-timeout", SEEDER_OPT_LEASE_TIMEOUT, TRUE, "with --coordinate, number of seconds after which a chunk whose worker stopped renewing its lease is handed to another worker (default: 300)"},
+  { "checkpoint", SEEDER_OPT_CHECKPOINT, TRUE, "periodically save the seeding position to the given file, to be able to --resume an interrupted seed (drill-down and scanline modes)"},
+  { "checkpoint-interval", SEEDER_OPT_CHECKPOINT_INTERVAL, TRUE, "number of seconds between two checkpoints (default: 60)"},
+  { "resume", SEEDER_OPT_RESUME, FALSE, "continue the seed from the --checkpoint file, without examining the metatiles that were processed before it. the other options must be the same as for the interrupted seed"},
+  { "png-benchmark", SEEDER_OPT_PNG_BENCHMARK, TRUE, "re-encode the png and jpeg tiles found in the given directory with the available png filter, compression and deflate settings, report the resulting sizes and encoding times, and exit (no config needed)"},
   { NULL, 0, 0, NULL }
 };
 
@@ -309,48 +424,264 @@ void mapcache_context_seeding_log(mapcache_context *ctx, mapcache_log_level leve
 }
 
 #ifdef USE_CLIPPERS
-int ogr_features_intersect_tile(mapcache_context *ctx, mapcache_tile *tile)
+typedef enum {
+  CLIP_OUTSIDE = 0,
+  CLIP_INTERSECTS,
+  CLIP_INSIDE
+} clip_state;
+
+/* clip state of each metatile of a zoom level, 2 bits per metatile */
+struct clip_bitmap {
+  int minx, miny; /* coordinates of the first metatile, in metatiles */
+  int width, height; /* in metatiles */
+  unsigned char *bits;
+};
+
+struct clip_query {
+  const GEOSGeometry *bbox;
+  clip_state state;
+};
+
+static void clip_query_cb(void *item, void *userdata)
+{
+  struct clip_query *q = (struct clip_query*)userdata;
+  const GEOSPreparedGeometry *clipper = (const GEOSPreparedGeometry*)item;
+  if(q->state == CLIP_INSIDE) {
+    return;
+  }
+  if(GEOSPreparedCovers(clipper, q->bbox) == 1) {
+    q->state = CLIP_INSIDE;
+  } else if(q->state == CLIP_OUTSIDE && GEOSPreparedIntersects(clipper, q->bbox) == 1) {
+    q->state = CLIP_INTERSECTS;
+  }
+}
+
+/**
+ * \brief the extent of the tiles of the metatile containing tile x,y,z
+ */
+static void metatile_extent(mapcache_context *ctx, int x, int y, int z, mapcache_extent *extent)
+{
+  mapcache_extent e0, e1;
+  int x0 = MAPCACHE_MAX((x / tileset->metasize_x) * tileset->metasize_x, grid_link->grid_limits[z].minx);
+  int y0 = MAPCACHE_MAX((y / tileset->metasize_y) * tileset->metasize_y, grid_link->grid_limits[z].miny);
+  int x1 = MAPCACHE_MIN((x / tileset->metasize_x + 1) * tileset->metasize_x, grid_link->grid_limits[z].maxx) - 1;
+  int y1 = MAPCACHE_MIN((y / tileset->metasize_y + 1) * tileset->metasize_y, grid_link->grid_limits[z].maxy) - 1;
+  mapcache_grid_get_tile_extent(ctx, grid_link->grid, x0, y0, z, &e0);
+  mapcache_grid_get_tile_extent(ctx, grid_link->grid, x1, y1, z, &e1);
+  extent->minx = MAPCACHE_MIN(e0.minx, e1.minx);
+  extent->miny = MAPCACHE_MIN(e0.miny, e1.miny);
+  extent->maxx = MAPCACHE_MAX(e0.maxx, e1.maxx);
+  extent->maxy = MAPCACHE_MAX(e0.maxy, e1.maxy);
+}
+
+/**
+ * \brief test an extent against the clipping features whose envelope intersects it
+ */
+static clip_state clip_test_extent(mapcache_extent e)
 {
-  mapcache_metatile *mt = mapcache_tileset_metatile_get(ctx,tile);
   GEOSCoordSequence *mtbboxls = GEOSCoordSeq_create(5,2);
   GEOSGeometry *mtbbox = GEOSGeom_createLinearRing(mtbboxls);
   GEOSGeometry *mtbboxg = GEOSGeom_createPolygon(mtbbox,NULL,0);
-  int i;
-  int intersects = 0;
-  GEOSCoordSeq_setX(mtbboxls,0,mt->map.extent.minx);
-  GEOSCoordSeq_setY(mtbboxls,0,mt->map.extent.miny);
-  GEOSCoordSeq_setX(mtbboxls,1,mt->map.extent.maxx);
-  GEOSCoordSeq_setY(mtbboxls,1,mt->map.extent.miny);
-  GEOSCoordSeq_setX(mtbboxls,2,mt->map.extent.maxx);
-  GEOSCoordSeq_setY(mtbboxls,2,mt->map.extent.maxy);
-  GEOSCoordSeq_setX(mtbboxls,3,mt->map.extent.minx);
-  GEOSCoordSeq_setY(mtbboxls,3,mt->map.extent.maxy);
-  GEOSCoordSeq_setX(mtbboxls,4,mt->map.extent.minx);
-  GEOSCoordSeq_setY(mtbboxls,4,mt->map.extent.miny);
-  for(i=0; i<nClippers; i++) {
-    const GEOSPreparedGeometry *clipper = clippers[i];
-    if(GEOSPreparedIntersects(clipper,mtbboxg)) {
-      intersects = 1;
-      break;
+  struct clip_query q;
+  GEOSCoordSeq_setX(mtbboxls,0,e.minx);
+  GEOSCoordSeq_setY(mtbboxls,0,e.miny);
+  GEOSCoordSeq_setX(mtbboxls,1,e.maxx);
+  GEOSCoordSeq_setY(mtbboxls,1,e.miny);
+  GEOSCoordSeq_setX(mtbboxls,2,e.maxx);
+  GEOSCoordSeq_setY(mtbboxls,2,e.maxy);
+  GEOSCoordSeq_setX(mtbboxls,3,e.minx);
+  GEOSCoordSeq_setY(mtbboxls,3,e.maxy);
+  GEOSCoordSeq_setX(mtbboxls,4,e.minx);
+  GEOSCoordSeq_setY(mtbboxls,4,e.miny);
+  q.bbox = mtbboxg;
+  q.state = CLIP_OUTSIDE;
+  GEOSSTRtree_query(clippers_index, mtbboxg, clip_query_cb, &q);
+  GEOSGeom_destroy(mtbboxg);
+  return q.state;
+}
+
+/**
+ * \brief test the metatile containing tile x,y,z against the clipping features
+ */
+static clip_state clip_test_metatile(mapcache_context *ctx, int x, int y, int z)
+{
+  mapcache_extent e;
+  metatile_extent(ctx, x, y, z, &e);
+  return clip_test_extent(e);
+}
+
+/**
+ * \brief test the single tile x,y,z against the clipping features
+ */
+static clip_state clip_test_tile(mapcache_context *ctx, int x, int y, int z)
+{
+  mapcache_extent e;
+  mapcache_grid_get_tile_extent(ctx, grid_link->grid, x, y, z, &e);
+  return clip_test_extent(e);
+}
+
+static clip_state clip_bitmap_get(int x, int y, int z)
+{
+  struct clip_bitmap *b = &clip_bitmaps[z];
+  size_t i = (size_t)(y / tileset->metasize_y - b->miny) * b->width + (x / tileset->metasize_x - b->minx);
+  return (clip_state)((b->bits[i >> 2] >> ((i & 3) * 2)) & 3);
+}
+
+static void clip_bitmap_set(int x, int y, int z, clip_state state)
+{
+  struct clip_bitmap *b = &clip_bitmaps[z];
+  size_t i = (size_t)(y / tileset->metasize_y - b->miny) * b->width + (x / tileset->metasize_x - b->minx);
+  b->bits[i >> 2] |= state << ((i & 3) * 2);
+}
+
+/**
+ * \brief find the metatile of level pz that contains the metatile containing tile x,y,z
+ * \returns MAPCACHE_FALSE if it straddles several metatiles of level pz, or lies outside the limits
+ */
+static int metatile_parent(mapcache_context *ctx, int x, int y, int z, int pz, int *px, int *py)
+{
+  mapcache_extent e;
+  mapcache_extent_i *limits = &grid_link->grid_limits[pz];
+  int x0, y0, x1, y1;
+  double epsx, epsy;
+  metatile_extent(ctx, x, y, z, &e);
+  epsx = (e.maxx - e.minx) * 0.001;
+  epsy = (e.maxy - e.miny) * 0.001;
+  mapcache_grid_get_xy(ctx, grid_link->grid, e.minx + epsx, e.miny + epsy, pz, &x0, &y0);
+  mapcache_grid_get_xy(ctx, grid_link->grid, e.maxx - epsx, e.maxy - epsy, pz, &x1, &y1);
+  if(GC_HAS_ERROR(ctx)) {
+    ctx->clear_errors(ctx);
+    return MAPCACHE_FALSE;
+  }
+  if(x0 < limits->minx || x0 >= limits->maxx || x1 < limits->minx || x1 >= limits->maxx ||
+      y0 < limits->miny || y0 >= limits->maxy || y1 < limits->miny || y1 >= limits->maxy ||
+      x0 / tileset->metasize_x != x1 / tileset->metasize_x || y0 / tileset->metasize_y != y1 / tileset->metasize_y) {
+    return MAPCACHE_FALSE;
+  }
+  *px = x0;
+  *py = y0;
+  return MAPCACHE_TRUE;
+}
+
+/**
+ * \brief the clip state of the metatile containing tile x,y,z, if it lies within a single
+ * metatile of level pz that is fully inside or outside the clipping features. returns
+ * CLIP_INTERSECTS if the metatile has to be tested
+ */
+static clip_state clip_bitmap_inherit(mapcache_context *ctx, int x, int y, int z, int pz)
+{
+  int px, py;
+  if(!metatile_parent(ctx, x, y, z, pz, &px, &py)) {
+    return CLIP_INTERSECTS;
+  }
+  return clip_bitmap_get(px, py, pz);
+}
+
+/**
+ * \brief compute the clip bitmaps of zoom levels minzoom to clip_bitmap_zoom. the state of a
+ * metatile is inherited from the previous level when possible, so that only the metatiles on
+ * the boundaries of the features are tested
+ */
+static int clip_bitmaps_build(mapcache_context *ctx)
+{
+  int z, mx, my;
+  size_t total = 0;
+  clip_bitmaps = apr_pcalloc(ctx->pool, (clip_bitmap_zoom + 1) * sizeof(struct clip_bitmap));
+  for(z = minzoom; z <= clip_bitmap_zoom; z++) {
+    struct clip_bitmap *b = &clip_bitmaps[z];
+    mapcache_extent_i *limits = &grid_link->grid_limits[z];
+    size_t nbytes;
+    b->minx = limits->minx / tileset->metasize_x;
+    b->miny = limits->miny / tileset->metasize_y;
+    b->width = (limits->maxx - 1) / tileset->metasize_x - b->minx + 1;
+    b->height = (limits->maxy - 1) / tileset->metasize_y - b->miny + 1;
+    nbytes = ((size_t)b->width * b->height + 3) / 4;
+    total += nbytes;
+    if(total > MAPCACHE_SEED_CLIP_BITMAP_MAX) {
+      ctx->set_error(ctx, 500, "clip bitmaps up to zoom level %d would use more than %d MB, use a lower --ogr-bitmap-zoom",
+                     z, (int)(MAPCACHE_SEED_CLIP_BITMAP_MAX >> 20));
+      return MAPCACHE_FAILURE;
+    }
+    b->bits = apr_pcalloc(ctx->pool, nbytes);
+    for(my = b->miny; my < b->miny + b->height; my++) {
+      for(mx = b->minx; mx < b->minx + b->width; mx++) {
+        int x = MAPCACHE_MAX(mx * tileset->metasize_x, limits->minx);
+        int y = MAPCACHE_MAX(my * tileset->metasize_y, limits->miny);
+        clip_state state = (z > minzoom) ? clip_bitmap_inherit(ctx, x, y, z, z - 1) : CLIP_INTERSECTS;
+        if(state == CLIP_INTERSECTS) {
+          state = clip_test_metatile(ctx, x, y, z);
+        }
+        clip_bitmap_set(x, y, z, state);
+      }
     }
   }
-  GEOSGeom_destroy(mtbboxg);
-  return intersects;
+  return MAPCACHE_SUCCESS;
+}
+
+/**
+ * \brief the clip state of the metatile containing the given tile
+ */
+static clip_state ogr_features_clip_tile(mapcache_context *ctx, mapcache_tile *tile)
+{
+  if(tile->z <= clip_bitmap_zoom) {
+    return clip_bitmap_get(tile->x, tile->y, tile->z);
+  }
+  if(clip_bitmap_zoom >= 0) {
+    clip_state state = clip_bitmap_inherit(ctx, tile->x, tile->y, tile->z, clip_bitmap_zoom);
+    if(state != CLIP_INTERSECTS) {
+      return state;
+    }
+  }
+  return clip_test_metatile(ctx, tile->x, tile->y, tile->z);
 }
 
 #endif
 
-cmd examine_tile(mapcache_context *ctx, mapcache_tile *tile)
+/**
+ * \brief add all the tiles of the existing metatile containing the given tile to the filter
+ *
+ * only the first tile of the metatile is checked for existence, the other ones were
+ * stored along with it (adding the ones that weren't, e.g. blank tiles, is harmless)
+ */
+static void existence_filter_add_metatile(mapcache_context *ctx, mapcache_existence_filter *filter, mapcache_tile *tile)
+{
+  mapcache_extent_i *limits = &tile->grid_link->grid_limits[tile->z];
+  mapcache_tile t = *tile;
+  int x0 = (tile->x / tileset->metasize_x) * tileset->metasize_x;
+  int y0 = (tile->y / tileset->metasize_y) * tileset->metasize_y;
+  for(t.y = MAPCACHE_MAX(y0, limits->miny); t.y < MAPCACHE_MIN(y0 + tileset->metasize_y, limits->maxy); t.y++) {
+    for(t.x = MAPCACHE_MAX(x0, limits->minx); t.x < MAPCACHE_MIN(x0 + tileset->metasize_x, limits->maxx); t.x++) {
+      mapcache_existence_filter_add(ctx, filter, &t);
+    }
+  }
+}
+
+/**
+ * \brief determine what should be done with the metatile containing the given tile
+ * \param inside if not NULL and set, the tile is known to be inside the clipping features.
+ * it is set if the metatile is found to be fully inside them, and so are its children
+ */
+cmd examine_tile(mapcache_context *ctx, mapcache_tile *tile, int *inside)
 {
   int action = MAPCACHE_CMD_SKIP;
   int tile_exists;
 
 #ifdef USE_CLIPPERS
   /* check we are in the requested features before checking the tile */
-  if(nClippers > 0 && ogr_features_intersect_tile(ctx,tile) == 0)
-    return MAPCACHE_CMD_STOP_RECURSION;
+  if(nClippers > 0 && !(inside && *inside)) {
+    clip_state state = ogr_features_clip_tile(ctx,tile);
+    if(state == CLIP_OUTSIDE)
+      return MAPCACHE_CMD_STOP_RECURSION;
+    if(state == CLIP_INSIDE && inside)
+      *inside = 1;
+  }
 #endif
 
+  if(mode == MAPCACHE_CMD_TRANSFER && bulk_transfer) {
+    /* the existence of the tiles is checked by transfer_block, for the whole block at once */
+    return MAPCACHE_CMD_TRANSFER;
+  }
+
   if(mode != MAPCACHE_CMD_TRANSFER && force) {
     if(mode == MAPCACHE_CMD_DELETE) {
       tile_exists = 1;
@@ -424,6 +755,9 @@ cmd examine_tile(mapcache_context *ctx, mapcache_tile *tile)
            check if the tile exists in the destination cache */
         tile->tileset = tileset_transfer;
         if (!force && mapcache_cache_tile_exists(ctx,tile->tileset->_cache, tile)) {
+          if(tile->tileset->existence_filter) {
+            existence_filter_add_metatile(ctx, tile->tileset->existence_filter, tile);
+          }
           action = MAPCACHE_CMD_SKIP;
         } else {
           action = MAPCACHE_CMD_TRANSFER;
@@ -431,6 +765,9 @@ cmd examine_tile(mapcache_context *ctx, mapcache_tile *tile)
         tile->tileset = tileset;
       } else {
         // the tile exists and we are in seed mode, skip to next one
+        if(tileset->existence_filter) {
+          existence_filter_add_metatile(ctx, tileset->existence_filter, tile);
+        }
         action = MAPCACHE_CMD_SKIP;
       }
     }
@@ -467,7 +804,148 @@ void rate_limit_sleep() {
   }
 }
 
-void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile)
+int time_limit_reached() {
+  return time_limit_deadline && apr_time_now() >= time_limit_deadline;
+}
+
+static const char* iteration_mode_name(mapcache_iteration_mode imode)
+{
+  return (imode == MAPCACHE_ITERATION_DEPTH_FIRST)?"drill-down":"scanline";
+}
+
+/**
+ * \brief write the checkpoint file, once the queued metatiles have been processed
+ */
+static void checkpoint_write(int finished)
+{
+  FILE *f;
+  int i;
+
+  while(apr_atomic_read32(&n_inflight)) {
+    if(sig_int_received || error_detected) {
+      /* the queue is being discarded, keep the previous checkpoint */
+      return;
+    }
+    apr_sleep(10000);
+  }
+  f = fopen(checkpoint_tmpfile, "w");
+  if(!f) {
+    ctx.log(&ctx, MAPCACHE_WARN, "failed to write checkpoint %s\n", checkpoint_tmpfile);
+    return;
+  }
+  fprintf(f, "mapcache_seed checkpoint\n");
+  fprintf(f, "tileset %s\n", tileset->name);
+  fprintf(f, "grid %s\n", grid_link->grid->name);
+  fprintf(f, "zooms %d %d\n", minzoom, maxzoom);
+  fprintf(f, "metasize %d %d\n", tileset->metasize_x, tileset->metasize_y);
+  fprintf(f, "iteration %s\n", iteration_mode_name(iteration_mode));
+  fprintf(f, "seeded %d %d\n", resume_metatiles + n_metatiles_tot, resume_nodata + n_nodata_tot);
+  fprintf(f, "finished %d\n", finished);
+  if(!finished) {
+    for(i = 0; i < checkpoint_depth; i++) {
+      fprintf(f, "position %d %d %d\n", checkpoint_path[i].z, checkpoint_path[i].x, checkpoint_path[i].y);
+    }
+  }
+  if(fclose(f) || rename(checkpoint_tmpfile, checkpoint_file)) {
+    ctx.log(&ctx, MAPCACHE_WARN, "failed to write checkpoint %s\n", checkpoint_file);
+  }
+}
+
+/**
+ * \brief record the metatile the feeder is about to examine, and save the checkpoint if it is due
+ */
+static void checkpoint_update(mapcache_tile *tile)
+{
+  int depth = (iteration_mode == MAPCACHE_ITERATION_DEPTH_FIRST)?tile->z - minzoom:0;
+  if(!checkpoint_file || checkpoint_stopped) return;
+  checkpoint_path[depth].x = tile->x;
+  checkpoint_path[depth].y = tile->y;
+  checkpoint_path[depth].z = tile->z;
+  checkpoint_depth = depth + 1;
+  if(time_limit_reached()) {
+    /* the feeder stops here, the next run resumes with this metatile */
+    checkpoint_write(0);
+    checkpoint_stopped = 1;
+  } else if(apr_time_now() >= checkpoint_next) {
+    checkpoint_write(0);
+    checkpoint_next = apr_time_now() + apr_time_from_sec(checkpoint_interval);
+  }
+}
+
+/**
+ * \brief read the checkpoint file into resume_path
+ * \returns MAPCACHE_FAILURE if it doesn't match the current seed
+ */
+static int checkpoint_read(int *finished)
+{
+  FILE *f = fopen(checkpoint_file, "r");
+  char line[512], name[256];
+  int a, b, c;
+  resume_depth = 0;
+  *finished = 0;
+  if(!f) {
+    ctx.set_error(&ctx, 500, "failed to open checkpoint %s", checkpoint_file);
+    return MAPCACHE_FAILURE;
+  }
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "tileset %255s", name) == 1 && strcmp(name, tileset->name)) {
+      ctx.set_error(&ctx, 400, "checkpoint %s is for tileset %s", checkpoint_file, name);
+    } else if(sscanf(line, "grid %255s", name) == 1 && strcmp(name, grid_link->grid->name)) {
+      ctx.set_error(&ctx, 400, "checkpoint %s is for grid %s", checkpoint_file, name);
+    } else if(sscanf(line, "zooms %d %d", &a, &b) == 2 && (a != minzoom || b != maxzoom)) {
+      ctx.set_error(&ctx, 400, "checkpoint %s is for zoom levels %d to %d", checkpoint_file, a, b);
+    } else if(sscanf(line, "metasize %d %d", &a, &b) == 2 && (a != tileset->metasize_x || b != tileset->metasize_y)) {
+      ctx.set_error(&ctx, 400, "checkpoint %s is for a %dx%d metatile size", checkpoint_file, a, b);
+    } else if(sscanf(line, "iteration %255s", name) == 1 && strcmp(name, iteration_mode_name(iteration_mode))) {
+      ctx.set_error(&ctx, 400, "checkpoint %s is for the %s iteration mode", checkpoint_file, name);
+    } else if(sscanf(line, "seeded %d %d", &a, &b) == 2) {
+      resume_metatiles = a;
+      resume_nodata = b;
+    } else if(sscanf(line, "finished %d", &a) == 1) {
+      *finished = a;
+    } else if(sscanf(line, "position %d %d %d", &c, &a, &b) == 3) {
+      /* drill-down positions go from minzoom down, scanline has a single one */
+      int expected = minzoom + resume_depth;
+      if(iteration_mode != MAPCACHE_ITERATION_DEPTH_FIRST) {
+        expected = resume_depth?-1:c;
+      }
+      if(c != expected || c < minzoom || c > maxzoom) {
+        ctx.set_error(&ctx, 400, "checkpoint %s contains an invalid position", checkpoint_file);
+      } else {
+        resume_path[resume_depth].x = a;
+        resume_path[resume_depth].y = b;
+        resume_path[resume_depth].z = c;
+        resume_depth++;
+      }
+    }
+    if(GC_HAS_ERROR(&ctx)) break;
+  }
+  fclose(f);
+  if(!GC_HAS_ERROR(&ctx) && !*finished && resume_depth == 0) {
+    ctx.set_error(&ctx, 400, "checkpoint %s contains no position", checkpoint_file);
+  }
+  return GC_HAS_ERROR(&ctx)?MAPCACHE_FAILURE:MAPCACHE_SUCCESS;
+}
+
+/**
+ * \brief whether a child metatile inherits its parent's "inside the clipping features"
+ * state: only if it lies within the parent metatile (px,py,pz), which isn't the case on
+ * non dyadic grids or when the metatile size doesn't divide the level's size
+ */
+static int child_inside(mapcache_context *ctx, mapcache_tile *tile, int px, int py, int pz, int inside)
+{
+#ifdef USE_CLIPPERS
+  int x, y;
+  if(!inside || !metatile_parent(ctx, tile->x, tile->y, tile->z, pz, &x, &y)) {
+    return 0;
+  }
+  return x / tileset->metasize_x == px / tileset->metasize_x && y / tileset->metasize_y == py / tileset->metasize_y;
+#else
+  return inside;
+#endif
+}
+
+void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile, int inside)
 {
   cmd action;
   int curx, cury, curz;
@@ -475,6 +953,7 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile)
   int minchildx,maxchildx,minchildy,maxchildy;
   mapcache_extent bboxbl,bboxtr;
   double epsilon;
+  struct seed_position *resume_child = NULL;
 
   apr_pool_clear(cmd_ctx->pool);
   if(sig_int_received || error_detected) { //stop if we were asked to stop by hitting ctrl-c
@@ -483,8 +962,20 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile)
     while (trypop_queue(&entry)!=APR_EAGAIN) /*do nothing*/;
     return;
   }
+  checkpoint_update(tile);
+  if(time_limit_reached())
+    return;
 
-  action = examine_tile(cmd_ctx, tile);
+  if(resume_depth && tile->z - minzoom < resume_depth - 1 &&
+      tile->x == resume_path[tile->z - minzoom].x && tile->y == resume_path[tile->z - minzoom].y) {
+    /* this metatile was examined before the checkpoint, continue with the child
+     * metatile on the checkpoint's path, skipping the ones before it */
+    resume_child = &resume_path[tile->z - minzoom + 1];
+    action = MAPCACHE_CMD_SKIP;
+  } else {
+    resume_depth = 0;
+    action = examine_tile(cmd_ctx, tile, &inside);
+  }
 
   if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_DELETE || action == MAPCACHE_CMD_TRANSFER) {
     //current x,y,z needs seeding, add it to the queue
@@ -541,7 +1032,10 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile)
     if(tile->x >= grid_link->grid_limits[tile->z].minx && tile->x < grid_link->grid_limits[tile->z].maxx) {
       for(tile->y = minchildy; tile->y < maxchildy; tile->y += tileset->metasize_y) {
         if(tile->y >= grid_link->grid_limits[tile->z].miny && tile->y < grid_link->grid_limits[tile->z].maxy) {
-          cmd_recurse(cmd_ctx,tile);
+          if(resume_child && (tile->x < resume_child->x || (tile->x == resume_child->x && tile->y < resume_child->y))) {
+            continue;
+          }
+          cmd_recurse(cmd_ctx,tile,child_inside(cmd_ctx,tile,curx,cury,curz,inside));
         }
       }
     }
@@ -552,6 +1046,151 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile)
   tile->z = curz;
 }
 
+static char* dist_path(apr_pool_t *pool, const char *state, const char *chunk)
+{
+  return apr_pstrcat(pool, dist_dir, "/", state, "/", chunk, NULL);
+}
+
+/**
+ * \brief rewrite an existing file so the filesystem sets its modification time
+ *
+ * the time is the one of the machine holding the shared directory, unlike the
+ * one that apr_file_mtime_set() would set
+ */
+static int dist_touch(apr_pool_t *pool, const char *path)
+{
+  apr_file_t *f;
+  apr_status_t rv;
+  if(apr_file_open(&f, path, APR_FOPEN_WRITE|APR_FOPEN_TRUNCATE, APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+    return MAPCACHE_FAILURE;
+  }
+  rv = apr_file_putc('\n', f);
+  apr_file_close(f);
+  return (rv == APR_SUCCESS)?MAPCACHE_SUCCESS:MAPCACHE_FAILURE;
+}
+
+/**
+ * \brief lease one of the pending chunks
+ * \returns the name of the chunk, or NULL if there are no pending chunks
+ */
+static char* dist_lease_chunk(apr_pool_t *pool)
+{
+  apr_dir_t *d;
+  apr_finfo_t finfo;
+  char *chunk = NULL;
+  if(apr_dir_open(&d, apr_pstrcat(pool, dist_dir, "/pending", NULL), pool) != APR_SUCCESS) {
+    return NULL;
+  }
+  while(apr_dir_read(&finfo, APR_FINFO_NAME, d) == APR_SUCCESS) {
+    if(finfo.name[0] == '.') continue;
+    /* refresh the chunk before leasing it: the rename keeps its modification
+     * time, and the coordinator would see an old one as an expired lease */
+    if(dist_touch(pool, dist_path(pool, "pending", finfo.name)) != MAPCACHE_SUCCESS) continue;
+    /* the rename is atomic, if it fails another worker leased the chunk first */
+    if(apr_file_rename(dist_path(pool, "pending", finfo.name), dist_path(pool, "leased", finfo.name), pool) == APR_SUCCESS) {
+      chunk = apr_pstrdup(pool, finfo.name);
+      break;
+    }
+  }
+  apr_dir_close(d);
+  return chunk;
+}
+
+static void dist_renew_lease(apr_pool_t *pool, const char *chunk)
+{
+  if(dist_touch(pool, dist_path(pool, "leased", chunk)) != MAPCACHE_SUCCESS) {
+    ctx.log(&ctx, MAPCACHE_WARN, "lease of chunk %s has expired, it may be seeded by another worker\n", chunk);
+  }
+}
+
+static void dist_complete_chunk(apr_pool_t *pool, const char *chunk, int failed)
+{
+  apr_file_t *f;
+  int written = 0;
+  /* not created if missing: the lease has expired and the chunk was handed back */
+  if(apr_file_open(&f, dist_path(pool, "leased", chunk), APR_FOPEN_WRITE|APR_FOPEN_TRUNCATE, APR_OS_DEFAULT, pool) == APR_SUCCESS) {
+    written = (apr_file_printf(f, "%d\n", failed) > 0);
+    apr_file_close(f);
+  }
+  if(!written || apr_file_rename(dist_path(pool, "leased", chunk), dist_path(pool, "done", chunk), pool) != APR_SUCCESS) {
+    ctx.log(&ctx, MAPCACHE_WARN, "failed to mark chunk %s as done, its lease has probably expired\n", chunk);
+  }
+}
+
+/**
+ * \brief lease and queue the chunks published by the coordinator until they are all done
+ */
+static void dist_feed(mapcache_context *cmd_ctx, mapcache_tile *tile)
+{
+  apr_pool_t *pool;
+  apr_interval_time_t renew_interval = apr_time_from_sec(dist_lease_timeout) / 3;
+  apr_pool_create(&pool, ctx.pool);
+  while(!sig_int_received && !error_detected && !time_limit_reached()) {
+    char *chunk;
+    int x, y, z, x0, y0, x1, y1;
+    apr_time_t renewed;
+    apr_finfo_t finfo;
+    apr_pool_clear(pool);
+    chunk = dist_lease_chunk(pool);
+    if(!chunk) {
+      if(apr_stat(&finfo, apr_pstrcat(pool, dist_dir, "/finished", NULL), APR_FINFO_TYPE, pool) == APR_SUCCESS) {
+        break;
+      }
+      /* the remaining chunks are leased by other workers, they come back if one of them dies */
+      apr_sleep(apr_time_from_sec(1));
+      continue;
+    }
+    if(sscanf(chunk, "%d-%d-%d-%d-%d", &z, &x0, &y0, &x1, &y1) != 5 || z < 0 || z >= grid_link->grid->nlevels) {
+      ctx.log(&ctx, MAPCACHE_WARN, "invalid chunk name %s\n", chunk);
+      dist_complete_chunk(pool, chunk, 1);
+      continue;
+    }
+    if(verbose) {
+      printf("leased chunk %s\n", chunk);
+    }
+    renewed = apr_time_now();
+    for(y = y0; y < y1 && !sig_int_received && !error_detected; y += tileset->metasize_y) {
+      for(x = x0; x < x1 && !sig_int_received && !error_detected; x += tileset->metasize_x) {
+        cmd action;
+        apr_pool_clear(cmd_ctx->pool);
+        tile->x = x;
+        tile->y = y;
+        tile->z = z;
+        action = examine_tile(cmd_ctx, tile, NULL);
+        if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_DELETE || action == MAPCACHE_CMD_TRANSFER) {
+          struct seed_cmd cmd;
+          cmd.x = x;
+          cmd.y = y;
+          cmd.z = z;
+          cmd.command = action;
+          if(rate_limit > 0)
+            rate_limit_sleep();
+          push_queue(cmd);
+        }
+        if(apr_time_now() - renewed > renew_interval) {
+          dist_renew_lease(pool, chunk);
+          renewed = apr_time_now();
+        }
+      }
+    }
+    /* the chunk is only done once the rendering threads have processed all its metatiles */
+    while(apr_atomic_read32(&n_inflight) && !sig_int_received && !error_detected) {
+      apr_sleep(100000);
+      if(apr_time_now() - renewed > renew_interval) {
+        dist_renew_lease(pool, chunk);
+        renewed = apr_time_now();
+      }
+    }
+    if(sig_int_received || error_detected) {
+      /* hand the chunk back to the other workers */
+      apr_file_rename(dist_path(pool, "leased", chunk), dist_path(pool, "pending", chunk), pool);
+      break;
+    }
+    dist_complete_chunk(pool, chunk, (int)apr_atomic_xchg32(&dist_failed, 0));
+  }
+  apr_pool_destroy(pool);
+}
+
 void feed_worker()
 {
   int n;
@@ -560,6 +1199,8 @@ void feed_worker()
   int x = grid_link->grid_limits[z].minx;
   int y = grid_link->grid_limits[z].miny;
   mapcache_context cmd_ctx = ctx;
+  int heatmap_next = 0;
+  apr_int64_t heatmap_seeded = 0;
   int nworkers = nthreads;
   if(nprocesses >= 1) nworkers = nprocesses;
   apr_pool_create(&cmd_ctx.pool,ctx.pool);
@@ -569,12 +1210,23 @@ void feed_worker()
     /* compute time between seed commands accounting for max rate-limit and current metasize */
     rate_limit_delay = (tileset->metasize_x * tileset->metasize_y) / (double)rate_limit;
   }
-  if(iteration_mode == MAPCACHE_ITERATION_DEPTH_FIRST) {
+  if(resume_depth) {
+    /* start from the checkpoint's top level (drill-down) or current (scanline) metatile */
+    x = resume_path[0].x;
+    y = resume_path[0].y;
+    z = resume_path[0].z;
+  }
+  if(checkpoint_file) {
+    checkpoint_next = apr_time_now() + apr_time_from_sec(checkpoint_interval);
+  }
+  if(iteration_mode == MAPCACHE_ITERATION_DISTRIBUTED) {
+    dist_feed(&cmd_ctx, tile);
+  } else if(iteration_mode == MAPCACHE_ITERATION_DEPTH_FIRST) {
     do {
       tile->x = x;
       tile->y = y;
       tile->z = z;
-      cmd_recurse(&cmd_ctx,tile);
+      cmd_recurse(&cmd_ctx,tile,0);
       x += tileset->metasize_x;
       if( x >= grid_link->grid_limits[z].maxx ) {
         y += tileset->metasize_y;
@@ -597,6 +1249,24 @@ void feed_worker()
         while (trypop_queue(&entry)!=APR_EAGAIN) /* do nothing */;
         break;
       }
+      if(iteration_mode == MAPCACHE_ITERATION_LEVEL_FIRST) {
+        tile->x = x;
+        tile->y = y;
+        tile->z = z;
+        checkpoint_update(tile);
+      }
+      if(time_limit_reached()) {
+        break;
+      }
+      if(iteration_mode == MAPCACHE_ITERATION_HEATMAP) {
+        if(heatmap_next == heatmap_count || (heatmap_budget > 0 && heatmap_seeded >= heatmap_budget)) {
+          break;
+        }
+        x = heatmap[heatmap_next].x;
+        y = heatmap[heatmap_next].y;
+        z = heatmap[heatmap_next].z;
+        heatmap_next++;
+      }
       if(iteration_mode == MAPCACHE_ITERATION_LOG) {
         if(3 != fscanf(retry_log,"%d,%d,%d\n",&x,&y,&z)) {
           break;
@@ -607,7 +1277,7 @@ void feed_worker()
       tile->x = x;
       tile->y = y;
       tile->z = z;
-      action = examine_tile(&cmd_ctx, tile);
+      action = examine_tile(&cmd_ctx, tile, NULL);
 
       if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_DELETE || action == MAPCACHE_CMD_TRANSFER) {
         //current x,y,z needs seeding, add it to the queue
@@ -619,6 +1289,10 @@ void feed_worker()
         if(rate_limit > 0)
           rate_limit_sleep();
         push_queue(cmd);
+        heatmap_seeded += tileset->metasize_x * tileset->metasize_y;
+      }
+      if(iteration_mode == MAPCACHE_ITERATION_HEATMAP) {
+        continue;
       }
 
       //compute next x,y,z
@@ -636,6 +1310,10 @@ void feed_worker()
       }
     }
   }
+  if(checkpoint_file && !checkpoint_stopped && !sig_int_received && !error_detected) {
+    checkpoint_write(1);
+  }
+
   //instruct rendering threads to stop working
 
   for(n=0; n<nworkers; n++) {
@@ -646,9 +1324,69 @@ void feed_worker()
 }
 
 
+/**
+ * \brief copy the encoded tiles of the metatile starting at the given tile to the
+ * destination tileset, with a single read and a single write of the whole block
+ * \param tiles storage for the metasize_x*metasize_y tiles of the block
+ *
+ * the tiles are not re-encoded: the ones stored as a single color marker are handed
+ * to the destination cache along with their color, so it can store them as a marker
+ * too, and the other ones read from a cache storing such markers are known not to be
+ * uniform, so the destination doesn't decode them to detect blank tiles. the tiff
+ * caches, and the blank detecting caches fed from other caches, still decode them.
+ */
+static void transfer_block(mapcache_context *ctx, mapcache_tile *origin, mapcache_tile *tiles)
+{
+  mapcache_extent_i *limits = &bulk_transfer_limits[origin->z];
+  int i, j, ntiles = 0, nfound = 0;
+#ifdef USE_CLIPPERS
+  /* the tiles of a block that intersects the features are tested one by one */
+  int clip = nClippers > 0 && ogr_features_clip_tile(ctx, origin) != CLIP_INSIDE;
+#endif
+
+  for(j = MAPCACHE_MAX(origin->y, limits->miny); j < origin->y + tileset->metasize_y && j < limits->maxy; j++) {
+    for(i = MAPCACHE_MAX(origin->x, limits->minx); i < origin->x + tileset->metasize_x && i < limits->maxx; i++) {
+      mapcache_tile *t;
+#ifdef USE_CLIPPERS
+      if(clip && clip_test_tile(ctx, i, j, origin->z) == CLIP_OUTSIDE) continue;
+#endif
+      t = &tiles[ntiles++];
+      *t = *origin;
+      t->x = i;
+      t->y = j;
+      t->encoded_data = NULL;
+      t->raw_image = NULL;
+      t->uniform_data = NULL;
+      t->nonuniform_data = NULL;
+      t->nodata = 0;
+      t->mtime = 0;
+    }
+  }
+  origin->nodata = 1;
+  if(!ntiles) return;
+
+  mapcache_cache_tile_multi_get(ctx, tileset->_cache, tiles, ntiles);
+  GC_CHECK_ERROR(ctx);
+  for(i = 0; i < ntiles; i++) {
+    if(!tiles[i].encoded_data || tiles[i].nodata) continue;
+    if(nfound != i) tiles[nfound] = tiles[i];
+    tiles[nfound].tileset = tileset_transfer;
+    tiles[nfound].keep_mtime = 1;
+    if(!tiles[nfound].raw_image) {
+      tiles[nfound].raw_image = mapcache_uniform_tile_image(ctx, &tiles[nfound]);
+    }
+    nfound++;
+  }
+  if(nfound) {
+    mapcache_cache_tile_multi_set(ctx, tileset_transfer->_cache, tiles, nfound);
+    origin->nodata = 0;
+  }
+}
+
 void seed_worker()
 {
   mapcache_tile *tile;
+  mapcache_tile *block = NULL;
   mapcache_context seed_ctx = ctx;
   apr_pool_t *tpool;
   seed_ctx.log = seed_log;
@@ -658,6 +1396,9 @@ void seed_worker()
   if(dimensions) {
     tile->dimensions = mapcache_requested_dimensions_clone(tpool,dimensions);
   }
+  if(mode == MAPCACHE_CMD_TRANSFER && bulk_transfer) {
+    block = apr_pcalloc(tpool, tileset->metasize_x * tileset->metasize_y * sizeof(mapcache_tile));
+  }
   while(1) {
     struct seed_cmd cmd;
     apr_status_t ret;
@@ -706,6 +1447,8 @@ void seed_worker()
       } else {
         mapcache_tileset_tile_set_get_with_subdimensions(&seed_ctx,tile);
       }
+    } else if (cmd.command == MAPCACHE_CMD_TRANSFER && block) {
+      transfer_block(&seed_ctx, tile, block);
     } else if (cmd.command == MAPCACHE_CMD_TRANSFER) {
       mapcache_tileset_tile_get(&seed_ctx, tile);
       if(!tile->nodata && !GC_HAS_ERROR(&seed_ctx)) {
@@ -816,6 +1559,9 @@ static void* APR_THREAD_FUNC log_thread_fn(apr_thread_t *thread, void *data) {
       if(failed_log) {
         fprintf(failed_log,"%d,%d,%d\n",st->x,st->y,st->z);
       }
+      if(dist_dir) {
+        apr_atomic_inc32(&dist_failed);
+      }
       for(i=0; i<FAIL_BACKLOG_COUNT; i++) {
         if(failed[i]>=0) ntotal++;
         if(failed[i]==1) nfailed++;
@@ -829,6 +1575,9 @@ static void* APR_THREAD_FUNC log_thread_fn(apr_thread_t *thread, void *data) {
     }
     if(st->msg) free(st->msg);
     free(st);
+    if(track_inflight) {
+      apr_atomic_dec32(&n_inflight);
+    }
     cur++;
     cur %= FAIL_BACKLOG_COUNT;
   }
@@ -863,6 +1612,342 @@ log_and_exit(const char *fmt, ...)
 }
 
 
+/**
+ * add count requests to the metatile of tile x,y,z, if it is in the seeded zoom levels and extent
+ */
+static void heatmap_add(apr_hash_t *metatiles, int x, int y, int z, apr_int64_t count)
+{
+  struct heatmap_entry *entry;
+  char key[64];
+  if(z < minzoom || z > maxzoom || count <= 0) return;
+  if(x < grid_link->grid_limits[z].minx || x >= grid_link->grid_limits[z].maxx ||
+      y < grid_link->grid_limits[z].miny || y >= grid_link->grid_limits[z].maxy) return;
+  x = (x / tileset->metasize_x) * tileset->metasize_x;
+  y = (y / tileset->metasize_y) * tileset->metasize_y;
+  snprintf(key, sizeof(key), "%d/%d/%d", z, x, y);
+  entry = apr_hash_get(metatiles, key, APR_HASH_KEY_STRING);
+  if(!entry) {
+    entry = apr_pcalloc(ctx.pool, sizeof(struct heatmap_entry));
+    entry->x = x;
+    entry->y = y;
+    entry->z = z;
+    apr_hash_set(metatiles, apr_pstrdup(ctx.pool, key), APR_HASH_KEY_STRING, entry);
+  }
+  entry->count += count;
+}
+
+/**
+ * add the tiles of the seeded tileset and grid requested by an access log line
+ */
+static void heatmap_add_request(mapcache_context *lctx, apr_hash_t *metatiles, char *line)
+{
+  char *url, *end, *query, *path;
+  apr_table_t *params;
+  int i;
+
+  if((url = strstr(line, "\"GET ")) != NULL) {
+    url += 5;
+  } else if((url = strstr(line, "\"HEAD ")) != NULL) {
+    url += 6;
+  } else {
+    return;
+  }
+  end = strpbrk(url, " \"");
+  if(end) *end = '\0';
+  if((end = strstr(url, "://")) != NULL) {
+    /* absolute url, skip the host */
+    url = strchr(end + 3, '/');
+    if(!url) return;
+  }
+  query = strchr(url, '?');
+  if(query) *query++ = '\0';
+  _mapcache_unescape_url(url);
+  params = mapcache_http_parse_param_string(lctx, query);
+
+  /* we don't know where mapcache is mounted: try the services on each suffix of the path */
+  for(path = url; path; path = strchr(path + 1, '/')) {
+    mapcache_request *request = NULL;
+    mapcache_service_dispatch_request(lctx, &request, path, params, cfg);
+    if(!GC_HAS_ERROR(lctx) && request && request->type == MAPCACHE_REQUEST_GET_TILE) {
+      mapcache_request_get_tile *req_tile = (mapcache_request_get_tile*)request;
+      for(i = 0; i < req_tile->ntiles; i++) {
+        mapcache_tile *tile = req_tile->tiles[i];
+        if(!strcmp(tile->tileset->name, tileset->name) && tile->grid_link->grid == grid_link->grid) {
+          heatmap_add(metatiles, tile->x, tile->y, tile->z, 1);
+        }
+      }
+      return;
+    }
+    lctx->clear_errors(lctx);
+  }
+}
+
+static int heatmap_entry_cmp(const void *a, const void *b)
+{
+  const struct heatmap_entry *ea = (const struct heatmap_entry*)a;
+  const struct heatmap_entry *eb = (const struct heatmap_entry*)b;
+  if(ea->count != eb->count) return (ea->count > eb->count) ? -1 : 1;
+  if(ea->z != eb->z) return ea->z - eb->z;
+  if(ea->y != eb->y) return ea->y - eb->y;
+  return ea->x - eb->x;
+}
+
+/**
+ * \brief read the heatmap file into the heatmap array of metatiles, sorted by decreasing popularity
+ */
+static int load_heatmap(const char *filename)
+{
+  FILE *f;
+  char line[8192];
+  apr_hash_t *metatiles = apr_hash_make(ctx.pool);
+  apr_hash_index_t *hi;
+  mapcache_context lctx = ctx;
+  int n = 0;
+
+  f = fopen(filename, "r");
+  if(!f) {
+    ctx.set_error(&ctx, 500, "failed to open heatmap file %s", filename);
+    return MAPCACHE_FAILURE;
+  }
+  lctx.log = seed_log;
+  apr_pool_create(&lctx.pool, ctx.pool);
+  while(fgets(line, sizeof(line), f)) {
+    int x, y, z, len;
+    apr_pool_clear(lctx.pool);
+    lctx.exceptions = NULL;
+    if(!strchr(line, '\n') && !feof(f)) {
+      /* skip the rest of an overlong line */
+      int c;
+      while((c = fgetc(f)) != EOF && c != '\n');
+    }
+    if(sscanf(line, "%d,%d,%d%n", &z, &x, &y, &len) == 3) {
+      char *endptr = line + len;
+      apr_int64_t count = 1;
+      if(*endptr == ',') {
+        count = apr_strtoi64(endptr + 1, &endptr, 10);
+      }
+      while(*endptr == ' ' || *endptr == '\t' || *endptr == '\r' || *endptr == '\n') endptr++;
+      if(*endptr) {
+        fclose(f);
+        ctx.set_error(&ctx, 500, "failed to parse heatmap line \"%s\", expecting z,x,y[,count]", line);
+        return MAPCACHE_FAILURE;
+      }
+      heatmap_add(metatiles, x, y, z, count);
+    } else {
+      heatmap_add_request(&lctx, metatiles, line);
+    }
+  }
+  fclose(f);
+  apr_pool_destroy(lctx.pool);
+
+  heatmap_count = apr_hash_count(metatiles);
+  heatmap = apr_pcalloc(ctx.pool, (heatmap_count + 1) * sizeof(struct heatmap_entry));
+  for(hi = apr_hash_first(ctx.pool, metatiles); hi; hi = apr_hash_next(hi)) {
+    struct heatmap_entry *entry;
+    apr_hash_this(hi, NULL, NULL, (void**)&entry);
+    heatmap[n++] = *entry;
+  }
+  qsort(heatmap, heatmap_count, sizeof(struct heatmap_entry), heatmap_entry_cmp);
+  return MAPCACHE_SUCCESS;
+}
+
+/**
+ * \brief read the description of the distributed seed written by the coordinator
+ * \returns MAPCACHE_FAILURE if the coordinator hasn't written it yet
+ */
+static int dist_read_job(struct dist_job *job)
+{
+  FILE *f = fopen(apr_pstrcat(ctx.pool, dist_dir, "/job", NULL), "r");
+  int n;
+  if(!f) {
+    return MAPCACHE_FAILURE;
+  }
+  n = fscanf(f, "%255s %255s %d %d %d %d %d %d %d %d %d %d %d", job->tileset, job->grid,
+             &job->metasize_x, &job->metasize_y, &job->minzoom, &job->maxzoom,
+             &job->limits.minx, &job->limits.miny, &job->limits.maxx, &job->limits.maxy,
+             &job->chunk_size, &job->nchunks, &job->lease_timeout);
+  fclose(f);
+  return (n == 13)?MAPCACHE_SUCCESS:MAPCACHE_FAILURE;
+}
+
+/**
+ * \brief check that the distributed seed in the shared directory is the one requested on the command line
+ * \returns a description of the mismatch, or NULL if the seed matches
+ */
+static char* dist_job_mismatch(struct dist_job *job, int check_chunks)
+{
+  mapcache_extent_i *limits = &grid_link->grid_limits[maxzoom];
+  if(strcmp(job->tileset, tileset->name) || strcmp(job->grid, grid_link->grid->name) ||
+      job->metasize_x != tileset->metasize_x || job->metasize_y != tileset->metasize_y) {
+    return apr_psprintf(ctx.pool, "%s contains a seed of tileset %s on grid %s with a %dx%d metatile size",
+                        dist_dir, job->tileset, job->grid, job->metasize_x, job->metasize_y);
+  }
+  if(!check_chunks) {
+    return NULL;
+  }
+  if(job->minzoom != minzoom || job->maxzoom != maxzoom) {
+    return apr_psprintf(ctx.pool, "%s contains a seed of zoom levels %d to %d", dist_dir, job->minzoom, job->maxzoom);
+  }
+  if(job->limits.minx != limits->minx || job->limits.miny != limits->miny ||
+      job->limits.maxx != limits->maxx || job->limits.maxy != limits->maxy) {
+    return apr_psprintf(ctx.pool, "%s contains a seed of a different extent", dist_dir);
+  }
+  if(job->chunk_size != dist_chunk_size) {
+    return apr_psprintf(ctx.pool, "%s contains a seed with a chunk size of %d", dist_dir, job->chunk_size);
+  }
+  return NULL;
+}
+
+/**
+ * \brief publish the chunks of the seed and wait until the workers have processed them
+ * \returns the exit code of the seeder
+ */
+static int dist_coordinate()
+{
+  apr_pool_t *pool;
+  apr_hash_t *done = apr_hash_make(ctx.pool);
+  struct dist_job job;
+  char *clock_file = apr_pstrcat(ctx.pool, dist_dir, "/clock", NULL);
+  int nchunks = 0, ndone = 0, nfailed = 0, nexpired = 0;
+  const char *states[] = {"pending", "leased", "done"};
+  int i, z;
+
+  for(i = 0; i < 3; i++) {
+    if(apr_dir_make_recursive(apr_pstrcat(ctx.pool, dist_dir, "/", states[i], NULL), APR_OS_DEFAULT, ctx.pool) != APR_SUCCESS) {
+      printf("failed to create directory %s/%s\n", dist_dir, states[i]);
+      return 1;
+    }
+  }
+  apr_pool_create(&pool, ctx.pool);
+
+  if(dist_read_job(&job) == MAPCACHE_SUCCESS) {
+    char *mismatch = dist_job_mismatch(&job, 1);
+    if(mismatch) {
+      printf("%s, not resuming it\n", mismatch);
+      return 1;
+    }
+    nchunks = job.nchunks;
+    printf("resuming the seed of %d chunks in %s\n", nchunks, dist_dir);
+  } else {
+    FILE *f;
+    for(z = minzoom; z <= maxzoom; z++) {
+      mapcache_extent_i *limits = &grid_link->grid_limits[z];
+      int stepx = dist_chunk_size * tileset->metasize_x;
+      int stepy = dist_chunk_size * tileset->metasize_y;
+      int x, y;
+      for(y = limits->miny; y < limits->maxy; y += stepy) {
+        for(x = limits->minx; x < limits->maxx; x += stepx) {
+          char *chunk = apr_psprintf(pool, "%d-%d-%d-%d-%d", z, x, y,
+                                     MAPCACHE_MIN(x + stepx, limits->maxx), MAPCACHE_MIN(y + stepy, limits->maxy));
+          f = fopen(dist_path(pool, "pending", chunk), "w");
+          if(!f) {
+            printf("failed to create chunk %s/pending/%s\n", dist_dir, chunk);
+            return 1;
+          }
+          fclose(f);
+          nchunks++;
+        }
+        apr_pool_clear(pool);
+      }
+    }
+    /* written last, the workers wait for it before leasing chunks */
+    f = fopen(apr_pstrcat(ctx.pool, dist_dir, "/job", NULL), "w");
+    if(!f) {
+      printf("failed to create %s/job\n", dist_dir);
+      return 1;
+    }
+    fprintf(f, "%s %s %d %d %d %d %d %d %d %d %d %d %d\n", tileset->name, grid_link->grid->name,
+            tileset->metasize_x, tileset->metasize_y, minzoom, maxzoom,
+            grid_link->grid_limits[maxzoom].minx, grid_link->grid_limits[maxzoom].miny,
+            grid_link->grid_limits[maxzoom].maxx, grid_link->grid_limits[maxzoom].maxy,
+            dist_chunk_size, nchunks, dist_lease_timeout);
+    fclose(f);
+    printf("published %d chunks in %s\n", nchunks, dist_dir);
+  }
+
+  {
+    FILE *f = fopen(clock_file, "w");
+    if(!f) {
+      printf("failed to create %s\n", clock_file);
+      return 1;
+    }
+    fclose(f);
+  }
+
+  while(!sig_int_received) {
+    apr_time_t now;
+    int nleased = 0;
+    apr_dir_t *d;
+    apr_finfo_t finfo;
+    apr_pool_clear(pool);
+
+    /* the current time of the shared filesystem, the leases are renewed with it */
+    if(dist_touch(pool, clock_file) != MAPCACHE_SUCCESS ||
+        apr_stat(&finfo, clock_file, APR_FINFO_MTIME, pool) != APR_SUCCESS) {
+      printf("failed to update %s\n", clock_file);
+      apr_pool_destroy(pool);
+      return 1;
+    }
+    now = finfo.mtime;
+
+    /* hand the chunks of the workers that stopped renewing their lease back to the others */
+    if(apr_dir_open(&d, apr_pstrcat(pool, dist_dir, "/leased", NULL), pool) == APR_SUCCESS) {
+      while(apr_dir_read(&finfo, APR_FINFO_NAME|APR_FINFO_MTIME, d) == APR_SUCCESS) {
+        if(finfo.name[0] == '.') continue;
+        if(now - finfo.mtime > apr_time_from_sec(dist_lease_timeout)) {
+          if(apr_file_rename(dist_path(pool, "leased", finfo.name), dist_path(pool, "pending", finfo.name), pool) == APR_SUCCESS) {
+            ctx.log(&ctx, MAPCACHE_WARN, "lease of chunk %s has expired, handing it to another worker\n", finfo.name);
+            nexpired++;
+          }
+        } else {
+          nleased++;
+        }
+      }
+      apr_dir_close(d);
+    }
+
+    if(apr_dir_open(&d, apr_pstrcat(pool, dist_dir, "/done", NULL), pool) == APR_SUCCESS) {
+      while(apr_dir_read(&finfo, APR_FINFO_NAME, d) == APR_SUCCESS) {
+        FILE *f;
+        int failed = 0;
+        if(finfo.name[0] == '.' || apr_hash_get(done, finfo.name, APR_HASH_KEY_STRING)) continue;
+        f = fopen(dist_path(pool, "done", finfo.name), "r");
+        if(f) {
+          if(fscanf(f, "%d", &failed) != 1) failed = 0;
+          fclose(f);
+        }
+        if(failed > 0) {
+          ctx.log(&ctx, MAPCACHE_WARN, "chunk %s was seeded with %d failed metatiles\n", finfo.name, failed);
+          nfailed += failed;
+        }
+        apr_hash_set(done, apr_pstrdup(ctx.pool, finfo.name), APR_HASH_KEY_STRING, (void*)1);
+        ndone++;
+      }
+      apr_dir_close(d);
+    }
+
+    if(!quiet) {
+      printf("                                                                                               \r");
+      printf("%d/%d chunks done, %d leased, %d failed metatiles\r", ndone, nchunks, nleased, nfailed);
+      fflush(stdout);
+    }
+    if(ndone >= nchunks) break;
+    apr_sleep(apr_time_from_sec(1));
+  }
+  apr_pool_destroy(pool);
+
+  if(sig_int_received) {
+    printf("\ninterrupted, rerun with the same options to resume the seed\n");
+    return 1;
+  }
+  {
+    FILE *f = fopen(apr_pstrcat(ctx.pool, dist_dir, "/finished", NULL), "w");
+    if(f) fclose(f);
+  }
+  printf("\nseeded %d chunks, %d failed metatiles, %d expired leases\n", nchunks, nfailed, nexpired);
+  return nfailed?1:0;
+}
+
 int usage(const char *progname, char *msg, ...)
 {
   int i=0;
@@ -902,6 +1987,100 @@ static int isPowerOfTwo(int x)
   return (x & (x - 1)) == 0;
 }
 
+/**
+ * \brief re-encode the sample tiles found in dir with the png settings, reporting the
+ * size versus encoding time tradeoff of each combination
+ */
+static int png_benchmark(const char *dir)
+{
+  static const char *filters[] = {"none", "sub", "up", "avg", "paeth", "adaptive"};
+  static const char *backends[] = {"zlib", "libdeflate"};
+  static const mapcache_compression_type compressions[] = {
+    MAPCACHE_COMPRESSION_FAST, MAPCACHE_COMPRESSION_DEFAULT, MAPCACHE_COMPRESSION_BEST
+  };
+  static const char *compression_names[] = {"fast", "default", "best"};
+  apr_array_header_t *images = apr_array_make(ctx.pool, 100, sizeof(mapcache_image*));
+  apr_dir_t *d;
+  apr_finfo_t finfo;
+  apr_pool_t *main_pool = ctx.pool;
+  double raw_size = 0;
+  int b, c, f, i, nbackends = 1;
+
+#ifdef USE_LIBDEFLATE
+  nbackends = 2;
+#endif
+  if(apr_dir_open(&d, dir, ctx.pool) != APR_SUCCESS) {
+    printf("failed to open directory %s\n", dir);
+    return 1;
+  }
+  while(apr_dir_read(&finfo, APR_FINFO_NAME|APR_FINFO_TYPE|APR_FINFO_SIZE, d) == APR_SUCCESS) {
+    apr_file_t *file;
+    apr_size_t bytes;
+    mapcache_buffer *data;
+    mapcache_image *image;
+    if(finfo.filetype != APR_REG || finfo.size == 0) continue;
+    if(apr_file_open(&file, apr_pstrcat(ctx.pool, dir, "/", finfo.name, NULL), APR_FOPEN_READ|APR_FOPEN_BINARY,
+                     APR_OS_DEFAULT, ctx.pool) != APR_SUCCESS) {
+      continue;
+    }
+    data = mapcache_buffer_create(finfo.size, ctx.pool);
+    if(apr_file_read_full(file, data->buf, finfo.size, &bytes) == APR_SUCCESS) {
+      data->size = bytes;
+    }
+    apr_file_close(file);
+    if(!mapcache_imageio_is_valid_format(&ctx, data)) continue;
+    image = mapcache_imageio_decode(&ctx, data);
+    if(GC_HAS_ERROR(&ctx)) {
+      ctx.clear_errors(&ctx);
+      continue;
+    }
+    APR_ARRAY_PUSH(images, mapcache_image*) = image;
+    raw_size += image->w * image->h * 4;
+  }
+  apr_dir_close(d);
+  if(!images->nelts) {
+    printf("no png or jpeg tiles found in %s\n", dir);
+    return 1;
+  }
+
+  printf("%d sample tiles, %.0f bytes of uncompressed rgba\n", images->nelts, raw_size);
+  printf("%-10s %-11s %-9s %12s %8s %10s\n", "deflate", "compression", "filter", "bytes", "ratio", "ms/tile");
+  for(b = 0; b < nbackends; b++) {
+    for(c = 0; c < sizeof(compressions) / sizeof(compressions[0]); c++) {
+      for(f = 0; f <= MAPCACHE_PNG_FILTER_ADAPTIVE; f++) {
+        mapcache_image_format_png *format;
+        apr_pool_t *tmp_pool;
+        apr_time_t start;
+        double total = 0;
+        apr_pool_create(&tmp_pool, main_pool);
+        format = (mapcache_image_format_png*)mapcache_imageio_create_png_format(tmp_pool, "benchmark", compressions[c]);
+        format->filter = f;
+        format->deflate = b;
+        ctx.pool = tmp_pool;
+        start = apr_time_now();
+        for(i = 0; i < images->nelts; i++) {
+          mapcache_buffer *encoded = format->format.write(&ctx, APR_ARRAY_IDX(images, i, mapcache_image*),
+                                     (mapcache_image_format*)format);
+          if(GC_HAS_ERROR(&ctx)) break;
+          total += encoded->size;
+        }
+        ctx.pool = main_pool;
+        if(GC_HAS_ERROR(&ctx)) {
+          printf("%-10s %-11s %-9s failed: %s\n", backends[b], compression_names[c], filters[f],
+                 ctx.get_error_message(&ctx));
+          ctx.clear_errors(&ctx);
+        } else {
+          printf("%-10s %-11s %-9s %12.0f %7.1f%% %10.2f\n", backends[b], compression_names[c], filters[f],
+                 total, 100.0 * total / raw_size, (apr_time_now() - start) / 1000.0 / images->nelts);
+        }
+        apr_pool_destroy(tmp_pool);
+      }
+    }
+  }
+  apr_terminate();
+  return 0;
+}
+
 int main(int argc, const char **argv)
 {
   /* initialize apr_getopt_t */
@@ -926,6 +2105,8 @@ int main(int argc, const char **argv)
   int metax=-1,metay=-1;
   double *extent_array = NULL;
   double thread_delay = 0.0;
+  const char *png_benchmark_dir = NULL;
+  const char *heatmap_file = NULL;
 
 #ifdef USE_CLIPPERS
   OGRFeatureH hFeature;
@@ -942,6 +2123,8 @@ int main(int argc, const char **argv)
   mapcache_context_init(&ctx);
   cfg = mapcache_configuration_create(ctx.pool);
   ctx.config = cfg;
+  /* let interactive requests go first when render concurrency is limited */
+  cfg->batch_rendering = 1;
   ctx.log= mapcache_context_seeding_log;
   apr_getopt_init(&opt, ctx.pool, argc, argv);
 
@@ -1085,6 +2268,57 @@ int main(int argc, const char **argv)
         if(thread_delay < 0.0 )
           return usage(argv[0], "failed to parse thread-delay, expecting positive number of seconds");
         break;
+      case SEEDER_OPT_EXISTENCE_FILTER:
+        build_existence_filter = 1;
+        break;
+      case SEEDER_OPT_PNG_BENCHMARK:
+        png_benchmark_dir = optarg;
+        break;
+      case SEEDER_OPT_HEATMAP:
+        heatmap_file = optarg;
+        break;
+      case SEEDER_OPT_HEATMAP_BUDGET:
+        heatmap_budget = apr_strtoi64(optarg, NULL, 10);
+        if(heatmap_budget <= 0)
+          return usage(argv[0], "failed to parse heatmap-budget, expecting positive number of tiles");
+        break;
+      case SEEDER_OPT_TIME_LIMIT:
+        time_limit = strtod(optarg, NULL);
+        if(time_limit <= 0)
+          return usage(argv[0], "failed to parse time-limit, expecting positive number of seconds");
+        break;
+      case SEEDER_OPT_COORDINATE:
+        dist_dir = optarg;
+        dist_coordinator = 1;
+        break;
+      case SEEDER_OPT_WORK:
+        dist_dir = optarg;
+        dist_coordinator = 0;
+        break;
+      case SEEDER_OPT_CHUNK_SIZE:
+        dist_chunk_size = (int)strtol(optarg, NULL, 10);
+        if(dist_chunk_size <= 0)
+          return usage(argv[0], "failed to parse chunk-size, expecting positive number of metatiles");
+        break;
+      case SEEDER_OPT_LEASE_TIMEOUT:
+        dist_lease_timeout = (int)strtol(optarg, NULL, 10);
+        if(dist_lease_timeout <= 0)
+          return usage(argv[0], "failed to parse lease-timeout, expecting positive number of seconds");
+        break;
+      case SEEDER_OPT_CHECKPOINT:
+        checkpoint_file = optarg;
+        break;
+      case SEEDER_OPT_CHECKPOINT_INTERVAL:
+        checkpoint_interval = (int)strtol(optarg, NULL, 10);
+        if(checkpoint_interval <= 0)
+          return usage(argv[0], "failed to parse checkpoint-interval, expecting positive number of seconds");
+        break;
+      case SEEDER_OPT_RESUME:
+        resume = 1;
+        break;
+      case SEEDER_OPT_BULK_TRANSFER:
+        bulk_transfer = 1;
+        break;
       case SEEDER_OPT_RATE_LIMIT:
         rate_limit = (int)strtol(optarg, NULL, 10);
         if(rate_limit <= 0 )
@@ -1103,6 +2337,13 @@ int main(int argc, const char **argv)
       case 'w':
         ogr_where = optarg;
         break;
+      case SEEDER_OPT_OGR_BITMAP_ZOOM: {
+        char *endptr;
+        clip_bitmap_zoom = (int)strtol(optarg, &endptr, 10);
+        if(*endptr || clip_bitmap_zoom < 0)
+          return usage(argv[0], "failed to parse ogr-bitmap-zoom, expecting a zoom level");
+        break;
+      }
 #endif
 
     }
@@ -1111,6 +2352,10 @@ int main(int argc, const char **argv)
     return usage(argv[0],"bad options");
   }
 
+  if(png_benchmark_dir) {
+    return png_benchmark(png_benchmark_dir);
+  }
+
   if( ! configfile ) {
     return usage(argv[0],"config not specified");
   } else {
@@ -1179,6 +2424,7 @@ int main(int argc, const char **argv)
 
     initGEOS(notice, log_and_exit);
     clippers = (const GEOSPreparedGeometry**)malloc(nClippers*sizeof(GEOSPreparedGeometry*));
+    clippers_index = GEOSSTRtree_create(10);
 
 
     geoswktreader = GEOSWKTReader_create();
@@ -1194,6 +2440,8 @@ int main(int argc, const char **argv)
       geosgeom = GEOSWKTReader_read(geoswktreader,wkt);
       free(wkt);
       clippers[f] = GEOSPrepare(geosgeom);
+      /* the geometry is kept alive, the tree indexes its envelope */
+      GEOSSTRtree_insert(clippers_index, geosgeom, (void*)clippers[f]);
       //GEOSGeom_destroy(geosgeom);
       OGR_G_GetEnvelope  (geom, &ogr_extent);
       if(f == 0) {
@@ -1292,6 +2540,18 @@ int main(int argc, const char **argv)
     if(retry_log) {
       iteration_mode = MAPCACHE_ITERATION_LOG;
     }
+    if(heatmap_file) {
+      if(retry_log) {
+        return usage(argv[0], "--heatmap and --retry-failed cannot be used together");
+      }
+      iteration_mode = MAPCACHE_ITERATION_HEATMAP;
+    }
+    if(dist_dir) {
+      if(retry_log || heatmap_file) {
+        return usage(argv[0], "--coordinate and --work cannot be used with --retry-failed or --heatmap");
+      }
+      iteration_mode = MAPCACHE_ITERATION_DISTRIBUTED;
+    }
 
     if(minzoom == -1 && maxzoom == -1) {
       minzoom = grid_link->minz;
@@ -1328,7 +2588,14 @@ int main(int argc, const char **argv)
   }
 
   if (mode == MAPCACHE_CMD_TRANSFER) {
-    tileset->metasize_x = tileset->metasize_y = 1;
+    if(!bulk_transfer) {
+      tileset->metasize_x = tileset->metasize_y = 1;
+    } else if(metax <= 0) {
+      /* the metatiles are only used as the blocks of tiles read and written at once */
+      tileset->metasize_x = tileset->metasize_y = 16;
+    }
+    if(bulk_transfer && age_limit)
+      return usage(argv[0],"--bulk-transfer cannot be used with -o/--older");
     if (!tileset_transfer_name)
       return usage(argv[0],"tileset where tiles should be transferred to not specified");
 
@@ -1337,6 +2604,69 @@ int main(int argc, const char **argv)
       return usage(argv[0], "tileset where tiles should be transferred to not found in configuration");
   }
 
+#ifdef USE_CLIPPERS
+  if(clip_bitmap_zoom >= 0) {
+    if(!nClippers) {
+      return usage(argv[0], "--ogr-bitmap-zoom requires an ogr datasource");
+    }
+    if(clip_bitmap_zoom > maxzoom) clip_bitmap_zoom = maxzoom;
+    if(clip_bitmap_zoom < minzoom) {
+      clip_bitmap_zoom = -1;
+    } else if(clip_bitmaps_build(&ctx) != MAPCACHE_SUCCESS) {
+      return usage(argv[0], "%s", ctx.get_error_message(&ctx));
+    }
+  }
+#endif
+
+  if(heatmap_file) {
+    /* the metatiles are computed with the final metatile size */
+    if(load_heatmap(heatmap_file) != MAPCACHE_SUCCESS) {
+      return usage(argv[0], "%s", ctx.get_error_message(&ctx));
+    }
+    if(!quiet) {
+      printf("seeding %d metatiles from heatmap %s\n", heatmap_count, heatmap_file);
+    }
+  } else if(heatmap_budget) {
+    return usage(argv[0], "--heatmap-budget can only be used with --heatmap");
+  }
+
+  if(build_existence_filter && (heatmap_file || time_limit > 0 || dist_dir || retry_log)) {
+    return usage(argv[0], "--existence-filter cannot be used with --heatmap, --time-limit, --coordinate, --work or --retry-failed, the run must cover the whole tileset");
+  }
+  if(build_existence_filter && resume) {
+    /* the metatiles processed before the checkpoint would not be added to the filter */
+    return usage(argv[0], "--existence-filter cannot be used with --resume, the run must cover the whole tileset");
+  }
+  if(build_existence_filter) {
+    int cached_maxzoom = (grid_link->outofzoom_strategy != MAPCACHE_OUTOFZOOM_NOTCONFIGURED)?
+                         grid_link->max_cached_zoom:grid_link->maxz - 1;
+    if(extent || minzoom > grid_link->minz || maxzoom < cached_maxzoom) {
+      return usage(argv[0], "--existence-filter cannot be used with -e/--extent, -z/--zoom or an ogr datasource restricting the run, the run must cover the whole tileset");
+    }
+    if(!apr_is_empty_array(tileset->dimensions)) {
+      return usage(argv[0], "--existence-filter cannot be used with a tileset with dimensions, a run only covers one value of each dimension");
+    }
+  }
+
+  if(build_existence_filter) {
+    /* in transfer mode, the filter is built for the destination tileset */
+    mapcache_tileset *filter_tileset = (mode == MAPCACHE_CMD_TRANSFER)?tileset_transfer:tileset;
+    if(mode == MAPCACHE_CMD_DELETE) {
+      return usage(argv[0], "--existence-filter cannot be used in delete mode");
+    }
+    if(!filter_tileset->existence_filter) {
+      return usage(argv[0], "tileset \"%s\" has no <existence_filter> configured", filter_tileset->name);
+    }
+    if(filter_tileset->grid_links->nelts > 1) {
+      /* the filter is shared by all the grids, a run only seeds one of them */
+      return usage(argv[0], "--existence-filter cannot be used with tileset \"%s\", it has more than one grid", filter_tileset->name);
+    }
+    mapcache_existence_filter_open(&ctx, filter_tileset->existence_filter, 1);
+    if(GC_HAS_ERROR(&ctx)) {
+      return usage(argv[0], "%s", ctx.get_error_message(&ctx));
+    }
+  }
+
   if(old) {
     if(strcasecmp(old,"now")) {
       struct tm oldtime;
@@ -1359,6 +2689,10 @@ int main(int argc, const char **argv)
     mapcache_grid_compute_limits(grid_link->grid,extent,grid_link->grid_limits,0);
   }
 
+  if(bulk_transfer) {
+    bulk_transfer_limits = apr_pmemdup(ctx.pool, grid_link->grid_limits, grid_link->grid->nlevels * sizeof(mapcache_extent_i));
+  }
+
   /* adjust our grid limits so they align on the metatile limits
    * we need to do this because the seeder does not check for individual tiles, it
    * goes from one metatile to the next*/
@@ -1403,6 +2737,69 @@ int main(int argc, const char **argv)
   }
 
 
+  if(dist_dir && dist_coordinator) {
+    rv = dist_coordinate();
+    apr_terminate();
+    return rv;
+  }
+
+  if(dist_dir) {
+    /* the chunks were computed by the coordinator, check they apply to the same seed */
+    struct dist_job job;
+    char *mismatch;
+    if(nprocesses >= 1) {
+      return usage(argv[0], "--work can only be used with -n|--nthreads");
+    }
+    while(dist_read_job(&job) != MAPCACHE_SUCCESS) {
+      if(sig_int_received) {
+        apr_terminate();
+        return 1;
+      }
+      if(!quiet) {
+        printf("waiting for the coordinator to publish the chunks in %s\n", dist_dir);
+      }
+      apr_sleep(apr_time_from_sec(5));
+    }
+    /* the chunks carry their own coordinates, the worker's zoom levels and extent don't matter */
+    mismatch = dist_job_mismatch(&job, 0);
+    if(mismatch) {
+      return usage(argv[0], "%s", mismatch);
+    }
+    dist_lease_timeout = job.lease_timeout;
+  }
+
+  if(resume && !checkpoint_file) {
+    return usage(argv[0], "--resume requires --checkpoint");
+  }
+  if(checkpoint_file) {
+    int finished;
+    if(iteration_mode != MAPCACHE_ITERATION_DEPTH_FIRST && iteration_mode != MAPCACHE_ITERATION_LEVEL_FIRST) {
+      return usage(argv[0], "--checkpoint cannot be used with --retry-failed, --heatmap or --work");
+    }
+    if(nprocesses >= 1) {
+      return usage(argv[0], "--checkpoint can only be used with -n|--nthreads");
+    }
+    checkpoint_tmpfile = apr_pstrcat(ctx.pool, checkpoint_file, ".tmp", NULL);
+    checkpoint_path = apr_pcalloc(ctx.pool, (maxzoom - minzoom + 1) * sizeof(struct seed_position));
+    resume_path = apr_pcalloc(ctx.pool, (maxzoom - minzoom + 1) * sizeof(struct seed_position));
+    if(resume) {
+      if(checkpoint_read(&finished) != MAPCACHE_SUCCESS) {
+        return usage(argv[0], "%s", ctx.get_error_message(&ctx));
+      }
+      if(finished) {
+        printf("checkpoint %s: the seed has already completed\n", checkpoint_file);
+        apr_terminate();
+        return 0;
+      }
+      if(!quiet) {
+        printf("resuming from checkpoint %s at z%d x%d y%d (%d metatiles seeded before)\n", checkpoint_file,
+               resume_path[resume_depth - 1].z, resume_path[resume_depth - 1].x, resume_path[resume_depth - 1].y,
+               resume_metatiles);
+      }
+    }
+  }
+  track_inflight = checkpoint_file || (dist_dir && !dist_coordinator);
+
   if(nthreads == 0 && nprocesses == 0) {
     nthreads = 1;
   }
@@ -1421,6 +2818,10 @@ int main(int argc, const char **argv)
     apr_thread_create(&log_thread, log_thread_attrs, log_thread_fn, NULL, ctx.pool);
   }
   
+  if(time_limit > 0) {
+    time_limit_deadline = apr_time_now() + (apr_time_t)(time_limit * APR_USEC_PER_SEC);
+  }
+
   if(nprocesses > 1) {
 #ifdef USE_FORK
     key_t key;
@@ -1531,11 +2932,24 @@ int main(int argc, const char **argv)
            duration,
            ntilestot/duration,
            (ntilestot-nnodatatot)/duration);
+    if(resume_metatiles) {
+      printf("%d metatiles seeded in total, including the runs before resuming\n", resume_metatiles + n_metatiles_tot);
+    }
   } else {
     if(!error_detected) {
       printf("0 tiles needed to be seeded, exiting\n");
     }
   }
+  if(build_existence_filter && !error_detected && !sig_int_received) {
+    mapcache_tileset *filter_tileset = (mode == MAPCACHE_CMD_TRANSFER)?tileset_transfer:tileset;
+    mapcache_existence_filter_set_complete(&ctx, filter_tileset->existence_filter);
+    if(GC_HAS_ERROR(&ctx)) {
+      ctx.log(&ctx, MAPCACHE_ERROR, "%s", ctx.get_error_message(&ctx));
+      error_detected = 1;
+    } else {
+      printf("existence filter %s is complete and will be used for lookups\n", filter_tileset->existence_filter->filename);
+    }
+  }
   apr_terminate();
 
   if (error_detected > 0) {